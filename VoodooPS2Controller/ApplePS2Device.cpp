@@ -135,7 +135,7 @@ void ApplePS2Device::uninstallPowerControlAction()
 
 void ApplePS2Device::dispatchMessage(int message, void *data)
 {
-    _controller->dispatchMessage(message, data);
+    _controller->dispatchMessage(_deviceType, message, data);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -144,3 +144,33 @@ ApplePS2Controller* ApplePS2Device::getController()
 {
     return _controller;
 }
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Device::submitRequestAsync(PS2Request * request, OSObject * target, PS2RequestAction action, void * param)
+{
+    return _controller->submitRequestAsync(_deviceType, request, target, action, param);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Device::submitRequestFuture(PS2Request * request)
+{
+    return _controller->submitRequestFuture(request);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Device::waitRequest(PS2Request * request)
+{
+    _controller->waitRequest(request);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+IOWorkLoop* ApplePS2Device::getWorkLoop() const
+{
+    if (!_controller)
+        return super::getWorkLoop();
+    return _controller->getDeviceWorkLoop(_deviceType);
+}
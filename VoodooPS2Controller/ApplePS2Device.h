@@ -52,9 +52,11 @@
 #define kDP_SetMouseResolution         0xE8 // (mouse)
 #define kDP_GetMouseInformation        0xE9 // (mouse)
 #define kDP_SetMouseStreamMode         0xEA // (mouse)
+#define kDP_ResetMouseWrapMode         0xEC // (mouse)
 #define kDP_SetKeyboardLEDs            0xED // (keyboard)
 #define kDP_TestKeyboardEcho           0xEE // (keyboard)
 #define kDP_GetSetKeyboardASCs         0xF0 // (keyboard)
+#define kDP_SetMouseRemoteMode         0xF0 // (mouse)
 #define kDP_GetId                      0xF2 // (keyboard+mouse)
 #define kDP_SetKeyboardTypematic       0xF3 // (keyboard)
 #define kDP_SetMouseSampleRate         0xF3 // (mouse)
@@ -268,6 +270,26 @@ public:
 //    o  Description: Writes the byte in the In Field to the command port (64h).
 //    o  In Field:    Holds byte that should be written.
 //
+// o  kPS2C_SendMouseCommandsAndCompareAck:
+//    o  Description: Sends each byte of a string to the mouse, comparing the
+//                    response to each with kSC_Acknowledge.  Stops at the
+//                    first byte that is not acknowledged, which fails the
+//                    request (as kPS2C_SendMouseCommandAndCompareAck would).
+//    o  In Fields:   bytesOffset/bytesCount: the bytes to send, kept in the
+//                    request's sequenceBytes (use PS2Request::addMouseBytes,
+//                    which copies them there and fills in the command).
+//    o  Out Field:   bytesDone: number of bytes acknowledged.
+//
+// o  kPS2C_PollDataPort:
+//    o  Description: Waits up to the number of milliseconds in the In Field
+//                    for a byte to arrive on the data port (60h), sleeping
+//                    between polls, and reads it.  For slow responses like
+//                    the BAT result after a reset, where a fixed sleep would
+//                    always take the worst case.  If nothing arrives in
+//                    time, the request is aborted.
+//    o  In Field:    inOrOut32: timeout in milliseconds.
+//    o  Out Field:   inOrOut: byte that was read.
+//
 
 enum PS2CommandEnum
 {
@@ -281,6 +303,8 @@ enum PS2CommandEnum
   kPS2C_FlushDataPort,
   kPS2C_SleepMS,
   kPS2C_ModifyCommandByte,
+  kPS2C_SendMouseCommandsAndCompareAck,
+  kPS2C_PollDataPort,
 };
 typedef enum PS2CommandEnum PS2CommandEnum;
 
@@ -297,6 +321,12 @@ struct PS2Command
           UInt8 clearBits;
           UInt8 oldBits;
       };
+      struct
+      {
+          UInt8 bytesOffset;    // into PS2Request::sequenceBytes
+          UInt8 bytesCount;
+          UInt8 bytesDone;
+      };
   };
 };
 typedef struct PS2Command PS2Command;
@@ -391,10 +421,62 @@ typedef struct PS2Command PS2Command;
 //      For stack-based allocation, and blocking submit do not
 //      freeRequest or delete.
 //
+// Pooled allocation:
+//      allocateRequest takes requests of up to kMaxCommands commands from a
+//      small pool kept by the controller (kPS2RequestPoolSize), and only
+//      falls back to the allocator when the pool is empty.  freeRequest
+//      returns them.  Nothing changes for the caller.
+//
+// Asynchronous requests with completion on the work loop:
+//      PS2Request* request = _device->allocateRequest(12);
+//      //... fill in request
+//      _device->submitRequestAsync(request, this,
+//          OSMemberFunctionCast(PS2RequestAction, this, &Driver::onRequestDone), param);
+//
+//      void Driver::onRequestDone(PS2Request* request, void* param)
+//      {
+//          if (!request->succeeded())
+//              ...
+//      }
+//
+//      submitRequestAsync returns right away.  The action is called on the
+//      submitting device's work loop (the one of the driver's packets and
+//      timers, see getWorkLoop), so it needs no locking against the rest of
+//      the driver.  target is retained until then.  The controller frees the
+//      request after the action returns (do not free it yourself).  action
+//      may be 0 (fire-and-forget).  Requests are processed in submission
+//      order, together with submitRequest and submitRequestAndBlock.
+//
+// Futures (init code that wants to overlap its own work with the 8042):
+//      TPS2Request<4> request;
+//      //... fill in request
+//      _device->submitRequestFuture(&request);
+//      //... other work
+//      _device->waitRequest(&request);
+//      if (request.succeeded()) ...
+//
+//      waitRequest blocks until the request was processed.  Never wait from
+//      an interrupt, packet or completion action.  The caller owns the
+//      request (free it after waitRequest, unless on the stack).
+//
 
 #define kMaxCommands 30
 
+// room for the bytes of kPS2C_SendMouseCommandsAndCompareAck, per request
+#define kMaxSequenceBytes 32
+
+struct PS2Request;
 typedef void (*PS2CompletionAction)(void * target, void * param);
+typedef void (*PS2RequestAction)(OSObject * target, PS2Request * request, void * param);
+
+// PS2Request::requestFlags (controller use)
+enum
+{
+    kPS2RF_Pooled   = 0x01,     // from the controller's pool
+    kPS2RF_Async    = 0x02,     // submitRequestAsync
+    kPS2RF_Future   = 0x04,     // submitRequestFuture
+    kPS2RF_Done     = 0x08,     // future has been processed
+};
 
 struct PS2Request
 {
@@ -410,11 +492,32 @@ protected:
 
 public:
     UInt8               commandsCount;
+    UInt8               commandsSubmitted;  // commandsCount when processing started
+    UInt8               requestFlags;       // kPS2RF_*
+    UInt8               requestDevice;      // PS2DeviceType of submitRequestAsync
     void *              completionTarget;
     PS2CompletionAction completionAction;
     void *              completionParam;
+    PS2RequestAction    requestAction;      // submitRequestAsync
     queue_chain_t       chain;
+    UInt8               sequenceBytesUsed;
+    UInt8               sequenceBytes[kMaxSequenceBytes];
     PS2Command          commands[0];
+
+    // all commands done (valid once processed)
+    inline bool succeeded() const { return commandsCount == commandsSubmitted; }
+
+    // make commands[index] a kPS2C_SendMouseCommandsAndCompareAck of bytes
+    inline void addMouseBytes(int index, const UInt8* bytes, UInt8 count)
+    {
+        assert(sequenceBytesUsed + count <= kMaxSequenceBytes);
+        commands[index].command = kPS2C_SendMouseCommandsAndCompareAck;
+        commands[index].bytesOffset = sequenceBytesUsed;
+        commands[index].bytesCount = count;
+        commands[index].bytesDone = 0;
+        for (unsigned i = 0; i < count; i++)
+            sequenceBytes[sequenceBytesUsed++] = bytes[i];
+    }
 };
 
 // special completionTarget for TPS2Request allocated on stack
@@ -557,9 +660,7 @@ typedef enum
 {
     kDT_Keyboard,
     kDT_Mouse,
-#if WATCHDOG_TIMER
     kDT_Watchdog,
-#endif
 } PS2DeviceType;
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -609,6 +710,14 @@ public:
 
     // Controller access
     virtual ApplePS2Controller* getController();
+
+    // Work loop for the driver's packets, timers and gates (per device)
+    virtual IOWorkLoop* getWorkLoop() const;
+
+    // Asynchronous requests (see PS2Request)
+    virtual bool submitRequestAsync(PS2Request * request, OSObject * target, PS2RequestAction action, void * param = 0);
+    virtual bool submitRequestFuture(PS2Request * request);
+    virtual void waitRequest(PS2Request * request);
 };
 
 #if 0   // Note: Now using architecture/i386/pio.h (see above)
@@ -38,3 +38,14 @@ bool ApplePS2MouseDevice::init()
     return result;
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2MouseDevice::getIdentity(PS2AuxIdentity* identity)
+{
+    OSData* data = OSDynamicCast(OSData, getProperty(kAuxIdentity));
+    if (!data || data->getLength() != sizeof(*identity))
+        return false;
+    memcpy(identity, data->getBytesNoCopy(), sizeof(*identity));
+    return kPS2Aux_Unknown != identity->vendor;
+}
+
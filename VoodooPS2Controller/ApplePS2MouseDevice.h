@@ -24,6 +24,7 @@
 #define _APPLEPS2MOUSEDEVICE_H
 
 #include "ApplePS2Device.h"
+#include "PS2AuxIdentity.h"
 
 class ApplePS2Controller;
 
@@ -34,6 +35,9 @@ class EXPORT ApplePS2MouseDevice : public ApplePS2Device
 
 public:
     virtual bool init();
+
+    // identity found by the controller (false if not identified)
+    bool getIdentity(PS2AuxIdentity* identity);
 };
 
 #endif /* !_APPLEPS2MOUSEDEVICE_H */
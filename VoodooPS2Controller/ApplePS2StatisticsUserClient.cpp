@@ -0,0 +1,62 @@
+//
+//  ApplePS2StatisticsUserClient.cpp
+//  VoodooPS2Controller
+//
+
+#include "ApplePS2StatisticsUserClient.h"
+#include "VoodooPS2Controller.h"
+
+// =============================================================================
+// ApplePS2StatisticsUserClient Class Implementation
+//
+
+OSDefineMetaClassAndStructors(ApplePS2StatisticsUserClient, IOUserClient);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2StatisticsUserClient::initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties)
+{
+    if (!super::initWithTask(owningTask, securityToken, type, properties))
+        return false;
+    // statistics are for administrators (VoodooPS2Daemon runs as root)
+    if (kIOReturnSuccess != clientHasPrivilege(securityToken, kIOClientPrivilegeAdministrator))
+        return false;
+    _controller = 0;
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2StatisticsUserClient::start(IOService* provider)
+{
+    _controller = OSDynamicCast(ApplePS2Controller, provider);
+    if (!_controller || !_controller->getStatisticsMemory())
+        return false;
+    return super::start(provider);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+IOReturn ApplePS2StatisticsUserClient::clientClose()
+{
+    _controller = 0;
+    terminate();
+    return kIOReturnSuccess;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+IOReturn ApplePS2StatisticsUserClient::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+{
+    if (kPS2StatisticsMemory != type || !_controller)
+        return kIOReturnBadArgument;
+    IOMemoryDescriptor* desc = _controller->getStatisticsMemory();
+    if (!desc)
+        return kIOReturnNotReady;
+
+    // the caller consumes this reference
+    desc->retain();
+    *memory = desc;
+    *options = kIOMapReadOnly;
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,41 @@
+//
+//  ApplePS2StatisticsUserClient.h
+//  VoodooPS2Controller
+//
+//  Read only access to the PS2Statistics block of ApplePS2Controller.
+//
+
+#ifndef _APPLEPS2STATISTICSUSERCLIENT_H
+#define _APPLEPS2STATISTICSUSERCLIENT_H
+
+#include <IOKit/IOUserClient.h>
+#include "ApplePS2Device.h"
+
+class ApplePS2Controller;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ApplePS2StatisticsUserClient
+//
+// o  Opened with IOServiceOpen on ApplePS2Controller (IOUserClientClass).
+//
+// o  There are no methods.  clientMemoryForType(kPS2StatisticsMemory) hands
+//    out the statistics block, which the client maps read only
+//    (IOConnectMapMemory64) and reads whenever it wants.
+//
+
+class EXPORT ApplePS2StatisticsUserClient : public IOUserClient
+{
+    typedef IOUserClient super;
+    OSDeclareDefaultStructors(ApplePS2StatisticsUserClient);
+
+private:
+    ApplePS2Controller* _controller;
+
+public:
+    virtual bool initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties);
+    virtual bool start(IOService* provider);
+    virtual IOReturn clientClose();
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory);
+};
+
+#endif /* _APPLEPS2STATISTICSUSERCLIENT_H */
@@ -0,0 +1,212 @@
+//
+//  PS2ALPSIdentity.h
+//  VoodooPS2Controller
+//
+//  ALPS model table and identification, used by ApplePS2Controller to
+//  identify the aux device and by ApplePS2ALPSGlidePoint for its protocol
+//  defaults (see PS2AuxIdentity.h).
+//
+
+#ifndef _PS2ALPSIDENTITY_H
+#define _PS2ALPSIDENTITY_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Protocol versions and model flags
+//
+// o  v1/v2 are the original GlidePoint 6-byte absolute format, which the
+//    driver decodes itself.  Everything from v3 on goes through ALPSDecoder.
+//
+
+enum ALPSProtocol
+{
+    kALPS_None = 0,
+    kALPS_V1 = 1,
+    kALPS_V2 = 2,
+    kALPS_V3 = 3,
+    kALPS_V4 = 4,
+    kALPS_V5 = 5,       // "Dolphin"
+    kALPS_V7 = 7,
+};
+
+#define kALPS_DualPoint         0x01    // has trackstick
+#define kALPS_ButtonPad         0x02    // clickpad, no separate right/middle buttons
+
+// command used for nibble 10 (GetId, returns one byte; GetMouseInformation
+// cannot be used, in command mode it reports a register)
+#define kALPSNibble10           0xF2
+#define kALPSNoParam            (-1)
+
+struct ALPSNibbleCommand
+{
+    uint8_t     command;
+    int16_t     param;      // kALPSNoParam if none
+};
+
+// command mode: each nibble of an address/value is sent as one PS/2 command
+static const ALPSNibbleCommand alpsNibblesV3[16] =
+{
+    { 0xF0, kALPSNoParam }, // 0: set remote mode
+    { 0xF6, kALPSNoParam }, // 1: set defaults
+    { 0xE7, kALPSNoParam }, // 2: set scaling 2:1
+    { 0xF3, 0x0A },         // 3: set sample rate
+    { 0xF3, 0x14 },         // 4
+    { 0xF3, 0x28 },         // 5
+    { 0xF3, 0x3C },         // 6
+    { 0xF3, 0x50 },         // 7
+    { 0xF3, 0x64 },         // 8
+    { 0xF3, 0xC8 },         // 9
+    { kALPSNibble10, kALPSNoParam }, // a: get id
+    { 0xE8, 0x00 },         // b: set resolution
+    { 0xE8, 0x01 },         // c
+    { 0xE8, 0x02 },         // d
+    { 0xE8, 0x03 },         // e
+    { 0xE6, kALPSNoParam }, // f: set scaling 1:1
+};
+
+// v4 is the same except for nibble 0
+static const ALPSNibbleCommand alpsNibblesV4[16] =
+{
+    { 0xF4, kALPSNoParam }, // 0: enable
+    { 0xF6, kALPSNoParam },
+    { 0xE7, kALPSNoParam },
+    { 0xF3, 0x0A },
+    { 0xF3, 0x14 },
+    { 0xF3, 0x28 },
+    { 0xF3, 0x3C },
+    { 0xF3, 0x50 },
+    { 0xF3, 0x64 },
+    { 0xF3, 0xC8 },
+    { kALPSNibble10, kALPSNoParam },
+    { 0xE8, 0x00 },
+    { 0xE8, 0x01 },
+    { 0xE8, 0x02 },
+    { 0xE8, 0x03 },
+    { 0xE6, kALPSNoParam },
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Model identification
+//
+// o  identifyALPS:
+//    o  Description:  Matches the E6/E7/EC reports against alpsModels, then
+//                     falls back to the E7/EC patterns for the newer protocols.
+//    o  Result:       true if the device is a supported ALPS; info is filled
+//                     in with the protocol defaults.  Dolphin (v5) devices
+//                     must still read their sensor size (setDolphinArea in
+//                     PS2ALPSDecoder.h).
+//
+// o  alpsModels:  ec2 is the third byte of the EC (command mode) response,
+//    or 0 for don't care.
+//
+
+struct ALPSModelInfo
+{
+    uint8_t     e7[3];
+    uint8_t     ec2;
+    uint8_t     proto;
+    uint8_t     byte0, mask0;   // first byte of a packet: (byte & mask0) == byte0
+    uint8_t     flags;
+};
+
+static const ALPSModelInfo alpsModels[] =
+{
+    { { 0x33, 0x02, 0x0a }, 0x00, kALPS_V1, 0x88, 0xf8, 0 },
+    { { 0x53, 0x02, 0x0a }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x53, 0x02, 0x14 }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x63, 0x02, 0x0a }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x63, 0x02, 0x14 }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x63, 0x02, 0x28 }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x63, 0x02, 0x3c }, 0x00, kALPS_V2, 0x8f, 0x8f, 0 },
+    { { 0x63, 0x02, 0x50 }, 0x00, kALPS_V2, 0xef, 0xef, 0 },
+    { { 0x63, 0x02, 0x64 }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },
+    { { 0x73, 0x02, 0x0a }, 0x00, kALPS_V2, 0xf8, 0xf8, 0 },  // 3622947
+    { { 0x20, 0x02, 0x0e }, 0x00, kALPS_V2, 0xf8, 0xf8, kALPS_DualPoint },
+    { { 0x22, 0x02, 0x0a }, 0x00, kALPS_V2, 0xf8, 0xf8, kALPS_DualPoint },
+    { { 0x22, 0x02, 0x14 }, 0x00, kALPS_V2, 0xff, 0xff, kALPS_DualPoint },
+    { { 0x73, 0x02, 0x64 }, 0x9b, kALPS_V3, 0x8f, 0x8f, kALPS_DualPoint },
+    { { 0x73, 0x02, 0x64 }, 0x9d, kALPS_V3, 0x8f, 0x8f, kALPS_DualPoint },
+    { { 0x73, 0x02, 0x64 }, 0x8a, kALPS_V4, 0x8f, 0x8f, 0 },
+};
+
+struct ALPSProtocolInfo
+{
+    uint8_t     proto;
+    uint8_t     byte0, mask0;
+    uint8_t     flags;
+    int         packetSize;
+    int         xMax, yMax;         // coordinate range
+    int         xBits, yBits;       // sensor lines in the bitmaps (v3/v4/v5)
+    const ALPSNibbleCommand* nibbles;
+    uint8_t     addrCommand;        // starts a command mode address
+};
+
+static inline void setALPSDefaults(ALPSProtocolInfo* info, uint8_t proto, uint8_t byte0, uint8_t mask0, uint8_t flags)
+{
+    info->proto = proto;
+    info->byte0 = byte0;
+    info->mask0 = mask0;
+    info->flags = flags;
+    info->packetSize = 6;
+    info->xMax = 2000;
+    info->yMax = 1400;
+    info->xBits = 15;
+    info->yBits = 11;
+    info->nibbles = alpsNibblesV3;
+    info->addrCommand = 0xEC;   // reset wrap mode
+    switch (proto)
+    {
+        case kALPS_V1:
+        case kALPS_V2:
+            info->xMax = 1023;
+            info->yMax = 767;
+            info->nibbles = 0;
+            break;
+        case kALPS_V4:
+            info->packetSize = 8;
+            info->nibbles = alpsNibblesV4;
+            info->addrCommand = 0xF5;   // disable
+            break;
+        case kALPS_V5:
+            info->xMax = 1360;
+            info->yMax = 660;
+            info->xBits = 23;
+            info->yBits = 12;
+            break;
+        case kALPS_V7:
+            info->xMax = 0xfff;
+            info->yMax = 0x7ff;
+            break;
+    }
+}
+
+static inline bool identifyALPS(const uint8_t e6[3], const uint8_t e7[3], const uint8_t ec[3], ALPSProtocolInfo* info)
+{
+    // ALPS returns 0,0,10 or 0,0,100 for the E6 report if no buttons are pressed
+    if ((e6[0] & 0xf8) != 0 || e6[1] != 0 || (e6[2] != 10 && e6[2] != 100))
+        return false;
+
+    for (unsigned i = 0; i < sizeof(alpsModels)/sizeof(alpsModels[0]); i++)
+    {
+        const ALPSModelInfo& model = alpsModels[i];
+        if (e7[0] == model.e7[0] && e7[1] == model.e7[1] && e7[2] == model.e7[2] &&
+            (!model.ec2 || model.ec2 == ec[2]))
+        {
+            setALPSDefaults(info, model.proto, model.byte0, model.mask0, model.flags);
+            return true;
+        }
+    }
+
+    if (e7[0] == 0x73 && e7[1] == 0x03 && e7[2] == 0x50 && ec[0] == 0x73 && (ec[1] == 0x01 || ec[1] == 0x02))
+        setALPSDefaults(info, kALPS_V5, 0xc8, 0xd8, 0);
+    else if (ec[0] == 0x88 && ((ec[1] & 0xf0) == 0xb0 || (ec[1] & 0xf0) == 0xc0))
+        setALPSDefaults(info, kALPS_V7, 0x48, 0x48, ec[1] != 0xba ? kALPS_ButtonPad : 0);
+    else if (ec[0] == 0x88 && ec[1] == 0x07 && ec[2] >= 0x90 && ec[2] <= 0x9d)
+        setALPSDefaults(info, kALPS_V3, 0x8f, 0x8f, kALPS_DualPoint);
+    else
+        return false;
+    return true;
+}
+
+#endif /* _PS2ALPSIDENTITY_H */
@@ -0,0 +1,148 @@
+//
+//  PS2Acceleration.h
+//  VoodooPS2Controller
+//
+//  Optional velocity based pointer acceleration shared by ApplePS2Mouse,
+//  ApplePS2SynapticsTouchPad and ApplePS2ALPSGlidePoint.
+//
+//  The curve is pure arithmetic on counts and packet timestamps (ns), so the
+//  three drivers share it without sharing any IOKit state.
+//
+
+#ifndef _PS2ACCELERATION_H
+#define _PS2ACCELERATION_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2Acceleration
+//
+// o  The curve is configured as pairs of numbers (AccelerationCurve):
+//    speed in counts per second, then gain in percent.  Speeds must be
+//    increasing.  Between points the gain is interpolated linearly; below
+//    the first and above the last point it is held.  An empty curve turns
+//    acceleration off (the default).
+//
+// o  setCurve builds a lookup table of kAccelTableSize 16.16 fixed point
+//    gains.  The table step is a power of two, so the lookup is a shift.
+//
+// o  Velocity is the movement of a packet divided by the time since the
+//    previous one, using the time each packet was completed at interrupt
+//    time.  So the same motion gets the same gain whatever the packet rate.
+//    The first packet after kAccelIdleTime uses kAccelIdleTime.
+//
+// o  Fractions are carried to the next packet, so slow movement with gain
+//    below 100% is not lost to rounding.
+//
+
+#define kAccelCurveMax          16                  // numbers (8 points)
+#define kAccelTableSize         64
+#define kAccelIdleTime          100000000ULL        // ns
+#define kAccelMinTime           1000000ULL          // ns
+#define kAccelOne               (1 << 16)
+
+class PS2Acceleration
+{
+private:
+    int32_t     _table[kAccelTableSize];
+    int         _shift;
+    bool        _enabled;
+    uint64_t    _lasttime;
+    int32_t     _xrest;
+    int32_t     _yrest;
+
+    static inline int iabs(int x) { return x < 0 ? -x : x; }
+
+public:
+    PS2Acceleration() : _shift(0), _enabled(false) { reset(); }
+
+    inline bool isEnabled() const { return _enabled; }
+
+    inline void reset()
+    {
+        _lasttime = 0;
+        _xrest = _yrest = 0;
+    }
+
+    // curve is count numbers: speed0, gain0, speed1, gain1, ...
+    bool setCurve(const int* curve, int count)
+    {
+        reset();
+        _enabled = false;
+        int points = count / 2;
+        if (points < 1)
+            return true;
+        for (int i = 1; i < points; i++)
+            if (curve[i*2] <= curve[i*2-2])
+                return false;
+
+        // smallest step that covers the last point
+        int last = curve[points*2-2];
+        _shift = 0;
+        while ((last >> _shift) >= kAccelTableSize-1)
+            ++_shift;
+
+        int p = 0;
+        for (int i = 0; i < kAccelTableSize; i++)
+        {
+            int speed = i << _shift;
+            while (p < points-1 && speed > curve[p*2+2])
+                ++p;
+            int64_t gain;
+            if (speed <= curve[0])
+                gain = curve[1];
+            else if (p >= points-1)
+                gain = curve[points*2-1];
+            else
+            {
+                int s0 = curve[p*2], g0 = curve[p*2+1];
+                int s1 = curve[p*2+2], g1 = curve[p*2+3];
+                // gain in 1/65536 percent, so interpolation keeps precision
+                gain = ((int64_t)g0 << 16) + (((int64_t)(g1 - g0) << 16) * (speed - s0)) / (s1 - s0);
+                _table[i] = (int32_t)(gain / 100);
+                continue;
+            }
+            _table[i] = (int32_t)((gain << 16) / 100);
+        }
+        _enabled = true;
+        return true;
+    }
+
+    inline int32_t gainForSpeed(uint64_t speed) const
+    {
+        uint64_t index = speed >> _shift;
+        return _table[index < kAccelTableSize ? index : kAccelTableSize-1];
+    }
+
+    // time_ns: interrupt time of the packet
+    void accelerate(int& dx, int& dy, uint64_t time_ns)
+    {
+        if (!_enabled || (!dx && !dy))
+            return;
+
+        uint64_t dt = time_ns - _lasttime;
+        if (!_lasttime || dt > kAccelIdleTime)
+        {
+            dt = kAccelIdleTime;
+            _xrest = _yrest = 0;
+        }
+        else if (dt < kAccelMinTime)
+            dt = kAccelMinTime;
+        _lasttime = time_ns;
+
+        // distance approximated as max + min/2
+        int ax = iabs(dx), ay = iabs(dy);
+        int dist = ax > ay ? ax + ay/2 : ay + ax/2;
+        uint64_t speed = (uint64_t)dist * 1000000000ULL / dt;
+        int32_t gain = gainForSpeed(speed);
+
+        int64_t x = (int64_t)dx * gain + _xrest;
+        int64_t y = (int64_t)dy * gain + _yrest;
+        dx = (int)(x >> 16);
+        dy = (int)(y >> 16);
+        _xrest = (int32_t)(x - ((int64_t)dx << 16));
+        _yrest = (int32_t)(y - ((int64_t)dy << 16));
+    }
+};
+
+#endif /* _PS2ACCELERATION_H */
@@ -0,0 +1,79 @@
+//
+//  PS2AuxIdentity.h
+//  VoodooPS2Controller
+//
+//  Identity of the device on the aux (mouse) port, found once by
+//  ApplePS2Controller before the mouse nub is registered.
+//
+
+#ifndef _PS2AUXIDENTITY_H
+#define _PS2AUXIDENTITY_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2AuxIdentity
+//
+// o  The controller sends the same knocks the pointing drivers used to send
+//    in their own probe, in the same (probe score) order, and stops at the
+//    first match:  Synaptics identify, Sentelic device ID register, ALPS
+//    E6/E7/EC reports.
+//
+// o  The record is published on the mouse nub as kAuxIdentity (OSData),
+//    read with ApplePS2MouseDevice::getIdentity.  For ioreg (and property
+//    matching), also as kAuxVendor, kAuxVersion, kAuxCapabilities and
+//    kAuxIdentifyTime (ns taken by the whole pass).  kAuxVendor is always
+//    published ("Unknown" without identification); the trackpad
+//    personalities match on it (IOPropertyMatch: their vendor or Unknown),
+//    so drivers for other hardware are not even probed.
+//
+// o  The keyboard nub is registered first, so the keyboard comes up while
+//    the aux device is being identified.
+//
+// o  A driver's probe only has to look at vendor.  The raw reports are kept,
+//    so drivers do not knock again.  kPS2Aux_Unknown means identification
+//    was not done (IdentifyAuxDevice is false), and drivers fall back to
+//    their own knocks.
+//
+// o  version and capabilities depend on vendor:
+//    o  Synaptics: version is major << 8 | minor, capabilities the three
+//       bytes of the capabilities query (selector 0x02).
+//    o  ALPS: version is the protocol (kALPS_V1..), capabilities the
+//       protocol flags (kALPS_DualPoint...).
+//    o  Sentelic: not used (the driver reads version/revision registers).
+//
+
+#define kAuxIdentity            "AuxIdentity"
+#define kAuxVendor              "AuxVendor"
+#define kAuxVersion             "AuxVersion"
+#define kAuxCapabilities        "AuxCapabilities"
+#define kAuxIdentifyTime        "AuxIdentifyTime"
+
+enum
+{
+    kPS2Aux_Unknown,        // not identified
+    kPS2Aux_None,           // nothing answered on the aux port
+    kPS2Aux_Generic,        // a device answered, but none of the below
+    kPS2Aux_Synaptics,
+    kPS2Aux_Sentelic,
+    kPS2Aux_ALPS,
+};
+
+struct PS2AuxIdentity
+{
+    uint8_t     vendor;
+    uint16_t    version;
+    uint32_t    capabilities;
+    uint8_t     synaptics[3];       // Synaptics identify (selector 0x00)
+    uint8_t     e6[3];              // ALPS reports
+    uint8_t     e7[3];
+    uint8_t     ec[3];
+};
+
+static inline const char* auxVendorName(int vendor)
+{
+    static const char* names[] = { "Unknown", "None", "Generic", "Synaptics", "Sentelic", "ALPS" };
+    return vendor >= 0 && vendor < (int)(sizeof(names)/sizeof(names[0])) ? names[vendor] : names[0];
+}
+
+#endif /* _PS2AUXIDENTITY_H */
@@ -0,0 +1,160 @@
+//
+//  PS2ConfigBlob.h
+//  VoodooPS2Controller
+//
+//  Flat, typed form of a merged configuration section (Info.plist profile
+//  plus RMCF), compiled once by ApplePS2Controller.
+//
+//  This header intentionally has no IOKit dependencies; the format is
+//  plain data, described below.
+//
+
+#ifndef _PS2CONFIGBLOB_H
+#define _PS2CONFIGBLOB_H
+
+#include <stdint.h>
+#include <string.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Blob format
+//
+// o  One contiguous buffer:  PS2ConfigHeader, itemCount PS2ConfigItem, then
+//    the string pool (keys, string and data values).  There are no pointers,
+//    only offsets and indexes, so the blob can be copied as is.
+//
+// o  The top level dictionary is items [0, rootCount).  The children of an
+//    array or dictionary are contiguous, starting at item value, and always
+//    come after their parent (the compiler is breadth first).
+//
+// o  Dictionary children are sorted by name (strcmp order), so a walk
+//    against a sorted PS2ParamEntry table is cheap.  Array children keep
+//    their order and have no name.
+//
+// o  value by type:
+//    o  kPS2Cfg_Bool:   0 or 1
+//    o  kPS2Cfg_Number: the number (unsigned64BitValue)
+//    o  kPS2Cfg_String, kPS2Cfg_Data: offset in the pool, count is length
+//       (strings are also NUL terminated)
+//    o  kPS2Cfg_Array, kPS2Cfg_Dict: index of first child, count is children
+//
+
+#define kConfigurationBlob      "Configuration Blob"
+
+#define kPS2ConfigMagic         0x47464350      // 'PCFG'
+#define kPS2ConfigVersion       1
+#define kPS2ConfigNoName        0xffffffff
+
+enum PS2ConfigType
+{
+    kPS2Cfg_Bool,
+    kPS2Cfg_Number,
+    kPS2Cfg_String,
+    kPS2Cfg_Data,
+    kPS2Cfg_Array,
+    kPS2Cfg_Dict,
+};
+
+struct PS2ConfigHeader
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    rootCount;
+    uint32_t    itemCount;
+    uint32_t    stringsOffset;      // from start of blob
+    uint32_t    size;               // of the whole blob
+};
+
+struct PS2ConfigItem
+{
+    uint32_t    name;               // pool offset, or kPS2ConfigNoName
+    uint32_t    type;
+    uint32_t    count;
+    uint32_t    reserved;
+    uint64_t    value;
+};
+
+static inline const PS2ConfigItem* configItems(const PS2ConfigHeader* blob)
+    { return (const PS2ConfigItem*)(blob + 1); }
+
+static inline const char* configString(const PS2ConfigHeader* blob, uint32_t offset)
+    { return (const char*)blob + blob->stringsOffset + offset; }
+
+static inline const char* configItemName(const PS2ConfigHeader* blob, const PS2ConfigItem* item)
+    { return kPS2ConfigNoName == item->name ? NULL : configString(blob, item->name); }
+
+// children of an array or dictionary (dict NULL for the top level)
+static inline const PS2ConfigItem* configChildren(const PS2ConfigHeader* blob, const PS2ConfigItem* dict, int* count)
+{
+    if (!dict)
+    {
+        *count = blob->rootCount;
+        return configItems(blob);
+    }
+    *count = dict->count;
+    return configItems(blob) + dict->value;
+}
+
+// checks everything a reader relies on, so a blob from anywhere is safe to walk
+static inline bool validateConfigBlob(const void* data, uint32_t size)
+{
+    const PS2ConfigHeader* blob = (const PS2ConfigHeader*)data;
+    if (size < sizeof(*blob) || blob->magic != kPS2ConfigMagic || blob->version != kPS2ConfigVersion)
+        return false;
+    if (blob->size != size || blob->rootCount > blob->itemCount)
+        return false;
+    uint64_t itemsEnd = sizeof(*blob) + (uint64_t)blob->itemCount * sizeof(PS2ConfigItem);
+    if (blob->stringsOffset != itemsEnd || itemsEnd > size)
+        return false;
+    uint32_t poolSize = size - blob->stringsOffset;
+    const char* pool = configString(blob, 0);
+    const PS2ConfigItem* items = configItems(blob);
+    for (uint32_t i = 0; i < blob->itemCount; i++)
+    {
+        const PS2ConfigItem* item = &items[i];
+        if (kPS2ConfigNoName != item->name && (item->name >= poolSize || !memchr(pool + item->name, 0, poolSize - item->name)))
+            return false;
+        switch (item->type)
+        {
+            case kPS2Cfg_Bool:
+            case kPS2Cfg_Number:
+                break;
+            case kPS2Cfg_String:
+            case kPS2Cfg_Data:
+                if (item->value > poolSize || item->count > poolSize - item->value)
+                    return false;
+                break;
+            case kPS2Cfg_Array:
+            case kPS2Cfg_Dict:
+            {
+                // children after parent, so there can be no cycles
+                if (item->value <= i || item->value > blob->itemCount || item->count > blob->itemCount - item->value)
+                    return false;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    // every dictionary entry is named, in order
+    for (uint32_t i = 0; i <= blob->itemCount; i++)
+    {
+        const PS2ConfigItem* child;
+        uint32_t count;
+        if (i == blob->itemCount)
+            child = items, count = blob->rootCount;
+        else if (kPS2Cfg_Dict == items[i].type)
+            child = &items[items[i].value], count = items[i].count;
+        else
+            continue;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            if (kPS2ConfigNoName == child[j].name)
+                return false;
+            if (j && strcmp(pool + child[j-1].name, pool + child[j].name) >= 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif /* _PS2CONFIGBLOB_H */
@@ -0,0 +1,289 @@
+//
+//  PS2MiddleButton.h
+//  VoodooPS2Controller
+//
+//  Middle button simulation (left+right pressed together) shared by
+//  ApplePS2Mouse and ApplePS2SynapticsTouchPad.
+//
+
+#ifndef _PS2MIDDLEBUTTON_H
+#define _PS2MIDDLEBUTTON_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOTimerEventSource.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2MiddleButton
+//
+// o  A single left or right button going down (or up, after a middle button)
+//    is held back for up to maxtime (ns) to see if the other button follows.
+//
+// o  The decision is made from packet timestamps: whenever a packet arrives
+//    after the window has expired, the held state is resolved right there.
+//    The timer is only a fallback for a stream that goes idle.  It is armed
+//    at the end of a packetReady drain (endDrain), and only when a button is
+//    still held back and the owner does not expect more packets (a touchpad
+//    with a finger down keeps reporting, and its next packet resolves the
+//    wait).  Outside a drain (timers, messages) it is armed immediately.
+//
+// o  T must provide (usually private, with PS2MiddleButton<T> as friend):
+//       void dispatchMiddleButtonEvent(UInt32 buttons, uint64_t now_abs);
+//
+// o  Statistics published by publishStatistics:
+//    o  MiddleButtonClicks: number of button events held back
+//    o  MiddleButtonTimerArms: number of times the fallback timer was armed
+//    o  MiddleButtonAddedLatency: average time (ns) events were held back
+//    o  MiddleButtonAddedLatencyMax: maximum time (ns) events were held back
+//
+
+#define kMiddleButtonClicks             "MiddleButtonClicks"
+#define kMiddleButtonTimerArms          "MiddleButtonTimerArms"
+#define kMiddleButtonAddedLatency       "MiddleButtonAddedLatency"
+#define kMiddleButtonAddedLatencyMax    "MiddleButtonAddedLatencyMax"
+
+enum PS2MiddleButtonFrom
+{
+    kPS2MB_Device,      // packet from the device itself
+    kPS2MB_Passthru,    // packet from a pass through device (trackpoint)
+    kPS2MB_Cancel,      // finger down; resolve anything held back
+};
+
+template <class T>
+class PS2MiddleButton
+{
+private:
+    enum
+    {
+        STATE_NOBUTTONS,
+        STATE_MIDDLE,
+        STATE_WAIT4TWO,
+        STATE_WAIT4NONE,
+        STATE_NOOP,
+    } _state;
+
+    T*                  _owner;
+    IOTimerEventSource* _timer;
+    UInt32              _pendingbuttons;
+    uint64_t            _buttontime;    // ns
+    bool                _timerArmed;
+    bool                _inDrain;
+
+    // statistics
+    UInt32              _clicks;
+    UInt32              _timerArms;
+    uint64_t            _latencyTotal;
+    uint64_t            _latencyMax;
+    bool                _statsChanged;
+
+    inline void armTimer(uint64_t maxtime)
+    {
+        if (_timerArmed || !_timer)
+            return;
+        // only wait for what is left of the window
+        uint64_t now_abs, now_ns;
+        clock_get_uptime(&now_abs);
+        absolutetime_to_nanoseconds(now_abs, &now_ns);
+        uint64_t elapsed = now_ns - _buttontime;
+        uint64_t time = elapsed < maxtime ? maxtime - elapsed : 0;
+        _timer->setTimeout(*(AbsoluteTime*)&time);
+        _timerArmed = true;
+        ++_timerArms;
+        _statsChanged = true;
+    }
+
+    inline void cancelTimer()
+    {
+        if (_timerArmed)
+        {
+            _timer->cancelTimeout();
+            _timerArmed = false;
+        }
+    }
+
+    inline void startWait(UInt32 buttons, uint64_t now_ns, uint64_t maxtime)
+    {
+        _pendingbuttons = buttons;
+        _buttontime = now_ns;
+        ++_clicks;
+        _statsChanged = true;
+        if (!_inDrain)
+            armTimer(maxtime);
+    }
+
+    inline void endWait(uint64_t now_ns)
+    {
+        uint64_t latency = now_ns - _buttontime;
+        _latencyTotal += latency;
+        if (latency > _latencyMax)
+            _latencyMax = latency;
+        _pendingbuttons = 0;
+        cancelTimer();
+    }
+
+    UInt32 process(UInt32 buttons, uint64_t now_abs, bool timer, bool cancel, uint64_t maxtime)
+    {
+        // resolve from timestamp if we see input after the window has expired
+        bool timeout = false;
+        uint64_t now_ns;
+        absolutetime_to_nanoseconds(now_abs, &now_ns);
+        if (timer || cancel || now_ns - _buttontime > maxtime)
+            timeout = true;
+
+        //
+        // A state machine to simulate middle buttons with two buttons pressed
+        // together.
+        //
+        switch (_state)
+        {
+            // no buttons down, waiting for something to happen
+            case STATE_NOBUTTONS:
+                if (!cancel)
+                {
+                    if (buttons & 0x4)
+                        _state = STATE_NOOP;
+                    else if (0x3 == buttons)
+                        _state = STATE_MIDDLE;
+                    else if (0x0 != buttons)
+                    {
+                        // only single button, so delay this for a bit
+                        startWait(buttons, now_ns, maxtime);
+                        _state = STATE_WAIT4TWO;
+                    }
+                }
+                break;
+
+            // waiting for second button to come down or timeout
+            case STATE_WAIT4TWO:
+                if (!timeout && 0x3 == buttons)
+                {
+                    endWait(now_ns);
+                    _state = STATE_MIDDLE;
+                }
+                else if (timeout || buttons != _pendingbuttons)
+                {
+                    if (timer || !(buttons & _pendingbuttons))
+                        _owner->dispatchMiddleButtonEvent(buttons|_pendingbuttons, now_abs);
+                    endWait(now_ns);
+                    if (0x0 == buttons)
+                        _state = STATE_NOBUTTONS;
+                    else
+                        _state = STATE_NOOP;
+                }
+                break;
+
+            // both buttons down and delivering middle button
+            case STATE_MIDDLE:
+                if (0x0 == buttons)
+                    _state = STATE_NOBUTTONS;
+                else if (0x3 != (buttons & 0x3))
+                {
+                    // only single button, so delay to see if we get to none
+                    startWait(buttons, now_ns, maxtime);
+                    _state = STATE_WAIT4NONE;
+                }
+                break;
+
+            // was middle button, but one button now up, waiting for second to go up
+            case STATE_WAIT4NONE:
+                if (!timeout && 0x0 == buttons)
+                {
+                    endWait(now_ns);
+                    _state = STATE_NOBUTTONS;
+                }
+                else if (timeout || buttons != _pendingbuttons)
+                {
+                    if (timer)
+                        _owner->dispatchMiddleButtonEvent(buttons|_pendingbuttons, now_abs);
+                    endWait(now_ns);
+                    if (0x0 == buttons)
+                        _state = STATE_NOBUTTONS;
+                    else
+                        _state = STATE_NOOP;
+                }
+                break;
+
+            case STATE_NOOP:
+                if (0x0 == buttons)
+                    _state = STATE_NOBUTTONS;
+                break;
+        }
+
+        // modify buttons after new state set
+        switch (_state)
+        {
+            case STATE_MIDDLE:
+                buttons = 0x4;
+                break;
+
+            case STATE_WAIT4NONE:
+            case STATE_WAIT4TWO:
+                buttons &= ~0x3;
+                break;
+
+            case STATE_NOBUTTONS:
+            case STATE_NOOP:
+                break;
+        }
+
+        // return modified buttons
+        return buttons;
+    }
+
+public:
+    void init(T* owner)
+    {
+        _state = STATE_NOBUTTONS;
+        _owner = owner;
+        _timer = 0;
+        _pendingbuttons = 0;
+        _buttontime = 0;
+        _timerArmed = false;
+        _inDrain = false;
+        _clicks = 0;
+        _timerArms = 0;
+        _latencyTotal = 0;
+        _latencyMax = 0;
+        _statsChanged = false;
+    }
+
+    inline void setTimer(IOTimerEventSource* timer) { _timer = timer; _timerArmed = false; }
+    inline bool isWaiting() const { return STATE_WAIT4TWO == _state || STATE_WAIT4NONE == _state; }
+
+    inline UInt32 middleButton(UInt32 buttons, uint64_t now_abs, PS2MiddleButtonFrom from, uint64_t maxtime)
+        { return process(buttons, now_abs, false, kPS2MB_Cancel == from, maxtime); }
+
+    // called from the owner's timer action
+    void onTimer(UInt32 buttons, uint64_t maxtime)
+    {
+        _timerArmed = false;
+        if (!isWaiting())
+            return;
+        uint64_t now_abs;
+        clock_get_uptime(&now_abs);
+        process(buttons, now_abs, true, false, maxtime);
+    }
+
+    // bracket the packet loop in packetReady
+    // (streaming: the device keeps sending packets without new input)
+    inline void beginDrain() { _inDrain = true; }
+    inline void endDrain(uint64_t maxtime, bool streaming = false)
+    {
+        _inDrain = false;
+        // stream may go idle with a button still held back, use the timer
+        if (isWaiting() && _pendingbuttons && !streaming)
+            armTimer(maxtime);
+    }
+
+    void publishStatistics(IOService* service)
+    {
+        if (!_statsChanged)
+            return;
+        _statsChanged = false;
+        service->setProperty(kMiddleButtonClicks, _clicks, 32);
+        service->setProperty(kMiddleButtonTimerArms, _timerArms, 32);
+        service->setProperty(kMiddleButtonAddedLatency, _clicks ? _latencyTotal / _clicks : 0, 64);
+        service->setProperty(kMiddleButtonAddedLatencyMax, _latencyMax, 64);
+    }
+};
+
+#endif /* _PS2MIDDLEBUTTON_H */
@@ -0,0 +1,348 @@
+//
+//  PS2ParamSchema.h
+//  VoodooPS2Controller
+//
+//  Table driven parameter handling shared by the keyboard, mouse and
+//  trackpad drivers (setParamProperties/setProperties).
+//
+
+#ifndef _PS2PARAMSCHEMA_H
+#define _PS2PARAMSCHEMA_H
+
+#include <IOKit/IOService.h>
+#include <libkern/c++/OSBoolean.h>
+#include <libkern/c++/OSNumber.h>
+#include <libkern/c++/OSArray.h>
+#include <libkern/c++/OSData.h>
+#include <libkern/c++/OSCollectionIterator.h>
+#include "PS2ConfigBlob.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Parameter schema
+//
+// o  Each driver describes its configuration variables in one table of
+//    PS2ParamEntry, sorted by name (strcmp order).  The order is checked
+//    at build time by check_schema.sh (run by the makefile), and again at
+//    runtime in DEBUG builds by checkParamSchema.
+//
+// o  applyParamSchema walks the keys of the incoming dictionary (usually
+//    much smaller than the table) and finds each with a binary search.
+//    Only values that differ from the current value are stored.
+//
+// o  A merged configuration from makeConfigurationNode carries its compiled
+//    form (kConfigurationBlob, see PS2ConfigBlob.h), validated once when it
+//    is built.  Then the sorted blob and the sorted table are walked together
+//    once, reading typed values by index, without dictionary lookups or casts.
+//
+// o  Each entry carries a driver defined "affects" bit mask.  The masks of
+//    all changed entries are OR'd together in the result, so the driver can
+//    recompute only the derived state that depends on what changed.
+//
+// o  Types (same conversions the drivers have always used):
+//    o  kPS2P_Int32:   OSNumber -> int (unsigned32BitValue)
+//    o  kPS2P_Limit:   as kPS2P_Int32, but 0 (no limit) is stored as 0x7FFFFFFF
+//    o  kPS2P_Int64:   OSNumber -> uint64_t
+//    o  kPS2P_Bool:    OSBoolean -> int (0 or 1)
+//    o  kPS2P_LowBit:  OSNumber (low bit) or OSBoolean -> bool
+//    o  kPS2P_IntArray: OSArray of OSNumber -> int[max+1], where [0] is
+//                      the count and max is the capacity
+//
+// o  min/max:  Int32 values are clamped to [min,max] when min < max.
+//
+
+enum PS2ParamType
+{
+    kPS2P_Int32,
+    kPS2P_Limit,
+    kPS2P_Int64,
+    kPS2P_Bool,
+    kPS2P_LowBit,
+    kPS2P_IntArray,
+};
+
+struct PS2ParamEntry
+{
+    const char*     name;
+    PS2ParamType    type;
+    void*           var;
+    int             min;
+    int             max;
+    UInt32          affects;
+};
+
+struct PS2ParamResult
+{
+    int             changed;    // number of keys that changed value
+    UInt32          affects;    // OR of affects for changed keys
+    uint64_t        start;      // when apply started (abs)
+};
+
+// properties published by publishParamResult
+#define kParamApplyTime         "ParamApplyTime"
+#define kParamChangedKeys       "ParamChangedKeys"
+
+static inline const PS2ParamEntry* findParamEntry(const PS2ParamEntry* table, int count, const char* name)
+{
+    int lo = 0, hi = count-1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, table[mid].name);
+        if (0 == cmp)
+            return &table[mid];
+        if (cmp < 0)
+            hi = mid-1;
+        else
+            lo = mid+1;
+    }
+    return NULL;
+}
+
+// number is true for OSNumber (or kPS2Cfg_Number), false for OSBoolean (kPS2Cfg_Bool)
+static inline bool applyParamScalar(IOService* service, const PS2ParamEntry* entry, bool number, uint64_t value)
+{
+    bool changed = false;
+
+    switch (entry->type)
+    {
+        case kPS2P_Int32:
+        {
+            if (!number)
+                return false;
+            int val = (UInt32)value;
+            if (entry->min < entry->max)
+            {
+                if (val < entry->min)
+                    val = entry->min;
+                else if (val > entry->max)
+                    val = entry->max;
+            }
+            int* var = (int*)entry->var;
+            changed = (*var != val);
+            *var = val;
+            if (changed || !service->getProperty(entry->name))
+                service->setProperty(entry->name, val, 32);
+            break;
+        }
+        case kPS2P_Limit:
+        {
+            if (!number)
+                return false;
+            // compare normalized value, so 0 is not a change on every apply
+            int val = (UInt32)value;
+            int norm = val ? val : 0x7FFFFFFF;
+            int* var = (int*)entry->var;
+            changed = (*var != norm);
+            *var = norm;
+            if (changed || !service->getProperty(entry->name))
+                service->setProperty(entry->name, val, 32);
+            break;
+        }
+        case kPS2P_Int64:
+        {
+            if (!number)
+                return false;
+            uint64_t val = value;
+            uint64_t* var = (uint64_t*)entry->var;
+            changed = (*var != val);
+            *var = val;
+            if (changed || !service->getProperty(entry->name))
+                service->setProperty(entry->name, val, 64);
+            break;
+        }
+        case kPS2P_Bool:
+        {
+            if (number)
+                return false;
+            int val = value ? 1 : 0;
+            int* var = (int*)entry->var;
+            changed = (*var != val);
+            *var = val;
+            if (changed || !service->getProperty(entry->name))
+                service->setProperty(entry->name, val ? kOSBooleanTrue : kOSBooleanFalse);
+            break;
+        }
+        case kPS2P_LowBit:
+        {
+            //REVIEW: are these items ever carried in a boolean?
+            bool val = (value & 0x1) ? true : false;
+            bool* var = (bool*)entry->var;
+            changed = (*var != val);
+            *var = val;
+            if (changed || !service->getProperty(entry->name))
+            {
+                if (number)
+                    service->setProperty(entry->name, val ? 1 : 0, 32);
+                else
+                    service->setProperty(entry->name, val ? kOSBooleanTrue : kOSBooleanFalse);
+            }
+            break;
+        }
+        case kPS2P_IntArray:
+            return false;
+    }
+    return changed;
+}
+
+static inline bool applyParamEntry(IOService* service, const PS2ParamEntry* entry, OSObject* value)
+{
+    if (kPS2P_IntArray == entry->type)
+    {
+        OSArray* array = OSDynamicCast(OSArray, value);
+        if (!array)
+            return false;
+        int* var = (int*)entry->var;
+        int count = array->getCount();
+        if (count > entry->max)
+            count = entry->max;
+        bool changed = (var[0] != count);
+        for (int i = 0; i < count; i++)
+        {
+            OSNumber* item = OSDynamicCast(OSNumber, array->getObject(i));
+            int val = item ? item->unsigned32BitValue() : 0;
+            changed |= (var[i+1] != val);
+            var[i+1] = val;
+        }
+        var[0] = count;
+        if (changed || !service->getProperty(entry->name))
+            service->setProperty(entry->name, array);
+        return changed;
+    }
+
+    if (OSNumber* num = OSDynamicCast(OSNumber, value))
+        return applyParamScalar(service, entry, true, num->unsigned64BitValue());
+    if (OSBoolean* bl = OSDynamicCast(OSBoolean, value))
+        return applyParamScalar(service, entry, false, bl->isTrue());
+    return false;
+}
+
+static inline bool applyParamItem(IOService* service, const PS2ParamEntry* entry, const PS2ConfigHeader* blob, const PS2ConfigItem* item)
+{
+    switch (item->type)
+    {
+        case kPS2Cfg_Number:
+            return applyParamScalar(service, entry, true, item->value);
+        case kPS2Cfg_Bool:
+            return applyParamScalar(service, entry, false, item->value);
+        case kPS2Cfg_Array:
+            break;
+        default:
+            return false;
+    }
+    if (kPS2P_IntArray != entry->type)
+        return false;
+
+    const PS2ConfigItem* child = configItems(blob) + item->value;
+    int* var = (int*)entry->var;
+    int count = item->count;
+    if (count > entry->max)
+        count = entry->max;
+    bool changed = (var[0] != count);
+    for (int i = 0; i < count; i++)
+    {
+        int val = kPS2Cfg_Number == child[i].type ? (UInt32)child[i].value : 0;
+        changed |= (var[i+1] != val);
+        var[i+1] = val;
+    }
+    var[0] = count;
+    if (changed || !service->getProperty(entry->name))
+    {
+        // property is the whole array, as for the dictionary case
+        if (OSArray* array = OSArray::withCapacity(item->count ? item->count : 1))
+        {
+            for (unsigned i = 0; i < item->count; i++)
+            {
+                if (kPS2Cfg_Number != child[i].type)
+                    continue;
+                if (OSNumber* num = OSNumber::withNumber(child[i].value, 32))
+                {
+                    array->setObject(num);
+                    num->release();
+                }
+            }
+            service->setProperty(entry->name, array);
+            array->release();
+        }
+    }
+    return changed;
+}
+
+static inline void applyParamBlob(IOService* service, const PS2ParamEntry* table, int count, const PS2ConfigHeader* blob, PS2ParamResult& result)
+{
+    // both are sorted by name, so one pass over each
+    int itemCount;
+    const PS2ConfigItem* items = configChildren(blob, NULL, &itemCount);
+    int i = 0, j = 0;
+    while (i < itemCount && j < count)
+    {
+        int cmp = strcmp(configItemName(blob, &items[i]), table[j].name);
+        if (cmp < 0)
+            ++i;
+        else if (cmp > 0)
+            ++j;
+        else
+        {
+            if (applyParamItem(service, &table[j], blob, &items[i]))
+            {
+                ++result.changed;
+                result.affects |= table[j].affects;
+            }
+            ++i, ++j;
+        }
+    }
+}
+
+static inline PS2ParamResult applyParamSchema(IOService* service, const PS2ParamEntry* table, int count, OSDictionary* dict)
+{
+    PS2ParamResult result = { 0, 0, 0 };
+    clock_get_uptime(&result.start);
+
+    // compiled form, if dict is a merged configuration from makeConfigurationNode
+    // (validated there; only those are immutable, dictionaries from user space
+    // through setProperties never are, so a blob in one of those is ignored)
+    if (dict && (dict->setOptions(0, 0) & OSCollection::kImmutable))
+    {
+        if (OSData* data = OSDynamicCast(OSData, dict->getObject(kConfigurationBlob)))
+        {
+            applyParamBlob(service, table, count, (const PS2ConfigHeader*)data->getBytesNoCopy(), result);
+            return result;
+        }
+    }
+
+    if (OSCollectionIterator* iter = OSCollectionIterator::withCollection(dict))
+    {
+        // Note: OSDictionary always contains OSSymbol*
+        while (const OSSymbol* key = static_cast<const OSSymbol*>(iter->getNextObject()))
+        {
+            const PS2ParamEntry* entry = findParamEntry(table, count, key->getCStringNoCopy());
+            if (entry && applyParamEntry(service, entry, dict->getObject(key)))
+            {
+                ++result.changed;
+                result.affects |= entry->affects;
+            }
+        }
+        iter->release();
+    }
+    return result;
+}
+
+// call after dependent state is recomputed, so apply time includes it
+static inline void publishParamResult(IOService* service, const PS2ParamResult& result)
+{
+    uint64_t now, time;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now-result.start, &time);
+    service->setProperty(kParamApplyTime, time, 64);
+    service->setProperty(kParamChangedKeys, result.changed, 32);
+}
+
+#ifdef DEBUG
+static inline void checkParamSchema(const char* driver, const PS2ParamEntry* table, int count)
+{
+    for (int i = 1; i < count; i++)
+        if (strcmp(table[i-1].name, table[i].name) >= 0)
+            IOLog("%s: parameter schema not sorted at \"%s\"\n", driver, table[i].name);
+}
+#endif
+
+#endif /* _PS2PARAMSCHEMA_H */
@@ -0,0 +1,243 @@
+//
+//  PS2Statistics.h
+//  VoodooPS2Controller
+//
+//  Counters for the PS/2 stack, kept in one block of memory that is shared
+//  read only with user space through ApplePS2StatisticsUserClient.
+//
+//  The kernel and VoodooPS2Daemon (the reader) both include this header,
+//  so it has no IOKit dependencies.
+//
+
+#ifndef _PS2STATISTICS_H
+#define _PS2STATISTICS_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2Statistics
+//
+// o  ApplePS2Controller owns the block.  It counts interrupts, bytes read
+//    per stream, the request queue and submitRequestAndBlock.  The keyboard
+//    and pointing drivers get the counters of their stream with
+//    getStreamStatistics, and count packets, resync drops, the ring buffer
+//    high-water mark, timer fires and HID events.  The keyboard also counts
+//    its batched drains (keyboardBatch, see BatchKeyboardEvents) and the
+//    swipe actions it replays (keyboardSwipe).  The controller also times
+//    the multi-byte mouse command strings (mouseSequences).
+//
+// o  Counters are updated with plain increments where they are counted
+//    (interrupt time or work loop), there is no locking.  A reader may see
+//    a block where one counter is a little ahead of another.
+//
+// o  Reading is mapping the block (memory type kPS2StatisticsMemory of the
+//    controller's user client), so reads cost nothing in the kernel and do
+//    not touch the registry.  VoodooPS2Daemon --statistics prints it.
+//
+// o  Fields are only ever added at the end; size tells the reader how much
+//    of the block the kernel knows about.
+//
+
+#define kPS2StatisticsMagic     0x53325350      // 'PS2S'
+#define kPS2StatisticsVersion   1
+#define kPS2StatisticsMemory    0               // clientMemoryForType type
+
+enum
+{
+    kPS2Stats_Keyboard,
+    kPS2Stats_Aux,
+    kPS2Stats_StreamCount,
+};
+
+struct PS2StreamStats
+{
+    uint64_t    bytes;              // read from the data port (controller)
+    uint64_t    packets;            // complete packets handled in packetReady
+    uint64_t    dropped;            // bytes thrown away to get back in sync
+    uint64_t    timerFires;         // driver timers (buttons, scroll, macros...)
+    uint64_t    hidEvents;          // events dispatched to HID
+    uint32_t    ringHighWater;      // most bytes waiting at the start of a drain
+    uint32_t    reserved;
+};
+
+struct PS2StormStats
+{
+    uint64_t    episodes;           // interrupt storms (stream polled meanwhile)
+    uint64_t    polledTime;         // ns, total
+    uint64_t    lastStart;          // ns of uptime
+    uint64_t    lastDuration;       // ns, 0 while still polled
+    uint32_t    lastPeakRate;       // interrupts per second that triggered it
+    uint32_t    reserved;
+};
+
+struct PS2BatchStats
+{
+    uint64_t    drains;             // packetReady drains dispatched as a batch
+    uint64_t    events;             // key events in those batches
+    uint32_t    eventsLast;
+    uint32_t    eventsMax;
+    uint64_t    latency;            // ns, total from oldest packet to batch dispatched
+    uint64_t    latencyMax;         // ns
+};
+
+enum
+{
+    kPS2Swipe_Up,
+    kPS2Swipe_Down,
+    kPS2Swipe_Left,
+    kPS2Swipe_Right,
+    kPS2Swipe_Count,
+};
+
+struct PS2SwipeStats
+{
+    uint64_t    count[kPS2Swipe_Count];
+    uint64_t    latency[kPS2Swipe_Count];   // ns, total from gesture to first key
+    uint64_t    latencyMax[kPS2Swipe_Count];// ns
+    uint64_t    dropped;                    // queue full
+};
+
+struct PS2SequenceStats
+{
+    uint64_t    sequences;          // kPS2C_SendMouseCommandsAndCompareAck
+    uint64_t    failures;           // a byte was not acknowledged
+    uint64_t    time;               // ns, total
+    uint64_t    timeMax;            // ns
+};
+
+struct PS2Statistics
+{
+    uint32_t        magic;
+    uint16_t        version;
+    uint16_t        size;           // of this structure, as the kernel knows it
+    uint64_t        interrupts;
+    uint64_t        requests;       // submitted with submitRequest
+    uint32_t        requestQueueDepth;
+    uint32_t        requestQueueHighWater;
+    uint64_t        blockingRequests;
+    uint64_t        blockingTime;   // ns, total in submitRequestAndBlock
+    uint64_t        blockingTimeMax;// ns
+    uint64_t        watchdogFires;
+    PS2StreamStats  stream[kPS2Stats_StreamCount];
+    uint64_t        requestPoolMisses;  // allocateRequest had to allocate
+    uint64_t        asyncCompletions;   // delivered on a device work loop
+    PS2StormStats   storm[kPS2Stats_StreamCount];
+    uint32_t        interruptMode;      // in effect: 0 immediate, 1 deferred
+    uint32_t        reserved;
+    uint64_t        handlerTime;        // ns, total in the interrupt handlers
+    uint64_t        handlerTimeMax;     // ns
+    uint64_t        wakeups;            // packetReady runs
+    uint64_t        wakeLatency;        // ns, total from last interrupt to packetReady
+    uint64_t        wakeLatencyMax;     // ns
+    PS2BatchStats   keyboardBatch;
+    PS2SwipeStats   keyboardSwipe;
+    PS2SequenceStats mouseSequences;
+};
+
+static inline void initStatistics(PS2Statistics* stats)
+{
+    char* p = (char*)stats;
+    for (unsigned i = 0; i < sizeof(*stats); i++)
+        p[i] = 0;
+    stats->magic = kPS2StatisticsMagic;
+    stats->version = kPS2StatisticsVersion;
+    stats->size = sizeof(*stats);
+}
+
+// used until a driver has its stream's counters (before start), so never NULL
+static inline PS2StreamStats* statisticsSink()
+{
+    static PS2StreamStats sink;
+    return &sink;
+}
+
+static inline PS2BatchStats* batchStatisticsSink()
+{
+    static PS2BatchStats sink;
+    return &sink;
+}
+
+static inline PS2SwipeStats* swipeStatisticsSink()
+{
+    static PS2SwipeStats sink;
+    return &sink;
+}
+
+static inline void noteRingCount(PS2StreamStats* stats, unsigned count)
+{
+    if (count > stats->ringHighWater)
+        stats->ringHighWater = count;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Reader
+//
+
+static inline bool validateStatistics(const void* data, uint64_t length)
+{
+    const PS2Statistics* stats = (const PS2Statistics*)data;
+    return length >= sizeof(*stats) && stats->magic == kPS2StatisticsMagic &&
+           stats->version == kPS2StatisticsVersion && stats->size >= sizeof(*stats);
+}
+
+typedef void (*PS2StatisticsPrint)(const char* format, ...);
+
+static inline void printStatistics(const PS2Statistics* stats, PS2StatisticsPrint print)
+{
+    static const char* names[kPS2Stats_StreamCount] = { "keyboard", "aux" };
+    print("interrupts:          %llu\n", (unsigned long long)stats->interrupts);
+    print("requests:            %llu (queue depth %u, high-water %u)\n", (unsigned long long)stats->requests,
+          stats->requestQueueDepth, stats->requestQueueHighWater);
+    print("blocking requests:   %llu (total %llu us, max %llu us)\n", (unsigned long long)stats->blockingRequests,
+          (unsigned long long)stats->blockingTime / 1000, (unsigned long long)stats->blockingTimeMax / 1000);
+    print("watchdog fires:      %llu\n", (unsigned long long)stats->watchdogFires);
+    print("interrupt mode:      %s\n", stats->interruptMode ? "deferred" : "immediate");
+    print("handler time:        %llu us (avg %llu ns, max %llu ns)\n", (unsigned long long)stats->handlerTime / 1000,
+          (unsigned long long)(stats->interrupts ? stats->handlerTime / stats->interrupts : 0),
+          (unsigned long long)stats->handlerTimeMax);
+    print("wake latency:        avg %llu ns, max %llu ns (%llu wakeups)\n",
+          (unsigned long long)(stats->wakeups ? stats->wakeLatency / stats->wakeups : 0),
+          (unsigned long long)stats->wakeLatencyMax, (unsigned long long)stats->wakeups);
+    print("request pool misses: %llu\n", (unsigned long long)stats->requestPoolMisses);
+    print("async completions:   %llu\n", (unsigned long long)stats->asyncCompletions);
+    const PS2BatchStats* batch = &stats->keyboardBatch;
+    if (batch->drains)
+        print("keyboard batches:    %llu (avg %llu events, last %u, max %u; latency avg %llu us, max %llu us)\n",
+              (unsigned long long)batch->drains, (unsigned long long)(batch->events / batch->drains),
+              batch->eventsLast, batch->eventsMax, (unsigned long long)(batch->latency / batch->drains / 1000),
+              (unsigned long long)batch->latencyMax / 1000);
+    static const char* swipes[kPS2Swipe_Count] = { "up", "down", "left", "right" };
+    const PS2SwipeStats* swipe = &stats->keyboardSwipe;
+    for (int i = 0; i < kPS2Swipe_Count; i++)
+    {
+        if (swipe->count[i])
+            print("swipe %-6s         %llu (latency avg %llu us, max %llu us)\n", swipes[i], (unsigned long long)swipe->count[i],
+                  (unsigned long long)(swipe->latency[i] / swipe->count[i] / 1000), (unsigned long long)swipe->latencyMax[i] / 1000);
+    }
+    if (swipe->dropped)
+        print("swipes dropped:      %llu\n", (unsigned long long)swipe->dropped);
+    const PS2SequenceStats* seq = &stats->mouseSequences;
+    if (seq->sequences)
+        print("mouse sequences:     %llu (%llu failed; avg %llu us, max %llu us)\n", (unsigned long long)seq->sequences,
+              (unsigned long long)seq->failures, (unsigned long long)(seq->time / seq->sequences / 1000),
+              (unsigned long long)seq->timeMax / 1000);
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        const PS2StreamStats* s = &stats->stream[i];
+        print("%s:\n", names[i]);
+        print("  bytes:             %llu\n", (unsigned long long)s->bytes);
+        print("  packets:           %llu\n", (unsigned long long)s->packets);
+        print("  dropped:           %llu\n", (unsigned long long)s->dropped);
+        print("  ring high-water:   %u\n", s->ringHighWater);
+        print("  timer fires:       %llu\n", (unsigned long long)s->timerFires);
+        print("  HID events:        %llu\n", (unsigned long long)s->hidEvents);
+        const PS2StormStats* storm = &stats->storm[i];
+        print("  interrupt storms:  %llu (polled %llu ms)\n", (unsigned long long)storm->episodes,
+              (unsigned long long)storm->polledTime / 1000000);
+        if (storm->episodes)
+            print("    last:            at %llu s, %llu ms, %u/s\n", (unsigned long long)storm->lastStart / 1000000000,
+                  (unsigned long long)storm->lastDuration / 1000000, storm->lastPeakRate);
+    }
+}
+
+#endif /* _PS2STATISTICS_H */
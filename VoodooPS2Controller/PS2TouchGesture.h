@@ -0,0 +1,237 @@
+//
+//  PS2TouchGesture.h
+//  VoodooPS2Controller
+//
+//  On-pad gestures (pointer, two finger scroll, swipe, tap) for absolute
+//  touchpads, shared by ApplePS2ALPSGlidePoint and ApplePS2SentelicFSP.
+//
+//  Works on decoded finger reports and nanosecond timestamps handed in by
+//  the driver, and returns a plain result; the driver does the HID dispatch.
+//
+
+#ifndef _PS2TOUCHGESTURE_H
+#define _PS2TOUCHGESTURE_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2TouchGesture
+//
+// o  One finger moves the pointer.  Two fingers scroll, tracking their
+//    midpoint.  Three or more only carry buttons.  Any change in the finger
+//    count starts over from the new position, so there is no jump when a
+//    finger is added or lifted.
+//
+// o  Motion is scaled by scale/scaleDivisor (scaleDivisor of zero: not
+//    scaled), with the remainder carried to the next report.
+//
+// o  Swipe:  two fingers that travel swipeDistance along one axis (and
+//    twice as far as along the other) within swipeTime of touching down
+//    produce one swipe; scrolling then stops until the fingers lift.
+//    swipeDistance of zero disables swipes.
+//
+// o  Tap:  touch and release within tapTime, moving less than tapMove,
+//    clicks left (one finger) or right (two fingers) when tapping is set.
+//
+// o  Scroll deltas are scrollDivisor (scaled) units per line, with the
+//    remainder carried to the next report.
+//
+// o  process takes the driver's own report type R, which must provide:
+//       int fingers; mt[2] with int x, y; uint32_t buttons;
+//
+
+enum PS2TouchSwipe
+{
+    kPS2TouchSwipe_None,
+    kPS2TouchSwipe_Left,
+    kPS2TouchSwipe_Right,
+    kPS2TouchSwipe_Up,
+    kPS2TouchSwipe_Down,
+};
+
+struct PS2TouchGestureConfig
+{
+    bool        tapping;
+    bool        vscroll;
+    bool        hscroll;
+    int         scale;
+    int         scaleDivisor;
+    int         scrollDivisor;
+    int         swipeDistance;
+    uint64_t    swipeTime;      // ns
+    uint64_t    tapTime;        // ns
+    int         tapMove;
+};
+
+struct PS2TouchGestureOutput
+{
+    uint32_t    tap;            // buttons to click before buttons below (0 if none)
+    int         dx;
+    int         dy;
+    uint32_t    buttons;
+    int         scrollx;        // lines (pad direction; negate for wheel)
+    int         scrolly;
+    PS2TouchSwipe swipe;
+};
+
+class PS2TouchGesture
+{
+private:
+    PS2TouchGestureConfig _config;
+    int                 _lastfingers;
+    int                 _maxfingers;
+    int                 _lastx;
+    int                 _lasty;
+    int                 _startx;
+    int                 _starty;
+    int                 _xrest;
+    int                 _yrest;
+    int                 _scrollxrest;
+    int                 _scrollyrest;
+    int                 _moved;
+    uint64_t            _touchtime;
+    uint64_t            _fingerstime;
+    bool                _swiped;
+
+    static inline int iabs(int x) { return x < 0 ? -x : x; }
+
+    inline int scaleDelta(int delta, int& rest)
+    {
+        if (!_config.scaleDivisor)
+            return delta;
+        int value = delta * _config.scale + rest;
+        int result = value / _config.scaleDivisor;
+        rest = value - result * _config.scaleDivisor;
+        return result;
+    }
+
+    inline int scrollLines(int delta, int& rest)
+    {
+        int divisor = _config.scrollDivisor > 0 ? _config.scrollDivisor : 1;
+        delta += rest;
+        int lines = delta / divisor;
+        rest = delta - lines * divisor;
+        return lines;
+    }
+
+public:
+    PS2TouchGesture()
+    {
+        _config.tapping = false;
+        _config.vscroll = true;
+        _config.hscroll = true;
+        _config.scale = 1;
+        _config.scaleDivisor = 0;
+        _config.scrollDivisor = 8;
+        _config.swipeDistance = 400;
+        _config.swipeTime = 250000000;
+        _config.tapTime = 200000000;
+        _config.tapMove = 10;
+        reset();
+    }
+
+    inline PS2TouchGestureConfig& config() { return _config; }
+
+    inline void reset()
+    {
+        _lastfingers = _maxfingers = 0;
+        _lastx = _lasty = _startx = _starty = 0;
+        _xrest = _yrest = 0;
+        _scrollxrest = _scrollyrest = 0;
+        _moved = 0;
+        _touchtime = _fingerstime = 0;
+        _swiped = false;
+    }
+
+    template <class R>
+    void process(const R& report, uint64_t now_ns, PS2TouchGestureOutput& out)
+    {
+        out.tap = 0;
+        out.dx = out.dy = 0;
+        out.buttons = report.buttons;
+        out.scrollx = out.scrolly = 0;
+        out.swipe = kPS2TouchSwipe_None;
+
+        int fingers = report.fingers;
+        if (!fingers)
+        {
+            if (_lastfingers && _config.tapping && !report.buttons && _moved < _config.tapMove &&
+                now_ns - _touchtime < _config.tapTime)
+            {
+                // tap: left click, or right click for two fingers
+                out.tap = _maxfingers >= 2 ? 0x2 : 0x1;
+            }
+            _lastfingers = 0;
+            return;
+        }
+
+        // two fingers track their midpoint
+        int x = report.mt[0].x, y = report.mt[0].y;
+        if (fingers >= 2)
+        {
+            x = (x + report.mt[1].x) / 2;
+            y = (y + report.mt[1].y) / 2;
+        }
+
+        if (fingers != _lastfingers)
+        {
+            if (!_lastfingers)
+            {
+                _touchtime = now_ns;
+                _moved = 0;
+                _maxfingers = 0;
+            }
+            if (fingers > _maxfingers)
+                _maxfingers = fingers;
+            _lastfingers = fingers;
+            _lastx = _startx = x;
+            _lasty = _starty = y;
+            _xrest = _yrest = 0;
+            _scrollxrest = _scrollyrest = 0;
+            _fingerstime = now_ns;
+            _swiped = false;
+            return;
+        }
+
+        int dx = scaleDelta(x - _lastx, _xrest);
+        int dy = scaleDelta(y - _lasty, _yrest);
+        _lastx = x;
+        _lasty = y;
+        _moved += iabs(dx) + iabs(dy);
+
+        if (fingers > 2)
+            return;
+
+        if (1 == fingers || report.buttons)
+        {
+            // (two fingers with a button down: click and drag)
+            out.dx = dx;
+            out.dy = dy;
+            return;
+        }
+
+        if (_swiped)
+            return;
+
+        if (_config.swipeDistance && now_ns - _fingerstime < _config.swipeTime)
+        {
+            int sx = x - _startx, sy = y - _starty;
+            if (iabs(sx) >= _config.swipeDistance && iabs(sx) >= 2*iabs(sy))
+                out.swipe = sx < 0 ? kPS2TouchSwipe_Left : kPS2TouchSwipe_Right;
+            else if (iabs(sy) >= _config.swipeDistance && iabs(sy) >= 2*iabs(sx))
+                out.swipe = sy < 0 ? kPS2TouchSwipe_Up : kPS2TouchSwipe_Down;
+            if (kPS2TouchSwipe_None != out.swipe)
+            {
+                _swiped = true;
+                return;
+            }
+        }
+
+        if (_config.hscroll)
+            out.scrollx = scrollLines(dx, _scrollxrest);
+        if (_config.vscroll)
+            out.scrolly = scrollLines(dy, _scrollyrest);
+    }
+};
+
+#endif /* _PS2TOUCHGESTURE_H */
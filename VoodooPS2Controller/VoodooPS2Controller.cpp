@@ -31,6 +31,9 @@
 #include "ApplePS2KeyboardDevice.h"
 #include "ApplePS2MouseDevice.h"
 #include "VoodooPS2Controller.h"
+#include "PS2AuxIdentity.h"
+#include "PS2ALPSIdentity.h"
+#include "PS2ConfigBlob.h"
 
 //REVIEW: avoids problem with Xcode 5.1.0 where -dead_strip eliminates these required symbols
 #include <libkern/OSKextLib.h>
@@ -65,17 +68,28 @@ void ApplePS2Controller::interruptHandlerMouse(OSObject*, void* refCon, IOServic
   ApplePS2Controller* me = (ApplePS2Controller*)refCon;
   if (me->_ignoreInterrupts)
     return;
+  OSIncrementAtomic(&me->_handlersActive);
+  uint64_t start;
+  clock_get_uptime(&start);
+  ++me->_interruptCount;
+  ++me->_stats->interrupts;
+  me->_interruptStamp[kPS2Stats_Aux] = start;
+  me->noteInterrupt(kPS2Stats_Aux);
     
   //
   // Wake our workloop to service the interrupt.    This is an edge-triggered
   // interrupt, so returning from this routine without clearing the interrupt
   // condition is perfectly normal.
   //
-#if HANDLE_INTERRUPT_DATA_LATER
-  me->_interruptSourceMouse->interruptOccurred(0, 0, 0);
-#else
-  me->handleInterrupt(kDT_Mouse);
-#endif
+  if (kInterruptDeferred == me->_interruptMode)
+  {
+    me->_deferredPending[kPS2Stats_Aux] = true;
+    me->_interruptSourceMouse->interruptOccurred(0, 0, 0);
+  }
+  else if (me->handleInterrupt(kDT_Mouse, me->_storm[kPS2Stats_Aux].limit ? kInterruptStormBytes : 0))
+    me->startInterruptStorm(kPS2Stats_Aux);
+  me->noteHandlerTime(start);
+  OSDecrementAtomic(&me->_handlersActive);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -86,6 +100,13 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
   ApplePS2Controller* me = (ApplePS2Controller*)refCon;
   if (me->_ignoreInterrupts)
     return;
+  OSIncrementAtomic(&me->_handlersActive);
+  uint64_t start;
+  clock_get_uptime(&start);
+  ++me->_interruptCount;
+  ++me->_stats->interrupts;
+  me->_interruptStamp[kPS2Stats_Keyboard] = start;
+  me->noteInterrupt(kPS2Stats_Keyboard);
     
 #if DEBUGGER_SUPPORT
   //
@@ -131,6 +152,7 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
         me->enqueueKeyboardData(key);
 
       // In all cases, we wake up our workloop to service the interrupt data.
+      me->_deferredPending[kPS2Stats_Keyboard] = true;
       me->_interruptSourceKeyboard->interruptOccurred(0, 0, 0);
     }
   }
@@ -145,75 +167,489 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
   // interrupt, so returning from this routine without clearing the interrupt
   // condition is perfectly normal.
   //
-#if HANDLE_INTERRUPT_DATA_LATER
-  me->_interruptSourceKeyboard->interruptOccurred(0, 0, 0);
+  if (kInterruptDeferred == me->_interruptMode)
+  {
+    me->_deferredPending[kPS2Stats_Keyboard] = true;
+    me->_interruptSourceKeyboard->interruptOccurred(0, 0, 0);
+  }
+  else if (me->handleInterrupt(kDT_Keyboard, me->_storm[kPS2Stats_Keyboard].limit ? kInterruptStormBytes : 0))
+    me->startInterruptStorm(kPS2Stats_Keyboard);
+
+#endif //DEBUGGER_SUPPORT
+  me->noteHandlerTime(start);
+  OSDecrementAtomic(&me->_handlersActive);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::noteHandlerTime(uint64_t start)
+{
+    //
+    // Interrupt time: account the time spent in the handler, and for
+    // kInterruptAuto, decide on the mode once there are enough samples.
+    //
+
+    uint64_t end, time;
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - start, &time);
+    _stats->handlerTime += time;
+    if (time > _stats->handlerTimeMax)
+        _stats->handlerTimeMax = time;
+
+    if (kInterruptAuto != _interruptModeConfig || _autoState)
+        return;
+    _autoTime += time;
+    if (++_autoSamples < kInterruptAutoSamples)
+        return;
+    if (_autoTime / _autoSamples > kInterruptAutoMaxTime * 1000ULL)
+        _interruptMode = kInterruptDeferred;
+    _stats->interruptMode = _interruptMode;
+    _autoState = 1;     // published by packetReady
+}
+
+void ApplePS2Controller::noteWakeLatency(int stream)
+{
+    uint64_t now, latency;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - _interruptStamp[stream], &latency);
+    ++_stats->wakeups;
+    _stats->wakeLatency += latency;
+    if (latency > _stats->wakeLatencyMax)
+        _stats->wakeLatencyMax = latency;
+
+    if (1 == _autoState && OSCompareAndSwap(1, 2, &_autoState))
+    {
+        IOLog("%s: interrupt handler averages %llu ns, using %s interrupt handling\n", getName(),
+              (unsigned long long)(_autoTime / _autoSamples), kInterruptDeferred == _interruptMode ? "deferred" : "immediate");
+        publishInterruptMode();
+    }
+}
+
+bool ApplePS2Controller::setInterruptMode(int mode)
+{
+    //
+    // Called with the controller's gate closed (setPropertiesGated).
+    //
+
+    if (mode < kInterruptImmediate || mode > kInterruptAuto)
+    {
+        IOLog("%s: InterruptMode %d is not valid, ignored\n", getName(), mode);
+        return false;
+    }
+#if DEBUGGER_SUPPORT
+    // keyboard data always goes through the keyboard queue
+    mode = kInterruptDeferred;
+#endif
+    _interruptModeConfig = mode;
+    _autoState = 0;
+    _autoSamples = 0;
+    _autoTime = 0;
+    int active = kInterruptDeferred == mode ? kInterruptDeferred : kInterruptImmediate;
+    if (active != _interruptMode)
+        switchInterruptMode(active);
+    _stats->interruptMode = _interruptMode;
+    publishInterruptMode();
+    return true;
+}
+
+void ApplePS2Controller::switchInterruptMode(int mode)
+{
+    //
+    // Only one side may read the data port: the interrupt handlers when
+    // immediate, readInterruptData (inside our gate, which the caller holds)
+    // when deferred.  Mask both interrupts and wait out handlers already
+    // running on other CPUs, so neither side is reading while we switch.
+    //
+
+    bool masked[kPS2Stats_StreamCount];
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        masked[i] = !_storm[i].polling;     // (polled streams stay masked)
+        if (masked[i])
+            setStreamInterruptEnabled(i, false);
+    }
+    while (_handlersActive)
+        IODelay(kDataDelay);
+
+    // Data the handlers left for readInterruptData has already interrupted,
+    // so nothing would read it once immediate: read it now.
+    if (kInterruptDeferred == _interruptMode)
+    {
+        _deferredPending[kPS2Stats_Keyboard] = false;
+        _deferredPending[kPS2Stats_Aux] = false;
+        if (!_hardwareOffline)
+            handleInterrupt(kDT_Keyboard);
+    }
+    _interruptMode = mode;
+
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        if (masked[i])
+            setStreamInterruptEnabled(i, true);
+    }
+}
+
+void ApplePS2Controller::publishInterruptMode()
+{
+    setProperty(kInterruptModeActive, kInterruptDeferred == _interruptMode ? "Deferred" : "Immediate");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::readInterruptData(PS2DeviceType deviceType)
+{
+    //
+    // kInterruptDeferred: read and dispatch the data the interrupt handler
+    // left waiting.  This happens inside the controller's gate (device work
+    // loop, then controller work loop), so processRequest is not reading the
+    // data port at the same time.  Complete packets of the other stream
+    // wake its packetReady; ours runs right after (see packetReady).
+    //
+
+    _workLoop->closeGate();
+    // (the mode may have been switched to immediate since the interrupt)
+    if (!_hardwareOffline && kInterruptDeferred == _interruptMode)
+    {
+#if DEBUGGER_SUPPORT
+        UInt8 status;
+        int state;
+        lockController(&state);              // (lock out interrupt + access to queue)
+        while (1)
+        {
+            // See if data is available on the keyboard input stream (off queue);
+            // we do not read keyboard data from the real data port if it should
+            // be available.
+
+            if (dequeueKeyboardData(&status))
+            {
+                unlockController(state);
+                dispatchDriverInterrupt(kDT_Keyboard, status);
+                lockController(&state);
+            }
+
+            // See if data is available on the mouse input stream (off real port).
+
+            else if ( (inb(kCommandPort) & (kOutputReady | kMouseData)) ==
+                                           (kOutputReady | kMouseData))
+            {
+                unlockController(state);
+                IODelay(kDataDelay);
+                dispatchDriverInterrupt(kDT_Mouse, inb(kDataPort));
+                lockController(&state);
+            }
+            else break; // out of loop
+        }
+        unlockController(state);      // (release interrupt lockout + access to queue)
 #else
-  me->handleInterrupt(kDT_Keyboard);
+        int stream = kDT_Mouse == deviceType ? kPS2Stats_Aux : kPS2Stats_Keyboard;
+        if (handleInterrupt(deviceType, _storm[stream].limit ? kInterruptStormBytes : 0, false))
+            startInterruptStorm(stream);
+#endif // DEBUGGER_SUPPORT
+    }
+    _workLoop->openGate();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::noteInterrupt(int stream)
+{
+    //
+    // Interrupt time: count the interrupt in the stream's current window,
+    // and past the stream's limit, switch it to polled mode.
+    //
+
+    InterruptStorm& storm = _storm[stream];
+    if (!storm.limit || storm.polling)
+        return;
+    uint64_t now;
+    clock_get_uptime(&now);
+    if (now - storm.windowStart >= _stormWindow)
+    {
+        storm.windowStart = now;
+        storm.count = 0;
+    }
+    if (++storm.count > storm.limit * kInterruptStormWindow / 1000)
+        startInterruptStorm(stream);
+}
+
+void ApplePS2Controller::startInterruptStorm(int stream)
+{
+    //
+    // Interrupt time: disable the stream's interrupt and let onInterruptStorm
+    // (work loop) record the episode and start polling.
+    //
+
+    InterruptStorm& storm = _storm[stream];
+    if (storm.polling)
+        return;
+    storm.peakRate = storm.count * (1000 / kInterruptStormWindow);
+    storm.recorded = false;
+    storm.polling = true;
+    setStreamInterruptEnabled(stream, false);
+    if (_stormSource)
+        _stormSource->interruptOccurred(0, 0, 0);
+}
+
+void ApplePS2Controller::setStreamInterruptEnabled(int stream, bool enable)
+{
+    bool mouse = kPS2Stats_Aux == stream;
+    if (!(mouse ? _interruptInstalledMouse : _interruptInstalledKeyboard))
+        return;
+    int source = mouse ? kIRQ_Mouse : kIRQ_Keyboard;
+#ifdef NEWIRQ
+    if (_newIRQLayout)
+        source = mouse ? 1 : 0;
 #endif
+    if (enable)
+        getProvider()->enableInterrupt(source);
+    else
+        getProvider()->disableInterrupt(source);
+}
 
-#endif //DEBUGGER_SUPPORT
+void ApplePS2Controller::onInterruptStorm(IOInterruptEventSource*, int)
+{                                                      // IOInterruptEventAction
+    bool poll = false;
+    uint64_t now;
+    clock_get_uptime(&now);
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        InterruptStorm& storm = _storm[i];
+        if (!storm.polling || storm.recorded)
+            continue;
+        storm.recorded = true;
+        storm.pollStart = now;
+        storm.checkTime = now;
+        storm.checkBytes = _stats->stream[i].bytes;
+
+        PS2StormStats& stats = _stats->storm[i];
+        ++stats.episodes;
+        absolutetime_to_nanoseconds(now, &stats.lastStart);
+        stats.lastDuration = 0;
+        stats.lastPeakRate = storm.peakRate;
+        IOLog("%s: interrupt storm on %s stream (%u/s), polling (%llu)\n", getName(),
+              kPS2Stats_Aux == i ? "mouse" : "keyboard", (unsigned)storm.peakRate, (unsigned long long)stats.episodes);
+        setProperty(kPS2Stats_Aux == i ? kInterruptStormsMouse : kInterruptStormsKeyboard, stats.episodes, 32);
+        poll = true;
+    }
+    if (poll)
+        _stormTimer->setTimeoutMS(kInterruptStormPollInterval);
+}
+
+void ApplePS2Controller::onStormPollTimer()
+{
+    //
+    // Polled mode: drain a bounded number of bytes, and every
+    // kInterruptStormRecovery ms, end the storm of any stream whose byte
+    // rate is back under half its limit.  While polled there are no
+    // interrupts to count; the 8042 raises one per byte, so the byte rate
+    // is the interrupt rate the stream would have (the limit's unit).
+    //
+
+    unsigned streams = pollingStreams();
+    if (!_hardwareOffline && streams)
+        handleInterrupt(kDT_Keyboard, kInterruptStormPollBytes, true, streams);
+
+    bool poll = false;
+    uint64_t now;
+    clock_get_uptime(&now);
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        InterruptStorm& storm = _storm[i];
+        if (!storm.polling || !storm.recorded)
+            continue;
+        uint64_t elapsed;
+        absolutetime_to_nanoseconds(now - storm.checkTime, &elapsed);
+        if (elapsed >= kInterruptStormRecovery * 1000000ULL)
+        {
+            uint64_t rate = (_stats->stream[i].bytes - storm.checkBytes) * 1000000000ULL / elapsed;
+            if (rate < storm.limit / 2)
+            {
+                endInterruptStorm(i, true);
+                continue;
+            }
+            storm.checkTime = now;
+            storm.checkBytes = _stats->stream[i].bytes;
+        }
+        poll = true;
+    }
+    if (poll)
+        _stormTimer->setTimeoutMS(kInterruptStormPollInterval);
+}
+
+void ApplePS2Controller::endInterruptStorm(int stream, bool enable)
+{
+    InterruptStorm& storm = _storm[stream];
+    if (!storm.polling)
+        return;
+    uint64_t now, duration;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - storm.pollStart, &duration);
+    storm.count = 0;
+    storm.windowStart = now;
+    if (storm.recorded)
+    {
+        PS2StormStats& stats = _stats->storm[stream];
+        stats.lastDuration = duration;
+        stats.polledTime += duration;
+        IOLog("%s: interrupt storm on %s stream over after %llu ms\n", getName(),
+              kPS2Stats_Aux == stream ? "mouse" : "keyboard", (unsigned long long)duration / 1000000);
+    }
+    storm.polling = false;
+    if (!enable)
+        return;
+
+    setStreamInterruptEnabled(stream, true);
+    // (edge triggered: data already waiting will not interrupt)
+    if (!_hardwareOffline && handleInterrupt(kDT_Keyboard, kInterruptStormBytes, true, 1 << stream))
+        startInterruptStorm(stream);
+}
+
+unsigned ApplePS2Controller::pollingStreams() const
+{
+    unsigned streams = 0;
+    for (int i = 0; i < kPS2Stats_StreamCount; i++)
+    {
+        if (_storm[i].polling)
+            streams |= 1 << i;
+    }
+    return streams;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-#if WATCHDOG_TIMER
+void ApplePS2Controller::armWatchdog(bool idle)
+{
+    // (also called from the device work loops; a lost race only re-arms
+    // the timer, which is harmless)
+    if (!_watchdogTimer || kWatchdogOff == _watchdogMode)
+        return;
+    // input shortens an idle arm
+    if (_watchdogArmed && (idle || !_watchdogIdle))
+        return;
+    _watchdogArmed = true;
+    _watchdogIdle = idle;
+    _watchdogTimer->setTimeoutMS(idle ? kWatchdogIdleInterval : kWatchdogTimerInterval);
+}
 
 void ApplePS2Controller::onWatchdogTimer()
 {
-    if (!_ignoreInterrupts)
+    _watchdogArmed = false;
+    ++_stats->watchdogFires;
+    if (_ignoreInterrupts || _hardwareOffline)
+    {
+        // adaptive watchdog: idle arm, until sleep (wake arms it again)
+        if (kWatchdogPeriodic == _watchdogMode)
+            armWatchdog();
+        else if (!_hardwareOffline)
+            armWatchdog(true);
+        return;
+    }
+    ++_watchdogChecks;
+
+    if (kWatchdogPeriodic == _watchdogMode)
+    {
+        handleInterrupt(kDT_Watchdog);
+        armWatchdog();
+        return;
+    }
+    if (kWatchdogAdaptive != _watchdogMode)
+        return;
+
+    // look for keyboard data waiting, without reading it
+    bool enable = ml_set_interrupts_enabled(false);
+    IODelay(kDataDelay);
+    UInt8 status = inb(kCommandPort);
+    ml_set_interrupts_enabled(enable);
+    bool pending = (status & (kOutputReady | kMouseData)) == kOutputReady;
+    UInt32 interrupts = _interruptCount;
+    bool active = interrupts != _watchdogInterrupts;
+
+    if (pending && _watchdogPending && !active)
+    {
+        // data waiting for a whole interval without an interrupt: lost interrupt
+        ++_watchdogRecovered;
+        IOLog("%s: recovered lost keyboard interrupt (%u)\n", getName(), (unsigned)_watchdogRecovered);
         handleInterrupt(kDT_Watchdog);
-    _watchdogTimer->setTimeoutMS(kWatchdogTimerInterval);
+        pending = false;
+        publishWatchdogStatistics();
+    }
+    _watchdogPending = pending;
+    _watchdogInterrupts = interrupts;
+
+    // keep watching closely only while input keeps coming, or data is waiting
+    if (active || pending)
+        armWatchdog();
+    else
+    {
+        if (!_watchdogIdle)
+            publishWatchdogStatistics();
+        armWatchdog(true);
+    }
 }
 
-#endif // WATCHDOG_TIMER
+void ApplePS2Controller::publishWatchdogStatistics()
+{
+    setProperty(kWatchdogChecks, _watchdogChecks, 32);
+    setProperty(kWatchdogRecovered, _watchdogRecovered, 32);
+}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-#if !HANDLE_INTERRUPT_DATA_LATER
-
-void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
+bool ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType, unsigned limit, bool wakeSelf, unsigned streams)
 {
     ////IOLog("%s:handleInterrupt(%s)\n", getName(), deviceType == kDT_Keyboard ? "kDT_Keyboard" : deviceType == kDT_Watchdog ? "kDT_Watchdog" : "kDT_Mouse");
 
-    // Loop only while there is data currently on the input stream.
+    // Loop only while there is data currently on the input stream, and for
+    // at most limit bytes (0: no limit).  Returns true if it stopped at limit.
+    // Without wakeSelf, the caller runs deviceType's packet action itself.
+    // Stops at the first byte of a stream not in streams (storm polling).
+    // Each byte is read and dispatched under _interruptLock: the interrupt
+    // handlers and the work loop callers (storm polling and its end,
+    // deferred mode, watchdog) can run at the same time on other CPUs, and a
+    // driver's interrupt action must see its bytes one at a time, in order.
     
     bool wakeMouse = false;
     bool wakeKeyboard = false;
+    bool limited = false;
+    unsigned count = 0;
     while (1)
     {
-        // while getting status and reading the port, no interrupts...
-        bool enable = ml_set_interrupts_enabled(false);
+        if (limit && count++ >= limit)
+        {
+            limited = true;
+            break;
+        }
+
+        // while getting status, reading the port and dispatching, no
+        // interrupts, and no other reader...
+        IOInterruptState state = IOSimpleLockLockDisableInterrupt(_interruptLock);
         IODelay(kDataDelay);
         UInt8 status = inb(kCommandPort);
         if (!(status & kOutputReady))
         {
             // no data available, so break out and return
-            ml_set_interrupts_enabled(enable);
+            IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
             break;
         }
         
-#if WATCHDOG_TIMER
         // do not process mouse data in watchdog timer
         if (deviceType == kDT_Watchdog && (status & kMouseData))
         {
-            ml_set_interrupts_enabled(enable);
+            IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+            break;
+        }
+        
+        // leave other streams' data to their interrupt handlers
+        if (!(streams & (1 << (status & kMouseData ? kPS2Stats_Aux : kPS2Stats_Keyboard))))
+        {
+            IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
             break;
         }
-#endif
         
         // read the data
         IODelay(kDataDelay);
         UInt8 data = inb(kDataPort);
         
-        // now ok for interrupts, we have read status, and found data...
-        // (it does not matter [too much] if keyboard data is delivered out of order)
-        ml_set_interrupts_enabled(enable);
-        
-#if WATCHDOG_TIMER
-        //REVIEW: remove this debug eventually...
-        if (deviceType == kDT_Watchdog)
-            IOLog("%s:handleInterrupt(kDT_Watchdog): %s = %02x\n", getName(), status & kMouseData ? "mouse" : "keyboard", data);
-#endif
         if (status & kMouseData)
         {
             // Dispatch the data to the mouse driver.
@@ -226,47 +662,23 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
             if (kPS2IR_packetReady == _dispatchDriverInterrupt(kDT_Keyboard, data))
                 wakeKeyboard = true;
         }
+        
+        // now ok for interrupts, the byte has been delivered
+        IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+        
+        if (deviceType == kDT_Watchdog)
+            DEBUG_LOG("%s:handleInterrupt(kDT_Watchdog): %s = %02x\n", getName(), status & kMouseData ? "mouse" : "keyboard", data);
     } // while (forever)
     
     // wake up workloop based mouse interrupt source if needed
-    if (wakeMouse)
+    if (wakeMouse && (wakeSelf || kDT_Mouse != deviceType))
         _interruptSourceMouse->interruptOccurred(0, 0, 0);
     // wake up workloop based keyboard interrupt source if needed
-    if (wakeKeyboard)
+    if (wakeKeyboard && (wakeSelf || kDT_Keyboard != deviceType))
         _interruptSourceKeyboard->interruptOccurred(0, 0, 0);
+    return limited;
 }
 
-#else // HANDLE_INTERRUPT_DATA_LATER
-
-void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
-{
-    ////IOLog("%s:handleInterrupt(%s)\n", getName(), deviceType == kDT_Keyboard ? "kDT_Keyboard" : deviceType == kDT_Watchdog ? "kDT_Watchdog" : "kDT_Mouse");
-    
-    // Loop only while there is data currently on the input stream.
-    
-    UInt8 status;
-    IODelay(kDataDelay);
-    while ((status = inb(kCommandPort)) & kOutputReady)
-    {
-#if WATCHDOG_TIMER
-        if (deviceType == kDT_Watchdog && (status & kMouseData))
-            break;
-#endif
-        
-        IODelay(kDataDelay);
-        UInt8 data = inb(kDataPort);
-#if WATCHDOG_TIMER
-        //REVIEW: remove this debug eventually...
-        if (deviceType == kDT_Watchdog)
-            IOLog("%s:handleInterrupt(kDT_Watchdog): %s = %02x\n", getName(), status & kMouseData ? "mouse" : "keyboard", data);
-#endif
-        dispatchDriverInterrupt(status & kMouseData ? kDT_Mouse : kDT_Keyboard, data);
-        IODelay(kDataDelay);
-    }
-}
-
-#endif // HANDLE_INTERRUPT_DATA_LATER
-
 // =============================================================================
 // ApplePS2Controller Class Implementation
 //
@@ -306,8 +718,14 @@ bool ApplePS2Controller::init(OSDictionary* dict)
   _cmdbyteLock = IOLockAlloc();
   if (!_cmdbyteLock)
       return false;
+  _interruptLock = IOSimpleLockAlloc();
+  if (!_interruptLock)
+      return false;
 
   _workLoop                = 0;
+  _workLoopKeyboard        = 0;
+  _workLoopMouse           = 0;
+  _deviceWorkLoops         = true;
 
   _interruptSourceKeyboard = 0;
   _interruptSourceMouse    = 0;
@@ -344,12 +762,51 @@ bool ApplePS2Controller::init(OSDictionary* dict)
     
   _requestQueueLock = 0;
 
-#if WATCHDOG_TIMER
   _watchdogTimer = 0;
-#endif
+  _watchdogMode = kWatchdogAdaptive;
+  _watchdogArmed = false;
+  _watchdogIdle = false;
+  _watchdogPending = false;
+  _watchdogInterrupts = 0;
+  _watchdogChecks = 0;
+  _watchdogRecovered = 0;
+  _interruptCount = 0;
+  bzero(_storm, sizeof(_storm));
+  _storm[kPS2Stats_Keyboard].limit = 2000;
+  _storm[kPS2Stats_Aux].limit = 4000;
+  nanoseconds_to_absolutetime(kInterruptStormWindow * 1000000ULL, &_stormWindow);
+  _stormSource = 0;
+  _stormTimer = 0;
+  _interruptModeConfig = kInterruptImmediate;
+  _interruptMode = kInterruptImmediate;
+  _outOfOrderCorrection = true;
+  _deferredPending[kPS2Stats_Keyboard] = false;
+  _deferredPending[kPS2Stats_Aux] = false;
+  _interruptStamp[kPS2Stats_Keyboard] = 0;
+  _interruptStamp[kPS2Stats_Aux] = 0;
+  _autoState = 0;
+  _handlersActive = 0;
+  _autoSamples = 0;
+  _autoTime = 0;
   _rmcfCache = 0;
+  _rmcfResolved = false;
+  _platformManufacturer = 0;
+  _platformProduct = 0;
+  _platformResolved = false;
+  _configCache = 0;
+  _configLoadTimes = 0;
+  _identifyAux = true;
+  _statsMemory = 0;
+  initStatistics(&_statsFallback);
+  _stats = &_statsFallback;
+
     
   queue_init(&_requestQueue);
+  queue_init(&_requestPool);
+  queue_init(&_completionQueueKeyboard);
+  queue_init(&_completionQueueMouse);
+  _completionSourceKeyboard = 0;
+  _completionSourceMouse = 0;
 
   _currentPowerState = kPS2PowerStateNormal;
   
@@ -396,6 +853,11 @@ void ApplePS2Controller::free(void)
         IOLockFree(_cmdbyteLock);
         _cmdbyteLock = 0;
     }
+    if (_interruptLock)
+    {
+        IOSimpleLockFree(_interruptLock);
+        _interruptLock = 0;
+    }
 #if DEBUGGER_SUPPORT
     if (_controllerLock)
     {
@@ -426,6 +888,64 @@ IOReturn ApplePS2Controller::setPropertiesGated(OSObject* props)
         _mouseWakeFirst = flag->isTrue();
         setProperty("MouseWakeFirst", _mouseWakeFirst);
     }
+    // get deviceWorkLoops (only used at start)
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject(kDeviceWorkLoops)))
+    {
+        _deviceWorkLoops = flag->isTrue();
+        setProperty(kDeviceWorkLoops, _deviceWorkLoops);
+    }
+    // get identifyAux (only used at start)
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("IdentifyAuxDevice")))
+    {
+        _identifyAux = flag->isTrue();
+        setProperty("IdentifyAuxDevice", _identifyAux);
+    }
+    // get watchdog mode (can be changed at runtime)
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kWatchdogMode)))
+    {
+        UInt32 mode = num->unsigned32BitValue();
+        if (mode > kWatchdogPeriodic)
+            IOLog("%s: %s %u not valid, ignored\n", getName(), kWatchdogMode, (unsigned)mode);
+        else
+        {
+            _watchdogMode = mode;
+            if (_watchdogTimer)
+            {
+                _watchdogTimer->cancelTimeout();
+                _watchdogArmed = false;
+                _watchdogPending = false;
+                armWatchdog(kWatchdogAdaptive == _watchdogMode);
+            }
+        }
+        setProperty(kWatchdogMode, _watchdogMode, 32);
+    }
+    // get interrupt handling mode (can be changed at runtime)
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kInterruptMode)))
+    {
+        if (setInterruptMode((int)num->unsigned32BitValue()))
+            setProperty(kInterruptMode, _interruptModeConfig, 32);
+    }
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject(kOutOfOrderCorrection)))
+    {
+        _outOfOrderCorrection = flag->isTrue();
+        setProperty(kOutOfOrderCorrection, _outOfOrderCorrection);
+    }
+    // get interrupt storm limits (can be changed at runtime, 0 is off, and
+    // ends a storm in progress: nothing would end it otherwise)
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kInterruptStormLimitKeyboard)))
+    {
+        _storm[kPS2Stats_Keyboard].limit = num->unsigned32BitValue();
+        setProperty(kInterruptStormLimitKeyboard, _storm[kPS2Stats_Keyboard].limit, 32);
+        if (!_storm[kPS2Stats_Keyboard].limit)
+            endInterruptStorm(kPS2Stats_Keyboard, true);
+    }
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kInterruptStormLimitMouse)))
+    {
+        _storm[kPS2Stats_Aux].limit = num->unsigned32BitValue();
+        setProperty(kInterruptStormLimitMouse, _storm[kPS2Stats_Aux].limit, 32);
+        if (!_storm[kPS2Stats_Aux].limit)
+            endInterruptStorm(kPS2Stats_Aux, true);
+    }
     return kIOReturnSuccess;
 }
 
@@ -592,36 +1112,80 @@ bool ApplePS2Controller::start(IOService * provider)
   _requestQueueLock = IOLockAlloc();
   if (!_requestQueueLock) goto fail;
 
+  //
+  // Counters shared read only with ApplePS2StatisticsUserClient.  Without
+  // the shared block, counting still works (in _statsFallback), there is
+  // just nothing to map.
+  //
+
+  _statsMemory = IOBufferMemoryDescriptor::withOptions(kIODirectionOutIn | kIOMemoryKernelUserShared, round_page(sizeof(PS2Statistics)), page_size);
+  if (_statsMemory)
+  {
+    _stats = (PS2Statistics*)_statsMemory->getBytesNoCopy();
+    initStatistics(_stats);
+  }
+  _stats->interruptMode = _interruptMode;
+  publishInterruptMode();
+
+  //
+  // Fill the request pool, so requests made at runtime (LEDs, mode changes)
+  // do not go to the allocator.  allocateRequest allocates when it is empty.
+  //
+
+  for (int i = 0; i < kPS2RequestPoolSize; i++)
+  {
+    PS2Request* request = new(kMaxCommands) PS2Request;
+    if (!request)
+      break;
+    request->requestFlags = kPS2RF_Pooled;
+    queue_enter(&_requestPool, request, PS2Request *, chain);
+  }
+
   //
   // Initialize our work loop, our command gate, and our interrupt event
   // sources.  The work loop can accept requests after this step.
   //
 
   _workLoop                = IOWorkLoop::workLoop();
-#if HANDLE_INTERRUPT_DATA_LATER
-  _interruptSourceMouse    = IOInterruptEventSource::interruptEventSource( this,
-	OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::interruptOccurred));
-  _interruptSourceKeyboard = IOInterruptEventSource::interruptEventSource( this,
-    OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::interruptOccurred));
-#else
+  // (with kInterruptDeferred, packetReady reads the ports inside the
+  // controller's gate, so separate work loops are fine for both modes)
+  if (_deviceWorkLoops)
+  {
+    _workLoopKeyboard      = IOWorkLoop::workLoop();
+    _workLoopMouse         = IOWorkLoop::workLoop();
+    if (!_workLoopKeyboard || !_workLoopMouse)
+    {
+      IOLog("%s: unable to create device work loops, sharing the controller's\n", getName());
+      OSSafeReleaseNULL(_workLoopKeyboard);
+      OSSafeReleaseNULL(_workLoopMouse);
+    }
+  }
   _interruptSourceMouse    = IOInterruptEventSource::interruptEventSource( this,
     OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::packetReadyMouse));
   _interruptSourceKeyboard = IOInterruptEventSource::interruptEventSource( this,
     OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::packetReadyKeyboard));
-#endif
   _interruptSourceQueue    = IOInterruptEventSource::interruptEventSource( this,
 			OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::processRequestQueue));
+  _completionSourceKeyboard = IOInterruptEventSource::interruptEventSource( this,
+			OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::processCompletionQueue));
+  _completionSourceMouse   = IOInterruptEventSource::interruptEventSource( this,
+			OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::processCompletionQueue));
   _cmdGate = IOCommandGate::commandGate(this);
-#if WATCHDOG_TIMER
   _watchdogTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onWatchdogTimer));
   if (!_watchdogTimer)
     goto fail;
-#endif
+  _stormSource = IOInterruptEventSource::interruptEventSource(this,
+            OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::onInterruptStorm));
+  _stormTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onStormPollTimer));
+  if (!_stormSource || !_stormTimer)
+    goto fail;
     
   if ( !_workLoop                ||
        !_interruptSourceMouse    ||
        !_interruptSourceKeyboard ||
        !_interruptSourceQueue    ||
+       !_completionSourceKeyboard ||
+       !_completionSourceMouse   ||
        !_cmdGate)  goto fail;
 
   if ( _workLoop->addEventSource(_interruptSourceQueue) != kIOReturnSuccess )
@@ -629,13 +1193,27 @@ bool ApplePS2Controller::start(IOService * provider)
   if ( _workLoop->addEventSource(_cmdGate) != kIOReturnSuccess )
     goto fail;
     
-#if WATCHDOG_TIMER
   if ( _workLoop->addEventSource(_watchdogTimer) != kIOReturnSuccess )
     goto fail;
-  _watchdogTimer->setTimeoutMS(kWatchdogTimerInterval);
-#endif
+  // adaptive watchdog is armed by input (packetReadyKeyboard/Mouse), and
+  // idle until then
+  armWatchdog(kWatchdogAdaptive == _watchdogMode);
   _interruptSourceQueue->enable();
 
+  if ( _workLoop->addEventSource(_stormSource) != kIOReturnSuccess )
+    goto fail;
+  if ( _workLoop->addEventSource(_stormTimer) != kIOReturnSuccess )
+    goto fail;
+  _stormSource->enable();
+
+  // async request completions run on the work loop of the submitting device
+  if ( getDeviceWorkLoop(kDT_Keyboard)->addEventSource(_completionSourceKeyboard) != kIOReturnSuccess )
+    goto fail;
+  if ( getDeviceWorkLoop(kDT_Mouse)->addEventSource(_completionSourceMouse) != kIOReturnSuccess )
+    goto fail;
+  _completionSourceKeyboard->enable();
+  _completionSourceMouse->enable();
+
   //
   // Since there is a calling path from the PS/2 driver stack to power
   // management for activity tickles.  We must create a thread callout
@@ -688,10 +1266,20 @@ bool ApplePS2Controller::start(IOService * provider)
 	  OSSafeReleaseNULL(_interruptSourceMouse);
   }
 	   
+  // the keyboard does not wait for the aux device to be identified
   if (_keyboardDevice)
 	_keyboardDevice->registerService();
+
+  // identify the aux device once, for all the pointing drivers' probe (and
+  // the trackpad personalities' IOPropertyMatch on kAuxVendor)
   if (_mouseDevice)
+  {
+    if (_identifyAux)
+      identifyAuxDevice(_mouseDevice);
+    else
+      _mouseDevice->setProperty(kAuxVendor, auxVendorName(kPS2Aux_Unknown));
 	_mouseDevice->registerService();
+  }
     
   registerService();
 
@@ -705,6 +1293,151 @@ fail:
   return false;
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Aux device identification (see PS2AuxIdentity.h)
+//
+
+static const UInt8 synapticsIdentifyKnock[] =
+{
+    kDP_SetDefaultsAndDisable,
+    kDP_SetMouseResolution, 0, kDP_SetMouseResolution, 0,
+    kDP_SetMouseResolution, 0, kDP_SetMouseResolution, 0,
+};
+static const UInt8 synapticsCapabilitiesKnock[] =
+{
+    kDP_SetDefaultsAndDisable,
+    kDP_SetMouseResolution, 0, kDP_SetMouseResolution, 0,
+    kDP_SetMouseResolution, 0, kDP_SetMouseResolution, 2,
+};
+// Sentelic register read of the device ID register (0x00), after 0x66 0x88
+// (see readSentelicId)
+static const UInt8 sentelicIdKnock[] = { kDP_SetMouseSampleRate, 0x66, 0x00 };
+static const UInt8 alpsE6Knock[] = { kDP_SetMouseResolution, 0, kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1 };
+static const UInt8 alpsE7Knock[] = { kDP_SetMouseResolution, 0, kDP_SetMouseScaling2To1, kDP_SetMouseScaling2To1, kDP_SetMouseScaling2To1 };
+static const UInt8 alpsECKnock[] = { kDP_SetMouseResolution, 0, kDP_ResetMouseWrapMode, kDP_ResetMouseWrapMode, kDP_ResetMouseWrapMode };
+
+bool ApplePS2Controller::readAuxReport(const UInt8* knock, UInt8 count, UInt8 report[3])
+{
+    // knock, then GetMouseInformation and its three bytes
+    TPS2Request<5> request;
+    request.addMouseBytes(0, knock, count);
+    request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut = kDP_GetMouseInformation;
+    for (int i = 2; i < 5; i++)
+    {
+        request.commands[i].command = kPS2C_ReadDataPort;
+        request.commands[i].inOrOut = 0;
+    }
+    request.commandsCount = 5;
+    submitRequestAndBlock(&request);
+    if (5 != request.commandsCount)
+        return false;
+    for (int i = 0; i < 3; i++)
+        report[i] = request.commands[2+i].inOrOut;
+    return true;
+}
+
+bool ApplePS2Controller::readSentelicId(UInt8 report[3])
+{
+    // F3, then 0x66 and 0x88, which the device need not acknowledge (sent
+    // and their response read, as the Sentelic driver does), then the
+    // register read as any other knock
+    TPS2Request<7> request;
+    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[0].inOrOut = kDP_SetMouseSampleRate;
+    request.commands[1].command = kPS2C_WriteCommandPort;
+    request.commands[1].inOrOut = kCP_TransmitToMouse;
+    request.commands[2].command = kPS2C_WriteDataPort;
+    request.commands[2].inOrOut = 0x66;
+    request.commands[3].command = kPS2C_ReadDataPort;
+    request.commands[3].inOrOut = 0;
+    request.commands[4].command = kPS2C_WriteCommandPort;
+    request.commands[4].inOrOut = kCP_TransmitToMouse;
+    request.commands[5].command = kPS2C_WriteDataPort;
+    request.commands[5].inOrOut = 0x88;
+    request.commands[6].command = kPS2C_ReadDataPort;
+    request.commands[6].inOrOut = 0;
+    request.commandsCount = 7;
+    submitRequestAndBlock(&request);
+    if (7 != request.commandsCount)
+        return false;
+    return readAuxReport(sentelicIdKnock, sizeof(sentelicIdKnock), report);
+}
+
+void ApplePS2Controller::identifyAuxDevice(ApplePS2MouseDevice* device)
+{
+    uint64_t start_abs, end_abs, time;
+    clock_get_uptime(&start_abs);
+
+    PS2AuxIdentity identity;
+    bzero(&identity, sizeof(identity));
+    UInt8 report[3];
+    ALPSProtocolInfo alps;
+
+    if (!readAuxReport(synapticsIdentifyKnock, sizeof(synapticsIdentifyKnock), identity.synaptics))
+    {
+        // not even the first knock was acknowledged
+        identity.vendor = kPS2Aux_None;
+    }
+    else if (0x47 == identity.synaptics[1] || 0x46 == identity.synaptics[1])
+    {
+        identity.vendor = kPS2Aux_Synaptics;
+        identity.version = (identity.synaptics[2] & 0x0f) << 8 | identity.synaptics[0];
+        if (readAuxReport(synapticsCapabilitiesKnock, sizeof(synapticsCapabilitiesKnock), report))
+            identity.capabilities = report[0] << 16 | report[1] << 8 | report[2];
+    }
+    else if (readSentelicId(report) && 0x01 == report[2])
+    {
+        identity.vendor = kPS2Aux_Sentelic;
+    }
+    else
+    {
+        identity.vendor = kPS2Aux_Generic;
+        if (readAuxReport(alpsE6Knock, sizeof(alpsE6Knock), identity.e6) &&
+            readAuxReport(alpsE7Knock, sizeof(alpsE7Knock), identity.e7))
+        {
+            // EC report: response to entering command mode, then leave it
+            readAuxReport(alpsECKnock, sizeof(alpsECKnock), identity.ec);
+            TPS2Request<1> request;
+            request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+            request.commands[0].inOrOut = kDP_SetMouseStreamMode;
+            request.commandsCount = 1;
+            submitRequestAndBlock(&request);
+            if (identifyALPS(identity.e6, identity.e7, identity.ec, &alps))
+            {
+                identity.vendor = kPS2Aux_ALPS;
+                identity.version = alps.proto;
+                identity.capabilities = alps.flags;
+            }
+        }
+    }
+
+    // leave the device as the drivers expect it at probe: disabled
+    // (publishing the identity does not depend on it, so overlap the two)
+    TPS2Request<1> request;
+    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[0].inOrOut = kDP_SetDefaultsAndDisable;
+    request.commandsCount = 1;
+    submitRequestFuture(&request);
+
+    OSData* data = OSData::withBytes(&identity, sizeof(identity));
+    if (data)
+    {
+        device->setProperty(kAuxIdentity, data);
+        data->release();
+    }
+    device->setProperty(kAuxVendor, auxVendorName(identity.vendor));
+    device->setProperty(kAuxVersion, identity.version, 32);
+    device->setProperty(kAuxCapabilities, identity.capabilities, 32);
+
+    waitRequest(&request);
+    clock_get_uptime(&end_abs);
+    absolutetime_to_nanoseconds(end_abs - start_abs, &time);
+    device->setProperty(kAuxIdentifyTime, time, 64);
+    IOLog("%s: aux device is %s (version 0x%x, capabilities 0x%x), identified in %llu us\n", getName(),
+          auxVendorName(identity.vendor), identity.version, (unsigned)identity.capabilities, time / 1000);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Controller::stop(IOService * provider)
@@ -734,30 +1467,78 @@ void ApplePS2Controller::stop(IOService * provider)
   OSSafeReleaseNULL(_keyboardDevice);
   OSSafeReleaseNULL(_mouseDevice);
 
+  // Empty out the request queue.  Completions still left are delivered
+  // on their device's work loop, like any other, before the completion
+  // sources go away.
+  if (_requestQueueLock)
+  {
+    _hardwareOffline = true;
+    processRequestQueue(0, 0);
+    drainCompletions(_completionSourceKeyboard, &_completionQueueKeyboard);
+    drainCompletions(_completionSourceMouse, &_completionQueueMouse);
+  }
+
   // Free the event/interrupt sources.
   OSSafeReleaseNULL(_interruptSourceKeyboard);
   OSSafeReleaseNULL(_interruptSourceMouse);
   OSSafeReleaseNULL(_interruptSourceQueue);
+  if (_completionSourceKeyboard && _completionSourceKeyboard->getWorkLoop())
+    _completionSourceKeyboard->getWorkLoop()->removeEventSource(_completionSourceKeyboard);
+  if (_completionSourceMouse && _completionSourceMouse->getWorkLoop())
+    _completionSourceMouse->getWorkLoop()->removeEventSource(_completionSourceMouse);
+  OSSafeReleaseNULL(_completionSourceKeyboard);
+  OSSafeReleaseNULL(_completionSourceMouse);
   OSSafeReleaseNULL(_cmdGate);
-#if WATCHDOG_TIMER
+  if (_watchdogTimer)
+  {
+    _watchdogTimer->cancelTimeout();
+    if (_workLoop)
+      _workLoop->removeEventSource(_watchdogTimer);
+    _watchdogArmed = false;
+  }
   OSSafeReleaseNULL(_watchdogTimer);
-#endif
+  if (_stormTimer)
+  {
+    _stormTimer->cancelTimeout();
+    if (_workLoop)
+      _workLoop->removeEventSource(_stormTimer);
+  }
+  if (_stormSource && _workLoop)
+    _workLoop->removeEventSource(_stormSource);
+  OSSafeReleaseNULL(_stormTimer);
+  OSSafeReleaseNULL(_stormSource);
     
-  // Free the work loop.
+  // Free the work loops.
+  OSSafeReleaseNULL(_workLoopKeyboard);
+  OSSafeReleaseNULL(_workLoopMouse);
   OSSafeReleaseNULL(_workLoop);
 
-  // Free the RMCF configuration cache
+  // Free the RMCF configuration cache, platform identity and merged configurations
   OSSafeReleaseNULL(_rmcfCache);
+  OSSafeReleaseNULL(_platformManufacturer);
+  OSSafeReleaseNULL(_platformProduct);
+  OSSafeReleaseNULL(_configCache);
+  OSSafeReleaseNULL(_configLoadTimes);
 
-  // Free the request queue lock and empty out the request queue.
+  // Drivers are gone, so nothing counts into the shared block any more
+  _stats = &_statsFallback;
+  OSSafeReleaseNULL(_statsMemory);
+
+  // Free the request queue lock (the queues were emptied above).
   if (_requestQueueLock)
   {
-    _hardwareOffline = true;
-    processRequestQueue(0, 0);
     IOLockFree(_requestQueueLock);
     _requestQueueLock = 0;
   }
 
+  // Free the request pool; all pooled requests are back by now.
+  while (!queue_empty(&_requestPool))
+  {
+    PS2Request* request;
+    queue_remove_first(&_requestPool, request, PS2Request *, chain);
+    delete request;
+  }
+
   // Free the power management thread call.
   if (_powerChangeThreadCall)
   {
@@ -787,6 +1568,12 @@ IOWorkLoop * ApplePS2Controller::getWorkLoop() const
     return _workLoop;
 }
 
+IOWorkLoop * ApplePS2Controller::getDeviceWorkLoop(PS2DeviceType deviceType) const
+{
+    IOWorkLoop* workLoop = kDT_Mouse == deviceType ? _workLoopMouse : _workLoopKeyboard;
+    return workLoop ? workLoop : _workLoop;
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Controller::installInterruptAction(PS2DeviceType      deviceType,
@@ -811,7 +1598,9 @@ void ApplePS2Controller::installInterruptAction(PS2DeviceType      deviceType,
     _interruptTargetKeyboard = target;
     _interruptActionKeyboard = interruptAction;
     _packetActionKeyboard = packetAction;
-    _workLoop->addEventSource(_interruptSourceKeyboard);
+    _storm[kPS2Stats_Keyboard].polling = false;
+    _storm[kPS2Stats_Keyboard].count = 0;
+    getDeviceWorkLoop(kDT_Keyboard)->addEventSource(_interruptSourceKeyboard);
     DEBUG_LOG("%s: setCommandByte for keyboard interrupt install\n", getName());
     setCommandByte(kCB_EnableKeyboardIRQ, 0);
 #ifdef NEWIRQ
@@ -834,7 +1623,9 @@ void ApplePS2Controller::installInterruptAction(PS2DeviceType      deviceType,
     _interruptTargetMouse = target;
     _interruptActionMouse = interruptAction;
     _packetActionMouse = packetAction;
-    _workLoop->addEventSource(_interruptSourceMouse);
+    _storm[kPS2Stats_Aux].polling = false;
+    _storm[kPS2Stats_Aux].count = 0;
+    getDeviceWorkLoop(kDT_Mouse)->addEventSource(_interruptSourceMouse);
     DEBUG_LOG("%s: setCommandByte for mouse interrupt install\n", getName());
     setCommandByte(kCB_EnableMouseIRQ, 0);
 #ifdef NEWIRQ
@@ -870,6 +1661,7 @@ void ApplePS2Controller::uninstallInterruptAction(PS2DeviceType deviceType)
 
   if (deviceType == kDT_Keyboard && _interruptInstalledKeyboard)
   {
+    endInterruptStorm(kPS2Stats_Keyboard, false);
     setCommandByte(0, kCB_EnableKeyboardIRQ);
 #ifdef NEWIRQ
     getProvider()->disableInterrupt(0);
@@ -878,7 +1670,7 @@ void ApplePS2Controller::uninstallInterruptAction(PS2DeviceType deviceType)
     getProvider()->disableInterrupt(kIRQ_Keyboard);
     getProvider()->unregisterInterrupt(kIRQ_Keyboard);
 #endif
-    _workLoop->removeEventSource(_interruptSourceKeyboard);
+    getDeviceWorkLoop(kDT_Keyboard)->removeEventSource(_interruptSourceKeyboard);
     _interruptInstalledKeyboard = false;
     _interruptActionKeyboard = NULL;
     _packetActionKeyboard = NULL;
@@ -888,6 +1680,7 @@ void ApplePS2Controller::uninstallInterruptAction(PS2DeviceType deviceType)
 
   else if (deviceType == kDT_Mouse && _interruptInstalledMouse)
   {
+    endInterruptStorm(kPS2Stats_Aux, false);
     setCommandByte(0, kCB_EnableMouseIRQ);
 #ifdef NEWIRQ
     getProvider()->disableInterrupt(1);
@@ -896,7 +1689,7 @@ void ApplePS2Controller::uninstallInterruptAction(PS2DeviceType deviceType)
     getProvider()->disableInterrupt(kIRQ_Mouse);
     getProvider()->unregisterInterrupt(kIRQ_Mouse);
 #endif
-    _workLoop->removeEventSource(_interruptSourceMouse);
+    getDeviceWorkLoop(kDT_Mouse)->removeEventSource(_interruptSourceMouse);
     _interruptInstalledMouse = false;
     _interruptActionMouse = NULL;
     _packetActionMouse = NULL;
@@ -913,8 +1706,23 @@ PS2Request * ApplePS2Controller::allocateRequest(int max)
   // Allocate a request structure.  Blocks until successful.
   // Most of request structure is guaranteed to be zeroed.
   //
+  // Requests that fit kMaxCommands come from the pool when it has one.
+  //
     
   assert(max > 0);
+
+  if (max <= kMaxCommands && _requestQueueLock)
+  {
+    PS2Request* request = 0;
+    IOLockLock(_requestQueueLock);
+    if (!queue_empty(&_requestPool))
+      queue_remove_first(&_requestPool, request, PS2Request *, chain);
+    else
+      ++_stats->requestPoolMisses;
+    IOLockUnlock(_requestQueueLock);
+    if (request)
+      return request;
+  }
     
   return new(max) PS2Request;
 }
@@ -922,9 +1730,14 @@ PS2Request * ApplePS2Controller::allocateRequest(int max)
 EXPORT PS2Request::PS2Request()
 {
   commandsCount = 0;
+  commandsSubmitted = 0;
+  requestFlags = 0;
+  requestDevice = 0;
   completionTarget = 0;
   completionAction = 0;
   completionParam = 0;
+  requestAction = 0;
+  sequenceBytesUsed = 0;
 
 #ifdef DEBUG
   // These items do not need to be initialized, but it might make it easier to
@@ -939,9 +1752,25 @@ EXPORT PS2Request::PS2Request()
 void ApplePS2Controller::freeRequest(PS2Request * request)
 {
   //
-  // Deallocate a request structure.
+  // Deallocate a request structure.  Pooled requests are reset and go back
+  // to the pool.
   //
 
+  if (request->requestFlags & kPS2RF_Pooled)
+  {
+    request->commandsCount = 0;
+    request->requestFlags = kPS2RF_Pooled;
+    request->completionTarget = 0;
+    request->completionAction = 0;
+    request->completionParam = 0;
+    request->requestAction = 0;
+    request->sequenceBytesUsed = 0;
+    IOLockLock(_requestQueueLock);
+    queue_enter(&_requestPool, request, PS2Request *, chain);
+    IOLockUnlock(_requestQueueLock);
+    return;
+  }
+
   delete request;
 }
 
@@ -980,115 +1809,225 @@ void ApplePS2Controller::setCommandByteGated(PS2Request* request)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-bool ApplePS2Controller::submitRequest(PS2Request * request)
+bool ApplePS2Controller::submitRequest(PS2Request * request)
+{
+  //
+  // Submit the request to the controller for processing, asynchronously.
+  //
+
+  IOLockLock(_requestQueueLock);
+  queue_enter(&_requestQueue, request, PS2Request *, chain);
+  ++_stats->requests;
+  if (++_stats->requestQueueDepth > _stats->requestQueueHighWater)
+    _stats->requestQueueHighWater = _stats->requestQueueDepth;
+  IOLockUnlock(_requestQueueLock);
+
+  _interruptSourceQueue->interruptOccurred(0, 0, 0);
+
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::submitRequestAndBlock(PS2Request * request)
+{
+    uint64_t start, end, time;
+    clock_get_uptime(&start);
+    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::submitRequestAndBlockGated), request);
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - start, &time);
+
+    // (racy between callers, but close enough for statistics)
+    ++_stats->blockingRequests;
+    _stats->blockingTime += time;
+    if (time > _stats->blockingTimeMax)
+        _stats->blockingTimeMax = time;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::submitRequestAndBlockGated(PS2Request* request)
+{
+    processRequestQueue(0, 0);
+    processRequest(request);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::submitRequestAsync(PS2DeviceType deviceType, PS2Request* request, OSObject* target, PS2RequestAction action, void* param)
+{
+  //
+  // Submit the request without waiting.  When it has been processed, action
+  // is called with target on the work loop of deviceType (see
+  // processCompletionQueue), and the request is freed after it returns.
+  // target is retained until then.
+  //
+
+  request->requestFlags |= kPS2RF_Async;
+  request->requestDevice = deviceType;
+  request->completionTarget = target;
+  request->completionAction = 0;
+  request->completionParam = param;
+  request->requestAction = action;
+  if (target)
+    target->retain();
+
+  return submitRequest(request);
+}
+
+bool ApplePS2Controller::submitRequestFuture(PS2Request* request)
 {
   //
-  // Submit the request to the controller for processing, asynchronously.
+  // Submit the request without waiting; waitRequest collects it later.  The
+  // caller owns the request (stack or allocateRequest) until then.
   //
 
-  IOLockLock(_requestQueueLock);
-  queue_enter(&_requestQueue, request, PS2Request *, chain);
-  IOLockUnlock(_requestQueueLock);
-
-  _interruptSourceQueue->interruptOccurred(0, 0, 0);
+  request->requestFlags = (request->requestFlags | kPS2RF_Future) & ~kPS2RF_Done;
 
-  return true;
+  return submitRequest(request);
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-void ApplePS2Controller::submitRequestAndBlock(PS2Request * request)
+void ApplePS2Controller::waitRequest(PS2Request* request)
 {
-    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::submitRequestAndBlockGated), request);
-}
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //
+  // Wait for a request submitted with submitRequestFuture.  Called inside the
+  // controller's gate, the queue cannot be processed by anyone else, so it is
+  // processed right here instead of sleeping.
+  //
 
-void ApplePS2Controller::submitRequestAndBlockGated(PS2Request* request)
-{
+  if (_workLoop->inGate())
     processRequestQueue(0, 0);
-    processRequest(request);
+
+  IOLockLock(_requestQueueLock);
+  while (!(request->requestFlags & kPS2RF_Done))
+    IOLockSleep(_requestQueueLock, request, THREAD_UNINT);
+  IOLockUnlock(_requestQueueLock);
+  request->requestFlags &= ~(kPS2RF_Future | kPS2RF_Done);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-#if HANDLE_INTERRUPT_DATA_LATER
-void ApplePS2Controller::interruptOccurred(IOInterruptEventSource* source, int)
-{                                                      // IOInterruptEventAction
-  //
-  // Our work loop has informed us of an interrupt, that is, asynchronous
-  // data has arrived on our input stream.  Read the data and dispatch it
-  // to the appropriate driver.
+void ApplePS2Controller::completeRequestAsync(PS2Request* request)
+{
   //
-  // This method should only be called from our single-threaded work loop.
+  // An async request has been processed (controller work loop).  Hand it to
+  // the completion source on the device's work loop, so the driver's action
+  // runs there, in the driver's own gate, without holding ours.
   //
 
-  if (_hardwareOffline)
+  if (!request->requestAction)
   {
-    // Toss any asynchronous data received. The interrupt event source may
-    // have been signalled before the PS/2 port was offline.
+    OSObject* target = (OSObject*)request->completionTarget;
+    OSSafeReleaseNULL(target);
+    freeRequest(request);
     return;
   }
 
-#if DEBUGGER_SUPPORT
-  UInt8 status;
-  int state;
-  lockController(&state);              // (lock out interrupt + access to queue)
-  while (1)
-  {
-    // See if data is available on the keyboard input stream (off queue);
-    // we do not read keyboard data from the real data port if it should
-    // be available. 
+  bool mouse = kDT_Mouse == request->requestDevice;
+  IOInterruptEventSource* source = mouse ? _completionSourceMouse : _completionSourceKeyboard;
+  IOLockLock(_requestQueueLock);
+  queue_enter(mouse ? &_completionQueueMouse : &_completionQueueKeyboard, request, PS2Request *, chain);
+  IOLockUnlock(_requestQueueLock);
+  if (source)
+    source->interruptOccurred(0, 0, 0);
+}
 
-    if (dequeueKeyboardData(&status))
-    {
-      unlockController(state);
-      dispatchDriverInterrupt(kDT_Keyboard, status);
-      lockController(&state);
-    }
+void ApplePS2Controller::processCompletionQueue(IOInterruptEventSource* source, int)
+{                                                      // IOInterruptEventAction
+  runCompletions(source == _completionSourceMouse ? &_completionQueueMouse : &_completionQueueKeyboard);
+}
 
-    // See if data is available on the mouse input stream (off real port).
+IOReturn ApplePS2Controller::runCompletionsAction(OSObject* target, void* queue, void*, void*, void*)
+{                                                      // IOWorkLoop::Action
+  ((ApplePS2Controller*)target)->runCompletions((queue_head_t*)queue);
+  return kIOReturnSuccess;
+}
 
-    else if ( (inb(kCommandPort) & (kOutputReady | kMouseData)) ==
-                                   (kOutputReady | kMouseData))
-    {
-      unlockController(state);
-      IODelay(kDataDelay);
-      dispatchDriverInterrupt(kDT_Mouse, inb(kDataPort));
-      lockController(&state);
-    }
-    else break; // out of loop
+void ApplePS2Controller::drainCompletions(IOInterruptEventSource* source, queue_head_t* queue)
+{
+  //
+  // Deliver whatever is left in queue through the work loop of its
+  // completion source, so actions see the same gate as in
+  // processCompletionQueue.  Used by stop, before the sources are removed.
+  //
+
+  IOWorkLoop* workLoop = source ? source->getWorkLoop() : 0;
+  if (workLoop)
+    workLoop->runAction(runCompletionsAction, this, queue);
+  else
+    runCompletions(queue);
+}
+
+void ApplePS2Controller::runCompletions(queue_head_t* queue)
+{
+  queue_head_t localQueue;
+
+  // Transfer completed requests to a local queue.
+
+  IOLockLock(_requestQueueLock);
+  if (!queue_empty(queue))
+  {
+    queue_assign(&localQueue, queue, PS2Request *, chain);
+    queue_init(queue);
+  }
+  else queue_init(&localQueue);
+  IOLockUnlock(_requestQueueLock);
+
+  // Deliver each completion in order.
+
+  while (!queue_empty(&localQueue))
+  {
+    PS2Request* request;
+    queue_remove_first(&localQueue, request, PS2Request *, chain);
+    OSObject* target = (OSObject*)request->completionTarget;
+    (*request->requestAction)(target, request, request->completionParam);
+    ++_stats->asyncCompletions;
+    OSSafeReleaseNULL(target);
+    freeRequest(request);
   }
-  unlockController(state);      // (release interrupt lockout + access to queue)
-#else
-  handleInterrupt(source == _interruptSourceKeyboard ? kDT_Keyboard : kDT_Mouse);
-#endif // DEBUGGER_SUPPORT
 }
-#endif // HANDLE_INTERRUPT_DATA_LATER
 
-#if !HANDLE_INTERRUPT_DATA_LATER
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::packetReadyKeyboard(IOInterruptEventSource *, int)
 {
+    noteWakeLatency(kPS2Stats_Keyboard);
+    // kInterruptDeferred: the interrupt handler left the data for us to read
+    if (_deferredPending[kPS2Stats_Keyboard])
+    {
+        _deferredPending[kPS2Stats_Keyboard] = false;
+        readInterruptData(kDT_Keyboard);
+    }
     // a complete packet has arrived for the keyboard and has signaled the workloop
     // -- dispatch it to the installed keyboard packet handler
+    // (when deferred, there may be none yet, which the handler is fine with)
     if (_interruptInstalledKeyboard)
         (*_packetActionKeyboard)(_interruptTargetKeyboard);
+    armWatchdog();
 }
 
 void ApplePS2Controller::packetReadyMouse(IOInterruptEventSource *, int)
 {
+    noteWakeLatency(kPS2Stats_Aux);
+    // kInterruptDeferred: the interrupt handler left the data for us to read
+    if (_deferredPending[kPS2Stats_Aux])
+    {
+        _deferredPending[kPS2Stats_Aux] = false;
+        readInterruptData(kDT_Mouse);
+    }
     // a complete packet has arrived for the mouse and has signaled the workloop
     // -- dispatch it to the installed mouse packet handler
     if (_interruptInstalledMouse)
         (*_packetActionMouse)(_interruptTargetMouse);
+    armWatchdog();
 }
-#endif // !HANDLE_INTERRUPT_DATA_LATER
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 PS2InterruptResult ApplePS2Controller::_dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data)
 {
     PS2InterruptResult result = kPS2IR_packetBuffering;
+    ++getStreamStatistics(deviceType)->bytes;
     if (kDT_Mouse == deviceType && _interruptInstalledMouse)
     {
         // Dispatch the data to the mouse driver.
@@ -1107,17 +2046,11 @@ void ApplePS2Controller::dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8
     PS2InterruptResult result = _dispatchDriverInterrupt(deviceType, data);
     if (kPS2IR_packetReady == result)
     {
-#if HANDLE_INTERRUPT_DATA_LATER
-        if (kDT_Mouse == deviceType)
-            (*_packetActionMouse)(_interruptTargetMouse);
-        else if (kDT_Keyboard == deviceType)
-            (*_packetActionKeyboard)(_interruptTargetKeyboard);
-#else
+        // (packets are handled on the device's work loop)
         if (kDT_Mouse == deviceType)
             _interruptSourceMouse->interruptOccurred(0, 0, 0);
         else if (kDT_Keyboard == deviceType)
             _interruptSourceKeyboard->interruptOccurred(0, 0, 0);
-#endif
     }
 }
 
@@ -1139,6 +2072,8 @@ void ApplePS2Controller::processRequest(PS2Request * request)
   bool          transmitToMouse = false;
   unsigned      index;
 
+  request->commandsSubmitted = request->commandsCount;
+
   if (_hardwareOffline)
   {
     failed = true;
@@ -1162,11 +2097,10 @@ void ApplePS2Controller::processRequest(PS2Request * request)
         break;
 
       case kPS2C_ReadDataPortAndCompare:
-#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
-        byte = readDataPort(deviceMode, request->commands[index].inOrOut);
-#else 
-        byte = readDataPort(deviceMode);
-#endif
+        if (_outOfOrderCorrection)
+          byte = readDataPort(deviceMode, request->commands[index].inOrOut);
+        else
+          byte = readDataPort(deviceMode);
         failed = (byte != request->commands[index].inOrOut);
         request->commands[index].inOrOut = byte;
         break;
@@ -1203,11 +2137,10 @@ void ApplePS2Controller::processRequest(PS2Request * request)
         writeCommandPort(kCP_TransmitToMouse);
         writeDataPort(request->commands[index].inOrOut);
         deviceMode = kDT_Mouse;
-#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
-        byte = readDataPort(kDT_Mouse, kSC_Acknowledge);
-#else 
-        byte = readDataPort(kDT_Mouse);
-#endif
+        if (_outOfOrderCorrection)
+          byte = readDataPort(kDT_Mouse, kSC_Acknowledge);
+        else
+          byte = readDataPort(kDT_Mouse);
         failed = (byte != kSC_Acknowledge);
         break;
             
@@ -1218,11 +2151,10 @@ void ApplePS2Controller::processRequest(PS2Request * request)
             
       case kPS2C_ReadMouseDataPortAndCompare:
         deviceMode= kDT_Mouse;
-#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
-        byte = readDataPort(deviceMode, request->commands[index].inOrOut);
-#else
-        byte = readDataPort(deviceMode);
-#endif
+        if (_outOfOrderCorrection)
+          byte = readDataPort(deviceMode, request->commands[index].inOrOut);
+        else
+          byte = readDataPort(deviceMode);
         failed = (byte != request->commands[index].inOrOut);
         break;
             
@@ -1241,6 +2173,16 @@ void ApplePS2Controller::processRequest(PS2Request * request)
         IOSleep(request->commands[index].inOrOut32);
         break;
             
+      case kPS2C_SendMouseCommandsAndCompareAck:
+        deviceMode = kDT_Mouse;
+        failed = !sendMouseBytesAndCompareAck(request, &request->commands[index]);
+        break;
+
+      case kPS2C_PollDataPort:
+        failed = !pollDataPort(deviceMode, request->commands[index].inOrOut32, &byte);
+        request->commands[index].inOrOut = byte;
+        break;
+
       case kPS2C_ModifyCommandByte:
         writeCommandPort(kCP_GetCommandByte);
         UInt8 commandByte = readDataPort(kDT_Keyboard);
@@ -1266,7 +2208,18 @@ hardware_offline:
 
   // Invoke the completion routine, if one was supplied.
 
-  if (request->completionTarget != kStackCompletionTarget && request->completionTarget && request->completionAction)
+  if (request->requestFlags & kPS2RF_Async)
+  {
+    completeRequestAsync(request);
+  }
+  else if (request->requestFlags & kPS2RF_Future)
+  {
+    IOLockLock(_requestQueueLock);
+    request->requestFlags |= kPS2RF_Done;
+    IOLockWakeup(_requestQueueLock, request, false);
+    IOLockUnlock(_requestQueueLock);
+  }
+  else if (request->completionTarget != kStackCompletionTarget && request->completionTarget && request->completionAction)
   {
     (*request->completionAction)(request->completionTarget,
                                  request->completionParam);
@@ -1280,6 +2233,50 @@ hardware_offline:
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+bool ApplePS2Controller::sendMouseBytesAndCompareAck(PS2Request* request, PS2Command* command)
+{
+  //
+  // Sends a string of bytes to the mouse, each expecting an acknowledge.
+  // This is the same as a run of kPS2C_SendMouseCommandAndCompareAck, but
+  // without going back through processRequest for every byte.  The first
+  // byte that is not acknowledged (resend, error, timeout) ends it.
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  const UInt8* bytes = &request->sequenceBytes[command->bytesOffset];
+  unsigned count = command->bytesCount;
+  unsigned done;
+  uint64_t start, end;
+
+  clock_get_uptime(&start);
+  for (done = 0; done < count; done++)
+  {
+    writeCommandPort(kCP_TransmitToMouse);
+    writeDataPort(bytes[done]);
+    UInt8 ack = _outOfOrderCorrection ? readDataPort(kDT_Mouse, kSC_Acknowledge) : readDataPort(kDT_Mouse);
+    if (ack != kSC_Acknowledge)
+      break;
+  }
+  clock_get_uptime(&end);
+  command->bytesDone = done;
+
+  // per-sequence timing
+  uint64_t time;
+  absolutetime_to_nanoseconds(end - start, &time);
+  PS2SequenceStats* stats = &_stats->mouseSequences;
+  ++stats->sequences;
+  if (done != count)
+    ++stats->failures;
+  stats->time += time;
+  if (time > stats->timeMax)
+    stats->timeMax = time;
+
+  return done == count;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::processRequestQueue(IOInterruptEventSource *, int)
 {
   queue_head_t localQueue;
@@ -1294,6 +2291,7 @@ void ApplePS2Controller::processRequestQueue(IOInterruptEventSource *, int)
     queue_init(&_requestQueue);
   }
   else queue_init(&localQueue);
+  _stats->requestQueueDepth = 0;
 
   IOLockUnlock(_requestQueueLock);
 
@@ -1409,7 +2407,32 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
+bool ApplePS2Controller::pollDataPort(PS2DeviceType deviceType, UInt32 timeoutMS, UInt8* byte)
+{
+  //
+  // Waits (sleeping, not spinning) until the controller has data, for up to
+  // timeoutMS milliseconds, then reads it with readDataPort.  Returns false
+  // if nothing arrived in time.
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  *byte = 0;
+  for (UInt32 elapsed = 0; !(inb(kCommandPort) & kOutputReady); ++elapsed)
+  {
+    if (elapsed >= timeoutMS)
+    {
+      IOLog("%s: Timed out after %u ms on %s input stream.\n", getName(), (unsigned)timeoutMS,
+            (deviceType == kDT_Keyboard) ? "keyboard" : "mouse");
+      return false;
+    }
+    IOSleep(1);
+  }
+  *byte = readDataPort(deviceType);
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
                                        UInt8         expectedByte)
@@ -1583,8 +2606,6 @@ skipForwardToY:
   } // while (forever)
 }
 
-#endif
-
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Controller::writeDataPort(UInt8 byte)
@@ -1841,9 +2862,19 @@ void ApplePS2Controller::setPowerStateCallout( thread_call_param_t param0,
 
   if (me->_workLoop)
   {
+    // device work loops first (see gate order), so the drivers' power
+    // control does not run alongside their packets and timers
+    if (me->_workLoopKeyboard)
+      me->_workLoopKeyboard->closeGate();
+    if (me->_workLoopMouse)
+      me->_workLoopMouse->closeGate();
     me->_workLoop->runAction( /* Action */ setPowerStateAction,
                               /* target */ me,
                               /*   arg0 */ param1 );
+    if (me->_workLoopMouse)
+      me->_workLoopMouse->openGate();
+    if (me->_workLoopKeyboard)
+      me->_workLoopKeyboard->openGate();
   }
 
   me->release();  // drop the retain from setPowerState()
@@ -1946,6 +2977,7 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
         //    that were blocked by submitRequest().
 
         _hardwareOffline = false;
+        armWatchdog(kWatchdogAdaptive == _watchdogMode);
 
         // 3. Notify clients about the state change: Keyboard, then Mouse.
         //   (This ordering is also part of the fix for ProBook 4x40s trackpad wake issue)
@@ -2060,20 +3092,53 @@ bool ApplePS2Controller::notificationHandler(void * refCon, IOService * newServi
     return true;
 }
 
-void ApplePS2Controller::dispatchMessageGated(int* message, void* data)
+void ApplePS2Controller::copyNotificationServicesGated(OSSet** services)
 {
-    OSCollectionIterator* i = OSCollectionIterator::withCollection(_notificationServices);
-    
-    if (i != NULL) {
-        while (IOService* service = OSDynamicCast(IOService, i->getNextObject()))  {
-            service->message(*message, this, data);
+    *services = OSSet::withSet(_notificationServices);
+}
+
+IOReturn ApplePS2Controller::messageAction(OSObject* target, void* service, void* message, void* data, void*)
+{                                                      // IOWorkLoop::Action
+    ((IOService*)service)->message((UInt32)(uintptr_t)message, (IOService*)target, data);
+    return kIOReturnSuccess;
+}
+
+void ApplePS2Controller::dispatchMessage(PS2DeviceType sender, int message, void* data)
+{
+    //
+    // Deliver message to each notification consumer.  The receivers are
+    // copied under our gate, but delivered outside of it (gate order, see
+    // Work loop definitions).  Our own drivers get the message inside their
+    // work loop's gate, so it does not race their packets and timers,
+    // except messages from the aux device to the keyboard: taking the
+    // keyboard's gate there would invert the gate order, so the keyboard
+    // handles those (swipes) without its gate.  Other consumers get it on
+    // the sender's thread, as before.
+    //
+
+    OSSet* services = 0;
+    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::copyNotificationServicesGated), &services);
+    if (services)
+    {
+        if (OSCollectionIterator* i = OSCollectionIterator::withCollection(services))
+        {
+            while (IOService* service = OSDynamicCast(IOService, i->getNextObject()))
+            {
+                IOWorkLoop* loop = OSDynamicCast(ApplePS2Device, service->getProvider()) ? service->getWorkLoop() : 0;
+                if (loop && kDT_Mouse == sender && loop != getDeviceWorkLoop(kDT_Mouse))
+                    loop = 0;
+                if (loop && kDT_Watchdog != sender)
+                    loop->runAction(&ApplePS2Controller::messageAction, this, service, (void*)(uintptr_t)message, data);
+                else
+                    service->message(message, this, data);
+            }
+            i->release();
         }
+        services->release();
     }
     
-    i->release();
-    
     // Convert kPS2M_notifyKeyPressed events into additional kPS2M_notifyKeyTime events for external consumers
-    if (*message == kPS2M_notifyKeyPressed) {
+    if (message == kPS2M_notifyKeyPressed) {
         
         // Register last key press, used for palm detection
         PS2KeyInfo* pInfo = (PS2KeyInfo*)data;
@@ -2092,15 +3157,15 @@ void ApplePS2Controller::dispatchMessageGated(int* message, void* data)
             case 0x3f:  // osx fn (function)
                 break;
             default:
-                int dispatchMessage = kPS2M_notifyKeyTime;
-                dispatchMessageGated(&dispatchMessage, &(pInfo->time));
+                dispatchMessage(sender, kPS2M_notifyKeyTime, &(pInfo->time));
         }
     }
 }
 
 void ApplePS2Controller::dispatchMessage(int message, void* data)
 {
-    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::dispatchMessageGated), &message, data);
+    // (sender unknown, so delivered on the caller's thread without gates)
+    dispatchMessage(kDT_Watchdog, message, data);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -2119,6 +3184,13 @@ void ApplePS2Controller::unlock()
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+PS2StreamStats* ApplePS2Controller::getStreamStatistics(PS2DeviceType deviceType)
+{
+    return &_stats->stream[kDT_Mouse == deviceType ? kPS2Stats_Aux : kPS2Stats_Keyboard];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 #define kDefault                "Default"
 
 struct DSDT_HEADER
@@ -2396,17 +3468,209 @@ OSDictionary* ApplePS2Controller::getConfigurationOverride(IOACPIPlatformDevice*
     return result;
 }
 
-OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, const char* section)
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Configuration compiler (see PS2ConfigBlob.h)
+//
+
+static bool addConfigString(OSData* pool, const void* bytes, uint32_t length, uint32_t* offset)
 {
-    if (!list)
-        return NULL;
+    *offset = pool->getLength();
+    return pool->appendBytes(bytes, length) && pool->appendByte(0, 1);
+}
 
-    lock(); // called from various probe functions, must protect against re-rentry
+// returns false only if out of memory (unsupported types are left out)
+static bool addConfigItem(OSData* items, OSArray* objects, OSData* pool, const char* name, OSObject* obj, int* count)
+{
+    PS2ConfigItem item;
+    bzero(&item, sizeof(item));
+    item.name = kPS2ConfigNoName;
+    uint32_t offset;
+
+    if (OSBoolean* bl = OSDynamicCast(OSBoolean, obj))
+    {
+        item.type = kPS2Cfg_Bool;
+        item.value = bl->isTrue();
+    }
+    else if (OSNumber* num = OSDynamicCast(OSNumber, obj))
+    {
+        item.type = kPS2Cfg_Number;
+        item.value = num->unsigned64BitValue();
+    }
+    else if (OSString* str = OSDynamicCast(OSString, obj))
+    {
+        item.type = kPS2Cfg_String;
+        item.count = str->getLength();
+        if (!addConfigString(pool, str->getCStringNoCopy(), item.count, &offset))
+            return false;
+        item.value = offset;
+    }
+    else if (OSData* data = OSDynamicCast(OSData, obj))
+    {
+        item.type = kPS2Cfg_Data;
+        item.count = data->getLength();
+        if (!addConfigString(pool, data->getBytesNoCopy(), item.count, &offset))
+            return false;
+        item.value = offset;
+    }
+    else if (OSDynamicCast(OSArray, obj))
+        item.type = kPS2Cfg_Array;      // children added later
+    else if (OSDynamicCast(OSDictionary, obj))
+        item.type = kPS2Cfg_Dict;
+    else
+        return true;
+
+    if (name && !addConfigString(pool, name, (uint32_t)strlen(name), &item.name))
+        return false;
+    if (!items->appendBytes(&item, sizeof(item)) || !objects->setObject(obj))
+        return false;
+    ++*count;
+    return true;
+}
+
+// adds the children of an array or dictionary, returns number added, or -1 if out of memory
+static int addConfigChildren(OSData* items, OSArray* objects, OSData* pool, OSArray* keys, OSObject* obj)
+{
+    int count = 0;
+    if (OSArray* array = OSDynamicCast(OSArray, obj))
+    {
+        for (unsigned i = 0; i < array->getCount(); i++)
+            if (!addConfigItem(items, objects, pool, NULL, array->getObject(i), &count))
+                return -1;
+        return count;
+    }
+    OSDictionary* dict = OSDynamicCast(OSDictionary, obj);
+    if (!dict)
+        return 0;
+
+    // dictionary children are added sorted by name
+    keys->flushCollection();
+    if (OSCollectionIterator* iter = OSCollectionIterator::withCollection(dict))
+    {
+        while (const OSSymbol* key = static_cast<const OSSymbol*>(iter->getNextObject()))
+        {
+            unsigned i = 0;
+            for (; i < keys->getCount(); i++)
+                if (strcmp(key->getCStringNoCopy(), static_cast<const OSSymbol*>(keys->getObject(i))->getCStringNoCopy()) < 0)
+                    break;
+            keys->setObject(i, key);
+        }
+        iter->release();
+    }
+    for (unsigned i = 0; i < keys->getCount(); i++)
+    {
+        const OSSymbol* key = static_cast<const OSSymbol*>(keys->getObject(i));
+        if (!addConfigItem(items, objects, pool, key->getCStringNoCopy(), dict->getObject(key), &count))
+            return -1;
+    }
+    keys->flushCollection();
+    return count;
+}
+
+static OSData* compileConfiguration(OSDictionary* dict)
+{
+    OSData* result = NULL;
+    OSData* items = OSData::withCapacity(32 * sizeof(PS2ConfigItem));
+    OSData* pool = OSData::withCapacity(512);
+    OSArray* objects = OSArray::withCapacity(32);   // source object of each item
+    OSArray* keys = OSArray::withCapacity(16);
+    if (!items || !pool || !objects || !keys)
+        goto done;
+
+    {
+        // top level, then the children of each container in order (breadth first)
+        int rootCount = addConfigChildren(items, objects, pool, keys, dict);
+        if (rootCount < 0)
+            goto done;
+        for (unsigned i = 0; i < objects->getCount(); i++)
+        {
+            OSObject* obj = objects->getObject(i);
+            if (!OSDynamicCast(OSArray, obj) && !OSDynamicCast(OSDictionary, obj))
+                continue;
+            uint32_t first = objects->getCount();
+            int count = addConfigChildren(items, objects, pool, keys, obj);
+            if (count < 0)
+                goto done;
+            // Note: items may have moved while adding
+            PS2ConfigItem* item = (PS2ConfigItem*)items->getBytesNoCopy() + i;
+            item->value = first;
+            item->count = count;
+        }
+
+        PS2ConfigHeader header;
+        header.magic = kPS2ConfigMagic;
+        header.version = kPS2ConfigVersion;
+        header.rootCount = rootCount;
+        header.itemCount = objects->getCount();
+        header.stringsOffset = sizeof(header) + items->getLength();
+        header.size = header.stringsOffset + pool->getLength();
+        result = OSData::withCapacity(header.size);
+        if (result && (!result->appendBytes(&header, sizeof(header)) ||
+                       !result->appendBytes(items) || !result->appendBytes(pool)))
+            OSSafeReleaseNULL(result);
+    }
+
+done:
+    OSSafeReleaseNULL(items);
+    OSSafeReleaseNULL(pool);
+    OSSafeReleaseNULL(objects);
+    OSSafeReleaseNULL(keys);
+    return result;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::resolvePlatform()
+{
+    // platform identity cannot change, so it is resolved once (with controller lock held)
+    if (_platformResolved)
+        return;
+    _platformResolved = true;
+
+    // Note: getPlatformManufacturer/getPlatformProduct results are not always retained
+    if (OSString* manufacturer = getPlatformManufacturer(this))
+        _platformManufacturer = OSString::withString(manufacturer);
+    if (OSString* product = getPlatformProduct(this))
+        _platformProduct = OSString::withString(product);
+    DEBUG_LOG("%s: platform is %s/%s\n", getName(),
+              _platformManufacturer ? _platformManufacturer->getCStringNoCopy() : "(none)",
+              _platformProduct ? _platformProduct->getCStringNoCopy() : "(none)");
+}
+
+OSDictionary* ApplePS2Controller::getRMCF()
+{
+    // RMCF is evaluated once (with controller lock held), even if it does not exist
+    if (_rmcfResolved)
+        return _rmcfCache;
+    _rmcfResolved = true;
+
+    // look for a parent that is ACPI... this will find PS2K (or eqivalent)
+    IORegistryEntry* entry = this;
+    IOACPIPlatformDevice* acpi = NULL;
+    while (entry)
+    {
+        acpi = OSDynamicCast(IOACPIPlatformDevice, entry);
+        if (acpi)
+            break;
+        entry = entry->getParentEntry(gIOServicePlane);
+    }
+    if (acpi)
+    {
+        // get override configuration data from ACPI RMCF
+        _rmcfCache = getConfigurationOverride(acpi, "RMCF");
+    }
+    return _rmcfCache;
+}
 
+OSDictionary* ApplePS2Controller::mergeConfigurationNode(OSDictionary* list, const char* section)
+{
     // first merge Default with specific platform profile overrides
     OSDictionary* result = 0;
     OSDictionary* defaultNode = _getConfigurationNode(list, kDefault);
-    OSDictionary* platformNode = getConfigurationNode(this, list);
+    OSDictionary* platformNode = NULL;
+    if (_platformManufacturer)
+        if (OSDictionary *manufacturerNode = OSDynamicCast(OSDictionary, list->getObject(_platformManufacturer)))
+            if (!(platformNode = _getConfigurationNode(manufacturerNode, _platformProduct)))
+                platformNode = _getConfigurationNode(manufacturerNode, kDefault);
     if (defaultNode)
     {
         // have default node, result is merge with platform node
@@ -2420,29 +3684,7 @@ OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, cons
         result = OSDictionary::withDictionary(platformNode);
     }
 
-    // check RMCF cache, otherwise load by calling RMCF
-    OSDictionary* over = _rmcfCache;
-    if (!over)
-    {
-        // look for a parent that is ACPI... this will find PS2K (or eqivalent)
-        IORegistryEntry* entry = this;
-        IOACPIPlatformDevice* acpi = NULL;
-        while (entry)
-        {
-            acpi = OSDynamicCast(IOACPIPlatformDevice, entry);
-            if (acpi)
-                break;
-            entry = entry->getParentEntry(gIOServicePlane);
-        }
-        if (acpi)
-        {
-            // get override configuration data from ACPI RMCF
-            over = getConfigurationOverride(acpi, "RMCF");
-            _rmcfCache = over;
-        }
-    }
-
-    if (over)
+    if (OSDictionary* over = getRMCF())
     {
         // check specific section, merge...
         if (OSDictionary* sect = OSDynamicCast(OSDictionary, over->getObject(section)))
@@ -2460,6 +3702,84 @@ OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, cons
         }
     }
 
+    return result;
+}
+
+void ApplePS2Controller::publishConfigLoadTime(const char* section, uint64_t time)
+{
+    if (!_configLoadTimes)
+        _configLoadTimes = OSDictionary::withCapacity(6);
+    if (!_configLoadTimes)
+        return;
+    if (OSNumber* num = OSNumber::withNumber(time, 64))
+    {
+        _configLoadTimes->setObject(section, num);
+        num->release();
+    }
+    // publish a copy, so the registry never sees it change
+    if (OSDictionary* copy = OSDictionary::withDictionary(_configLoadTimes))
+    {
+        setProperty(kConfigurationLoadTime, copy);
+        copy->release();
+    }
+}
+
+OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, const char* section)
+{
+    if (!list)
+        return NULL;
+
+    lock(); // called from various probe functions, must protect against re-rentry
+
+    //
+    // Each section belongs to one driver, and its list always comes from that
+    // driver's personality, so the merged result is kept per section until the
+    // controller stops.  After the first probe, this is a lookup and a retain.
+    // The cached dictionaries are immutable, as they are shared.  Each also
+    // carries its compiled form as kConfigurationBlob (see PS2ParamSchema.h).
+    //
+    // The time taken to merge and compile each section is published in
+    // kConfigurationLoadTime (ns, by section).
+    //
+    // kOSBooleanFalse in the cache means the section has no configuration.
+    //
+
+    OSDictionary* result = NULL;
+    OSObject* cached = _configCache ? _configCache->getObject(section) : NULL;
+    if (cached)
+    {
+        result = OSDynamicCast(OSDictionary, cached);
+        if (result)
+            result->retain();
+    }
+    else
+    {
+        uint64_t start_abs, now_abs, time;
+        clock_get_uptime(&start_abs);
+        resolvePlatform();
+        result = mergeConfigurationNode(list, section);
+        if (result)
+        {
+            // validated once here, applyParamSchema trusts it after
+            if (OSData* blob = compileConfiguration(result))
+            {
+                if (validateConfigBlob(blob->getBytesNoCopy(), blob->getLength()))
+                    result->setObject(kConfigurationBlob, blob);
+                else
+                    IOLog("ApplePS2Controller: configuration blob for \"%s\" not valid, not used\n", section);
+                blob->release();
+            }
+            result->setOptions(OSCollection::kImmutable, OSCollection::kImmutable);
+        }
+        clock_get_uptime(&now_abs);
+        absolutetime_to_nanoseconds(now_abs - start_abs, &time);
+        publishConfigLoadTime(section, time);
+        if (!_configCache)
+            _configCache = OSDictionary::withCapacity(6);
+        if (_configCache)
+            _configCache->setObject(section, result ? (OSObject*)result : (OSObject*)kOSBooleanFalse);
+    }
+
     unlock();
 
     return result;
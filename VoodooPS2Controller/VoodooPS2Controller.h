@@ -27,7 +27,9 @@
 #include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include "ApplePS2Device.h"
+#include "PS2Statistics.h"
 
 class ApplePS2KeyboardDevice;
 class ApplePS2MouseDevice;
@@ -91,31 +93,66 @@ class ApplePS2MouseDevice;
 // driver writer disable the mouse first, then send any dangerous commands, and
 // re-enable the mouse when the command completes. 
 //
-// Note that the OUT_OF_ORDER_DATA_CORRECTION_FEATURE can be turned off at
-// compile time.    Please see the readDataPort:expecting: method for more
-// information about the assumptions necessary for this feature.
+// Note that the OUT_OF_ORDER_DATA_CORRECTION_FEATURE can be turned off with
+// OutOfOrderCorrection (see Interrupt handling definitions).    Please see
+// the readDataPort:expecting: method for more information about the
+// assumptions necessary for this feature.
 //
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Definitions
 //
 
-// Enable debugger support (eg. mini-monitor).
+// Enable debugger support (eg. mini-monitor).  This one stays a compile
+// time option: it needs its own keyboard queue, and forces kInterruptDeferred.
 
 #define DEBUGGER_SUPPORT 0
 
-// Enable dynamic "second chance" re-ordering of input stream data if a
-// command response fails to match the expected byte.
+// Interrupt handling definitions
+//
+// InterruptMode (Controller configuration, can be changed at runtime;
+// other values are ignored):
+//
+// o  kInterruptImmediate (default):  data is read at real interrupt time
+//    (handleInterrupt) and buffered by the driver's interrupt action; only
+//    complete packets wake packetReady on the device's work loop.
+//
+// o  kInterruptDeferred:  the interrupt handler only wakes packetReady,
+//    which reads and dispatches the data there (readInterruptData, inside
+//    the controller's gate).  Less time at interrupt time, more latency.
+//    This way is also easier to debug.
+//
+// o  kInterruptAuto:  starts immediate and times the interrupt handler for
+//    kInterruptAutoSamples interrupts.  If it averages over
+//    kInterruptAutoMaxTime us (slow or emulated ports), switches to
+//    deferred.  The choice is logged and published as InterruptModeActive.
+//    It only ever switches from immediate to deferred, once, and it judges
+//    by the time spent in the handler, not by the interrupt to packetReady
+//    latency (wakeLatency in the statistics block, which deferred adds to).
+//    Setting InterruptMode again starts over.
+//
+// Switching at runtime masks both interrupts and waits for running
+// handlers (switchInterruptMode), so the handlers and readInterruptData
+// are never reading the data port at the same time.
+//
+// Handler time and interrupt to packetReady latency are kept in the
+// statistics block for either mode, to compare them on a given machine.
+//
+// OutOfOrderCorrection (default true, runtime):  dynamic "second chance"
+// re-ordering of input stream data if a command response fails to match
+// the expected byte (see above).
+//
 
-#define OUT_OF_ORDER_DATA_CORRECTION_FEATURE 1
+#define kInterruptMode              "InterruptMode"
+#define kInterruptModeActive        "InterruptModeActive"
+#define kOutOfOrderCorrection       "OutOfOrderCorrection"
 
-// Enable handling of interrupt data in workloop instead of at interrupt
-// time.  This way is easier to debug.  For production use, this should
-// be zero, such that PS2 data is buffered at real interrupt time, and handled
-// as packets later in the workloop.
+#define kInterruptImmediate         0
+#define kInterruptDeferred          1
+#define kInterruptAuto              2
 
-#define HANDLE_INTERRUPT_DATA_LATER 0
-#define WATCHDOG_TIMER 0
+#define kInterruptAutoSamples       512
+#define kInterruptAutoMaxTime       40      // us
 
 // Interrupt definitions.
 
@@ -143,8 +180,109 @@ class ApplePS2MouseDevice;
 #define kMouseData              0x20    // mouse data available
 
 // Watchdog timer definitions
+//
+// Some ECs drop keyboard interrupts, leaving a byte stuck in the output
+// buffer (and the keyboard dead) until something reads it.  WatchdogMode:
+//
+// o  kWatchdogOff: no watchdog.
+//
+// o  kWatchdogAdaptive (default): the timer is armed by input, and
+//    re-armed every kWatchdogTimerInterval ms only while input keeps coming
+//    or a keyboard byte is pending.  A keyboard byte seen pending on two
+//    checks in a row, with no interrupt in between, is read by the watchdog
+//    (WatchdogRecovered).  An idle machine only has a check every
+//    kWatchdogIdleInterval ms, so an interrupt lost with no input before it
+//    does not leave the keyboard dead.
+//
+// o  kWatchdogPeriodic: poll every kWatchdogTimerInterval ms regardless.
+//
+
+#define kWatchdogMode           "WatchdogMode"
+#define kWatchdogChecks         "WatchdogChecks"
+#define kWatchdogRecovered      "WatchdogRecovered"
+
+#define kWatchdogOff            0
+#define kWatchdogAdaptive       1
+#define kWatchdogPeriodic       2
 
 #define kWatchdogTimerInterval  100
+#define kWatchdogIdleInterval   2000
+
+// Interrupt storm definitions
+//
+// A chattering device or a misbehaving EC can raise interrupts (with data
+// always ready) fast enough to keep a CPU in handleInterrupt.
+//
+// o  Interrupts are counted per stream in windows of kInterruptStormWindow
+//    ms.  Above InterruptStormLimitKeyboard/Mouse (interrupts per second,
+//    0 turns it off) the stream's interrupt is disabled and the controller
+//    drains the 8042 from a timer every kInterruptStormPollInterval ms, at
+//    most kInterruptStormPollBytes bytes each time.  Polling reads only the
+//    polled streams' bytes; it stops at a byte of a stream whose interrupt
+//    is still live (as the watchdog does with mouse data) and leaves it to
+//    that stream's handler.  Either side may still read a byte of the
+//    other's stream (a handler already running when the storm starts or
+//    ends), so handleInterrupt reads and dispatches each byte under
+//    _interruptLock; a driver is never fed from two CPUs at once.
+//
+// o  handleInterrupt reads at most kInterruptStormBytes bytes per
+//    interrupt.  Running into that is a storm as well (the rest is polled).
+//
+// o  Every kInterruptStormRecovery ms the polled byte rate is checked
+//    (one byte is one interrupt on the 8042); under half the limit, the
+//    interrupt is enabled again.  Setting the limit to 0 ends the storm.
+//
+// o  Each episode is logged once when it starts and once when it ends, and
+//    recorded in the statistics block (PS2StormStats) and the registry
+//    (InterruptStormsKeyboard/Mouse).
+//
+
+#define kInterruptStormLimitKeyboard    "InterruptStormLimitKeyboard"
+#define kInterruptStormLimitMouse       "InterruptStormLimitMouse"
+#define kInterruptStormsKeyboard        "InterruptStormsKeyboard"
+#define kInterruptStormsMouse           "InterruptStormsMouse"
+
+#define kInterruptStormWindow           100     // ms
+#define kInterruptStormPollInterval     10      // ms
+#define kInterruptStormPollBytes        64
+#define kInterruptStormBytes            64
+#define kInterruptStormRecovery         1000    // ms
+
+// handleInterrupt streams (bit per kPS2Stats_ stream)
+#define kStreamsAll                     ((1 << kPS2Stats_Keyboard) | (1 << kPS2Stats_Aux))
+
+// Work loop definitions
+//
+// o  The controller's own work loop (getWorkLoop) owns the 8042:  the
+//    request queue, submitRequestAndBlock, the command byte and the
+//    watchdog.  All port I/O outside of interrupt time happens there, or
+//    inside its gate (kInterruptDeferred reads in packetReady).
+//
+// o  With DeviceWorkLoops (default), the keyboard and the aux device each
+//    get a work loop for their packetReady and, through the nub's
+//    getWorkLoop, the driver's timers and command gate.  So a long
+//    trackpad dispatch or timer does not hold up keystrokes (and the other
+//    way around).
+//
+// o  Gate order is device work loop (keyboard, then mouse), then controller
+//    work loop; never the other way.  Drivers call into the controller
+//    (submitRequestAndBlock, dispatchMessage) from their work loop, and
+//    power changes close the device gates before the controller's, so
+//    setDevicePowerState still runs with nothing else of the driver's
+//    running.
+//
+// o  Messages (dispatchMessage) are delivered without holding the
+//    controller's gate, inside the receiving driver's work loop gate.
+//    The one exception is aux device to keyboard (swipes), which would
+//    take the gates in the wrong order; the keyboard queues those under
+//    its own lock.
+//
+
+#define kDeviceWorkLoops        "DeviceWorkLoops"
+
+// Requests kept by the controller for allocateRequest (see PS2Request)
+
+#define kPS2RequestPoolSize     16
 
 #if DEBUGGER_SUPPORT
 // Definitions for our internal keyboard queue (holds keys processed by the
@@ -164,6 +302,7 @@ struct KeyboardQueueElement
 
 #define kDisableDevice          "DisableDevice"
 #define kPlatformProfile        "Platform Profile"
+#define kConfigurationLoadTime  "ConfigurationLoadTime"
 
 #ifdef DEBUG
 #define kMergedConfiguration    "Merged Configuration"
@@ -198,9 +337,18 @@ public:                                // interrupt-time variables and functions
 
 private:
   IOWorkLoop *             _workLoop;
+  IOWorkLoop *             _workLoopKeyboard;     // 0 if sharing _workLoop
+  IOWorkLoop *             _workLoopMouse;
+  bool                     _deviceWorkLoops;
   queue_head_t             _requestQueue;
+  queue_head_t             _requestPool;          // free pooled requests
+  queue_head_t             _completionQueueKeyboard;  // processed async requests
+  queue_head_t             _completionQueueMouse;
+  IOInterruptEventSource * _completionSourceKeyboard; // on the device work loops
+  IOInterruptEventSource * _completionSourceMouse;
   IOLock*                  _requestQueueLock;
   IOLock*                  _cmdbyteLock;
+  IOSimpleLock*            _interruptLock;        // handleInterrupt, one byte at a time
 
   OSObject *               _interruptTargetKeyboard;
   OSObject *               _interruptTargetMouse;
@@ -250,29 +398,93 @@ private:
   int                      _wakedelay;
   bool                     _mouseWakeFirst;
   IOCommandGate*           _cmdGate;
-#if WATCHDOG_TIMER
   IOTimerEventSource*      _watchdogTimer;
-#endif
+  int                      _watchdogMode;
+  bool                     _watchdogArmed;
+  bool                     _watchdogIdle;           // armed with kWatchdogIdleInterval
+  bool                     _watchdogPending;        // keyboard byte seen pending at last check
+  UInt32                   _watchdogInterrupts;     // _interruptCount at last check
+  UInt32                   _watchdogChecks;
+  UInt32                   _watchdogRecovered;
+  volatile UInt32          _interruptCount;         // keyboard and mouse interrupts
   OSDictionary*            _rmcfCache;
+  bool                     _rmcfResolved;
+  OSString*                _platformManufacturer;
+  OSString*                _platformProduct;
+  bool                     _platformResolved;
+  OSDictionary*            _configCache;            // section -> merged configuration
+  OSDictionary*            _configLoadTimes;        // section -> ns to merge and compile
+  bool                     _identifyAux;
+  IOBufferMemoryDescriptor* _statsMemory;           // shared with ApplePS2StatisticsUserClient
+  PS2Statistics*           _stats;                  // in _statsMemory, or _statsFallback
+  PS2Statistics            _statsFallback;
+
+  // interrupt storms, per stream (kPS2Stats_Keyboard/Aux)
+  struct InterruptStorm
+  {
+    UInt32                 limit;                   // interrupts per second, 0 = off
+    UInt32                 count;                   // interrupts in current window
+    uint64_t               windowStart;             // abs time
+    volatile bool          polling;                 // interrupt disabled, polled
+    bool                   recorded;                // episode start handled on work loop
+    UInt32                 peakRate;                // interrupts per second, when detected
+    uint64_t               pollStart;               // abs time
+    uint64_t               checkTime;               // abs time of last recovery check
+    uint64_t               checkBytes;              // stream bytes at last recovery check
+  };
+  InterruptStorm           _storm[kPS2Stats_StreamCount];
+  uint64_t                 _stormWindow;            // kInterruptStormWindow in abs time
+  IOInterruptEventSource*  _stormSource;
+  IOTimerEventSource*      _stormTimer;
+
+  // interrupt handling (kInterruptMode)
+  int                      _interruptModeConfig;    // as configured, may be kInterruptAuto
+  volatile int             _interruptMode;          // in effect, immediate or deferred
+  bool                     _outOfOrderCorrection;
+  volatile bool            _deferredPending[kPS2Stats_StreamCount]; // data left for packetReady
+  uint64_t                 _interruptStamp[kPS2Stats_StreamCount];  // abs time of last interrupt
+  volatile UInt32          _autoState;              // kInterruptAuto: measuring, decided, published
+  volatile SInt32          _handlersActive;         // interrupt handlers running right now
+  UInt32                   _autoSamples;
+  uint64_t                 _autoTime;               // ns
 
   virtual PS2InterruptResult _dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
   virtual void dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
-#if HANDLE_INTERRUPT_DATA_LATER
-  virtual void  interruptOccurred(IOInterruptEventSource *, int);
-#else
   void packetReadyMouse(IOInterruptEventSource*, int);
   void packetReadyKeyboard(IOInterruptEventSource*, int);
-#endif
-  void handleInterrupt(PS2DeviceType deviceType);
-#if WATCHDOG_TIMER
+  bool handleInterrupt(PS2DeviceType deviceType, unsigned limit = 0, bool wakeSelf = true, unsigned streams = kStreamsAll);
+  unsigned pollingStreams() const;
+  void readInterruptData(PS2DeviceType deviceType);
+  void noteHandlerTime(uint64_t start);
+  void noteWakeLatency(int stream);
+  bool setInterruptMode(int mode);
+  void switchInterruptMode(int mode);
+  void publishInterruptMode();
+  void noteInterrupt(int stream);
+  void startInterruptStorm(int stream);
+  void setStreamInterruptEnabled(int stream, bool enable);
+  void onInterruptStorm(IOInterruptEventSource*, int);
+  void onStormPollTimer();
+  void endInterruptStorm(int stream, bool enable);
   void onWatchdogTimer();
-#endif
+  void armWatchdog(bool idle = false);
+  void publishWatchdogStatistics();
   virtual void  processRequest(PS2Request * request);
   virtual void  processRequestQueue(IOInterruptEventSource *, int);
+  void completeRequestAsync(PS2Request* request);
+  void processCompletionQueue(IOInterruptEventSource* source, int);
+  void runCompletions(queue_head_t* queue);
+  void drainCompletions(IOInterruptEventSource* source, queue_head_t* queue);
+  static IOReturn runCompletionsAction(OSObject* target, void* queue, void*, void*, void*);
 
   virtual UInt8 readDataPort(PS2DeviceType deviceType);
+  bool pollDataPort(PS2DeviceType deviceType, UInt32 timeoutMS, UInt8* byte);
   virtual void  writeCommandPort(UInt8 byte);
   virtual void  writeDataPort(UInt8 byte);
+  bool sendMouseBytesAndCompareAck(PS2Request* request, PS2Command* command);
+  bool readSentelicId(UInt8 report[3]);
+  bool readAuxReport(const UInt8* knock, UInt8 count, UInt8 report[3]);
+  void identifyAuxDevice(ApplePS2MouseDevice* device);
   void resetController(void);
     
   static void interruptHandlerMouse(OSObject*, void* refCon, IOService*, int);
@@ -281,11 +493,10 @@ private:
   void notificationHandlerGated(IOService * newService, IONotifier * notifier);
   bool notificationHandler(void * refCon, IOService * newService, IONotifier * notifier);
 
-  void dispatchMessageGated(int* message, void* data);
+  void copyNotificationServicesGated(OSSet** services);
+  static IOReturn messageAction(OSObject* target, void* service, void* message, void* data, void*);
     
-#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
   virtual UInt8 readDataPort(PS2DeviceType deviceType, UInt8 expectedByte);
-#endif
 
   static void setPowerStateCallout(thread_call_param_t param0,
                                    thread_call_param_t param1);
@@ -308,6 +519,7 @@ public:
   virtual void stop(IOService * provider);
 
   virtual IOWorkLoop * getWorkLoop() const;
+  IOWorkLoop * getDeviceWorkLoop(PS2DeviceType deviceType) const;
 
   virtual void installInterruptAction(PS2DeviceType      deviceType,
                                       OSObject *         target,
@@ -321,6 +533,9 @@ public:
   virtual void         submitRequestAndBlock(PS2Request * request);
   virtual UInt8        setCommandByte(UInt8 setBits, UInt8 clearBits);
   void setCommandByteGated(PS2Request* request);
+  bool submitRequestAsync(PS2DeviceType deviceType, PS2Request* request, OSObject* target, PS2RequestAction action, void* param);
+  bool submitRequestFuture(PS2Request* request);
+  void waitRequest(PS2Request* request);
 
   virtual IOReturn setPowerState(unsigned long powerStateOrdinal,
                                  IOService *   policyMaker);
@@ -332,15 +547,25 @@ public:
   virtual void uninstallPowerControlAction(PS2DeviceType deviceType);
     
   virtual void dispatchMessage(int message, void* data);
+  void dispatchMessage(PS2DeviceType sender, int message, void* data);
     
   virtual IOReturn setProperties(OSObject* props);
   virtual void lock();
   virtual void unlock();
+
+  virtual PS2StreamStats* getStreamStatistics(PS2DeviceType deviceType);
+  virtual PS2BatchStats* getKeyboardBatchStatistics() { return &_stats->keyboardBatch; }
+  virtual PS2SwipeStats* getKeyboardSwipeStatistics() { return &_stats->keyboardSwipe; }
+  IOMemoryDescriptor* getStatisticsMemory() const { return _statsMemory; }
     
   static OSDictionary* getConfigurationNode(IORegistryEntry* entry, OSDictionary* list);
   virtual OSDictionary* makeConfigurationNode(OSDictionary* list, const char* section);
 
   OSDictionary* getConfigurationOverride(IOACPIPlatformDevice* acpi, const char* method);
+  void resolvePlatform();
+  OSDictionary* getRMCF();
+  OSDictionary* mergeConfigurationNode(OSDictionary* list, const char* section);
+  void publishConfigLoadTime(const char* section, uint64_t time);
   OSObject* translateArray(OSArray* array);
   OSObject* translateEntry(OSObject* obj);
 };
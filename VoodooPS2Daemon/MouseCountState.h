@@ -0,0 +1,149 @@
+//
+//  MouseCountState.h
+//  VoodooPS2Daemon
+//
+//  MouseCount state machine for the daemon.
+//
+//  main.cpp turns matching notifications and the run loop timer into calls
+//  on it, and it talks back only through Sink, so it has no CoreFoundation
+//  or IOKit dependencies.
+//
+
+#ifndef _MOUSECOUNTSTATE_H
+#define _MOUSECOUNTSTATE_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// MouseCountState
+//
+// o  Waiting:  no PS2 driver matched yet.  Pointer arrivals and removals
+//    are counted, nothing is sent.
+//
+// o  Ready:  the driver matched.  The current count is sent right away.
+//    After that, a change arms the timer for debounce; each further change
+//    pushes it back, but never past maxDelay after the first change.  When
+//    the timer fires, the count is sent once, and only if it differs from
+//    what the driver already has.  So a burst of arrivals (a hub or dock
+//    with several devices) is one property update.
+//
+// o  The driver going away returns to Waiting.
+//
+// o  Times are microseconds from any monotonic clock the caller uses.
+//
+
+class MouseCountState
+{
+public:
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+        virtual void sendMouseCount(int count) = 0;
+        virtual void setTimer(uint64_t delay) = 0;     // replaces any armed timer
+        virtual void cancelTimer() = 0;
+    };
+
+    enum { kUnknown = -2 };
+
+private:
+    Sink*       _sink;
+    uint64_t    _debounce;
+    uint64_t    _maxDelay;
+    bool        _ready;
+    bool        _pending;
+    uint64_t    _firstChange;
+    int         _count;
+    int         _sent;          // last count sent, or kUnknown
+
+    // statistics (DEBUG_LOG in the daemon)
+    unsigned    _changes;
+    unsigned    _sends;
+
+    void changed(uint64_t now)
+    {
+        ++_changes;
+        if (!_ready)
+            return;
+        if (!_pending)
+        {
+            _pending = true;
+            _firstChange = now;
+        }
+        uint64_t deadline = now + _debounce;
+        if (deadline > _firstChange + _maxDelay)
+            deadline = _firstChange + _maxDelay;
+        _sink->setTimer(deadline > now ? deadline - now : 0);
+    }
+
+    void send(int count)
+    {
+        _sink->sendMouseCount(count);
+        _sent = count;
+        ++_sends;
+    }
+
+public:
+    MouseCountState(Sink* sink, uint64_t debounce, uint64_t maxDelay)
+        : _sink(sink), _debounce(debounce), _maxDelay(maxDelay),
+          _ready(false), _pending(false), _firstChange(0), _count(0), _sent(kUnknown),
+          _changes(0), _sends(0) {}
+
+    inline int count() const { return _count; }
+    inline bool isReady() const { return _ready; }
+    inline unsigned changes() const { return _changes; }
+    inline unsigned sends() const { return _sends; }
+
+    void driverMatched()
+    {
+        _ready = true;
+        _pending = false;
+        _sink->cancelTimer();
+        send(_count);
+    }
+
+    void driverTerminated()
+    {
+        _ready = false;
+        _pending = false;
+        _sent = kUnknown;
+        _sink->cancelTimer();
+    }
+
+    void mouseAdded(uint64_t now)
+    {
+        ++_count;
+        changed(now);
+    }
+
+    void mouseRemoved(uint64_t now)
+    {
+        if (_count)
+            --_count;
+        changed(now);
+    }
+
+    void timerFired()
+    {
+        if (!_pending)
+            return;
+        _pending = false;
+        if (_count != _sent)
+            send(_count);
+    }
+
+    // no longer tracking MouseCount, so zero, then -1 so LED can be forced off
+    void shutdown()
+    {
+        _sink->cancelTimer();
+        if (_ready)
+        {
+            send(0);
+            send(-1);
+        }
+        _ready = false;
+        _pending = false;
+    }
+};
+
+#endif /* _MOUSECOUNTSTATE_H */
@@ -5,13 +5,17 @@
 //  Created by RehabMan on 1/5/13.
 //  Copyright (c) 2013 RehabMan. All rights reserved.
 //
-//  The purpose of this daemon is to watch for USB mice being connected or disconnected from
-//  the system.  This done by monitoring changes to the ioreg.
+//  The purpose of this daemon is to watch for USB and Bluetooth mice being connected or
+//  disconnected from the system.  This done by monitoring changes to the ioreg.
 //
 //  When changes in the status are detected, this information is sent to the trackpad
 //  driver through a ioreg property. When the trackpad driver sees the chagnes to the property it
 //  can decide to enable or disable the trackpad as appropriate.
 //
+//  Everything is driven from the run loop: the PS2 driver and the mice are found by
+//  matching notifications, and bursts of changes are coalesced by MouseCountState into one
+//  property update.
+//
 //  This code was loosely based on "Another USB Notification Example" at:
 //  http://www.opensource.apple.com/source/IOUSBFamily/IOUSBFamily-540.4.1/Examples/Another%20USB%20Notification%20Example/
 //
@@ -22,8 +26,12 @@
 #include <IOKit/IOMessage.h>
 #include <IOKit/usb/IOUSBLib.h>
 #include <mach/mach.h>
+#include <mach/mach_time.h>
 #include <unistd.h>
+#include <stdarg.h>
 #include <sys/utsname.h>
+#include "MouseCountState.h"
+#include "../VoodooPS2Controller/PS2Statistics.h"
 
 // notification data for IOServiceAddInterestNotification
 typedef struct NotificationData
@@ -33,12 +41,19 @@ typedef struct NotificationData
 
 static IONotificationPortRef g_NotifyPort;
 static io_iterator_t g_AddedIter;
+static io_iterator_t g_HIDAddedIter;
+static io_iterator_t g_DriverIter[2];
 
-static int g_MouseCount;
 static io_service_t g_ioservice;
+static io_object_t g_ioserviceNotification;
+static CFRunLoopTimerRef g_timer;
+
+static int g_startupDelay = 0;
+static int g_notificationDelay = 50000;     // debounce (us)
+static int g_maxDelay = 250000;             // longest a change waits (us)
 
-static int g_startupDelay = 1000000;
-static int g_notificationDelay = 20000;
+// timer is repeating with this interval, so it is never invalidated by firing
+static const CFTimeInterval kTimerNever = 1.0e10;
 
 #ifdef DEBUG
 #define DEBUG_LOG(args...)   do { printf(args); fflush(stdout); } while (0)
@@ -47,102 +62,112 @@ static int g_notificationDelay = 20000;
 #endif
 #define ALWAYS_LOG(args...)   do { printf(args); fflush(stdout); } while (0)
 
-// SendMouseCount
+static uint64_t GetTimeMicroseconds()
+{
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom)
+        mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+}
+
+// DaemonSink
 //
-// This function sends the current mouse count to the trackpad driver
-// It is called whenever the mouse count changes
+// MouseCountState output: sends MouseCount to the driver and drives the debounce timer.
 
-static void SendMouseCount(int nCount)
+class DaemonSink : public MouseCountState::Sink
 {
-    if (g_ioservice)
+public:
+    // SendMouseCount
+    //
+    // This function sends the current mouse count to the trackpad driver
+    // It is called (after debounce) whenever the mouse count changes
+    virtual void sendMouseCount(int nCount)
     {
-        CFStringRef cf_key = CFStringCreateWithCString(kCFAllocatorDefault, "MouseCount", CFStringGetSystemEncoding());
-        CFNumberRef cf_number = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &nCount);
-        kern_return_t kr = IORegistryEntrySetCFProperty(g_ioservice, cf_key, cf_number);
-        if (KERN_SUCCESS != kr)
-            DEBUG_LOG("IORegistryEntrySetCFProperty() returned error 0x%08x\n", kr);
-        CFRelease(cf_key);
-        CFRelease(cf_number);
+        if (g_ioservice)
+        {
+            CFNumberRef cf_number = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &nCount);
+            kern_return_t kr = IORegistryEntrySetCFProperty(g_ioservice, CFSTR("MouseCount"), cf_number);
+            if (KERN_SUCCESS != kr)
+                DEBUG_LOG("IORegistryEntrySetCFProperty() returned error 0x%08x\n", kr);
+            CFRelease(cf_number);
+            DEBUG_LOG("sent mouse count: %d\n", nCount);
+        }
     }
-}
+    virtual void setTimer(uint64_t delay)
+    {
+        CFRunLoopTimerSetNextFireDate(g_timer, CFAbsoluteTimeGetCurrent() + delay / 1000000.0);
+    }
+    virtual void cancelTimer()
+    {
+        // timer stays in the run loop, just never fires
+        CFRunLoopTimerSetNextFireDate(g_timer, CFAbsoluteTimeGetCurrent() + kTimerNever);
+    }
+};
+
+static DaemonSink g_sink;
+static MouseCountState* g_state;
 
+static void TimerFired(CFRunLoopTimerRef timer, void* info)
+{
+    g_state->timerFired();
+    DEBUG_LOG("mouse count changes: %u, sent: %u\n", g_state->changes(), g_state->sends());
+}
 
 // DeviceNotification
 //
-// This function deals with IOUSBInterface nodes we previously expressed an interest
-// in because they were USB mice.
-// This is used to keep track of USB mice getting terminated
+// This function deals with IOUSBInterface and IOHIDDevice nodes we previously expressed
+// an interest in because they were USB or Bluetooth mice.
+// This is used to keep track of mice getting terminated
 
 static void DeviceNotification(void* refCon, io_service_t service, natural_t messageType, void* messageArgument)
 {
     NotificationData* pData = (NotificationData*)refCon;
     if (kIOMessageServiceIsTerminated == messageType)
     {
-        if (g_MouseCount)
-            --g_MouseCount;
-        DEBUG_LOG("mouse count is now: %d\n", g_MouseCount);
+        g_state->mouseRemoved(GetTimeMicroseconds());
+        DEBUG_LOG("mouse count is now: %d\n", g_state->count());
         IOObjectRelease(pData->notification);
         free(pData);
-        SendMouseCount(g_MouseCount);
-    }
-}
-
-static uint64_t GetNumericProperty(io_service_t service, const char* name)
-{
-    // next check on alternate device in legacy tree
-    uint64_t value = 0;
-    CFStringRef str = CFStringCreateWithCString(kCFAllocatorDefault, name, CFStringGetSystemEncoding());
-    CFTypeRef prop = IORegistryEntryCreateCFProperty(service, str, kCFAllocatorDefault, 0);
-    if (prop)
-    {
-        if (CFNumberGetTypeID() == CFGetTypeID(prop) &&
-            CFNumberGetValue((CFNumberRef)prop, kCFNumberLongLongType, &value))
-        {
-            //DEBUG_LOG("property %s is = %llx\n", name, value);
-        }
-        CFRelease(prop);
     }
-    CFRelease(str);
-    return value;
 }
 
-static void CheckForMouseAndRegisterInterest(io_service_t service)
+static void RegisterMouseInterest(io_service_t service)
 {
-    // check for HID device that is a mouse
-    if (GetNumericProperty(service, "bInterfaceClass") == 3 &&
-        GetNumericProperty(service, "bInterfaceSubClass") == 1 &&
-        GetNumericProperty(service, "bInterfaceProtocol") == 2)
-    {
+    // matching dictionary only matches HID mice, so no need to check properties
 #ifdef DEBUG
-        unsigned idVendor = (unsigned)GetNumericProperty(service, "idVendor");
-        unsigned idProduct = (unsigned)GetNumericProperty(service, "idProduct");
-        DEBUG_LOG("found mouse %04x:%04x\n", idVendor, idProduct);
+    CFTypeRef vendor = IORegistryEntryCreateCFProperty(service, CFSTR("idVendor"), kCFAllocatorDefault, 0);
+    CFTypeRef product = IORegistryEntryCreateCFProperty(service, CFSTR("idProduct"), kCFAllocatorDefault, 0);
+    unsigned idVendor = 0, idProduct = 0;
+    if (vendor && CFNumberGetTypeID() == CFGetTypeID(vendor))
+        CFNumberGetValue((CFNumberRef)vendor, kCFNumberIntType, &idVendor);
+    if (product && CFNumberGetTypeID() == CFGetTypeID(product))
+        CFNumberGetValue((CFNumberRef)product, kCFNumberIntType, &idProduct);
+    if (vendor) CFRelease(vendor);
+    if (product) CFRelease(product);
+    DEBUG_LOG("found mouse %04x:%04x\n", idVendor, idProduct);
 #endif
-        NotificationData* pData = (NotificationData*)malloc(sizeof(*pData));
-        if (pData != NULL)
+    NotificationData* pData = (NotificationData*)malloc(sizeof(*pData));
+    if (pData != NULL)
+    {
+        kern_return_t kr = IOServiceAddInterestNotification(g_NotifyPort, service, kIOGeneralInterest, DeviceNotification, pData, &pData->notification);
+        if (KERN_SUCCESS != kr)
         {
-            kern_return_t kr = IOServiceAddInterestNotification(g_NotifyPort, service, kIOGeneralInterest, DeviceNotification, pData, &pData->notification);
-            if (KERN_SUCCESS != kr)
-            {
-                DEBUG_LOG("IOServiceAddInterestNotification returned 0x%08x\n", kr);
-                return;
-            }
-            ++g_MouseCount;
-            DEBUG_LOG("mouse count is now: %d\n", g_MouseCount);
+            DEBUG_LOG("IOServiceAddInterestNotification returned 0x%08x\n", kr);
+            free(pData);
+            return;
         }
+        g_state->mouseAdded(GetTimeMicroseconds());
+        DEBUG_LOG("mouse count is now: %d\n", g_state->count());
     }
 }
 
 // InterfaceAdded
 //
-// This function deals with USB devices as they are connected.  We look for HID
-// USB devices that are mice.
+// This function deals with USB and Bluetooth devices as they are connected.  Only
+// mice match (see CreateMouseMatching and CreateBluetoothPointerMatching).
 
 static void InterfaceAdded(void *refCon, io_iterator_t iter1)
 {
-    usleep(g_notificationDelay); // wait 20ms for entry to populate
-
-    int oldMouseCount = g_MouseCount;
     io_service_t service;
     while ((service = IOIteratorNext(iter1)))
     {
@@ -152,15 +177,52 @@ static void InterfaceAdded(void *refCon, io_iterator_t iter1)
         if (KERN_SUCCESS == kr1)
             DEBUG_LOG("name = '%s'\n", name);
 #endif
-
-        // check in the normal part of the registry
-        CheckForMouseAndRegisterInterest(service);
+        RegisterMouseInterest(service);
         IOObjectRelease(service);
     }
-    if (oldMouseCount != g_MouseCount)
-        SendMouseCount(g_MouseCount);
 }
 
+// DriverNotification/DriverAdded
+//
+// The trackpad (or mouse) driver is found by matching notification, so there is no
+// need to wait for it at startup.  MouseCount is sent as soon as it matches.
+
+static void DriverNotification(void* refCon, io_service_t service, natural_t messageType, void* messageArgument)
+{
+    if (kIOMessageServiceIsTerminated == messageType && service == g_ioservice)
+    {
+        DEBUG_LOG("driver terminated\n");
+        g_state->driverTerminated();
+        IOObjectRelease(g_ioserviceNotification);
+        g_ioserviceNotification = 0;
+        IOObjectRelease(g_ioservice);
+        g_ioservice = 0;
+    }
+}
+
+static void DriverAdded(void *refCon, io_iterator_t iter1)
+{
+    io_service_t service;
+    while ((service = IOIteratorNext(iter1)))
+    {
+        if (g_ioservice)
+        {
+            // already talking to a driver
+            IOObjectRelease(service);
+            continue;
+        }
+#ifdef DEBUG
+        io_name_t name;
+        if (KERN_SUCCESS == IORegistryEntryGetName(service, name))
+            DEBUG_LOG("driver matched: '%s'\n", name);
+#endif
+        g_ioservice = service;
+        kern_return_t kr = IOServiceAddInterestNotification(g_NotifyPort, service, kIOGeneralInterest, DriverNotification, NULL, &g_ioserviceNotification);
+        if (KERN_SUCCESS != kr)
+            DEBUG_LOG("IOServiceAddInterestNotification returned 0x%08x\n", kr);
+        g_state->driverMatched();
+    }
+}
 
 // SignalHandler
 //
@@ -173,9 +235,9 @@ static void SignalHandler1(int sigraised)
 
     // special shutdown sequence
     //  - no longer tracking MouseCount, so set to zero
-    //  - and send special -1 MouseCount so LED can be forced off 
-    SendMouseCount(0);
-    SendMouseCount(-1);
+    //  - and send special -1 MouseCount so LED can be forced off
+    if (g_state)
+        g_state->shutdown();
     
     // clean up here
     if (g_AddedIter)
@@ -183,6 +245,19 @@ static void SignalHandler1(int sigraised)
         IOObjectRelease(g_AddedIter);
         g_AddedIter = 0;
     }
+    if (g_HIDAddedIter)
+    {
+        IOObjectRelease(g_HIDAddedIter);
+        g_HIDAddedIter = 0;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (g_DriverIter[i])
+        {
+            IOObjectRelease(g_DriverIter[i]);
+            g_DriverIter[i] = 0;
+        }
+    }
     IONotificationPortDestroy(g_NotifyPort);
     
     if (g_ioservice)
@@ -195,6 +270,121 @@ static void SignalHandler1(int sigraised)
     _exit(0);
 }
 
+static CFMutableDictionaryRef CreateMouseMatching()
+{
+    // match only HID mice, so notifications come only for them
+    CFMutableDictionaryRef matchingDict = IOServiceMatching("IOUSBInterface");
+    if (!matchingDict)
+        return NULL;
+    CFMutableDictionaryRef propertyDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!propertyDict)
+    {
+        CFRelease(matchingDict);
+        return NULL;
+    }
+    static const struct { CFStringRef key; int value; } props[] =
+    {
+        { CFSTR("bInterfaceClass"), 3 },
+        { CFSTR("bInterfaceSubClass"), 1 },
+        { CFSTR("bInterfaceProtocol"), 2 },
+    };
+    for (int i = 0; i < (int)(sizeof(props)/sizeof(props[0])); i++)
+    {
+        CFNumberRef number = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &props[i].value);
+        CFDictionarySetValue(propertyDict, props[i].key, number);
+        CFRelease(number);
+    }
+    CFDictionarySetValue(matchingDict, CFSTR(kIOPropertyMatchKey), propertyDict);
+    CFRelease(propertyDict);
+    return matchingDict;
+}
+
+static CFMutableDictionaryRef CreateBluetoothPointerMatching()
+{
+    // Bluetooth HID devices with a pointer or mouse primary usage (generic desktop page).
+    // Only Bluetooth: USB mice have an IOHIDDevice too, but are counted by their
+    // IOUSBInterface (CreateMouseMatching).  An IOPropertyMatch array matches any entry.
+    CFMutableDictionaryRef matchingDict = IOServiceMatching("IOHIDDevice");
+    if (!matchingDict)
+        return NULL;
+    CFMutableArrayRef propertyArray = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    if (!propertyArray)
+    {
+        CFRelease(matchingDict);
+        return NULL;
+    }
+    static const int usagePage = 1;     // generic desktop
+    static const int usages[] = { 1, 2 };   // pointer, mouse
+    CFNumberRef page = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usagePage);
+    for (int i = 0; i < (int)(sizeof(usages)/sizeof(usages[0])); i++)
+    {
+        CFMutableDictionaryRef propertyDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        if (!propertyDict)
+            continue;
+        CFNumberRef usage = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usages[i]);
+        CFDictionarySetValue(propertyDict, CFSTR("Transport"), CFSTR("Bluetooth"));
+        CFDictionarySetValue(propertyDict, CFSTR("PrimaryUsagePage"), page);
+        CFDictionarySetValue(propertyDict, CFSTR("PrimaryUsage"), usage);
+        CFRelease(usage);
+        CFArrayAppendValue(propertyArray, propertyDict);
+        CFRelease(propertyDict);
+    }
+    CFRelease(page);
+    CFDictionarySetValue(matchingDict, CFSTR(kIOPropertyMatchKey), propertyArray);
+    CFRelease(propertyArray);
+    return matchingDict;
+}
+
+// ShowStatistics
+//
+// Maps ApplePS2Controller's statistics block (ApplePS2StatisticsUserClient)
+// and prints it (--statistics).  Nothing is read through the registry.
+// Opening the user client needs administrator privileges (sudo).
+//
+
+static void PrintStatistics(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+static int ShowStatistics()
+{
+    io_service_t controller = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceMatching("ApplePS2Controller"));
+    if (!controller)
+    {
+        ALWAYS_LOG("ApplePS2Controller not found\n");
+        return 1;
+    }
+    io_connect_t connect;
+    kern_return_t kr = IOServiceOpen(controller, mach_task_self(), 0, &connect);
+    IOObjectRelease(controller);
+    if (KERN_SUCCESS != kr)
+    {
+        ALWAYS_LOG("IOServiceOpen failed (0x%x), needs root\n", kr);
+        return 1;
+    }
+    mach_vm_address_t address = 0;
+    mach_vm_size_t size = 0;
+    kr = IOConnectMapMemory64(connect, kPS2StatisticsMemory, mach_task_self(), &address, &size, kIOMapAnywhere | kIOMapReadOnly);
+    int result = 1;
+    if (KERN_SUCCESS != kr)
+        ALWAYS_LOG("IOConnectMapMemory64 failed (0x%x)\n", kr);
+    else if (!validateStatistics((const void*)address, size))
+        ALWAYS_LOG("statistics block not recognized (%llu bytes)\n", (unsigned long long)size);
+    else
+    {
+        printStatistics((const PS2Statistics*)address, PrintStatistics);
+        result = 0;
+    }
+    if (KERN_SUCCESS == kr)
+        IOConnectUnmapMemory64(connect, kPS2StatisticsMemory, mach_task_self(), address);
+    IOServiceClose(connect);
+    return result;
+}
+
 // main
 //
 // Entry point from command line or (eventually) launchd LaunchDaemon
@@ -214,6 +404,8 @@ int main(int argc, const char *argv[])
     // parse arguments...
     for (int i = 1; i < argc; i++)
     {
+        if (0 == strcmp(argv[i], "--statistics"))
+            return ShowStatistics();
         if (0 == strcmp(argv[i], "--startupDelay"))
         {
             if (++i < argc && argv[i])
@@ -224,27 +416,23 @@ int main(int argc, const char *argv[])
             if (++i < argc && argv[i])
                 g_notificationDelay = atoi(argv[i]);
         }
+        if (0 == strcmp(argv[i], "--maxDelay"))
+        {
+            if (++i < argc && argv[i])
+                g_maxDelay = atoi(argv[i]);
+        }
     }
     DEBUG_LOG("g_startupDelay: %d\n", g_startupDelay);
     DEBUG_LOG("g_notificationDelay: %d\n", g_notificationDelay);
+    DEBUG_LOG("g_maxDelay: %d\n", g_maxDelay);
+
+    // no longer needed (everything is notification driven), but still honored if given
+    if (g_startupDelay > 0)
+        usleep(g_startupDelay);
+
+    static MouseCountState state(&g_sink, g_notificationDelay, g_maxDelay);
+    g_state = &state;
 
-    // Note: on Snow Leopard, the system is not ready to enumerate USB devices, so we wait a
-    // bit before continuing...
-    usleep(g_startupDelay);
-
-    // first check for trackpad driver
-	g_ioservice = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceMatching("ApplePS2SynapticsTouchPad"));
-	if (!g_ioservice)
-	{
-        // otherwise, talk to mouse driver
-        g_ioservice = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceMatching("ApplePS2Mouse"));
-        if (!g_ioservice)
-        {
-            DEBUG_LOG("No ApplePS2SynapticsTouchPad or ApplePS2Mouse found\n");
-            return -1;
-        }
-	}
-    
     // Set up a signal handler so we can clean up when we're interrupted from the command line
     // or otherwise asked to terminate.
     if (SIG_ERR == signal(SIGINT, SignalHandler1))
@@ -257,9 +445,8 @@ int main(int argc, const char *argv[])
     uname(&system_info);
     DEBUG_LOG("System version: %s\n", system_info.release);
 
-    // Create dictionary to match all USB devices
-    //CFMutableDictionaryRef matchingDict = IOServiceMatching(kIOUSBDeviceClassName);
-    CFMutableDictionaryRef matchingDict = IOServiceMatching("IOUSBInterface");
+    // Create dictionary to match USB mice
+    CFMutableDictionaryRef matchingDict = CreateMouseMatching();
     if (!matchingDict)
     {
         DEBUG_LOG("Can't create a USB matching dictionary\n");
@@ -272,7 +459,11 @@ int main(int argc, const char *argv[])
     CFRunLoopSourceRef runLoopSource = IONotificationPortGetRunLoopSource(g_NotifyPort);
     CFRunLoopRef runLoop = CFRunLoopGetCurrent();
     CFRunLoopAddSource(runLoop, runLoopSource, kCFRunLoopDefaultMode);
-    
+
+    // debounce timer, armed by MouseCountState
+    g_timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + kTimerNever, kTimerNever, 0, 0, TimerFired, NULL);
+    CFRunLoopAddTimer(runLoop, g_timer, kCFRunLoopDefaultMode);
+
     // Now set up a notification to be called when a device is first matched by I/O Kit.
     // Note that this will not catch any devices that were already plugged in so we take
     // care of those later.
@@ -288,6 +479,36 @@ int main(int argc, const char *argv[])
     InterfaceAdded(NULL, g_AddedIter);
     DEBUG_LOG("Initial iterate done\n");
 
+    // Same for Bluetooth mice
+    matchingDict = CreateBluetoothPointerMatching();
+    if (!matchingDict)
+    {
+        DEBUG_LOG("Can't create a Bluetooth matching dictionary\n");
+        return -1;
+    }
+    kr = IOServiceAddMatchingNotification(g_NotifyPort, kIOFirstMatchNotification, matchingDict, InterfaceAdded, NULL, &g_HIDAddedIter);
+    if (KERN_SUCCESS != kr)
+    {
+        DEBUG_LOG("IOServiceAddMatchingNotification failed(%08x)\n", kr);
+        return -1;
+    }
+    InterfaceAdded(NULL, g_HIDAddedIter);
+
+    // Same for the driver: trackpad driver first, otherwise mouse driver
+    static const char* drivers[] = { "ApplePS2SynapticsTouchPad", "ApplePS2Mouse" };
+    for (int i = 0; i < 2; i++)
+    {
+        kr = IOServiceAddMatchingNotification(g_NotifyPort, kIOMatchedNotification, IOServiceMatching(drivers[i]), DriverAdded, NULL, &g_DriverIter[i]);
+        if (KERN_SUCCESS != kr)
+        {
+            DEBUG_LOG("IOServiceAddMatchingNotification failed(%08x)\n", kr);
+            return -1;
+        }
+        DriverAdded(NULL, g_DriverIter[i]);
+    }
+    if (!g_ioservice)
+        DEBUG_LOG("No ApplePS2SynapticsTouchPad or ApplePS2Mouse yet, waiting\n");
+
     // Start the run loop. Now we'll receive notifications.
     CFRunLoopRun();
     
@@ -296,5 +517,3 @@ int main(int argc, const char *argv[])
     
     return 0;
 }
-
-
@@ -0,0 +1,196 @@
+//
+//  PS2ScanCodeDecoder.h
+//  VoodooPS2Keyboard
+//
+//  Scan code (set 1, translated) state machine used by ApplePS2Keyboard.
+//
+//  The decoder only sees bytes: reading the port, dispatching key events
+//  and talking to the keyboard stay in the driver, so it needs nothing but
+//  <stdint.h>.
+//
+
+#ifndef _PS2SCANCODEDECODER_H
+#define _PS2SCANCODEDECODER_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Definitions used to keep track of key state.   Key up/down state is tracked
+// in a bit list.  Bits are set for key-down, and cleared for key-up.  The bit
+// vector and macros for it's manipulation are defined here.
+//
+
+#define KBV_NUM_KEYCODES        512     // related with ADB_CONVERTER_LEN
+#define KBV_BITS_PER_UNIT       32      // for UInt32
+#define KBV_BITS_MASK           31
+#define KBV_BITS_SHIFT          5       // 1<<5 == 32, for cheap divide
+#define KBV_NUNITS ((KBV_NUM_KEYCODES + \
+            (KBV_BITS_PER_UNIT-1))/KBV_BITS_PER_UNIT)
+
+#define KBV_KEYDOWN(n) \
+    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] |= (1 << ((n) & KBV_BITS_MASK))
+
+#define KBV_KEYUP(n) \
+    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] &= ~(1 << ((n) & KBV_BITS_MASK))
+
+#define KBV_IS_KEYDOWN(n) \
+    (((_keyBitVector)[((n)>>KBV_BITS_SHIFT)] & (1 << ((n) & KBV_BITS_MASK))) != 0)
+
+#define KBV_NUM_SCANCODES       256
+
+// Special bits for _PS2ToPS2Map
+
+#define kBreaklessKey           0x01    // keys with this flag don't generate break codes
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2ScanCodeDecoder
+//
+// o  decode:
+//    o  Description:  Feeds one byte from the keyboard data stream.
+//    o  Result:       kPS2SC_Key when a complete (non-repeat) make or break was
+//                     decoded; extended/scanCode are filled in.  extended is
+//                     0 for normal keys and 1 for $E0/$E1 keys.  scanCode
+//                     includes the up bit ($80) for breaks.
+//                     kPS2SC_Reset for a spontaneous $AA $00 sequence.
+//                     kPS2SC_Acknowledge/kPS2SC_Resend for unexpected $FA/$FE.
+//                     kPS2SC_None otherwise (prefix, typematic repeat, etc.)
+//
+// o  breakless flags:
+//    o  Optional table of KBV_NUM_KEYCODES flags (same layout as _PS2flags).
+//       Keys with kBreaklessKey set are not tracked in the key bit vector,
+//       so they are never suppressed as repeats.
+//
+
+enum PS2ScanCodeResult
+{
+    kPS2SC_None,
+    kPS2SC_Key,
+    kPS2SC_Reset,
+    kPS2SC_Acknowledge,
+    kPS2SC_Resend,
+};
+
+class PS2ScanCodeDecoder
+{
+private:
+    enum
+    {
+        kAcknowledge = 0xFA,
+        kExtend = 0xE0,
+        kPause = 0xE1,
+        kResend = 0xFE,
+        kReset = 0xAA,
+        kUpBit = 0x80,
+    };
+
+    uint32_t            _keyBitVector[KBV_NUNITS];
+    const uint16_t*     _flags;
+    uint8_t             _extendCount;
+    uint8_t             _lastdata;
+
+public:
+    PS2ScanCodeDecoder() : _flags(0) { reset(); releaseAll(); }
+
+    inline void setFlags(const uint16_t* flags) { _flags = flags; }
+
+    // forget any partial sequence in progress
+    inline void reset() { _extendCount = 0; _lastdata = 0; }
+
+    // start out with all keys up
+    inline void releaseAll()
+    {
+        for (int i = 0; i < KBV_NUNITS; i++)
+            _keyBitVector[i] = 0;
+    }
+
+    inline bool isKeyDown(unsigned keyCode) const
+    {
+        return keyCode < KBV_NUM_KEYCODES && KBV_IS_KEYDOWN(keyCode);
+    }
+
+    inline PS2ScanCodeResult decode(uint8_t data, uint8_t& extended, uint8_t& scanCode)
+    {
+        // special case for $AA $00, spontaneous reset (usually due to static electricity)
+        if (kReset == _lastdata && 0x00 == data)
+        {
+            _extendCount = 0;
+            _lastdata = data;
+            return kPS2SC_Reset;
+        }
+        _lastdata = data;
+
+        // other data error conditions
+        if (kAcknowledge == data)
+            return kPS2SC_Acknowledge;
+        if (kResend == data)
+            return kPS2SC_Resend;
+
+        //
+        // See if this scan code introduces an extended key sequence.  If so, note
+        // it and then return.  Next time we get a key we'll finish the sequence.
+        //
+
+        if (kExtend == data)
+        {
+            _extendCount = 1;
+            return kPS2SC_None;
+        }
+
+        //
+        // See if this scan code introduces an extended key sequence for the Pause
+        // Key.  If so, note it and then return.  The next time we get a key, drop
+        // it.  The next key we get after that finishes the Pause Key sequence.
+        //
+        // The sequence actually sent to us by the keyboard for the Pause Key is:
+        //
+        // 1. E1  Extended Sequence for Pause Key
+        // 2. 1D  Useless Data, with Up Bit Cleared
+        // 3. 45  Pause Key, with Up Bit Cleared
+        // 4. E1  Extended Sequence for Pause Key
+        // 5. 9D  Useless Data, with Up Bit Set
+        // 6. C5  Pause Key, with Up Bit Set
+        //
+        // The reason items 4 through 6 are sent with the Pause Key is because the
+        // keyboard hardware never generates a release code for the Pause Key and
+        // the designers are being smart about it.  The sequence above translates
+        // to this parser as two separate events, as it should be -- one down key
+        // event and one up key event (for the Pause Key).
+        //
+
+        if (kPause == data)
+        {
+            _extendCount = 2;
+            return kPS2SC_None;
+        }
+
+        //
+        // Otherwise it is a normal scan code...
+        //
+
+        uint8_t ext = _extendCount;
+        if (_extendCount && 0 != --_extendCount)
+            return kPS2SC_None;
+
+        // Update our key bit vector, which maintains the up/down status of all keys.
+        unsigned keyCodeRaw = (ext << 8) | (data & ~kUpBit);
+        if (!_flags || !(_flags[keyCodeRaw] & kBreaklessKey))
+        {
+            if (!(data & kUpBit))
+            {
+                // typematic repeat of a key already down is suppressed
+                if (KBV_IS_KEYDOWN(keyCodeRaw))
+                    return kPS2SC_None;
+                KBV_KEYDOWN(keyCodeRaw);
+            }
+            else
+            {
+                KBV_KEYUP(keyCodeRaw);
+            }
+        }
+        extended = ext;
+        scanCode = data;
+        return kPS2SC_Key;
+    }
+};
+
+#endif /* _PS2SCANCODEDECODER_H */
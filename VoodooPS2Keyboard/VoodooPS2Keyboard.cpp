@@ -34,6 +34,7 @@
 #include "ApplePS2ToADBMap.h"
 #include "VoodooPS2Controller.h"
 #include "VoodooPS2Keyboard.h"
+#include "PS2ParamSchema.h"
 #include "ApplePS2ToADBMap.h"
 #include "AppleACPIPS2Nub.h"
 #include <IOKit/hidsystem/ev_keymap.h>
@@ -69,6 +70,10 @@ void* _org_rehabman_dontstrip_[] =
 #define kMacroInversion                     "Macro Inversion"
 #define kMacroTranslation                   "Macro Translation"
 #define kMaxMacroTime                       "MaximumMacroTime"
+#define kTypematicRate                      "TypematicRate"
+#define kResetKeyboard                      "ResetKeyboard"
+#define kKeyboardReadyTime                  "KeyboardReadyTime"
+#define kBatchKeyboardEvents                "BatchKeyboardEvents"
 
 // Definitions for Macro Inversion data format
 //REVIEW: This should really be defined as some sort of structure
@@ -81,6 +86,12 @@ void* _org_rehabman_dontstrip_[] =
 #define kSequenceBytesOffset    (kPrefixBytes+0)
 #define kMinMacroInversion      (kPrefixBytes+2)
 
+// maximum number of commands in the request built by initKeyboard
+#define kInitKeyboardCommands   16
+
+// how long initKeyboard waits for the BAT result after a reset (ms)
+#define kKeyboardBATTimeout     750
+
 // Constants for other services to communicate with
 
 #define kIOHIDSystem                        "IOHIDSystem"
@@ -183,11 +194,27 @@ error:
     return false;
 }
 
+static UInt16* parseAction(const char* psz)
+{
+    // size for worst case (each entry separated by a comma), plus terminator
+    int size = 2;
+    for (const char* p = psz; *p; p++)
+        if (',' == *p)
+            ++size;
+    UInt16* result = new UInt16[size];
+    if (result && !parseAction(psz, result, size))
+    {
+        delete[] result;
+        result = NULL;
+    }
+    return result;
+}
+
 #ifdef DEBUG
 static void logKeySequence(const char* header, UInt16* pAction)
 {
     DEBUG_LOG("ApplePS2Keyboard: %s { ", header);
-    for (; *pAction; ++pAction)
+    for (; pAction && *pAction; ++pAction)
     {
         DEBUG_LOG("%04x, ", *pAction);
     }
@@ -209,12 +236,25 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     
     // initialize state
     _device                    = 0;
-    _extendCount               = 0;
+    _stats                     = statisticsSink();
+    _batchStats                = batchStatisticsSink();
     _interruptHandlerInstalled = false;
     _ledState                  = 0;
-    _lastdata = 0;
+    _typematic = 0x2B;      // 10.9 cps, 500 ms delay (same as kDP_SetDefaults)
+    _resetkeyboard = false;
+    _initStartTime = 0;
+    
+    _keyEventCount = 0;
+    _batchActive = false;
+    _batchkeys = false;
+    _batchEvents = 0;
     
     _swapcommandoption = false;
+    _swapcapsctrl = false;
+    _appkeyrightwin = false;
+    _appkeyfn = false;
+    _hangulhanja = false;
+    _isolayout = false;
     _sleepEjectTimer = 0;
     _cmdGate = 0;
     
@@ -241,9 +281,6 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     _macroMaxTime = 25000000ULL;
     _macroTimer = 0;
 
-    // start out with all keys up
-    bzero(_keyBitVector, sizeof(_keyBitVector));
-    
     // make separate copy of ADB translation table.
     bcopy(PS2ToADBMapStock, _PS2ToADBMapMapped, sizeof(_PS2ToADBMapMapped));
     
@@ -255,18 +292,47 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
         _PS2ToPS2Map[i] = i;
     }
     bcopy(_PS2flagsStock, _PS2flags, sizeof(_PS2flags));
+    _decoder.setFlags(_PS2flags);
     
     // Setup default swipe actions
-    parseAction("3b d, 37 d, 7e d, 7e u, 37 u, 3b u", _actionSwipeUp, countof(_actionSwipeUp));
-    parseAction("3b d, 37 d, 7d d, 7d u, 37 u, 3b u", _actionSwipeDown, countof(_actionSwipeDown));
-    parseAction("3b d, 37 d, 7b d, 7b u, 37 u, 3b u", _actionSwipeLeft, countof(_actionSwipeLeft));
-    parseAction("3b d, 37 d, 7c d, 7c u, 37 u, 3b u", _actionSwipeRight, countof(_actionSwipeRight));
+    _swipeThreadCall = 0;
+    _swipeLastTime = 0;
+    bzero(_actionSwipe, sizeof(_actionSwipe));
+    _swipeStats = swipeStatisticsSink();
+    _swipeLock = IOLockAlloc();
+    if (!_swipeLock)
+        return false;
+    setSwipeAction(kSwipeUp, "3b d, 37 d, 7e d, 7e u, 37 u, 3b u");
+    setSwipeAction(kSwipeDown, "3b d, 37 d, 7d d, 7d u, 37 u, 3b u");
+    setSwipeAction(kSwipeLeft, "3b d, 37 d, 7b d, 7b u, 37 u, 3b u");
+    setSwipeAction(kSwipeRight, "3b d, 37 d, 7c d, 7c u, 37 u, 3b u");
 
     return true;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2Keyboard::free()
+{
+    for (int i = 0; i < kSwipeCount; i++)
+    {
+        if (_actionSwipe[i])
+        {
+            delete[] _actionSwipe[i];
+            _actionSwipe[i] = 0;
+        }
+    }
+    if (_swipeLock)
+    {
+        IOLockFree(_swipeLock);
+        _swipeLock = 0;
+    }
+    
+    super::free();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 ApplePS2Keyboard* ApplePS2Keyboard::probe(IOService * provider, SInt32 * score)
 {
     DEBUG_LOG("ApplePS2Keyboard::probe entered...\n");
@@ -357,10 +423,10 @@ ApplePS2Keyboard* ApplePS2Keyboard::probe(IOService * provider, SInt32 * score)
     OSSafeReleaseNULL(config);
     
 #ifdef DEBUG
-    logKeySequence("Swipe Up:", _actionSwipeUp);
-    logKeySequence("Swipe Down:", _actionSwipeDown);
-    logKeySequence("Swipe Left:", _actionSwipeLeft);
-    logKeySequence("Swipe Right:", _actionSwipeRight);
+    logKeySequence("Swipe Up:", _actionSwipe[kSwipeUp]);
+    logKeySequence("Swipe Down:", _actionSwipe[kSwipeDown]);
+    logKeySequence("Swipe Left:", _actionSwipe[kSwipeLeft]);
+    logKeySequence("Swipe Right:", _actionSwipe[kSwipeRight]);
 #endif
     
     // Note: always return success for keyboard, so no need to do this!
@@ -426,6 +492,9 @@ bool ApplePS2Keyboard::start(IOService * provider)
 
     _device = (ApplePS2KeyboardDevice *)provider;
     _device->retain();
+    _stats = _device->getController()->getStreamStatistics(kDT_Keyboard);
+    _batchStats = _device->getController()->getKeyboardBatchStatistics();
+    _swipeStats = _device->getController()->getKeyboardSwipeStatistics();
     
     //
     // Setup workloop with command gate for thread syncronization...
@@ -450,6 +519,9 @@ bool ApplePS2Keyboard::start(IOService * provider)
     pWorkLoop->addEventSource(_sleepEjectTimer);
     pWorkLoop->addEventSource(_cmdGate);
     
+    // _swipeThreadCall is used to replay swipe actions
+    _swipeThreadCall = thread_call_allocate((thread_call_func_t)swipeCallout, (thread_call_param_t)this);
+    
     // _macroTimer is used in for macro inversion
     _macroTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Keyboard::onMacroTimer));
     if (_macroTimer)
@@ -777,31 +849,99 @@ OSData** ApplePS2Keyboard::loadMacroData(OSDictionary* dict, const char* name)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Keyboard::setParamPropertiesGated(OSDictionary * dict)
+// bits for PS2ParamEntry::affects
+enum
 {
-    if (NULL == dict)
-        return;
+    kAffectsADBMap = 0x01,
+};
+
+void ApplePS2Keyboard::buildADBMap()
+{
+    //
+    // Rebuild the entries of _PS2ToADBMap controlled by user preferences,
+    // always starting from _PS2ToADBMapMapped.
+    //
+
+    if (_swapcapsctrl) {
+        _PS2ToADBMap[0x3a]  = _PS2ToADBMapMapped[0x1d];
+        _PS2ToADBMap[0x1d]  = _PS2ToADBMapMapped[0x3a];
+    }
+    else {
+        _PS2ToADBMap[0x3a]  = _PS2ToADBMapMapped[0x3a];
+        _PS2ToADBMap[0x1d]  = _PS2ToADBMapMapped[0x1d];
+    }
     
-//REVIEW: this code needs cleanup (should be table driven like mouse/trackpad)
+    if (_swapcommandoption) {
+        _PS2ToADBMap[0x38]  = _PS2ToADBMapMapped[0x15b];
+        _PS2ToADBMap[0x15b] = _PS2ToADBMapMapped[0x38];
+        _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x15c];
+        _PS2ToADBMap[0x15c] = _PS2ToADBMapMapped[0x138];
+    }
+    else {
+        _PS2ToADBMap[0x38]  = _PS2ToADBMapMapped[0x38];
+        _PS2ToADBMap[0x15b] = _PS2ToADBMapMapped[0x15b];
+        _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x138];
+        _PS2ToADBMap[0x15c] = _PS2ToADBMapMapped[0x15c];
+    }
 
-    // get time before sleep button takes effect
-	if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kSleepPressTime)))
-    {
-        _maxsleeppresstime = num->unsigned32BitValue();
-        setProperty(kSleepPressTime, _maxsleeppresstime, 32);
+    // these two options are mutually exclusive
+    // kMakeApplicationKeyAppleFN is ignored if kMakeApplicationKeyRightWindows is set
+    if (_appkeyrightwin)
+        _PS2ToADBMap[0x15d] = _swapcommandoption ?  0x3d : 0x36;  // ADB = right-option/right-command
+    // not implemented yet (Note: maybe not true any more)
+    // Apple Fn key works well, but no combined key action was made.
+    else if (_appkeyfn)
+        _PS2ToADBMap[0x15d] = 0x3f; // ADB = AppleFN
+    else
+        _PS2ToADBMap[0x15d] = _PS2ToADBMapMapped[0x15d];
+    
+    if (_hangulhanja) {
+        _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0xf2];    // Right alt becomes Hangul
+        _PS2ToADBMap[0x11d] = _PS2ToADBMapMapped[0xf1];    // Right control becomes Hanja
     }
-    // get time before eject button takes effect (no modifiers)
-    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kHIDF12EjectDelay)))
-    {
-        _f12ejectdelay = num->unsigned32BitValue();
-        setProperty(kHIDF12EjectDelay, _f12ejectdelay, 32);
+    else {
+        // 0x138 already set above (depends on _swapcommandoption)
+        _PS2ToADBMap[0x11d] = _PS2ToADBMapMapped[0x11d];
     }
-    // get time between keys part of a macro "inversion"
-    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kMaxMacroTime)))
-    {
-        _macroMaxTime = num->unsigned64BitValue();
-        setProperty(kMaxMacroTime, _macroMaxTime, 64);
+    
+    // ISO specific mapping to match ADB keyboards
+    // This should really be done in the keymaps.
+    if (_isolayout) {
+            _PS2ToADBMap[0x29]  = _PS2ToADBMapMapped[0x56];     //Europe2 ''
+            _PS2ToADBMap[0x56]  = _PS2ToADBMapMapped[0x29];     //Grave '~'
     }
+    else {
+        _PS2ToADBMap[0x29]  = _PS2ToADBMapMapped[0x29];
+        _PS2ToADBMap[0x56]  = _PS2ToADBMapMapped[0x56];
+    }
+}
+
+void ApplePS2Keyboard::setParamPropertiesGated(OSDictionary * dict)
+{
+    if (NULL == dict)
+        return;
+    
+    // Note: must be kept sorted by name (see PS2ParamSchema.h)
+    const PS2ParamEntry schema[]={
+        {kBatchKeyboardEvents,              kPS2P_Bool,     &_batchkeys},
+        {kHIDF12EjectDelay,                 kPS2P_Int32,    &_f12ejectdelay},
+        {kLogScanCodes,                     kPS2P_Int32,    &_logscancodes},
+        {kMakeApplicationKeyAppleFN,        kPS2P_Bool,     &_appkeyfn, 0, 0, kAffectsADBMap},
+        {kMakeApplicationKeyRightWindows,   kPS2P_Bool,     &_appkeyrightwin, 0, 0, kAffectsADBMap},
+        {kMakeRightModsHangulHanja,         kPS2P_Bool,     &_hangulhanja, 0, 0, kAffectsADBMap},
+        {kMaxMacroTime,                     kPS2P_Int64,    &_macroMaxTime},
+        {kResetKeyboard,                    kPS2P_Bool,     &_resetkeyboard},
+        {kSleepPressTime,                   kPS2P_Int32,    &_maxsleeppresstime},
+        {kSwapCapsLockLeftControl,          kPS2P_Bool,     &_swapcapsctrl, 0, 0, kAffectsADBMap},
+        {kSwapCommandOption,                kPS2P_Bool,     &_swapcommandoption, 0, 0, kAffectsADBMap},
+        {kTypematicRate,                    kPS2P_Int32,    &_typematic, 0, 0x7F},
+        {kUseISOLayoutKeyboard,             kPS2P_Bool,     &_isolayout, 0, 0, kAffectsADBMap},
+    };
+#ifdef DEBUG
+    checkParamSchema("VoodooPS2Keyboard", schema, countof(schema));
+#endif
+
+    PS2ParamResult result = applyParamSchema(this, schema, countof(schema), dict);
     
     if (_fkeymodesupported)
     {
@@ -814,148 +954,45 @@ void ApplePS2Keyboard::setParamPropertiesGated(OSDictionary * dict)
         }
         if (oldfkeymode != _fkeymode)
         {
+            ++result.changed;
             OSArray* keys = _fkeymode ? _keysStandard : _keysSpecial;
             assert(keys);
             loadCustomPS2Map(keys);
         }
     }
     
-    //
-    // Configure user preferences from Info.plist
-    //
-    OSBoolean* xml = OSDynamicCast(OSBoolean, dict->getObject(kSwapCapsLockLeftControl));
-    if (xml) {
-        if (xml->isTrue()) {
-            _PS2ToADBMap[0x3a]  = _PS2ToADBMapMapped[0x1d];
-            _PS2ToADBMap[0x1d]  = _PS2ToADBMapMapped[0x3a];
-        }
-        else {
-            _PS2ToADBMap[0x3a]  = _PS2ToADBMapMapped[0x3a];
-            _PS2ToADBMap[0x1d]  = _PS2ToADBMapMapped[0x1d];
-        }
-        setProperty(kSwapCapsLockLeftControl, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
-    
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kSwapCommandOption));
-    if (xml) {
-        if (xml->isTrue()) {
-            _swapcommandoption = true;
-            _PS2ToADBMap[0x38]  = _PS2ToADBMapMapped[0x15b];
-            _PS2ToADBMap[0x15b] = _PS2ToADBMapMapped[0x38];
-            _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x15c];
-            _PS2ToADBMap[0x15c] = _PS2ToADBMapMapped[0x138];
-        }
-        else {
-            _swapcommandoption = false;
-            _PS2ToADBMap[0x38]  = _PS2ToADBMapMapped[0x38];
-            _PS2ToADBMap[0x15b] = _PS2ToADBMapMapped[0x15b];
-            _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x138];
-            _PS2ToADBMap[0x15c] = _PS2ToADBMapMapped[0x15c];
-        }
-        setProperty(kSwapCommandOption, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
+    // user preferences for modifier keys, etc.
+    if (result.affects & kAffectsADBMap)
+        buildADBMap();
 
     // special hack for HP Envy brightness
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kBrightnessHack));
+    OSBoolean* xml = OSDynamicCast(OSBoolean, dict->getObject(kBrightnessHack));
     if (xml && xml->isTrue())
     {
         //REVIEW: should really read the key assignments via Info.plist instead of hardcoding to F2/F3
         _brightnessHack = true;
     }
 
-    // these two options are mutually exclusive
-    // kMakeApplicationKeyAppleFN is ignored if kMakeApplicationKeyRightWindows is set
-    bool temp = false;
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kMakeApplicationKeyRightWindows));
-    if (xml) {
-        if (xml->isTrue()) {
-            _PS2ToADBMap[0x15d] = _swapcommandoption ?  0x3d : 0x36;  // ADB = right-option/right-command
-            temp = true;
-        }
-        else {
-            _PS2ToADBMap[0x15d] = _PS2ToADBMapMapped[0x15d];
-        }
-        setProperty(kMakeApplicationKeyRightWindows, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
-    // not implemented yet (Note: maybe not true any more)
-    // Apple Fn key works well, but no combined key action was made.
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kMakeApplicationKeyAppleFN));
-    if (xml) {
-        if (!temp) {
-            if (xml->isTrue()) {
-                _PS2ToADBMap[0x15d] = 0x3f; // ADB = AppleFN
-            }
-            else {
-                _PS2ToADBMap[0x15d] = _PS2ToADBMapMapped[0x15d];
-            }
-        }
-        setProperty(kMakeApplicationKeyAppleFN, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
-    
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kMakeRightModsHangulHanja));
-    if (xml) {
-        if (xml->isTrue()) {
-            _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0xf2];    // Right alt becomes Hangul
-            _PS2ToADBMap[0x11d] = _PS2ToADBMapMapped[0xf1];    // Right control becomes Hanja
-        }
-        else {
-            if (_swapcommandoption)
-                _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x15c];
-            else
-                _PS2ToADBMap[0x138] = _PS2ToADBMapMapped[0x138];
-            _PS2ToADBMap[0x11d] = _PS2ToADBMapMapped[0x11d];
-        }
-        setProperty(kMakeRightModsHangulHanja, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
-    
-    // ISO specific mapping to match ADB keyboards
-    // This should really be done in the keymaps.
-    xml = OSDynamicCast(OSBoolean, dict->getObject(kUseISOLayoutKeyboard));
-    if (xml) {
-        if (xml->isTrue()) {
-            _PS2ToADBMap[0x29]  = _PS2ToADBMapMapped[0x56];     //Europe2 ''
-            _PS2ToADBMap[0x56]  = _PS2ToADBMapMapped[0x29];     //Grave '~'
-        }
-        else {
-            _PS2ToADBMap[0x29]  = _PS2ToADBMapMapped[0x29];
-            _PS2ToADBMap[0x56]  = _PS2ToADBMapMapped[0x56];
-        }
-        setProperty(kUseISOLayoutKeyboard, xml->isTrue() ? kOSBooleanTrue : kOSBooleanFalse);
-    }
-    
-    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kLogScanCodes))) {
-        _logscancodes = num->unsigned32BitValue();
-        setProperty(kLogScanCodes, num);
-    }
-    
-    // now load swipe Action configuration data
-    OSString* str = OSDynamicCast(OSString, dict->getObject(kActionSwipeUp));
-    if (str)
+    // now load swipe Action configuration data (parse only when changed)
+    static const struct { const char* name; int action; } swipes[] =
     {
-        parseAction(str->getCStringNoCopy(), _actionSwipeUp, countof(_actionSwipeUp));
-        setProperty(kActionSwipeUp, str);
-    }
-    
-    str = OSDynamicCast(OSString, dict->getObject(kActionSwipeDown));
-    if (str)
-    {
-        parseAction(str->getCStringNoCopy(), _actionSwipeDown, countof(_actionSwipeDown));
-        setProperty(kActionSwipeDown, str);
-    }
-    
-    str = OSDynamicCast(OSString, dict->getObject(kActionSwipeLeft));
-    if (str)
-    {
-        parseAction(str->getCStringNoCopy(), _actionSwipeLeft, countof(_actionSwipeLeft));
-        setProperty(kActionSwipeLeft, str);
-    }
-    
-    str = OSDynamicCast(OSString, dict->getObject(kActionSwipeRight));
-    if (str)
+        { kActionSwipeUp,       kSwipeUp },
+        { kActionSwipeDown,     kSwipeDown },
+        { kActionSwipeLeft,     kSwipeLeft },
+        { kActionSwipeRight,    kSwipeRight },
+    };
+    for (int i = 0; i < countof(swipes); i++)
     {
-        parseAction(str->getCStringNoCopy(), _actionSwipeRight, countof(_actionSwipeRight));
-        setProperty(kActionSwipeRight, str);
+        OSString* str = OSDynamicCast(OSString, dict->getObject(swipes[i].name));
+        if (str && !str->isEqualTo(getProperty(swipes[i].name)))
+        {
+            ++result.changed;
+            setSwipeAction(swipes[i].action, str->getCStringNoCopy());
+            setProperty(swipes[i].name, str);
+        }
     }
+
+    publishParamResult(this, result);
 }
 
 IOReturn ApplePS2Keyboard::setParamProperties(OSDictionary *dict)
@@ -1001,6 +1038,17 @@ void ApplePS2Keyboard::stop(IOService * provider)
     //
 
     setKeyboardEnable(false);
+    
+    // no more swipe actions (wait for one in progress to finish)
+    IOLockLock(_swipeLock);
+    thread_call_t swipeThreadCall = _swipeThreadCall;
+    _swipeThreadCall = 0;
+    IOLockUnlock(_swipeLock);
+    if (swipeThreadCall)
+    {
+        thread_call_cancel_wait(swipeThreadCall);
+        thread_call_free(swipeThreadCall);
+    }
 
     // free up the command gate
     IOWorkLoop* pWorkLoop = getWorkLoop();
@@ -1110,68 +1158,74 @@ IOReturn ApplePS2Keyboard::message(UInt32 type, IOService* provider, void* argum
     {
         case kPS2M_swipeDown:
             DEBUG_LOG("ApplePS2Keyboard: Synaptic Trackpad call Swipe Down\n");
-            sendKeySequence(_actionSwipeDown);
+            queueSwipeAction(kSwipeDown, (uint64_t*)argument);
             break;
             
         case kPS2M_swipeLeft:
             DEBUG_LOG("ApplePS2Keyboard: Synaptic Trackpad call Swipe Left\n");
-            sendKeySequence(_actionSwipeLeft);
+            queueSwipeAction(kSwipeLeft, (uint64_t*)argument);
             break;
             
         case kPS2M_swipeRight:
             DEBUG_LOG("ApplePS2Keyboard: Synaptic Trackpad call Swipe Right\n");
-            sendKeySequence(_actionSwipeRight);
+            queueSwipeAction(kSwipeRight, (uint64_t*)argument);
             break;
             
         case kPS2M_swipeUp:
             DEBUG_LOG("ApplePS2Keyboard: Synaptic Trackpad call Swipe Up\n");
-            sendKeySequence(_actionSwipeUp);
+            queueSwipeAction(kSwipeUp, (uint64_t*)argument);
             break;
             
         case kIOACPIMessageDeviceNotification:
-            if (NULL != argument) {
-                UInt32 arg = *static_cast<UInt32*>(argument);
-                if ((arg & 0xFFFF0000) == 0)
-                {
-                    UInt8 packet[kPacketLength];
-                    packet[0] = arg >> 8;
-                    packet[1] = arg;
-                    if (1 == packet[0] || 2 == packet[0])
-                    {
-                        // mark packet with timestamp
-                        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-                        if (!_macroInversion || !invertMacros(packet))
-                        {
-                            // normal packet
-                            dispatchKeyboardEventWithPacket(packet);
-                        }
-                    }
-                    if (3 == packet[0] || 4 == packet[0])
-                    {
-                        // code 3 and 4 indicate send both make and break
-                        packet[0] -= 2;
-                        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-                        if (!_macroInversion || !invertMacros(packet))
-                        {
-                            // normal packet (make)
-                            dispatchKeyboardEventWithPacket(packet);
-                        }
-                        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-                        packet[1] |= 0x80; // break code
-                        if (!_macroInversion || !invertMacros(packet))
-                        {
-                            // normal packet (break)
-                            dispatchKeyboardEventWithPacket(packet);
-                        }
-                    }
-                }
-            }
+            // comes in on the ACPI thread; the packet state (macros, batch)
+            // belongs to our work loop
+            if (NULL != argument && _cmdGate)
+                _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Keyboard::acpiNotificationGated), argument);
             break;
     }
 
     return kIOReturnSuccess;
 }
 
+void ApplePS2Keyboard::acpiNotificationGated(UInt32* argument)
+{
+    UInt32 arg = *argument;
+    if ((arg & 0xFFFF0000) == 0)
+    {
+        UInt8 packet[kPacketLength];
+        packet[0] = arg >> 8;
+        packet[1] = arg;
+        if (1 == packet[0] || 2 == packet[0])
+        {
+            // mark packet with timestamp
+            clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+            if (!_macroInversion || !invertMacros(packet))
+            {
+                // normal packet
+                dispatchKeyboardEventWithPacket(packet);
+            }
+        }
+        if (3 == packet[0] || 4 == packet[0])
+        {
+            // code 3 and 4 indicate send both make and break
+            packet[0] -= 2;
+            clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+            if (!_macroInversion || !invertMacros(packet))
+            {
+                // normal packet (make)
+                dispatchKeyboardEventWithPacket(packet);
+            }
+            clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+            packet[1] |= 0x80; // break code
+            if (!_macroInversion || !invertMacros(packet))
+            {
+                // normal packet (break)
+                dispatchKeyboardEventWithPacket(packet);
+            }
+        }
+    }
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 PS2InterruptResult ApplePS2Keyboard::interruptOccurred(UInt8 data)   // PS2InterruptAction
@@ -1188,110 +1242,63 @@ PS2InterruptResult ApplePS2Keyboard::interruptOccurred(UInt8 data)   // PS2Inter
     //
     
     UInt8* packet = _ringBuffer.head();
+    UInt8 extended, scanCode;
     
-    // special case for $AA $00, spontaneous reset (usually due to static electricity)
-    if (kSC_Reset == _lastdata && 0x00 == data)
-    {
-        IOLog("%s: Unexpected reset (%02x %02x) request from PS/2 controller.\n", getName(), _lastdata, data);
-        
-        // buffer a packet that will cause a reset in work loop
-        packet[0] = 0x00;
-        packet[1] = kSC_Reset;
-        // mark packet with timestamp
-        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-        _ringBuffer.advanceHead(kPacketLength);
-        _extendCount = 0;
-        return kPS2IR_packetReady;
-    }
-    _lastdata = data;
-    
-    // other data error conditions
-    if (kSC_Acknowledge == data)
-    {
-        IOLog("%s: Unexpected acknowledge (%02x) from PS/2 controller.\n", getName(), data);
-        return kPS2IR_packetBuffering;
-    }
-    if (kSC_Resend == data)
-    {
-        IOLog("%s: Unexpected resend (%02x) request from PS/2 controller.\n", getName(), data);
-        return kPS2IR_packetBuffering;
-    }
-    
-    //
-    // See if this scan code introduces an extended key sequence.  If so, note
-    // it and then return.  Next time we get a key we'll finish the sequence.
-    //
-    
-    if (data == kSC_Extend)
-    {
-        _extendCount = 1;
-        return kPS2IR_packetBuffering;
-    }
-    
-    //
-    // See if this scan code introduces an extended key sequence for the Pause
-    // Key.  If so, note it and then return.  The next time we get a key, drop
-    // it.  The next key we get after that finishes the Pause Key sequence.
-    //
-    // The sequence actually sent to us by the keyboard for the Pause Key is:
-    //
-    // 1. E1  Extended Sequence for Pause Key
-    // 2. 1D  Useless Data, with Up Bit Cleared
-    // 3. 45  Pause Key, with Up Bit Cleared
-    // 4. E1  Extended Sequence for Pause Key
-    // 5. 9D  Useless Data, with Up Bit Set
-    // 6. C5  Pause Key, with Up Bit Set
-    //
-    // The reason items 4 through 6 are sent with the Pause Key is because the
-    // keyboard hardware never generates a release code for the Pause Key and
-    // the designers are being smart about it.  The sequence above translates
-    // to this parser as two separate events, as it should be -- one down key
-    // event and one up key event (for the Pause Key).
-    //
-    
-    if (data == kSC_Pause)
+    switch (_decoder.decode(data, extended, scanCode))
     {
-        _extendCount = 2;
-        return kPS2IR_packetBuffering;
+        case kPS2SC_Reset:
+            // spontaneous reset (usually due to static electricity)
+            IOLog("%s: Unexpected reset (%02x %02x) request from PS/2 controller.\n", getName(), kSC_Reset, data);
+            
+            // buffer a packet that will cause a reset in work loop
+            packet[0] = 0x00;
+            packet[1] = kSC_Reset;
+            // mark packet with timestamp
+            clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+            _ringBuffer.advanceHead(kPacketLength);
+            return kPS2IR_packetReady;
+            
+        // other data error conditions
+        case kPS2SC_Acknowledge:
+            IOLog("%s: Unexpected acknowledge (%02x) from PS/2 controller.\n", getName(), data);
+            ++_stats->dropped;
+            return kPS2IR_packetBuffering;
+            
+        case kPS2SC_Resend:
+            IOLog("%s: Unexpected resend (%02x) request from PS/2 controller.\n", getName(), data);
+            ++_stats->dropped;
+            return kPS2IR_packetBuffering;
+            
+        case kPS2SC_Key:
+            // non-repeat make, or just break found, buffer it and dispatch
+            packet[0] = extended + 1;  // packet[0] = 0 is special packet, so add one
+            packet[1] = scanCode;
+            // mark packet with timestamp
+            clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+            _ringBuffer.advanceHead(kPacketLength);
+            return kPS2IR_packetReady;
+            
+        default:
+            // prefix ($E0/$E1) or repeat of key already down
+            return kPS2IR_packetBuffering;
     }
-    
-    //
-    // Otherwise it is a normal scan code, packetize it...
-    //
-    
-    UInt8 extended = _extendCount;
-    if (!_extendCount || 0 == --_extendCount)
-    {
-        // Update our key bit vector, which maintains the up/down status of all keys.
-        unsigned keyCodeRaw =  (extended << 8) | (data & ~kSC_UpBit);
-        if (!(_PS2flags[keyCodeRaw] & kBreaklessKey))
-        {
-            if (!(data & kSC_UpBit))
-            {
-                if (KBV_IS_KEYDOWN(keyCodeRaw))
-                    return kPS2IR_packetBuffering;
-                KBV_KEYDOWN(keyCodeRaw);
-            }
-            else
-            {
-                KBV_KEYUP(keyCodeRaw);
-            }
-        }
-        // non-repeat make, or just break found, buffer it and dispatch
-        packet[0] = extended + 1;  // packet[0] = 0 is special packet, so add one
-        packet[1] = data;
-        // mark packet with timestamp
-        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-        _ringBuffer.advanceHead(kPacketLength);
-        return kPS2IR_packetReady;
-    }
-    return kPS2IR_packetBuffering;
 }
 
 void ApplePS2Keyboard::packetReady()
 {
     // empty the ring buffer, dispatching each packet...
     // each packet is always two bytes, for simplicity...
+    if (_ringBuffer.count() < kPacketLength)
+        return;
+    
+    noteRingCount(_stats, _ringBuffer.count());
+
+    // oldest packet in this drain, for drain latency
+    uint64_t first_abs = *(uint64_t*)(&_ringBuffer.tail()[kPacketTimeOffset]);
+    
+    // in batch mode, events are collected and dispatched after the drain
+    _batchActive = _batchkeys;
+    _batchEvents = 0;
     while (_ringBuffer.count() >= kPacketLength)
     {
         UInt8* packet = _ringBuffer.tail();
@@ -1300,6 +1307,7 @@ void ApplePS2Keyboard::packetReady()
             if (!_macroInversion || !invertMacros(packet))
             {
                 // normal packet
+                ++_stats->packets;
                 dispatchKeyboardEventWithPacket(packet);
             }
         }
@@ -1310,6 +1318,51 @@ void ApplePS2Keyboard::packetReady()
         }
         _ringBuffer.advanceTail(kPacketLength);
     }
+    if (!_batchActive)
+        return;
+    flushKeyEvents();
+    _batchActive = false;
+    
+    // count batch size and drain latency (interrupt to dispatch complete)
+    uint64_t now_abs, latency;
+    clock_get_uptime(&now_abs);
+    absolutetime_to_nanoseconds(now_abs-first_abs, &latency);
+    ++_batchStats->drains;
+    _batchStats->events += _batchEvents;
+    _batchStats->eventsLast = _batchEvents;
+    if (_batchEvents > _batchStats->eventsMax)
+        _batchStats->eventsMax = _batchEvents;
+    _batchStats->latency += latency;
+    if (latency > _batchStats->latencyMax)
+        _batchStats->latencyMax = latency;
+}
+
+void ApplePS2Keyboard::queueKeyEvent(unsigned int keyCode, bool goingDown, uint64_t time)
+{
+    if (_keyEventCount >= countof(_keyEvents))
+        flushKeyEvents();
+    
+    // keep timestamps in order (a few special keys use the current time
+    // instead of the packet time)
+    if (_keyEventCount && time < _keyEvents[_keyEventCount-1].time)
+        time = _keyEvents[_keyEventCount-1].time;
+    
+    ++_batchEvents;
+    KeyEvent& event = _keyEvents[_keyEventCount++];
+    event.keyCode = keyCode;
+    event.goingDown = goingDown;
+    event.time = time;
+}
+
+void ApplePS2Keyboard::flushKeyEvents()
+{
+    // submit collected events in order, with their original timestamps
+    for (int i = 0; i < _keyEventCount; i++)
+    {
+        KeyEvent& event = _keyEvents[i];
+        dispatchKeyboardEvent(event.keyCode, event.goingDown, *(AbsoluteTime*)&event.time);
+    }
+    _keyEventCount = 0;
 }
 
 bool ApplePS2Keyboard::compareMacro(const UInt8* buffer, const UInt8* data, int count)
@@ -1401,6 +1454,7 @@ bool ApplePS2Keyboard::invertMacros(const UInt8* packet)
 void ApplePS2Keyboard::onMacroTimer()
 {
     DEBUG_LOG("ApplePS2Keyboard::onMacroTimer\n");
+    ++_stats->timerFires;
 
     // timers have a very high priority, packets may have been placed in the
     // input queue already.
@@ -1555,6 +1609,7 @@ void ApplePS2Keyboard::modifyKeyboardBacklight(int keyCode, bool goingDown)
 
 void ApplePS2Keyboard::onSleepEjectTimer()
 {
+    ++_stats->timerFires;
     switch (_timerFunc)
     {
         case kTimerSleep:
@@ -1685,11 +1740,11 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
                 // if Option key is down don't pull up on the Shift keys
                 int start = checkModifierState(kMaskLeftWindows) ? 1 : 0;
                 for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
+                    if (_decoder.isKeyDown(keys[i]))
                         dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], false, now_abs);
                 dispatchKeyboardEventX(keyCode == 0x4e ? 0x90 : 0x91, goingDown, now_abs);
                 for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
+                    if (_decoder.isKeyDown(keys[i]))
                         dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], true, now_abs);
                 keyCode = 0;
             }
@@ -1911,13 +1966,91 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Keyboard::sendKeySequence(UInt16* pKeys)
+void ApplePS2Keyboard::setSwipeAction(int action, const char* psz)
 {
-    for (; *pKeys; ++pKeys)
+    // compile the action string once, so it can be replayed directly later
+    UInt16* keys = parseAction(psz);
+    IOLockLock(_swipeLock);
+    UInt16* old = _actionSwipe[action];
+    _actionSwipe[action] = keys;
+    IOLockUnlock(_swipeLock);
+    if (old)
+        delete[] old;
+}
+
+void ApplePS2Keyboard::queueSwipeAction(int action, const uint64_t* time)
+{
+    //
+    // Called from message() on the aux device's work loop, without our gate
+    // (see Work loop definitions in VoodooPS2Controller.h).  Just note the
+    // action and gesture timestamp, and let swipeCallout replay the keys,
+    // so the trackpad can continue processing packets.
+    //
+    
+    SwipeRequest request;
+    request.action = action;
+    if (time)
+        request.time = *time;
+    else
+        clock_get_uptime(&request.time);
+    IOLockLock(_swipeLock);
+    if (_swipeQueue.count() < kSwipeQueueSize - 1)
+    {
+        _swipeQueue.push(request);
+        if (_swipeThreadCall)
+            thread_call_enter(_swipeThreadCall);
+    }
+    else
     {
+        ++_swipeStats->dropped;
+        DEBUG_LOG("ApplePS2Keyboard: swipe queue full, swipe dropped\n");
+    }
+    IOLockUnlock(_swipeLock);
+}
+
+void ApplePS2Keyboard::swipeCallout(thread_call_param_t param0, thread_call_param_t param1)
+{
+    ((ApplePS2Keyboard*)param0)->dispatchSwipeQueue();
+}
+
+void ApplePS2Keyboard::dispatchSwipeQueue()
+{
+    IOLockLock(_swipeLock);
+    while (_swipeQueue.count())
+    {
+        SwipeRequest request = _swipeQueue.fetch();
+        
+        // dispatch latency: from gesture detection to the first key
         uint64_t now_abs;
         clock_get_uptime(&now_abs);
-        dispatchKeyboardEventX(*pKeys & 0xFF, *pKeys & 0x1000 ? false : true, now_abs);
+        uint64_t latency = 0;
+        if (now_abs > request.time)
+            absolutetime_to_nanoseconds(now_abs-request.time, &latency);
+        ++_swipeStats->count[request.action];
+        _swipeStats->latency[request.action] += latency;
+        if (latency > _swipeStats->latencyMax[request.action])
+            _swipeStats->latencyMax[request.action] = latency;
+        
+        if (UInt16* keys = _actionSwipe[request.action])
+            sendKeySequence(keys, request.time);
+    }
+    IOLockUnlock(_swipeLock);
+}
+
+void ApplePS2Keyboard::sendKeySequence(UInt16* pKeys, uint64_t time)
+{
+    // Keys use the originating gesture's timestamp, each one a tick later than
+    // the previous key sent, so the timestamps are strictly increasing (even
+    // across back to back gestures).
+    for (; *pKeys; ++pKeys)
+    {
+        if (time <= _swipeLastTime)
+            time = _swipeLastTime + 1;
+        _swipeLastTime = time;
+        // Note: not dispatchKeyboardEventX (this is not the work loop, so
+        // must not be mixed into a batch being collected by packetReady)
+        ++_stats->hidEvents;
+        dispatchKeyboardEvent(*pKeys & 0xFF, *pKeys & 0x1000 ? false : true, *(AbsoluteTime*)&time);
     }
 }
 
@@ -2279,22 +2412,20 @@ void ApplePS2Keyboard::initKeyboard()
     //
     // Reset the keyboard to its default state.
     //
-
-    TPS2Request<2> request;
-    request.commands[0].command = kPS2C_WriteDataPort;
-    request.commands[0].inOrOut = kDP_SetDefaults;
-    request.commands[1].command = kPS2C_ReadDataPortAndCompare;
-    request.commands[1].inOrOut = kSC_Acknowledge;
-    request.commandsCount = 2;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
+    // The whole bring-up sequence (reset, defaults, typematic, LEDs, enable
+    // and translate mode) is submitted as one asynchronous request, so the
+    // power management thread does not block on the ack round trips during
+    // wake.  initKeyboardComplete is called when the request has finished.
+    //
+    
+    clock_get_uptime(&_initStartTime);
     
     // look for any keys that are down (just in case the reset happened with keys down)
     // for each key that is down, dispatch a key up for it
     UInt8 packet[kPacketLength];
     for (int scanCode = 0; scanCode < KBV_NUM_KEYCODES; scanCode++)
     {
-        if (KBV_IS_KEYDOWN(scanCode))
+        if (_decoder.isKeyDown(scanCode))
         {
             packet[0] = scanCode < KBV_NUM_SCANCODES ? 1 : 2;
             packet[1] = scanCode | kSC_UpBit;
@@ -2303,32 +2434,128 @@ void ApplePS2Keyboard::initKeyboard()
     }
     
     // start out with all keys up
-    bzero(_keyBitVector, sizeof(_keyBitVector));
+    _decoder.releaseAll();
     _PS2modifierState = 0;
     
-    //
-    // Initialize the keyboard LED state.
-    //
-
-    setLEDs(_ledState);
-    
     //
     // Reset state of packet/keystroke buffer
     //
     
-    _extendCount = 0;
+    _decoder.reset();
     _ringBuffer.reset();
 
+    PS2Request* request = _device->allocateRequest(kInitKeyboardCommands);
+    if (!request)
+        return;
+    int i = 0;
+    int bat = -1;   // index of the BAT result poll, if any
+    
+    if (_resetkeyboard)
+    {
+        // (reset command) ack, then BAT result ($AA) once self-test is done
+        request->commands[i].command = kPS2C_WriteDataPort;
+        request->commands[i++].inOrOut = kDP_Reset;
+        request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+        request->commands[i++].inOrOut = kSC_Acknowledge;
+        // (self-test normally takes a few hundred ms; poll rather than
+        // always sleeping the worst case)
+        bat = i;
+        request->commands[i].command = kPS2C_PollDataPort;
+        request->commands[i++].inOrOut32 = kKeyboardBATTimeout;
+    }
+    
+    // (set defaults command)
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = kDP_SetDefaults;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    
+    // (set typematic rate/delay command)
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = kDP_SetKeyboardTypematic;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = _typematic;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    
+    // (set LEDs command)
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = kDP_SetKeyboardLEDs;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = _ledState;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    
+    // (keyboard enable command)
+    request->commands[i].command = kPS2C_WriteDataPort;
+    request->commands[i++].inOrOut = kDP_Enable;
+    request->commands[i].command = kPS2C_ReadDataPortAndCompare;
+    request->commands[i++].inOrOut = kSC_Acknowledge;
+    
+    // enable keyboard Kscan -> scan code translation mode
+    request->commands[i].command = kPS2C_ModifyCommandByte;
+    request->commands[i].setBits = kCB_TranslateMode;
+    request->commands[i++].clearBits = 0;
+    
+    request->commandsCount = i;
+    assert(request->commandsCount <= kInitKeyboardCommands);
+    
+    _device->submitRequestAsync(request, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2Keyboard::initKeyboardComplete), (void*)(intptr_t)bat);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Keyboard::initKeyboardComplete(PS2Request* request, void* param)
+{
     //
-    // Finally, we enable the keyboard itself, so that it may start reporting
-    // key events.
+    // Completion routine for the request submitted by initKeyboard.  Runs on
+    // the keyboard's work loop; the controller frees the request afterwards.
+    // param is the index of the BAT result poll, or -1 if no reset was sent.
     //
     
-    setKeyboardEnable(true);
+    int bat = (int)(intptr_t)param;
+    bool failed = !request->succeeded();
+    if (!failed && bat >= 0 && kSC_Reset != request->commands[bat].inOrOut)
+    {
+        // the poll got a byte, but it is not a passed self-test ($FC is failed)
+        IOLog("%s: keyboard self-test failed (BAT result 0x%02x), enabling anyway\n", getName(), request->commands[bat].inOrOut);
+        failed = true;
+    }
     
-    //
-    // Enable keyboard Kscan -> scan code translation mode.
-    //
-    _device->setCommandByte(kCB_TranslateMode, 0);
+    if (failed)
+    {
+        // Something in the sequence was not acknowledged (keyboard still
+        // busy after wake, no BAT result, etc.), or the self-test failed.
+        // At least make sure the keyboard is enabled and in translate mode,
+        // same as the individual requests used to do.  The keyboard is not
+        // ready, so KeyboardReadyTime is not published.
+        if (!request->succeeded())
+            IOLog("%s: keyboard initialization failed at command %d, enabling anyway\n", getName(), request->commandsCount);
+        PS2Request* fallback = _device->allocateRequest(3);
+        if (fallback)
+        {
+            fallback->commands[0].command = kPS2C_WriteDataPort;
+            fallback->commands[0].inOrOut = kDP_Enable;
+            fallback->commands[1].command = kPS2C_ReadDataPortAndCompare;
+            fallback->commands[1].inOrOut = kSC_Acknowledge;
+            fallback->commands[2].command = kPS2C_ModifyCommandByte;
+            fallback->commands[2].setBits = kCB_TranslateMode;
+            fallback->commands[2].clearBits = 0;
+            fallback->commandsCount = 3;
+            _device->submitRequestAsync(fallback, NULL, NULL);
+        }
+        return;
+    }
+    
+    // time from initKeyboard (start or wake) until the keyboard is ready
+    uint64_t now_abs;
+    clock_get_uptime(&now_abs);
+    uint64_t ready_ns;
+    absolutetime_to_nanoseconds(now_abs-_initStartTime, &ready_ns);
+    setProperty(kKeyboardReadyTime, ready_ns, 64);
+    DEBUG_LOG("%s: keyboard ready in %lld us\n", getName(), ready_ns/1000);
 }
-
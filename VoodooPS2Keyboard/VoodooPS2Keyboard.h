@@ -28,34 +28,9 @@
 #include <IOKit/hidsystem/IOHIKeyboard.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <IOKit/IOCommandGate.h>
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// Definitions used to keep track of key state.   Key up/down state is tracked
-// in a bit list.  Bits are set for key-down, and cleared for key-up.  The bit
-// vector and macros for it's manipulation are defined here.
-//
-
-#define KBV_NUM_KEYCODES        512     // related with ADB_CONVERTER_LEN
-#define KBV_BITS_PER_UNIT       32      // for UInt32
-#define KBV_BITS_MASK           31
-#define KBV_BITS_SHIFT          5       // 1<<5 == 32, for cheap divide
-#define KBV_NUNITS ((KBV_NUM_KEYCODES + \
-            (KBV_BITS_PER_UNIT-1))/KBV_BITS_PER_UNIT)
-
-#define KBV_KEYDOWN(n) \
-    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] |= (1 << ((n) & KBV_BITS_MASK))
-
-#define KBV_KEYUP(n) \
-    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] &= ~(1 << ((n) & KBV_BITS_MASK))
-
-#define KBV_IS_KEYDOWN(n) \
-    (((_keyBitVector)[((n)>>KBV_BITS_SHIFT)] & (1 << ((n) & KBV_BITS_MASK))) != 0)
-
-#define KBV_NUM_SCANCODES       256
-
-// Special bits for _PS2ToPS2Map
-
-#define kBreaklessKey           0x01    // keys with this flag don't generate break codes
+#include <kern/thread_call.h>
+#include "PS2ScanCodeDecoder.h"
+#include "PS2Statistics.h"
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2Keyboard Class Declaration
@@ -73,15 +48,19 @@ class EXPORT ApplePS2Keyboard : public IOHIKeyboard
 
 private:
     ApplePS2KeyboardDevice *    _device;
-    UInt32                      _keyBitVector[KBV_NUNITS];
-    UInt8                       _extendCount;
+    PS2ScanCodeDecoder          _decoder;
     RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
-    UInt8                       _lastdata;
+    PS2StreamStats*             _stats;     // keyboard stream counters (controller's PS2Statistics)
     bool                        _interruptHandlerInstalled;
     bool                        _powerControlHandlerInstalled;
     UInt8                       _ledState;
     IOCommandGate*              _cmdGate;
 
+    // asynchronous keyboard initialization (start and wake)
+    int                         _typematic;
+    int                         _resetkeyboard;
+    uint64_t                    _initStartTime;
+
     // for keyboard remapping
     UInt16                      _PS2modifierState;
     UInt16                      _PS2ToPS2Map[KBV_NUM_SCANCODES*2];
@@ -92,7 +71,13 @@ private:
     bool                        _fkeymodesupported;
     OSArray*                    _keysStandard;
     OSArray*                    _keysSpecial;
-    bool                        _swapcommandoption;
+    // user preferences applied to _PS2ToADBMap (see buildADBMap)
+    int                         _swapcommandoption;
+    int                         _swapcapsctrl;
+    int                         _appkeyrightwin;
+    int                         _appkeyfn;
+    int                         _hangulhanja;
+    int                         _isolayout;
     int                         _logscancodes;
     UInt32                      _f12ejectdelay;
     enum { kTimerSleep, kTimerEject } _timerFunc;
@@ -101,11 +86,24 @@ private:
     IOTimerEventSource*         _sleepEjectTimer;
     UInt32                      _maxsleeppresstime;
 
-    // configuration items for swipe actions
-    UInt16                      _actionSwipeUp[16];
-    UInt16                      _actionSwipeDown[16];
-    UInt16                      _actionSwipeLeft[16];
-    UInt16                      _actionSwipeRight[16];
+    // configuration items for swipe actions (zero terminated, any length)
+    enum { kSwipeUp = kPS2Swipe_Up, kSwipeDown = kPS2Swipe_Down, kSwipeLeft = kPS2Swipe_Left, kSwipeRight = kPS2Swipe_Right, kSwipeCount = kPS2Swipe_Count };
+    UInt16*                     _actionSwipe[kSwipeCount];
+    
+    // swipe actions are queued and replayed from a thread call, so the
+    // trackpad is not held up meanwhile (_swipeLock: queue, actions and
+    // thread call)
+    struct SwipeRequest
+    {
+        int                     action;
+        uint64_t                time;
+    };
+    enum { kSwipeQueueSize = 16 };
+    RingBuffer<SwipeRequest, kSwipeQueueSize> _swipeQueue;
+    thread_call_t               _swipeThreadCall;
+    IOLock*                     _swipeLock;
+    uint64_t                    _swipeLastTime;
+    PS2SwipeStats*              _swipeStats;    // controller's PS2Statistics
 
     // ACPI support for screen brightness
     IOACPIPlatformDevice *      _provider;
@@ -119,6 +117,20 @@ private:
     // special hack for Envy brightness access, while retaining F2/F3 functionality
     bool                        _brightnessHack;
     
+    // batched dispatch of key events produced by one packetReady drain
+    struct KeyEvent
+    {
+        UInt16                  keyCode;
+        bool                    goingDown;
+        uint64_t                time;
+    };
+    KeyEvent                    _keyEvents[64];
+    int                         _keyEventCount;
+    bool                        _batchActive;
+    int                         _batchkeys;
+    UInt32                      _batchEvents;
+    PS2BatchStats*              _batchStats;    // controller's PS2Statistics
+    
     // macro processing
     OSData**                    _macroTranslation;
     OSData**                    _macroInversion;
@@ -132,8 +144,15 @@ private:
     virtual void setLEDs(UInt8 ledState);
     virtual void setKeyboardEnable(bool enable);
     virtual void initKeyboard();
+    void initKeyboardComplete(PS2Request* request, void* param);
     virtual void setDevicePowerState(UInt32 whatToDo);
-    void sendKeySequence(UInt16* pKeys);
+    void sendKeySequence(UInt16* pKeys, uint64_t time);
+    void queueKeyEvent(unsigned int keyCode, bool goingDown, uint64_t time);
+    void flushKeyEvents();
+    void setSwipeAction(int action, const char* psz);
+    void queueSwipeAction(int action, const uint64_t* time);
+    void dispatchSwipeQueue();
+    static void swipeCallout(thread_call_param_t param0, thread_call_param_t param1);
     void modifyKeyboardBacklight(int adbKeyCode, bool goingDown);
     void modifyScreenBrightness(int adbKeyCode, bool goingDown);
     inline bool checkModifierState(UInt16 mask)
@@ -143,6 +162,8 @@ private:
     void loadBreaklessPS2(OSDictionary* dict, const char* name);
     void loadCustomADBMap(OSDictionary* dict, const char* name);
     void setParamPropertiesGated(OSDictionary* dict);
+    void acpiNotificationGated(UInt32* argument);
+    void buildADBMap();
     void onSleepEjectTimer(void);
     
     static OSData** loadMacroData(OSDictionary* dict, const char* name);
@@ -158,7 +179,13 @@ protected:
     virtual void setNumLockFeedback(bool locked);
     virtual UInt32 maxKeyCodes();
     inline void dispatchKeyboardEventX(unsigned int keyCode, bool goingDown, uint64_t time)
-        { dispatchKeyboardEvent(keyCode, goingDown, *(AbsoluteTime*)&time); }
+    {
+        ++_stats->hidEvents;
+        if (_batchActive)
+            queueKeyEvent(keyCode, goingDown, time);
+        else
+            dispatchKeyboardEvent(keyCode, goingDown, *(AbsoluteTime*)&time);
+    }
     inline void setTimerTimeout(IOTimerEventSource* timer, uint64_t time)
         { timer->setTimeout(*(AbsoluteTime*)&time); }
     inline void cancelTimer(IOTimerEventSource* timer)
@@ -166,6 +193,7 @@ protected:
 
 public:
     virtual bool init(OSDictionary * dict);
+    virtual void free();
     virtual ApplePS2Keyboard * probe(IOService * provider, SInt32 * score);
 
     virtual bool start(IOService * provider);
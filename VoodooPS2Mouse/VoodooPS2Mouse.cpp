@@ -26,6 +26,7 @@
 #include <IOKit/bluetooth/BluetoothAssignedNumbers.h>
 #include "VoodooPS2Controller.h"
 #include "VoodooPS2Mouse.h"
+#include "PS2ParamSchema.h"
 
 //REVIEW: avoids problem with Xcode 5.1.0 where -dead_strip eliminates these required symbols
 #include <libkern/OSKextLib.h>
@@ -41,6 +42,23 @@ void* _org_rehabman_dontstrip_[] =
 #define DEBUG_VERBOSE
 #endif
 
+// properties published by autotune
+#define kMouseSampleRate            "MouseSampleRate"
+#define kMouseResolutionCode        "MouseResolutionCode"
+#define kMouseSupportedSampleRates  "MouseSupportedSampleRates"
+#define kMouseMeasuredRate          "MouseMeasuredRate"
+
+// number of packet intervals in each measurement window
+#define kMeasureCount               128
+
+// autotune hysteresis (measurement windows): step down after kAutotuneDown
+// bad windows in a row, step up after _autotuneUpWindows good ones, which
+// starts at kAutotuneUpFirst and doubles (up to kAutotuneUpMax) each time a
+// step up has to be taken back
+#define kAutotuneDown               2
+#define kAutotuneUpFirst            16
+#define kAutotuneUpMax              512
+
 // =============================================================================
 // ApplePS2Mouse Class Implementation
 //
@@ -70,9 +88,10 @@ bool ApplePS2Mouse::init(OSDictionary * dict)
   _device                    = 0;
   _interruptHandlerInstalled = false;
   _packetByteCount           = 0;
+  _stats                     = statisticsSink();
   _lastdata                  = 0;
   _packetLength              = kPacketLengthStandard;
-  defres					 = 150 << 16; // (default is 150 dpi; 6 counts/mm)
+  defres					 = 150; // (default is 150 dpi; 6 counts/mm)
   forceres					 = false;
   mouseyinverter			 = 1;   // 1 for normal, -1 for inverting
   scrollyinverter            = 1;   // 1 for normal, -1 for inverting
@@ -96,12 +115,30 @@ bool ApplePS2Mouse::init(OSDictionary * dict)
   _processusbmouse           = true;
   _processbluetoothmouse     = true;
 
+  // state for sample rate autotune
+  _autotune = false;
+  _autotuneRateCount = 0;
+  _autotuneIndex = 0;
+  _autotuneLow = 0;
+  _autotuneHigh = 0;
+  _autotuneUpWindows = kAutotuneUpFirst;
+  _autotuneSteppedUp = false;
+  _lastPacketTime = 0;
+  _measureTime = 0;
+  _measureCount = 0;
+  _measureOnTime = 0;
+  _measuredRate = 0;
+  _measuredOnTime = 0;
+  _measureReady = false;
+  _mouseEnabled = false;
+  _enableGeneration = 0;
+
   // state for middle button
   _buttonTimer = 0;
-  _mbuttonstate = STATE_NOBUTTONS;
-  _pendingbuttons = 0;
-  _buttontime = 0;
+  _middleButton.init(this);
   _maxmiddleclicktime = 100000000;
+  _packetTime = 0;
+  _accelcurve[0] = 0;
 
   // announce version
   extern kmod_info_t kmod_info;
@@ -121,82 +158,60 @@ bool ApplePS2Mouse::init(OSDictionary * dict)
 }
 
 
+// bits for PS2ParamEntry::affects
+enum
+{
+    kAffectsUSBMouse = 0x01,
+    kAffectsAccel = 0x02,
+};
+
 void ApplePS2Mouse::setParamPropertiesGated(OSDictionary * config)
 {
 	if (NULL == config)
 		return;
     
-    const struct {const char *name; int *var;} int32vars[]={
-        {"DefaultResolution",               &defres},
-        {"ResolutionMode",                  &resmode},
-        {"ScrollResolution",                &scrollres},
-        {"MouseYInverter",                  &mouseyinverter},
-        {"ScrollYInverter",                 &scrollyinverter},
-        {"WakeDelay",                       &wakedelay},
-        {"ButtonCount",                     &_buttonCount},
-    };
-    const struct {const char *name; int *var;} boolvars[]={
-        {"ForceDefaultResolution",          &forceres},
-        {"ForceSetResolution",              &forcesetres},
-        {"ActLikeTrackpad",                 &actliketrackpad},
-        {"DisableLEDUpdating",              &noled},
-        {"FakeMiddleButton",                &_fakemiddlebutton},
-        {"ProcessUSBMouseStopsTrackpad",    &_processusbmouse},
-        {"ProcessBluetoothMouseStopsTrackpad", &_processbluetoothmouse},
-    };
-    const struct {const char* name; bool* var;} lowbitvars[]={
-        {"TrackpadScroll",                  &scroll},
-        {"OutsidezoneNoAction When Typing", &outzone_wt},
-        {"PalmNoAction Permanent",          &palm},
-        {"PalmNoAction When Typing",        &palm_wt},
-        {"USBMouseStopsTrackpad",           &usb_mouse_stops_trackpad},
+    // Note: must be kept sorted by name (see PS2ParamSchema.h)
+    const PS2ParamEntry schema[]={
+        {"AccelerationCurve",               kPS2P_IntArray, _accelcurve, 0, kAccelCurveMax, kAffectsAccel},
+        {"ActLikeTrackpad",                 kPS2P_Bool,     &actliketrackpad},
+        {"AutotuneSampleRate",              kPS2P_Bool,     &_autotune},
+        {"ButtonCount",                     kPS2P_Int32,    &_buttonCount},
+        {"DefaultResolution",               kPS2P_Int32,    &defres},
+        {"DisableLEDUpdating",              kPS2P_Bool,     &noled},
+        {"FakeMiddleButton",                kPS2P_Bool,     &_fakemiddlebutton},
+        {"ForceDefaultResolution",          kPS2P_Bool,     &forceres},
+        {"ForceSetResolution",              kPS2P_Bool,     &forcesetres},
+        {"MiddleClickTime",                 kPS2P_Int64,    &_maxmiddleclicktime},
+        {"MouseYInverter",                  kPS2P_Int32,    &mouseyinverter},
+        {"OutsidezoneNoAction When Typing", kPS2P_LowBit,   &outzone_wt},
+        {"PalmNoAction Permanent",          kPS2P_LowBit,   &palm},
+        {"PalmNoAction When Typing",        kPS2P_LowBit,   &palm_wt},
+        {"ProcessBluetoothMouseStopsTrackpad", kPS2P_Bool,  &_processbluetoothmouse},
+        {"ProcessUSBMouseStopsTrackpad",    kPS2P_Bool,     &_processusbmouse},
+        {"QuietTimeAfterTyping",            kPS2P_Int64,    &maxaftertyping},
+        {"ResolutionMode",                  kPS2P_Int32,    &resmode},
+        {"ScrollResolution",                kPS2P_Int32,    &scrollres},
+        {"ScrollYInverter",                 kPS2P_Int32,    &scrollyinverter},
+        {"TrackpadScroll",                  kPS2P_LowBit,   &scroll},
+        {"USBMouseStopsTrackpad",           kPS2P_LowBit,   &usb_mouse_stops_trackpad, 0, 0, kAffectsUSBMouse},
+        {"WakeDelay",                       kPS2P_Int32,    &wakedelay},
     };
-    const struct {const char* name; uint64_t* var; } int64vars[]={
-        {"MiddleClickTime",                 &_maxmiddleclicktime},
-        {"QuietTimeAfterTyping",            &maxaftertyping},
-    };
-    
-    
-    OSNumber *num;
-    OSBoolean *bl;
+#ifdef DEBUG
+    checkParamSchema("VoodooPS2Mouse", schema, countof(schema));
+#endif
 
-    // 64-bit config items
-    for (int i = 0; i < countof(int64vars); i++)
-        if ((num=OSDynamicCast(OSNumber, config->getObject(int64vars[i].name))))
-        {
-            *int64vars[i].var = num->unsigned64BitValue();
-            setProperty(int64vars[i].name, *int64vars[i].var, 64);
-        }
-    // boolean config items
-    for (int i = 0; i < countof(boolvars); i++)
-        if ((bl=OSDynamicCast (OSBoolean,config->getObject (boolvars[i].name))))
-        {
-            *boolvars[i].var = bl->isTrue();
-            setProperty(boolvars[i].name, *boolvars[i].var ? kOSBooleanTrue : kOSBooleanFalse);
-        }
-    // lowbit config items
-	for (int i = 0; i < countof(lowbitvars); i++)
-		if ((num=OSDynamicCast (OSNumber,config->getObject(lowbitvars[i].name))))
-        {
-			*lowbitvars[i].var = (num->unsigned32BitValue()&0x1)?true:false;
-            setProperty(lowbitvars[i].name, *lowbitvars[i].var ? 1 : 0, 32);
-        }
-    // 32-bit config items
-    for (int i = 0; i < countof(int32vars);i++)
-        if ((num=OSDynamicCast (OSNumber,config->getObject (int32vars[i].name))))
-        {
-            *int32vars[i].var = num->unsigned32BitValue();
-            setProperty(int32vars[i].name, *int32vars[i].var, 32);
-        }
+    PS2ParamResult result = applyParamSchema(this, schema, countof(schema), config);
+
+    if ((result.affects & kAffectsAccel) && !_accel.setCurve(&_accelcurve[1], _accelcurve[0]))
+        IOLog("%s: AccelerationCurve speeds must be increasing\n", getName());
 
     // disable trackpad when USB mouse is plugged in and this functionality is requested
-    if (attachedHIDPointerDevices && attachedHIDPointerDevices->getCount() > 0) {
+    if ((result.affects & kAffectsUSBMouse) && attachedHIDPointerDevices && attachedHIDPointerDevices->getCount() > 0) {
         ignoreall = usb_mouse_stops_trackpad;
         updateTouchpadLED();
     }
-    
-    // convert to IOFixed format...
-    defres <<= 16;
+
+    publishParamResult(this, result);
 }
 
 IOReturn ApplePS2Mouse::setParamProperties(OSDictionary* dict)
@@ -315,6 +330,14 @@ ApplePS2Mouse* ApplePS2Mouse::probe(IOService * provider, SInt32 * score)
     removeProperty("TrackpadScroll");
   }
 
+  // controller identification already knows if anything is there
+  PS2AuxIdentity identity;
+  if (device->getIdentity(&identity))
+  {
+    DEBUG_LOG("ApplePS2Mouse::probe leaving (aux device is %s).\n", auxVendorName(identity.vendor));
+    return kPS2Aux_None != identity.vendor ? this : 0;
+  }
+
   //
   // Check to see if acknowledges are being received for commands to the mouse.
   //
@@ -361,6 +384,7 @@ bool ApplePS2Mouse::start(IOService * provider)
 
   _device = (ApplePS2MouseDevice *)provider;
   _device->retain();
+  _stats = _device->getController()->getStreamStatistics(kDT_Mouse);
 
   //
   // Setup workloop with command gate for thread syncronization...
@@ -382,7 +406,10 @@ bool ApplePS2Mouse::start(IOService * provider)
   //
   _buttonTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Mouse::onButtonTimer));
   if (_buttonTimer)
+  {
       pWorkLoop->addEventSource(_buttonTimer);
+      _middleButton.setTimer(_buttonTimer);
+  }
     
   //
   // Lock the controller during initialization
@@ -464,6 +491,7 @@ void ApplePS2Mouse::stop(IOService * provider)
       pWorkLoop->removeEventSource(_buttonTimer);
       _buttonTimer->release();
       _buttonTimer = 0;
+      _middleButton.setTimer(0);
     }
   }
     
@@ -562,8 +590,10 @@ void ApplePS2Mouse::resetMouse()
         setMouseResolution(resmode);
       
     _mouseInfoBytes = getMouseInformation();
+    if (_autotune && _mouseInfoBytes != (UInt32)-1)
+        autotuneMouse();
 	if (forceres)
-		_resolution = defres;
+		_resolution = defres << 16; // convert to IOFixed format...
 	else
 	  switch (_mouseInfoBytes & 0x00FF00)
 	  {
@@ -624,6 +654,8 @@ void ApplePS2Mouse::resetMouse()
     
   _packetByteCount = 0;
   _ringBuffer.reset();
+  _packetTimes.reset();
+  _accel.reset();
 
   //
   // Finally, we enable the mouse itself, so that it may start reporting
@@ -672,6 +704,7 @@ PS2InterruptResult ApplePS2Mouse::interruptOccurred(UInt8 data)      // PS2Inter
         packet[0] = 0x00;
         packet[1] = kSC_Reset;
         _ringBuffer.advanceHead(kPacketLengthMax);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -683,6 +716,7 @@ PS2InterruptResult ApplePS2Mouse::interruptOccurred(UInt8 data)      // PS2Inter
     if (_packetByteCount == 0 && ((data == kSC_Acknowledge) || !(data & 0x08)))
     {
         IOLog("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        ++_stats->dropped;
         
         //
         // Reset the mouse when packet synchronization is lost. Limit the number
@@ -695,6 +729,7 @@ PS2InterruptResult ApplePS2Mouse::interruptOccurred(UInt8 data)      // PS2Inter
             packet[0] = 0x00;
             packet[1] = kSC_Acknowledge;
             _ringBuffer.advanceHead(kPacketLengthMax);
+            queuePacketTime();
             return kPS2IR_packetReady;
         }
         return kPS2IR_packetBuffering;
@@ -710,6 +745,9 @@ PS2InterruptResult ApplePS2Mouse::interruptOccurred(UInt8 data)      // PS2Inter
     {
         _mouseResetCount = 0;
         _ringBuffer.advanceHead(kPacketLengthMax);
+        uint64_t now = queuePacketTime();
+        if (_autotune && _autotuneRateCount)
+            measurePacketRate(now);
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -721,12 +759,17 @@ void ApplePS2Mouse::packetReady()
     // empty the ring buffer, dispatching each packet...
     // all packets are kPacketLengthMax even if _packetLength is smaller, as they
     // are padded at interrupt time.
+    _middleButton.beginDrain();
+    noteRingCount(_stats, _ringBuffer.count());
     while (_ringBuffer.count() >= kPacketLengthMax)
     {
         UInt8* packet = _ringBuffer.tail();
+        // time packet was completed at interrupt time
+        _packetTime = _packetTimes.count() ? _packetTimes.fetch() : 0;
         if (0x00 != packet[0])
         {
             // normal packet with deltas
+            ++_stats->packets;
             dispatchRelativePointerEventWithPacket(_ringBuffer.tail(), _packetLength);
         }
         else
@@ -735,16 +778,20 @@ void ApplePS2Mouse::packetReady()
         }
         _ringBuffer.advanceTail(kPacketLengthMax);
     }
+    _packetTime = 0;
+    _middleButton.endDrain(_maxmiddleclicktime);
+    _middleButton.publishStatistics(this);
+    if (_measureReady)
+        checkSampleRate();
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Mouse::onButtonTimer(void)
 {
-	uint64_t now_abs;
-	clock_get_uptime(&now_abs);
-    
-    middleButton(lastbuttons, now_abs, fromTimer);
+    ++_stats->timerFires;
+    _middleButton.onTimer(lastbuttons, _maxmiddleclicktime);
+    _middleButton.publishStatistics(this);
 }
 
 UInt32 ApplePS2Mouse::middleButton(UInt32 buttons, uint64_t now_abs, MBComingFrom from)
@@ -752,116 +799,7 @@ UInt32 ApplePS2Mouse::middleButton(UInt32 buttons, uint64_t now_abs, MBComingFro
     if (!_fakemiddlebutton || _buttonCount <= 2 || (ignoreall && fromMouse == from))
         return buttons;
     
-    // cancel timer if we see input before timeout has fired, but after expired
-    bool timeout = false;
-    uint64_t now_ns;
-    absolutetime_to_nanoseconds(now_abs, &now_ns);
-    if (fromTimer == from || now_ns - _buttontime > _maxmiddleclicktime)
-        timeout = true;
-    
-    //
-    // A state machine to simulate middle buttons with two buttons pressed
-    // together.
-    //
-    switch (_mbuttonstate)
-    {
-        // no buttons down, waiting for something to happen
-        case STATE_NOBUTTONS:
-            if (buttons & 0x4)
-                _mbuttonstate = STATE_NOOP;
-            else if (0x3 == buttons)
-                _mbuttonstate = STATE_MIDDLE;
-            else if (0x0 != buttons)
-            {
-                // only single button, so delay this for a bit
-                _pendingbuttons = buttons;
-                _buttontime = now_ns;
-                setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                _mbuttonstate = STATE_WAIT4TWO;
-            }
-            break;
-            
-        // waiting for second button to come down or timeout
-        case STATE_WAIT4TWO:
-            if (!timeout && 0x3 == buttons)
-            {
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_MIDDLE;
-            }
-            else if (timeout || buttons != _pendingbuttons)
-            {
-                if (fromTimer == from || !(buttons & _pendingbuttons))
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
-                else
-                    _mbuttonstate = STATE_NOOP;
-            }
-            break;
-            
-        // both buttons down and delivering middle button
-        case STATE_MIDDLE:
-            if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
-            else if (0x3 != (buttons & 0x3))
-            {
-                // only single button, so delay to see if we get to none
-                _pendingbuttons = buttons;
-                _buttontime = now_ns;
-                setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                _mbuttonstate = STATE_WAIT4NONE;
-            }
-            break;
-            
-        // was middle button, but one button now up, waiting for second to go up
-        case STATE_WAIT4NONE:
-            if (!timeout && 0x0 == buttons)
-            {
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_NOBUTTONS;
-            }
-            else if (timeout || buttons != _pendingbuttons)
-            {
-                if (fromTimer == from)
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
-                else
-                    _mbuttonstate = STATE_NOOP;
-            }
-            break;
-            
-        case STATE_NOOP:
-            if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
-            break;
-    }
-    
-    // modify buttons after new state set
-    switch (_mbuttonstate)
-    {
-        case STATE_MIDDLE:
-            buttons = 0x4;
-            break;
-            
-        case STATE_WAIT4NONE:
-        case STATE_WAIT4TWO:
-            buttons &= ~0x3;
-            break;
-            
-        case STATE_NOBUTTONS:
-        case STATE_NOOP:
-            break;
-    }
-    
-    // return modified buttons
-    return buttons;
+    return _middleButton.middleButton(buttons, now_abs, kPS2MB_Device, _maxmiddleclicktime);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -887,8 +825,9 @@ void ApplePS2Mouse::dispatchRelativePointerEventWithPacket(UInt8 * packet,
   SInt32 dy = -(((packet[0] & 0x20) ? 0xffffff00 : 0 ) | packet[2]);
   SInt16 dz = 0;
 
-  uint64_t now_abs;
-  clock_get_uptime(&now_abs);
+  uint64_t now_abs = _packetTime;
+  if (!now_abs)
+    clock_get_uptime(&now_abs);
   uint64_t now_ns;
   absolutetime_to_nanoseconds(now_abs, &now_ns);
     
@@ -967,6 +906,10 @@ void ApplePS2Mouse::setMouseEnable(bool enable)
   // It is safe to issue this request from the interrupt/completion context.
   //
 
+  // (a sample rate change in flight checks these before enabling again)
+  _mouseEnabled = enable;
+  ++_enableGeneration;
+
   // (mouse enable/disable command)
   TPS2Request<3> request;
   request.commands[0].command = kPS2C_WriteCommandPort;
@@ -982,7 +925,7 @@ void ApplePS2Mouse::setMouseEnable(bool enable)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Mouse::setMouseSampleRate(UInt8 sampleRate)
+bool ApplePS2Mouse::setMouseSampleRate(UInt8 sampleRate)
 {
   DEBUG_LOG("%s::setMouseSampleRate(0x%x)\n", getName(), sampleRate);
     
@@ -1010,11 +953,13 @@ void ApplePS2Mouse::setMouseSampleRate(UInt8 sampleRate)
   request.commandsCount = 6;
   assert(request.commandsCount <= countof(request.commands));
   _device->submitRequestAndBlock(&request);
+
+  return 6 == request.commandsCount;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Mouse::setMouseResolution(UInt8 resolution)
+bool ApplePS2Mouse::setMouseResolution(UInt8 resolution)
 {
   //
   // Instructs the mouse to change its resolution given the following
@@ -1047,6 +992,255 @@ void ApplePS2Mouse::setMouseResolution(UInt8 resolution)
   request.commandsCount = 6;
   assert(request.commandsCount <= countof(request.commands));
   _device->submitRequestAndBlock(&request);
+
+  return 6 == request.commandsCount;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Mouse::autotuneMouse()
+{
+  //
+  // Find the highest resolution and sample rates the mouse accepts.  Each
+  // setting must be acknowledged and read back by Status Request ($E9)
+  // before it is considered supported.
+  //
+  // On return, _mouseInfoBytes holds the chosen resolution and sample rate,
+  // so resetMouse/setIntellimouseMode restore them on wake as usual.
+  //
+  // Rates are probed lowest first: 200, 100, 80 (or 200, 200, 80) in a row
+  // is the Intellimouse knock, which must not happen by accident here.
+  //
+  // Do NOT issue this request from the interrupt/completion context.
+  //
+
+  static const UInt8 rates[] = { 40, 60, 80, 100, 200 };
+
+  UInt32 info = _mouseInfoBytes;
+  UInt8 rescode = (info >> 8) & 3;
+
+  // no reports in between the probe's responses (resetMouse flushes the
+  // packet buffer before the mouse is enabled again)
+  setMouseEnable(false);
+
+  // highest resolution, unless explicitly configured
+  if (!(forcesetres && resmode != -1))
+  {
+    for (int code = 3; code >= 0; code--)
+    {
+      UInt32 check;
+      if (setMouseResolution(code) && (check = getMouseInformation()) != (UInt32)-1 && code == ((check >> 8) & 0xFF))
+      {
+        rescode = code;
+        break;
+      }
+    }
+    setMouseResolution(rescode);
+  }
+
+  // all supported sample rates, highest first
+  UInt8 supported[countof(rates)];
+  int count = 0;
+  for (int i = 0; i < countof(rates); i++)
+  {
+    UInt32 check;
+    if (setMouseSampleRate(rates[i]) && (check = getMouseInformation()) != (UInt32)-1 && rates[i] == (check & 0xFF))
+      supported[count++] = rates[i];
+  }
+  _autotuneRateCount = 0;
+  while (count)
+    _autotuneRates[_autotuneRateCount++] = supported[--count];
+  _autotuneIndex = 0;
+  _autotuneLow = 0;
+  _autotuneHigh = 0;
+  _autotuneUpWindows = kAutotuneUpFirst;
+  _autotuneSteppedUp = false;
+  UInt8 rate = _autotuneRateCount ? _autotuneRates[0] : info & 0xFF;
+  setMouseSampleRate(rate);
+
+  _mouseInfoBytes = (info & 0xFF0000) | (rescode << 8) | rate;
+
+  if (OSArray* array = OSArray::withCapacity(_autotuneRateCount))
+  {
+    for (int i = 0; i < _autotuneRateCount; i++)
+    {
+      if (OSNumber* num = OSNumber::withNumber(_autotuneRates[i], 32))
+      {
+        array->setObject(num);
+        num->release();
+      }
+    }
+    setProperty(kMouseSupportedSampleRates, array);
+    array->release();
+  }
+  setProperty(kMouseResolutionCode, rescode, 32);
+  setProperty(kMouseSampleRate, rate, 32);
+
+  IOLog("%s: autotune selected resolution code %d, %d samples/sec (%d rates supported)\n", getName(), rescode, rate, _autotuneRateCount);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Mouse::measurePacketRate(uint64_t now_abs)
+{
+  //
+  // Called at interrupt time for each complete packet.
+  //
+  // In stream mode the mouse only reports when something changed, so only
+  // intervals that look like continuous motion (up to 4 sample periods) are
+  // counted.  A window is complete after kMeasureCount such intervals.
+  //
+
+  uint64_t now_ns;
+  absolutetime_to_nanoseconds(now_abs, &now_ns);
+  uint64_t interval = now_ns - _lastPacketTime;
+  _lastPacketTime = now_ns;
+
+  uint64_t period = 1000000000ULL / _autotuneRates[_autotuneIndex];
+  if (interval > 4*period || _measureReady)
+    return;
+
+  _measureTime += interval;
+  ++_measureCount;
+  // "on time" means within half a period of the configured rate
+  if (interval*2 <= period*3)
+    ++_measureOnTime;
+  if (_measureCount >= kMeasureCount)
+  {
+    _measuredRate = (UInt32)(_measureCount * 1000000000ULL / _measureTime);
+    _measuredOnTime = _measureOnTime;
+    _measureTime = 0;
+    _measureCount = 0;
+    _measureOnTime = 0;
+    _measureReady = true;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Mouse::checkSampleRate()
+{
+  //
+  // Runs on the work loop (packetReady) after a measurement window is
+  // complete.  If the configured rate is not actually delivered (almost no
+  // packets arrive within a sample period of each other) for kAutotuneDown
+  // windows in a row, step down to the next supported rate.  Below the
+  // highest rate, after _autotuneUpWindows windows in a row where at least
+  // half the packets are on time, try the next higher rate again.  A step
+  // up that does not hold doubles the windows needed for the next one, so
+  // a mouse that cannot keep up is not switched back and forth.
+  //
+
+  UInt32 measured = _measuredRate;
+  UInt32 onTime = _measuredOnTime;
+  _measureReady = false;
+
+  setProperty(kMouseMeasuredRate, measured, 32);
+
+  int index = _autotuneIndex;
+  if (onTime*8 < kMeasureCount)
+  {
+    // bad window
+    _autotuneHigh = 0;
+    if (++_autotuneLow < kAutotuneDown || _autotuneIndex+1 >= _autotuneRateCount)
+      return;
+    if (_autotuneSteppedUp && _autotuneUpWindows < kAutotuneUpMax)
+      _autotuneUpWindows *= 2;
+    _autotuneSteppedUp = false;
+    ++index;
+  }
+  else if (onTime*2 >= kMeasureCount)
+  {
+    // good window
+    _autotuneLow = 0;
+    if (++_autotuneHigh < _autotuneUpWindows || !_autotuneIndex)
+      return;
+    _autotuneSteppedUp = true;
+    --index;
+  }
+  else
+  {
+    // in between: neither
+    _autotuneLow = 0;
+    _autotuneHigh = 0;
+    return;
+  }
+
+  _autotuneLow = 0;
+  _autotuneHigh = 0;
+  _autotuneIndex = index;
+  UInt8 rate = _autotuneRates[index];
+  _mouseInfoBytes = (_mouseInfoBytes & ~0xFF) | rate;
+  setProperty(kMouseSampleRate, rate, 32);
+  DEBUG_LOG("%s: measured %d packets/sec, stepping %s to %d samples/sec\n", getName(), measured, _autotuneSteppedUp ? "up" : "down", rate);
+  setSampleRate(rate);
+}
+
+void ApplePS2Mouse::setSampleRate(UInt8 rate)
+{
+  //
+  // Asynchronous (must not block in packetReady).  The mouse is disabled
+  // first, and once it is quiet, the packet buffer is flushed (a partial
+  // packet would be out of sync after the command responses), then the
+  // rate is set and the mouse enabled again.
+  //
+  // The rate and the setMouseEnable generation travel in param, so the
+  // mouse is not enabled again if it was disabled (or reset) meanwhile.
+  //
+
+  if (!_mouseEnabled)
+    return;
+  PS2Request* request = _device->allocateRequest(2);
+  if (!request)
+    return;
+  request->commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+  request->commands[0].inOrOut = kDP_SetDefaultsAndDisable;
+  request->commands[1].command = kPS2C_FlushDataPort;
+  request->commands[1].inOrOut32 = 0;
+  request->commandsCount = 2;
+  uintptr_t param = rate | ((uintptr_t)(_enableGeneration & 0xFFFFFF) << 8);
+  _device->submitRequestAsync(request, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2Mouse::onSampleRateDisabled), (void*)param);
+}
+
+void ApplePS2Mouse::onSampleRateDisabled(PS2Request* request, void* param)
+{
+  // (on our work loop, mouse not reporting)
+  if (!request->succeeded())
+    IOLog("%s: sample rate change failed to disable mouse\n", getName());
+  _packetByteCount = 0;
+  _ringBuffer.reset();
+  _packetTimes.reset();
+  _lastPacketTime = 0;
+  _measureTime = 0;
+  _measureCount = 0;
+  _measureOnTime = 0;
+
+  // disabled or reset since setSampleRate: leave the mouse as it is now
+  UInt32 generation = (UInt32)((uintptr_t)param >> 8);
+  if (!_mouseEnabled || generation != (_enableGeneration & 0xFFFFFF))
+  {
+    DEBUG_LOG("%s: sample rate change dropped, mouse disabled meanwhile\n", getName());
+    return;
+  }
+
+  PS2Request* next = _device->allocateRequest(3);
+  if (!next)
+    return;
+  next->commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+  next->commands[0].inOrOut = kDP_SetMouseSampleRate;
+  next->commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
+  next->commands[1].inOrOut = (UInt8)(uintptr_t)param;
+  next->commands[2].command = kPS2C_SendMouseCommandAndCompareAck;
+  next->commands[2].inOrOut = kDP_Enable;
+  next->commandsCount = 3;
+  _device->submitRequestAsync(next, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2Mouse::onSampleRateDone));
+}
+
+void ApplePS2Mouse::onSampleRateDone(PS2Request* request, void*)
+{
+  // (on our work loop)
+  if (!request->succeeded())
+    IOLog("%s: sample rate change failed at command %d\n", getName(), request->commandsCount);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1353,47 +1547,54 @@ void ApplePS2Mouse::updateTouchpadLED()
 
 bool ApplePS2Mouse::setTouchpadLED(UInt8 touchLED)
 {
-    TPS2Request<12> request;
+    // (called from packet handling, so do not wait for the touchpad)
+    PS2Request* request = _device->allocateRequest(12);
+    if (!request)
+        return false;
     
     // send NOP before special command sequence
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetMouseScaling1To1;
+    request->commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[0].inOrOut  = kDP_SetMouseScaling1To1;
     
     // 4 set resolution commands, each encode 2 data bits of LED level
-    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = (touchLED >> 6) & 0x3;
-    
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = (touchLED >> 4) & 0x3;
-    
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[6].inOrOut  = (touchLED >> 2) & 0x3;
-    
-    request.commands[7].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[8].inOrOut  = (touchLED >> 0) & 0x3;
+    request->commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[1].inOrOut  = kDP_SetMouseResolution;
+    request->commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[2].inOrOut  = (touchLED >> 6) & 0x3;
+    
+    request->commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[3].inOrOut  = kDP_SetMouseResolution;
+    request->commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[4].inOrOut  = (touchLED >> 4) & 0x3;
+    
+    request->commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[5].inOrOut  = kDP_SetMouseResolution;
+    request->commands[6].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[6].inOrOut  = (touchLED >> 2) & 0x3;
+    
+    request->commands[7].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[7].inOrOut  = kDP_SetMouseResolution;
+    request->commands[8].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[8].inOrOut  = (touchLED >> 0) & 0x3;
     
     // Set sample rate 10 (10 is command for setting LED)
-    request.commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[9].inOrOut  = kDP_SetMouseSampleRate;
-    request.commands[10].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[10].inOrOut = 10; // 0x0A command for setting LED
+    request->commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[9].inOrOut  = kDP_SetMouseSampleRate;
+    request->commands[10].command = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[10].inOrOut = 10; // 0x0A command for setting LED
     
     // finally send NOP command to end the special sequence
-    request.commands[11].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[11].inOrOut  = kDP_SetMouseScaling1To1;
-    request.commandsCount = 12;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
-    
-    return 12 == request.commandsCount;
+    request->commands[11].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[11].inOrOut  = kDP_SetMouseScaling1To1;
+    request->commandsCount = 12;
+    return _device->submitRequestAsync(request, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2Mouse::onLEDDone));
+}
+
+void ApplePS2Mouse::onLEDDone(PS2Request* request, void*)
+{
+    // (on our work loop)
+    if (!request->succeeded())
+        DEBUG_LOG("%s: setTouchpadLED failed: %d\n", getName(), request->commandsCount);
 }
 
 bool ApplePS2Mouse::getTouchPadData(UInt8 dataSelector, UInt8 buf3[])
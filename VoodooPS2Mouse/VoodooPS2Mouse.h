@@ -24,6 +24,9 @@
 #define _APPLEPS2MOUSE_H
 
 #include "ApplePS2MouseDevice.h"
+#include "PS2MiddleButton.h"
+#include "PS2Acceleration.h"
+#include "PS2Statistics.h"
 #include <IOKit/hidsystem/IOHIPointing.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/IOTimerEventSource.h>
@@ -57,7 +60,12 @@ private:
   bool                  _interruptHandlerInstalled;
   bool                  _powerControlHandlerInstalled;
   RingBuffer<UInt8, kPacketLengthMax*32> _ringBuffer;
+  RingBuffer<uint64_t, 32> _packetTimes;    // interrupt time of each packet in _ringBuffer
+  uint64_t              _packetTime;        // time of packet being dispatched (0 for now)
+  PS2Acceleration       _accel;
+  int                   _accelcurve[kAccelCurveMax+1];  // [0] is count (AccelerationCurve)
   UInt32                _packetByteCount;
+  PS2StreamStats*       _stats;             // aux stream counters (controller's PS2Statistics)
   UInt8                 _lastdata;
   UInt32                _packetLength;
   IOFixed               _resolution;                // (dots per inch)
@@ -87,6 +95,25 @@ private:
     
   int _processusbmouse;
   int _processbluetoothmouse;
+
+  // sample rate autotune
+  int                   _autotune;
+  UInt8                 _autotuneRates[8];  // supported rates, highest first
+  int                   _autotuneRateCount;
+  int                   _autotuneIndex;     // current rate in _autotuneRates
+  int                   _autotuneLow;       // consecutive windows below rate
+  int                   _autotuneHigh;      // consecutive windows at rate
+  int                   _autotuneUpWindows; // _autotuneHigh needed to step up
+  bool                  _autotuneSteppedUp; // last change was a step up
+  uint64_t              _lastPacketTime;    // ns, written at interrupt time
+  uint64_t              _measureTime;
+  UInt32                _measureCount;
+  UInt32                _measureOnTime;
+  volatile UInt32       _measuredRate;
+  volatile UInt32       _measuredOnTime;
+  volatile bool         _measureReady;
+  volatile bool         _mouseEnabled;      // last setMouseEnable
+  volatile UInt32       _enableGeneration;  // counts setMouseEnable calls
     
   OSSet* attachedHIDPointerDevices;
     
@@ -97,25 +124,20 @@ private:
   IONotifier* bluetooth_hid_terminate_notify; // Notification when a bluetooth HID device is disconnected
     
   // for middle button simulation
-  enum mbuttonstate
-  {
-      STATE_NOBUTTONS,
-      STATE_MIDDLE,
-      STATE_WAIT4TWO,
-      STATE_WAIT4NONE,
-      STATE_NOOP,
-  } _mbuttonstate;
-  
+  friend class PS2MiddleButton<ApplePS2Mouse>;
+  PS2MiddleButton<ApplePS2Mouse> _middleButton;
   UInt32 lastbuttons;
-  UInt32 _pendingbuttons;
-  uint64_t _buttontime;
   IOTimerEventSource* _buttonTimer;
   uint64_t _maxmiddleclicktime;
   int _fakemiddlebutton;
     
   void onButtonTimer(void);
-  enum MBComingFrom { fromTimer, fromMouse };
+  enum MBComingFrom { fromMouse };
   UInt32 middleButton(UInt32 butttons, uint64_t now, MBComingFrom from);
+  inline void dispatchMiddleButtonEvent(UInt32 buttons, uint64_t now)
+    { dispatchRelativePointerEventX(0, 0, buttons, now); }
+  inline uint64_t queuePacketTime()
+    { uint64_t now; clock_get_uptime(&now); _packetTimes.push(now); return now; }
    
   virtual void   dispatchRelativePointerEventWithPacket(UInt8 * packet,
                                                         UInt32  packetSize);
@@ -123,14 +145,21 @@ private:
   virtual UInt32 getMouseInformation();
   virtual PS2MouseId setIntellimouseMode();
   virtual void   setMouseEnable(bool enable);
-  virtual void   setMouseSampleRate(UInt8 sampleRate);
-  virtual void   setMouseResolution(UInt8 resolution);
+  virtual bool   setMouseSampleRate(UInt8 sampleRate);
+  virtual bool   setMouseResolution(UInt8 resolution);
   virtual void   initMouse();
   virtual void   resetMouse();
   virtual void   setDevicePowerState(UInt32 whatToDo);
+  void autotuneMouse();
+  void measurePacketRate(uint64_t now_abs);
+  void checkSampleRate();
+  void setSampleRate(UInt8 rate);
+  void onSampleRateDisabled(PS2Request* request, void* param);
+  void onSampleRateDone(PS2Request* request, void*);
     
   void updateTouchpadLED();
   bool setTouchpadLED(UInt8 touchLED);
+  void onLEDDone(PS2Request* request, void*);
   bool getTouchPadData(UInt8 dataSelector, UInt8 buf3[]);
   void setParamPropertiesGated(OSDictionary * dict);
   void injectVersionDependentProperties(OSDictionary* dict);
@@ -145,9 +174,18 @@ protected:
   virtual IOItemCount buttonCount();
   virtual IOFixed     resolution();
   inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
-    { dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
+  {
+    if (_accel.isEnabled())
+    {
+      uint64_t now_ns;
+      absolutetime_to_nanoseconds(now, &now_ns);
+      _accel.accelerate(dx, dy, now_ns);
+    }
+    ++_stats->hidEvents;
+    dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now);
+  }
   inline void dispatchScrollWheelEventX(short deltaAxis1, short deltaAxis2, short deltaAxis3, uint64_t now)
-    { dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
+    { ++_stats->hidEvents; dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
   inline void setTimerTimeout(IOTimerEventSource* timer, uint64_t time)
     { timer->setTimeout(*(AbsoluteTime*)&time); }
   inline void cancelTimer(IOTimerEventSource* timer)
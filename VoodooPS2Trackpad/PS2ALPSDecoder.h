@@ -0,0 +1,565 @@
+//
+//  PS2ALPSDecoder.h
+//  VoodooPS2Trackpad
+//
+//  ALPS packet decoding (protocol v3, v4, v5 and v7) used by
+//  ApplePS2ALPSGlidePoint.  Model identification is in PS2ALPSIdentity.h.
+//
+//  This header intentionally has no IOKit dependencies, so the decoders
+//  do not depend on the driver's state or the kernel environment.
+//
+
+#ifndef _PS2ALPSDECODER_H
+#define _PS2ALPSDECODER_H
+
+#include <stdint.h>
+#include "PS2ALPSIdentity.h"
+
+#define kALPSPacketMax          8       // largest packet (v4)
+
+// Dolphin: sensor lines from the third byte of its size report
+// (returns false, leaving info unchanged, if the report gives less than two
+// lines on an axis, as bitmapCoord divides by lines-1)
+static inline bool setDolphinArea(ALPSProtocolInfo* info, uint8_t report2)
+{
+    int xBits = 8 + (report2 & 0x0f);
+    int yBits = 1 + ((report2 >> 4) & 0x0f);
+    if (xBits < 2 || yBits < 2)
+        return false;
+    info->xBits = xBits;
+    info->yBits = yBits;
+    info->xMax = (info->xBits - 1) * 64;
+    info->yMax = (info->yBits - 1) * 64;
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ALPSDecoder
+//
+// o  isValidByte:
+//    o  Description:  Checks one byte of a packet as it arrives (index is its
+//                     position in the packet).  Called at interrupt time.
+//
+// o  decode:
+//    o  Description:  Decodes one complete packet.
+//    o  Result:       kALPSD_Touch: report has the touchpad state.  fingers
+//                     is the finger count, mt[0] (and mt[1] with two or more
+//                     fingers) the positions.  Coordinates are 0..xMax/yMax
+//                     with y increasing downwards.
+//                     kALPSD_Trackstick: report has relative dx/dy.
+//                     kALPSD_None: nothing to report (first half of a v3/v5
+//                     multi-packet, noise, etc.)
+//                     buttons is bit 0 left, bit 1 right, bit 2 middle.
+//
+// o  Multi-finger positions come from the sensor bitmaps (v3/v4/v5): each
+//    axis has one bit per sensor line.  Runs of set bits are contacts.  The
+//    first touch comes from the regular position data, and the second is the
+//    corner of the bitmap box opposite to it.  v7 reports both positions.
+//
+
+enum ALPSDecodeResult
+{
+    kALPSD_None,
+    kALPSD_Touch,
+    kALPSD_Trackstick,
+};
+
+struct ALPSPoint
+{
+    int         x, y;
+};
+
+struct ALPSReport
+{
+    int         fingers;
+    ALPSPoint   mt[2];
+    int         z;
+    uint32_t    buttons;
+    int         dx, dy;     // trackstick
+};
+
+class ALPSDecoder
+{
+private:
+    struct Fields
+    {
+        unsigned    xMap, yMap;
+        int         fingers;
+        int         pressure;
+        ALPSPoint   st;
+        ALPSPoint   mt[2];
+        bool        firstMp, isMp;
+        uint32_t    buttons;
+        uint32_t    tsButtons;
+    };
+
+    struct BitmapPoint
+    {
+        int         start;
+        int         count;
+    };
+
+    ALPSProtocolInfo    _info;
+    Fields              _f;
+    uint8_t             _multiData[6];
+    int                 _multiPacket;
+    int                 _secondTouch;
+
+    static inline void getBitmapPoints(unsigned map, BitmapPoint& low, BitmapPoint& high, int& fingers)
+    {
+        BitmapPoint* point = &low;
+        int prev = 0;
+        for (int i = 0; map; i++, map >>= 1)
+        {
+            int bit = map & 1;
+            if (bit)
+            {
+                if (!prev)
+                {
+                    point->start = i;
+                    point->count = 0;
+                    ++fingers;
+                }
+                ++point->count;
+            }
+            else if (prev)
+                point = &high;
+            prev = bit;
+        }
+    }
+
+    inline int bitmapCoord(int max, int bits, const BitmapPoint& point)
+        { return max * (2 * point.start + point.count - 1) / (2 * (bits - 1)); }
+
+    int processBitmap()
+    {
+        if (!_f.xMap || !_f.yMap)
+            return 0;
+
+        int fingersX = 0, fingersY = 0;
+        BitmapPoint xLow = { 0, 0 }, xHigh = { 0, 0 };
+        BitmapPoint yLow = { 0, 0 }, yHigh = { 0, 0 };
+        getBitmapPoints(_f.xMap, xLow, xHigh, fingersX);
+        getBitmapPoints(_f.yMap, yLow, yHigh, fingersY);
+
+        // fingers can overlap, so the axis with more contacts wins
+        int fingers = fingersX > fingersY ? fingersX : fingersY;
+
+        // single contact on an axis: overlapping or adjacent fingers, split it
+        if (1 == fingersX)
+        {
+            int i = (xLow.count - 1) / 2;
+            xLow.count -= i;
+            xHigh.start = xLow.start + i;
+            xHigh.count = i > 1 ? i : 1;
+        }
+        if (1 == fingersY)
+        {
+            int i = (yLow.count - 1) / 2;
+            yLow.count -= i;
+            yHigh.start = yLow.start + i;
+            yHigh.count = i > 1 ? i : 1;
+        }
+
+        // corners of the box: top-left, top-right, bottom-right, bottom-left
+        ALPSPoint corner[4];
+        corner[0].x = bitmapCoord(_info.xMax, _info.xBits, xLow);
+        corner[0].y = bitmapCoord(_info.yMax, _info.yBits, yLow);
+        corner[1].x = bitmapCoord(_info.xMax, _info.xBits, xHigh);
+        corner[1].y = corner[0].y;
+        corner[2].x = corner[1].x;
+        corner[2].y = bitmapCoord(_info.yMax, _info.yBits, yHigh);
+        corner[3].x = corner[0].x;
+        corner[3].y = corner[2].y;
+
+        // x bitmap is reversed on v5, y bitmap on v3 and v4
+        for (int i = 0; i < 4; i++)
+        {
+            if (kALPS_V5 == _info.proto)
+                corner[i].x = _info.xMax - corner[i].x;
+            else
+                corner[i].y = _info.yMax - corner[i].y;
+        }
+
+        // pick the second touch corner once per touch, so it doesn't jump around
+        if (-1 == _secondTouch)
+        {
+            int closest = 0x7fffffff;
+            for (int i = 0; i < 4; i++)
+            {
+                int dx = _f.st.x - corner[i].x;
+                int dy = _f.st.y - corner[i].y;
+                int distance = dx*dx + dy*dy;
+                if (distance < closest)
+                {
+                    _secondTouch = i;
+                    closest = distance;
+                }
+            }
+            // opposite corner is the second touch
+            _secondTouch = (_secondTouch + 2) % 4;
+        }
+
+        _f.mt[0] = _f.st;
+        _f.mt[1] = corner[_secondTouch];
+        return fingers;
+    }
+
+    static inline uint32_t buttonsV3(const uint8_t* p) { return p[3] & 0x07; }
+    static inline uint32_t trackstickButtonsV3(const uint8_t* p) { return (p[3] >> 4) & 0x07; }
+
+    // v3 "Pinnacle"
+    void decodePinnacle(const uint8_t* p)
+    {
+        _f.firstMp = (p[4] & 0x40) != 0;
+        _f.isMp = (p[0] & 0x40) != 0;
+        if (_f.isMp)
+        {
+            _f.fingers = (p[5] & 0x3) + 1;
+            _f.xMap = ((p[4] & 0x7e) << 8) | ((p[1] & 0x7f) << 2) | ((p[0] & 0x30) >> 4);
+            _f.yMap = ((p[3] & 0x70) << 4) | ((p[2] & 0x7f) << 1) | (p[4] & 0x01);
+        }
+        else
+        {
+            _f.st.x = ((p[1] & 0x7f) << 4) | ((p[4] & 0x30) >> 2) | ((p[0] & 0x30) >> 4);
+            _f.st.y = ((p[2] & 0x7f) << 4) | (p[4] & 0x0f);
+            _f.pressure = p[5] & 0x7f;
+            _f.buttons = buttonsV3(p);
+            _f.tsButtons = trackstickButtonsV3(p);
+        }
+    }
+
+    // v5 "Dolphin"
+    void decodeDolphin(const uint8_t* p)
+    {
+        _f.firstMp = (p[0] & 0x02) != 0;
+        _f.isMp = (p[0] & 0x20) != 0;
+        if (!_f.isMp)
+        {
+            _f.st.x = (p[1] & 0x7f) | ((p[4] & 0x0f) << 7);
+            _f.st.y = (p[2] & 0x7f) | ((p[4] & 0xf0) << 3);
+            _f.pressure = (p[0] & 4) ? 0 : p[5] & 0x7f;
+            _f.buttons = buttonsV3(p);
+            _f.tsButtons = trackstickButtonsV3(p);
+        }
+        else
+        {
+            _f.fingers = ((p[0] & 0x6) >> 1) | ((p[0] & 0x10) >> 2);
+            uint64_t palm = (p[1] & 0x7f) |
+                            ((p[2] & 0x7f) << 7) |
+                            ((p[4] & 0x7f) << 14) |
+                            ((p[5] & 0x7f) << 21) |
+                            ((uint64_t)(p[3] & 0x07) << 28) |
+                            ((uint64_t)(p[3] & 0x70) << 27) |
+                            ((uint64_t)(p[0] & 0x01) << 34);
+            // y profile in the low yBits, x profile in the next xBits
+            _f.yMap = (unsigned)(palm & ((1ULL << _info.yBits) - 1));
+            _f.xMap = (unsigned)((palm >> _info.yBits) & ((1ULL << _info.xBits) - 1));
+        }
+    }
+
+    inline void decodeFields(const uint8_t* p)
+    {
+        if (kALPS_V5 == _info.proto)
+            decodeDolphin(p);
+        else
+            decodePinnacle(p);
+    }
+
+    // common to v3/v4/v5: single touch data when there is no usable bitmap
+    ALPSDecodeResult reportSemiMT(int fingers, ALPSReport& report)
+    {
+        _f.mt[0] = _f.st;
+        if (fingers < 2)
+        {
+            fingers = _f.pressure > 0 ? 1 : 0;
+            _secondTouch = -1;
+        }
+        report.fingers = fingers;
+        report.mt[0] = _f.mt[0];
+        report.mt[1] = _f.mt[1];
+        report.z = _f.pressure;
+        report.buttons = _f.buttons | _f.tsButtons;
+        return kALPSD_Touch;
+    }
+
+    ALPSDecodeResult processTouchV3V5(const uint8_t* packet, ALPSReport& report)
+    {
+        int fingers = 0;
+        decodeFields(packet);
+
+        //
+        // There is nothing in a packet that says it is a bitmap packet, except
+        // that a bitmap packet always follows a position packet with the
+        // "first multi-packet" bit set.  If what follows turns out to be a
+        // position packet after all, it is processed as one.
+        //
+        if (_multiPacket)
+        {
+            if (_f.isMp)
+            {
+                fingers = _f.fingers;
+                // bitmap processing needs the position packet's coordinates
+                decodeFields(_multiData);
+                if (0 == processBitmap())
+                    fingers = 0;
+            }
+            else
+                _multiPacket = 0;
+        }
+
+        // bitmap packets out of sequence (or a palm) are dropped
+        if (_f.isMp)
+            return kALPSD_None;
+
+        if (!_multiPacket && _f.firstMp)
+        {
+            _multiPacket = 1;
+            for (int i = 0; i < 6; i++)
+                _multiData[i] = packet[i];
+            return kALPSD_None;
+        }
+        _multiPacket = 0;
+
+        // single z == 0 packets in the middle of a stream are flukes
+        // (real releases have x, y and z all zero)
+        if (_f.st.x && _f.st.y && !_f.pressure)
+            return kALPSD_None;
+
+        return reportSemiMT(fingers, report);
+    }
+
+    ALPSDecodeResult processTrackstickV3(const uint8_t* p, ALPSReport& report)
+    {
+        if (!(_info.flags & kALPS_DualPoint) || !(p[0] & 0x40))
+            return kALPSD_None;
+        // end of trackstick stream marker
+        if (p[1] == 0x7f && p[2] == 0x7f && p[4] == 0x7f)
+            return kALPSD_None;
+
+        // values are large, scale them down
+        int x = (int8_t)(((p[0] & 0x20) << 2) | (p[1] & 0x7f));
+        int y = (int8_t)(((p[0] & 0x10) << 3) | (p[2] & 0x7f));
+        report.dx = x / 8;
+        report.dy = -y / 8;
+        report.buttons = p[3] & 0x07;
+        return kALPSD_Trackstick;
+    }
+
+    ALPSDecodeResult processV4(const uint8_t* p, ALPSReport& report)
+    {
+        //
+        // v4 has a 6-byte bitmap, spread over bytes 6 and 7 of three packets.
+        //
+        if (p[6] & 0x40)
+            _multiPacket = 0;   // sync
+        if (_multiPacket > 2)
+            return kALPSD_None;
+
+        int offset = 2 * _multiPacket;
+        _multiData[offset] = p[6];
+        _multiData[offset + 1] = p[7];
+
+        _f.buttons = p[4] & 0x03;
+        _f.tsButtons = 0;
+        _f.st.x = ((p[1] & 0x7f) << 4) | ((p[3] & 0x30) >> 2) | ((p[0] & 0x30) >> 4);
+        _f.st.y = ((p[2] & 0x7f) << 4) | (p[3] & 0x0f);
+        _f.pressure = p[5] & 0x7f;
+
+        if (++_multiPacket > 2)
+        {
+            _multiPacket = 0;
+            _f.xMap = ((_multiData[2] & 0x1f) << 10) |
+                      ((_multiData[3] & 0x60) << 3) |
+                      ((_multiData[0] & 0x3f) << 2) |
+                      ((_multiData[1] & 0x60) >> 5);
+            _f.yMap = ((_multiData[5] & 0x01) << 10) |
+                      ((_multiData[3] & 0x1f) << 5) |
+                      (_multiData[1] & 0x1f);
+            _f.fingers = processBitmap();
+        }
+        return reportSemiMT(_f.fingers, report);
+    }
+
+    enum
+    {
+        kV7_Idle,
+        kV7_Two,
+        kV7_Multi,
+        kV7_New,
+        kV7_Unknown,
+    };
+
+    static inline int packetIdV7(const uint8_t* p)
+    {
+        if (p[4] & 0x40)
+            return kV7_Two;
+        if (p[4] & 0x01)
+            return kV7_Multi;
+        if ((p[0] & 0x10) && !(p[4] & 0x43))
+            return kV7_New;
+        if (p[1] == 0x00 && p[4] == 0x00)
+            return kV7_Idle;
+        return kV7_Unknown;
+    }
+
+    static void coordinatesV7(ALPSPoint* mt, const uint8_t* p, int id)
+    {
+        mt[0].x = ((p[2] & 0x80) << 4) | ((p[2] & 0x3f) << 5) | ((p[3] & 0x30) >> 1) | (p[3] & 0x07);
+        mt[0].y = (p[1] << 3) | (p[0] & 0x07);
+
+        mt[1].x = ((p[3] & 0x80) << 4) | ((p[4] & 0x80) << 3) | ((p[4] & 0x3f) << 4);
+        mt[1].y = ((p[5] & 0x80) << 3) | ((p[5] & 0x3f) << 4);
+
+        switch (id)
+        {
+            case kV7_Two:
+                mt[1].x &= ~0x000f;
+                mt[1].y |= 0x000f;
+                // false positive: x & y at max (y becomes 0 below)
+                if (mt[1].y == 0x7ff && mt[1].x == 0xff0)
+                    mt[1].x = 0;
+                break;
+            case kV7_Multi:
+                mt[1].x &= ~0x003f;
+                mt[1].y &= ~0x0020;
+                mt[1].y |= ((p[4] & 0x02) << 4);
+                mt[1].y |= 0x001f;
+                break;
+        }
+
+        mt[0].y = 0x7ff - mt[0].y;
+        mt[1].y = 0x7ff - mt[1].y;
+    }
+
+    ALPSDecodeResult processV7(const uint8_t* p, ALPSReport& report)
+    {
+        if (p[0] == 0x48 && (p[4] & 0x47) == 0x06)
+        {
+            // trackstick
+            int x = (int8_t)((p[2] & 0xbf) | ((p[3] & 0x10) << 2));
+            int y = (int8_t)((p[3] & 0x07) | (p[4] & 0xb8) | ((p[3] & 0x20) << 1));
+            report.dx = x;
+            report.dy = -y;
+            report.buttons = p[1] & 0x07;
+            return kALPSD_Trackstick;
+        }
+
+        int id = packetIdV7(p);
+        if (kV7_Unknown == id)
+            return kALPSD_None;
+        //
+        // NEW packets mark a discontinuity (a finger moved between slots).
+        // They have no right/middle buttons, no reliable finger count and
+        // inaccurate x for the second touch, so they are just ignored.
+        //
+        if (kV7_New == id)
+            return kALPSD_None;
+
+        report.fingers = 0;
+        report.mt[0].x = report.mt[0].y = 0;
+        report.mt[1].x = report.mt[1].y = 0;
+        report.z = 0;
+        report.buttons = 0;
+        if (kV7_Idle == id)
+            return kALPSD_Touch;
+
+        coordinatesV7(report.mt, p, id);
+        int fingers = 0;
+        if (kV7_Two == id)
+        {
+            for (int i = 0; i < 2; i++)
+                if (report.mt[i].x || report.mt[i].y)
+                    ++fingers;
+        }
+        else
+            fingers = 3 + (p[5] & 0x03);
+
+        report.buttons = (p[0] & 0x80) >> 7;
+        if (_info.flags & kALPS_ButtonPad)
+        {
+            if (p[0] & 0x20)
+                ++fingers;
+            if (p[0] & 0x10)
+                ++fingers;
+        }
+        else
+        {
+            report.buttons |= (p[0] & 0x20) >> 4;   // right
+            report.buttons |= (p[0] & 0x10) >> 2;   // middle
+        }
+
+        // a single touch is sometimes reported in mt[1]
+        if (1 == fingers && !report.mt[0].x && !report.mt[0].y)
+        {
+            report.mt[0] = report.mt[1];
+            report.mt[1].x = report.mt[1].y = 0;
+        }
+        report.fingers = fingers;
+        report.z = fingers ? 64 : 0;    // no pressure in v7
+        return kALPSD_Touch;
+    }
+
+public:
+    ALPSDecoder() { _info.proto = kALPS_None; reset(); }
+
+    inline void init(const ALPSProtocolInfo& info) { _info = info; reset(); }
+    inline const ALPSProtocolInfo& info() const { return _info; }
+
+    // forget any multi-packet sequence in progress
+    inline void reset()
+    {
+        _multiPacket = 0;
+        _secondTouch = -1;
+        _f.xMap = _f.yMap = 0;
+        _f.fingers = 0;
+        _f.pressure = 0;
+        _f.st.x = _f.st.y = 0;
+        _f.mt[0] = _f.mt[1] = _f.st;
+        _f.firstMp = _f.isMp = false;
+        _f.buttons = _f.tsButtons = 0;
+    }
+
+    inline bool isValidByte(int index, uint8_t data) const
+    {
+        if (0 == index)
+            return (data & _info.mask0) == _info.byte0;
+        switch (_info.proto)
+        {
+            case kALPS_V3:
+            case kALPS_V4:
+                // bytes 1..n have bit 7 clear
+                return !(data & 0x80);
+            case kALPS_V7:
+                if (2 == index)
+                    return (data & 0x40) == 0x40;
+                if (3 == index)
+                    return (data & 0x48) == 0x48;
+                if (5 == index)
+                    return (data & 0x40) == 0x00;
+                break;
+        }
+        return true;
+    }
+
+    ALPSDecodeResult decode(const uint8_t* packet, ALPSReport& report)
+    {
+        switch (_info.proto)
+        {
+            case kALPS_V3:
+                // trackstick packets always have 0x3f in the last byte
+                if (0x3f == packet[5])
+                    return processTrackstickV3(packet, report);
+                return processTouchV3V5(packet, report);
+            case kALPS_V5:
+                return processTouchV3V5(packet, report);
+            case kALPS_V4:
+                return processV4(packet, report);
+            case kALPS_V7:
+                return processV7(packet, report);
+        }
+        return kALPSD_None;
+    }
+};
+
+#endif /* _PS2ALPSDECODER_H */
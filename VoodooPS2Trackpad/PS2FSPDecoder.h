@@ -0,0 +1,167 @@
+//
+//  PS2FSPDecoder.h
+//  VoodooPS2Trackpad
+//
+//  Sentelic FSP absolute packet decoding used by ApplePS2SentelicFSP.
+//
+//  Works on packet bytes handed in by the driver, and returns plain finger
+//  reports; the gestures are PS2TouchGesture, the HID dispatch the driver's.
+//
+
+#ifndef _PS2FSPDECODER_H
+#define _PS2FSPDECODER_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Packet format
+//
+// o  Absolute packets are 4 bytes (intellimouse mode must be enabled):
+//
+//     7  6  5  4  3  2  1  0
+//    -----------------------
+//     0  1  M  P  1  F  R  L    M: MFMC (multi finger), P: physical button
+//    X9 X8 X7 X6 X5 X4 X3 X2    F: second finger (MFMC) or middle button
+//    Y9 Y8 Y7 Y6 Y5 Y4 Y3 Y2
+//     .  .  .  .  X1 X0 Y1 Y0
+//
+// o  SFAC (single finger) packets carry the only finger.  MFMC packets
+//    carry one of two fingers each, so the decoder keeps both slots.
+//
+
+#define FSP_PKT_TYPE_NORMAL     0x00
+#define FSP_PKT_TYPE_ABS        0x01
+#define FSP_PKT_TYPE_NOTIFY     0x02
+#define FSP_PKT_TYPE_NORMAL_OPC 0x03
+#define FSP_PKT_TYPE_SHIFT      6
+
+#define FSP_PB0_LBTN            0x01
+#define FSP_PB0_RBTN            0x02
+#define FSP_PB0_MBTN            0x04
+#define FSP_PB0_MFMC_FGR2       FSP_PB0_MBTN
+#define FSP_PB0_MUST_SET        0x08
+#define FSP_PB0_PHY_BTN         0x10
+#define FSP_PB0_MFMC            0x20
+
+#define kFSPAbsXMax             1023
+#define kFSPAbsYMax             767
+
+struct FSPContact
+{
+    bool        down;
+    int         x;
+    int         y;
+};
+
+struct FSPReport
+{
+    int         fingers;
+    FSPContact  mt[2];
+    uint32_t    buttons;
+};
+
+class FSPDecoder
+{
+private:
+    FSPContact  _slot[2];
+    int         _lastmt;        // finger of last MFMC packet (0 if SFAC)
+
+    inline void setSlot(int slot, bool down, int x, int y)
+    {
+        _slot[slot].down = down;
+        _slot[slot].x = down ? x : 0;
+        _slot[slot].y = down ? y : 0;
+    }
+
+public:
+    FSPDecoder() { reset(); }
+
+    inline void reset()
+    {
+        setSlot(0, false, 0, 0);
+        setSlot(1, false, 0, 0);
+        _lastmt = 0;
+    }
+
+    static inline int packetType(const uint8_t* packet)
+        { return packet[0] >> FSP_PKT_TYPE_SHIFT; }
+
+    // returns false if packet is not an absolute packet
+    bool decode(const uint8_t* packet, FSPReport& report)
+    {
+        if (packetType(packet) != FSP_PKT_TYPE_ABS)
+            return false;
+
+        uint8_t byte0 = packet[0];
+        uint8_t byte3 = packet[3];
+
+        // ignore coordinate noise as the finger leaves the surface, otherwise
+        // the position jumps to the upper-left corner
+        if ((byte0 == 0x48 || byte0 == 0x49) && packet[1] == 0 && packet[2] == 0)
+            byte3 &= 0xf0;
+
+        int x = (packet[1] << 2) | ((byte3 >> 2) & 0x03);
+        int y = (packet[2] << 2) | (byte3 & 0x03);
+        int fingers = 0;
+
+        if (byte0 & FSP_PB0_MFMC)
+        {
+            // MFMC packet: assume two fingers on the pad
+            fingers = 2;
+            if (byte0 & FSP_PB0_MFMC_FGR2)
+            {
+                // some firmware sends the second finger twice after the
+                // first is lifted
+                if (2 == _lastmt)
+                {
+                    fingers = 1;
+                    setSlot(0, false, 0, 0);
+                }
+                _lastmt = 2;
+                setSlot(1, fingers == 2, x, y);
+            }
+            else
+            {
+                if (1 == _lastmt)
+                {
+                    fingers = 1;
+                    setSlot(1, false, 0, 0);
+                }
+                _lastmt = 1;
+                setSlot(0, fingers != 0, x, y);
+            }
+        }
+        else
+        {
+            // SFAC packet: an on-pad click (no physical button) is a tap,
+            // which is done in software
+            if ((byte0 & (FSP_PB0_LBTN|FSP_PB0_PHY_BTN)) == FSP_PB0_LBTN)
+                byte0 &= ~FSP_PB0_LBTN;
+            _lastmt = 0;
+            if (x != 0 && y != 0)
+                fingers = 1;
+            setSlot(0, fingers > 0, x, y);
+            setSlot(1, false, 0, 0);
+        }
+
+        report.fingers = fingers;
+        if (2 == fingers)
+        {
+            report.mt[0] = _slot[0];
+            report.mt[1] = _slot[1];
+        }
+        else
+        {
+            // single finger is always reported in mt[0], from this packet
+            report.mt[0].down = fingers != 0;
+            report.mt[0].x = x;
+            report.mt[0].y = y;
+            report.mt[1].down = false;
+            report.mt[1].x = report.mt[1].y = 0;
+        }
+        report.buttons = byte0 & (FSP_PB0_LBTN|FSP_PB0_RBTN);
+        return true;
+    }
+};
+
+#endif /* _PS2FSPDECODER_H */
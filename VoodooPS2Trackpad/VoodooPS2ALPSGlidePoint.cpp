@@ -24,6 +24,7 @@
 #include <IOKit/hidsystem/IOHIDParameter.h>
 #include "VoodooPS2Controller.h"
 #include "VoodooPS2ALPSGlidePoint.h"
+#include "PS2ParamSchema.h"
 
 enum {
     //
@@ -31,6 +32,18 @@ enum {
     kTapEnabled  = 0x01
 };
 
+// v3 and later: finger motion is scaled to the range of the old (v1/v2) pads
+#define kALPSLegacyRange        1023
+// software tap (v3 and later)
+#define kTapMaxTime             200000000   // ns
+#define kTapMaxMove             10
+
+#define kALPSRegBasePinnacle    0x0000
+
+#define kALPSProtocolVersion    "ALPSProtocolVersion"
+
+#define abs(x) ((x) < 0 ? -(x) : (x))
+
 // =============================================================================
 // ApplePS2ALPSGlidePoint Class Implementation
 //
@@ -45,7 +58,6 @@ UInt32 ApplePS2ALPSGlidePoint::interfaceID()
 
 IOItemCount ApplePS2ALPSGlidePoint::buttonCount() { return 2; };
 IOFixed     ApplePS2ALPSGlidePoint::resolution()  { return _resolution; };
-bool IsItALPS(ALPSStatus_t *E6,ALPSStatus_t *E7);
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
@@ -61,18 +73,86 @@ bool ApplePS2ALPSGlidePoint::init(OSDictionary * dict)
 
     // initialize state...
     _device                    = 0;
+    _cmdGate                   = 0;
     _interruptHandlerInstalled = false;
     _packetByteCount           = 0;
+    _stats                     = statisticsSink();
     _resolution                = (100) << 16; // (100 dpi, 4 counts/mm)
     _touchPadModeByte          = kTapEnabled;
     _scrolling                 = SCROLL_NONE;
     _zscrollpos                = 0;
+    _edgeaccell                = 0;
+    _edgeaccelvalue            = 0;
+    _scrolledgex               = 900;
+    _scrolledgey               = 650;
+    _cornerlow                 = 100;
+    _cornerhigh                = 950;
+    _protocol.proto            = kALPS_None;
+    _packetTime                = 0;
+    _accelcurve[0]             = 0;
+
+    // v3 and later: software gestures, scaled to the old pads' range once
+    // the sensor size is known (initTouchPad)
+    PS2TouchGestureConfig& gesture = _gesture.config();
+    gesture.tapping = _touchPadModeByte & kTapEnabled;
+    gesture.vscroll = false;
+    gesture.hscroll = false;
+    gesture.scale = kALPSLegacyRange;
+    gesture.scrollDivisor = 1;     // (scrollDelta does the scaling)
+    gesture.swipeDistance = 0;
+    gesture.tapTime = kTapMaxTime;
+    gesture.tapMove = kTapMaxMove;
+
+    buildScrollRegions();
+    buildScrollAccel();
     
     return true;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2ALPSGlidePoint::buildScrollRegions()
+{
+    //
+    // Classify each coordinate once, so insideScrollArea and the corner
+    // check are just table lookups at packet time.
+    //
+
+    for (int i = 0; i < kALPSCoordMax; i++)
+    {
+        UInt8 x = 0, y = 0;
+        if (i > _scrolledgex)
+            x |= kRegionEdge;
+        if (i > _scrolledgey)
+            y |= kRegionEdge;
+        if (i <= _cornerlow)
+            x |= kRegionLow, y |= kRegionLow;
+        else if (i >= _cornerhigh)
+            x |= kRegionHigh, y |= kRegionHigh;
+        _xregion[i] = x;
+        _yregion[i] = y;
+    }
+}
+
+void ApplePS2ALPSGlidePoint::buildScrollAccel()
+{
+    //
+    // Scroll delta for each possible coordinate delta (truncated toward zero,
+    // negative deltas use the same table via scrollDelta).
+    //
+
+    for (int i = 0; i < kALPSCoordMax; i++)
+    {
+        SInt64 v = ((SInt64)i * _edgeaccelvalue) >> kEdgeAccelShift;
+        _scrollaccel[i] = v > 0x7fff ? 0x7fff : (SInt16)v;
+    }
+
+    // corner "tapping" amount: 25 divided by the acceleration (when above 1.0)
+    _cornerscroll = _edgeaccelvalue > kEdgeAccelOne ? (25 << kEdgeAccelShift) / _edgeaccelvalue : 25;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 ApplePS2ALPSGlidePoint* ApplePS2ALPSGlidePoint::probe( IOService * provider, SInt32 * score )
 {
     DEBUG_LOG("ApplePS2ALPSGlidePoint::probe entered...\n");
@@ -93,6 +173,7 @@ ApplePS2ALPSGlidePoint* ApplePS2ALPSGlidePoint::probe( IOService * provider, SIn
             config->release();
             return 0;
         }
+        setAccelerationParams(config);
 #ifdef DEBUG
         // save configuration for later/diagnostics...
         setProperty(kMergedConfiguration, config);
@@ -100,7 +181,7 @@ ApplePS2ALPSGlidePoint* ApplePS2ALPSGlidePoint::probe( IOService * provider, SIn
     }
     OSSafeReleaseNULL(config);
 
-	ALPSStatus_t E6,E7;
+	ALPSStatus_t E6,E7,EC;
     //
     // The driver has been instructed to verify the presence of the actual
     // hardware we represent. We are guaranteed by the controller that the
@@ -113,13 +194,34 @@ ApplePS2ALPSGlidePoint* ApplePS2ALPSGlidePoint::probe( IOService * provider, SIn
 
     _device = (ApplePS2MouseDevice *) provider;
 
-    getModel(&E6, &E7);
+    PS2AuxIdentity identity;
+    if (_device->getIdentity(&identity))
+    {
+        // controller already has the reports
+        if (kPS2Aux_ALPS != identity.vendor)
+        {
+            DEBUG_LOG("%s: aux device is %s, not ALPS\n", getName(), auxVendorName(identity.vendor));
+            _device = 0;
+            return 0;
+        }
+        E6.byte0 = identity.e6[0], E6.byte1 = identity.e6[1], E6.byte2 = identity.e6[2];
+        E7.byte0 = identity.e7[0], E7.byte1 = identity.e7[1], E7.byte2 = identity.e7[2];
+        EC.byte0 = identity.ec[0], EC.byte1 = identity.ec[1], EC.byte2 = identity.ec[2];
+    }
+    else
+    {
+        getModel(&E6, &E7);
+        getCommandModeReport(&EC);
+    }
 
-    DEBUG_LOG("E7: { 0x%02x, 0x%02x, 0x%02x } E6: { 0x%02x, 0x%02x, 0x%02x }",
-        E7.byte0, E7.byte1, E7.byte2, E6.byte0, E6.byte1, E6.byte2);
+    DEBUG_LOG("E7: { 0x%02x, 0x%02x, 0x%02x } E6: { 0x%02x, 0x%02x, 0x%02x } EC: { 0x%02x, 0x%02x, 0x%02x }",
+        E7.byte0, E7.byte1, E7.byte2, E6.byte0, E6.byte1, E6.byte2, EC.byte0, EC.byte1, EC.byte2);
 
-    success = IsItALPS(&E6,&E7);
-	DEBUG_LOG("ALPS Device? %s\n", (success ? "yes" : "no"));
+    UInt8 e6[3] = { E6.byte0, E6.byte1, E6.byte2 };
+    UInt8 e7[3] = { E7.byte0, E7.byte1, E7.byte2 };
+    UInt8 ec[3] = { EC.byte0, EC.byte1, EC.byte2 };
+    success = identifyALPS(e6, e7, ec, &_protocol);
+	DEBUG_LOG("ALPS Device? %s (protocol v%d)\n", (success ? "yes" : "no"), _protocol.proto);
 
     // override
     //success = true;
@@ -132,59 +234,6 @@ ApplePS2ALPSGlidePoint* ApplePS2ALPSGlidePoint::probe( IOService * provider, SIn
     return (success) ? this : 0;
 }
 
-bool IsItALPS(ALPSStatus_t *E6,ALPSStatus_t *E7)
-{
-	bool	success = false;
-	short   i;
-	
-	UInt8 byte0, byte1, byte2;
-	byte0 = E7->byte0;
-	byte1 = E7->byte1;
-	byte2 = E7->byte2;
-	
-	#define NUM_SINGLES 10
-	static int singles[NUM_SINGLES * 3] ={
-		0x33,0x2,0x0a,
-		0x53,0x2,0x0a,
-		0x53,0x2,0x14,
-		0x63,0x2,0xa,
-		0x63,0x2,0x14,
-		0x73,0x2,0x0a,	// 3622947
-		0x63,0x2,0x28,
-		0x63,0x2,0x3c,
-		0x63,0x2,0x50,
-		0x63,0x2,0x64};
-	#define NUM_DUALS 3
-	static int duals[NUM_DUALS * 3]={
-		0x20,0x2,0xe,
-		0x22,0x2,0xa,
-		0x22,0x2,0x14};
-
-	for (i = 0; i < NUM_SINGLES; i++)
-    {
-		if ((byte0 == singles[i * 3]) && (byte1 == singles[i * 3 + 1]) && 
-            (byte2 == singles[i * 3 + 2]))
-		{
-			success = true;
-			break;
-		}
-	}
-    
-	if (!success)
-	{
-		for(i = 0;i < NUM_DUALS;i++)
-		{
-			if ((byte0 == duals[i * 3]) && (byte1 == duals[i * 3 + 1]) && 
-                (byte2 == duals[i * 3 + 2]))
-			{
-				success = true;
-				break;
-			}
-		}
-	}
-	return success;
-}
-
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 bool ApplePS2ALPSGlidePoint::start( IOService * provider )
@@ -205,6 +254,20 @@ bool ApplePS2ALPSGlidePoint::start( IOService * provider )
 
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _stats = _device->getController()->getStreamStatistics(kDT_Mouse);
+
+    //
+    // Setup workloop with command gate for thread syncronization...
+    //
+    IOWorkLoop* pWorkLoop = getWorkLoop();
+    _cmdGate = IOCommandGate::commandGate(this);
+    if (!pWorkLoop || !_cmdGate)
+    {
+        OSSafeReleaseNULL(_cmdGate);
+        OSSafeReleaseNULL(_device);
+        return false;
+    }
+    pWorkLoop->addEventSource(_cmdGate);
 
     //
     // Announce hardware properties.
@@ -240,18 +303,30 @@ bool ApplePS2ALPSGlidePoint::start( IOService * provider )
     
     _device->lock();
     
-    // Enable tapping
-    setTapEnable( true );
-    
-    // Enable Absolute Mode
-	setAbsoluteMode();
-    
-    //
-    // Finally, we enable the trackpad itself, so that it may start reporting
-    // asynchronous events.
-    //
-    
-    setTouchPadEnable(true);
+    setProperty(kALPSProtocolVersion, _protocol.proto, 32);
+    if (_protocol.proto >= kALPS_V3)
+    {
+        // newer protocols: command mode register setup, ends with enable
+        if (kALPS_V5 == _protocol.proto)
+            getDolphinArea();
+        _decoder.init(_protocol);
+        initTouchPad();
+    }
+    else
+    {
+        // Enable tapping
+        setTapEnable( true );
+        
+        // Enable Absolute Mode
+        setAbsoluteMode();
+        
+        //
+        // Finally, we enable the trackpad itself, so that it may start reporting
+        // asynchronous events.
+        //
+        
+        setTouchPadEnable(true);
+    }
     
     //
     // Enable the mouse clock (should already be so) and the mouse IRQ line.
@@ -312,6 +387,18 @@ void ApplePS2ALPSGlidePoint::stop( IOService * provider )
     if ( _powerControlHandlerInstalled ) _device->uninstallPowerControlAction();
     _powerControlHandlerInstalled = false;
 
+    //
+    // Free up the command gate.
+    //
+
+    if (_cmdGate)
+    {
+        if (IOWorkLoop* pWorkLoop = getWorkLoop())
+            pWorkLoop->removeEventSource(_cmdGate);
+        _cmdGate->release();
+        _cmdGate = 0;
+    }
+
     //
     // Release the pointer to the provider object.
     //
@@ -333,26 +420,55 @@ PS2InterruptResult ApplePS2ALPSGlidePoint::interruptOccurred(UInt8 data)
     // Ignore all bytes until we see the start of a packet, otherwise the
     // packets may get out of sequence and things will get very confusing.
     //
+
+    if (_protocol.proto >= kALPS_V3)
+    {
+        if (!_decoder.isValidByte(_packetByteCount, data))
+        {
+            DEBUG_LOG("%s: Unexpected byte%d data (%02x) from PS/2 controller\n", getName(), _packetByteCount, data);
+            _stats->dropped += _packetByteCount + 1;
+            _packetByteCount = 0;
+            return kPS2IR_packetBuffering;
+        }
+        UInt8* packet = _ringBuffer.head();
+        packet[_packetByteCount++] = data;
+        if ((UInt32)_protocol.packetSize == _packetByteCount)
+        {
+            _ringBuffer.advanceHead(kPacketLengthMax);
+            queuePacketTime();
+            _packetByteCount = 0;
+            return kPS2IR_packetReady;
+        }
+        return kPS2IR_packetBuffering;
+    }
 		
     if (0 == _packetByteCount && (data & 0xc8) != 0x08 && (data & 0xf8) != 0xf8)
     {
         DEBUG_LOG("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        ++_stats->dropped;
         return kPS2IR_packetBuffering;
     }
-    if (_packetByteCount >= 1 && data == 0x80)
+    UInt8* packet = _ringBuffer.head();
+    //
+    // Validate the rest of the packet here, so a bad packet never makes it to
+    // the ring buffer (and packetReady).  Bytes 1-5 of an absolute packet
+    // always have bit 7 clear.
+    //
+    if (_packetByteCount >= 1 && (data == 0x80 || ((packet[0] & 0xf8) == 0xf8 && (data & 0x80))))
     {
         DEBUG_LOG("%s: Unexpected byte%d data (%02x) from PS/2 controller\n", getName(), _packetByteCount, data);
+        _stats->dropped += _packetByteCount + 1;
         _packetByteCount = 0;
         return kPS2IR_packetBuffering;
     }
 
-    UInt8* packet = _ringBuffer.head();
     packet[_packetByteCount++] = data;
     if (kPacketLengthLarge == _packetByteCount ||
         (kPacketLengthSmall == _packetByteCount && (packet[0] & 0xc8) == 0x08))
     {
         // complete 6 or 3-byte packet received...
         _ringBuffer.advanceHead(kPacketLengthMax);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -362,16 +478,23 @@ PS2InterruptResult ApplePS2ALPSGlidePoint::interruptOccurred(UInt8 data)
 void ApplePS2ALPSGlidePoint::packetReady()
 {
     // empty the ring buffer, dispatching each packet...
+    noteRingCount(_stats, _ringBuffer.count());
     while (_ringBuffer.count() >= kPacketLengthMax)
     {
         UInt8* packet = _ringBuffer.tail();
-        // now we have complete packet, either 6-byte or 3-byte
-        if ((packet[0] & 0xf8) == 0xf8)
+        ++_stats->packets;
+        // time packet was completed at interrupt time
+        _packetTime = _packetTimes.count() ? _packetTimes.fetch() : 0;
+        // now we have complete packet, either 6-byte or 3-byte (or v3+)
+        if (_protocol.proto >= kALPS_V3)
+            dispatchDecodedPacket(packet);
+        else if ((packet[0] & 0xf8) == 0xf8)
             dispatchAbsolutePointerEventWithPacket(packet, kPacketLengthLarge);
         else
             dispatchRelativePointerEventWithPacket(packet, kPacketLengthSmall);
         _ringBuffer.advanceTail(kPacketLengthMax);
     }
+    _packetTime = 0;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -388,7 +511,7 @@ void ApplePS2ALPSGlidePoint::dispatchAbsolutePointerEventWithPacket(UInt8* packe
     int y = (packet[4] & 0x7f) | ((packet[3] & 0x70) << (7-4));
     int z = packet[5]; // touch pression
     
-    clock_get_uptime(&now_abs);
+    now_abs = packetTime();
     
     left  |= (packet[2]) & 1;
     left  |= (packet[3]) & 1;
@@ -435,17 +558,17 @@ void ApplePS2ALPSGlidePoint::dispatchAbsolutePointerEventWithPacket(UInt8* packe
         xdiff = x - _xscrollpos;
         ydiff = y - _yscrollpos;
         
-        ydiff = (scroll == SCROLL_VERT) ? -((int)((double)ydiff * _edgeaccellvalue)) : 0;
-        xdiff = (scroll == SCROLL_HORIZ) ? -((int)((double)xdiff * _edgeaccellvalue)) : 0;
+        ydiff = (scroll == SCROLL_VERT) ? -scrollDelta(ydiff) : 0;
+        xdiff = (scroll == SCROLL_HORIZ) ? -scrollDelta(xdiff) : 0;
         
         // Those "if" should provide angle tapping (simulate click on up/down
         // buttons of a scrollbar), but i have to investigate more on the values,
         // since currently they don't work...
         if (ydiff == 0 && scroll == SCROLL_HORIZ)
-            ydiff = ((x >= 950 ? 25 : (x <= 100 ? -25 : 0)) / max(_edgeaccellvalue, 1));
+            ydiff = (_xregion[x] & kRegionHigh) ? _cornerscroll : (_xregion[x] & kRegionLow) ? -_cornerscroll : 0;
         
         if (xdiff == 0 && scroll == SCROLL_VERT)
-            xdiff = ((y >= 950 ? 25 : (y <= 100 ? -25 : 0)) / max(_edgeaccellvalue, 1));
+            xdiff = (_yregion[y] & kRegionHigh) ? _cornerscroll : (_yregion[y] & kRegionLow) ? -_cornerscroll : 0;
         
         dispatchScrollWheelEventX(ydiff, xdiff, 0, now_abs);
         _zscrollpos = z;
@@ -468,10 +591,10 @@ void ApplePS2ALPSGlidePoint::dispatchAbsolutePointerEventWithPacket(UInt8* packe
 int ApplePS2ALPSGlidePoint::insideScrollArea(int x, int y)
 {
     int scroll = 0;
-    if (x > 900) scroll |= SCROLL_VERT;
-    if (y > 650) scroll |= SCROLL_HORIZ;
+    if (_xregion[x] & kRegionEdge) scroll |= SCROLL_VERT;
+    if (_yregion[y] & kRegionEdge) scroll |= SCROLL_HORIZ;
     
-    if (x > 900 && y > 650)
+    if ((SCROLL_VERT|SCROLL_HORIZ) == scroll)
     {
         if (_scrolling == SCROLL_VERT)
             scroll = SCROLL_VERT;
@@ -515,9 +638,51 @@ void ApplePS2ALPSGlidePoint::
 	if(packet[0] & 0x20)
 		dy = dy  - 256;
 
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
-    dispatchRelativePointerEventX(dx, dy, buttons, now_abs);
+    dispatchRelativePointerEventX(dx, dy, buttons, packetTime());
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2ALPSGlidePoint::dispatchDecodedPacket(UInt8* packet)
+{
+    uint64_t now_abs = packetTime();
+
+    ALPSReport report;
+    switch (_decoder.decode(packet, report))
+    {
+        case kALPSD_Touch:
+            dispatchTouch(report, now_abs);
+            break;
+
+        case kALPSD_Trackstick:
+            dispatchRelativePointerEventX(report.dx, report.dy, report.buttons, now_abs);
+            break;
+
+        case kALPSD_None:
+            break;
+    }
+}
+
+void ApplePS2ALPSGlidePoint::dispatchTouch(const ALPSReport& report, uint64_t now_abs)
+{
+    //
+    // Gestures are PS2TouchGesture: one finger moves the pointer, two fingers
+    // scroll (TrackpadScroll and TrackpadHorizScroll, through the edge scroll
+    // acceleration), three or more only carry buttons.
+    //
+
+    uint64_t now_ns;
+    absolutetime_to_nanoseconds(now_abs, &now_ns);
+
+    PS2TouchGestureOutput out;
+    _gesture.process(report, now_ns, out);
+
+    if (out.tap)
+        dispatchRelativePointerEventX(0, 0, out.tap, now_abs);
+    if (out.scrollx || out.scrolly)
+        dispatchScrollWheelEventX(-scrollDelta(out.scrolly), -scrollDelta(out.scrollx), 0, now_abs);
+    else
+        dispatchRelativePointerEventX(out.dx, out.dy, out.buttons, now_abs);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -597,6 +762,28 @@ void ApplePS2ALPSGlidePoint::setTouchPadEnable( bool enable )
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2ALPSGlidePoint::setAccelerationParams(OSDictionary* dict)
+{
+    const PS2ParamEntry schema[]={
+        {"AccelerationCurve",               kPS2P_IntArray, _accelcurve, 0, kAccelCurveMax, 1},
+    };
+
+    PS2ParamResult result = applyParamSchema(this, schema, countof(schema), dict);
+    if (result.changed && !_accel.setCurve(&_accelcurve[1], _accelcurve[0]))
+        IOLog("%s: AccelerationCurve speeds must be increasing\n", getName());
+
+    // edge scroll acceleration tables, also read by packetReady
+    if (OSNumber* eaccell = OSDynamicCast(OSNumber, dict->getObject("HIDTrackpadScrollAcceleration")))
+    {
+        _edgeaccell = eaccell->unsigned32BitValue();
+        // value/1966.08/75 in 16.16 fixed point (1966.08*75 == 147456 == 2.25*65536)
+        _edgeaccelvalue = (SInt32)(((UInt64)_edgeaccell << kEdgeAccelShift) / 147456);
+        _edgeaccelvalue = _edgeaccelvalue == 0 ? kEdgeAccelOne/100 : _edgeaccelvalue;
+        buildScrollAccel();
+        setProperty("HIDTrackpadScrollAcceleration", eaccell);
+    }
+}
+
 IOReturn ApplePS2ALPSGlidePoint::setParamProperties( OSDictionary * dict )
 {
     OSNumber * clicking = OSDynamicCast( OSNumber, dict->getObject("Clicking") );
@@ -604,7 +791,6 @@ IOReturn ApplePS2ALPSGlidePoint::setParamProperties( OSDictionary * dict )
 	OSNumber * draglock = OSDynamicCast( OSNumber, dict->getObject("DragLock") );
     OSNumber * hscroll  = OSDynamicCast( OSNumber, dict->getObject("TrackpadHorizScroll") );
     OSNumber * vscroll  = OSDynamicCast( OSNumber, dict->getObject("TrackpadScroll") );
-    OSNumber * eaccell  = OSDynamicCast( OSNumber, dict->getObject("HIDTrackpadScrollAcceleration") );
 
     OSCollectionIterator* iter = OSCollectionIterator::withCollection( dict );
     OSObject* obj;
@@ -631,9 +817,14 @@ IOReturn ApplePS2ALPSGlidePoint::setParamProperties( OSDictionary * dict )
         if (_touchPadModeByte != newModeByteValue)
         {
             _touchPadModeByte = newModeByteValue;
-			setTapEnable(_touchPadModeByte);
+            _gesture.config().tapping = _touchPadModeByte & kTapEnabled;
 			setProperty("Clicking", clicking);
-			setAbsoluteMode(); //restart the mouse...
+            // v3 and later tap in software (dispatchTouch)
+            if (_protocol.proto < kALPS_V3)
+            {
+                setTapEnable(_touchPadModeByte);
+                setAbsoluteMode(); //restart the mouse...
+            }
         }
     }
 
@@ -652,21 +843,20 @@ IOReturn ApplePS2ALPSGlidePoint::setParamProperties( OSDictionary * dict )
     if (hscroll)
     {
         _edgehscroll = hscroll->unsigned32BitValue() & 0x1 ? true : false;
+        _gesture.config().hscroll = _edgehscroll;
         setProperty("TrackpadHorizScroll", hscroll);
     }
 
     if (vscroll)
     {
         _edgevscroll = vscroll->unsigned32BitValue() & 0x1 ? true : false;
+        _gesture.config().vscroll = _edgevscroll;
         setProperty("TrackpadScroll", vscroll);
         }
-    if (eaccell)
-    {
-        _edgeaccell = eaccell->unsigned32BitValue();
-        _edgeaccellvalue = (((double)(_edgeaccell / 1966.08)) / 75.0); 
-        _edgeaccellvalue = _edgeaccellvalue == 0 ? 0.01 : _edgeaccellvalue;
-        setProperty("HIDTrackpadScrollAcceleration", eaccell);
-    }
+
+    // (the curve and scroll tables are used by packetReady, so change them on our work loop)
+    if (_cmdGate)
+        _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2ALPSGlidePoint::setAccelerationParams), dict);
 
     return super::setParamProperties(dict);
 }
@@ -688,6 +878,17 @@ void ApplePS2ALPSGlidePoint::setDevicePowerState( UInt32 whatToDo )
 
         case kPS2C_EnableDevice:
             
+            if (_protocol.proto >= kALPS_V3)
+            {
+                _ringBuffer.reset();
+                _packetTimes.reset();
+                _accel.reset();
+                _packetByteCount = 0;
+                _decoder.reset();
+                initTouchPad();
+                break;
+            }
+
             setTapEnable( _touchPadModeByte );
 
             //
@@ -697,6 +898,8 @@ void ApplePS2ALPSGlidePoint::setDevicePowerState( UInt32 whatToDo )
 			setAbsoluteMode();
             
             _ringBuffer.reset();
+            _packetTimes.reset();
+            _accel.reset();
             _packetByteCount = 0;
             
             setTouchPadEnable( true );
@@ -733,68 +936,50 @@ void ApplePS2ALPSGlidePoint::getStatus(ALPSStatus_t *status)
     DEBUG_LOG("getStatus(): [%02x %02x %02x]\n", status->byte0, status->byte1, status->byte2);
 }
 
+// E8 00 (set resolution 0), then 3X set scaling 1:1 (E6) or 2:1 (E7)
+static const UInt8 alpsE6Knock[] = { kDP_SetMouseResolution, 0, kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1 };
+static const UInt8 alpsE7Knock[] = { kDP_SetMouseResolution, 0, kDP_SetMouseScaling2To1, kDP_SetMouseScaling2To1, kDP_SetMouseScaling2To1 };
+
 void ApplePS2ALPSGlidePoint::getModel(ALPSStatus_t *E6,ALPSStatus_t *E7)
 {
     // "E6 report"
-    TPS2Request<9> request;
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetMouseResolution;
-	request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
-	request.commands[1].inOrOut = 0;
-
-    // 3X set mouse scaling 1 to 1
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = kDP_SetMouseScaling1To1;
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseScaling1To1;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = kDP_SetMouseScaling1To1;
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_GetMouseInformation;
-    request.commands[6].command  = kPS2C_ReadDataPort;
-    request.commands[6].inOrOut  = 0;
-    request.commands[7].command = kPS2C_ReadDataPort;
-    request.commands[7].inOrOut = 0;
-    request.commands[8].command = kPS2C_ReadDataPort;
-    request.commands[8].inOrOut = 0;
-	request.commandsCount = 9;
+    TPS2Request<5> request;
+    request.addMouseBytes(0, alpsE6Knock, sizeof(alpsE6Knock));
+    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut  = kDP_GetMouseInformation;
+    request.commands[2].command  = kPS2C_ReadDataPort;
+    request.commands[2].inOrOut  = 0;
+    request.commands[3].command = kPS2C_ReadDataPort;
+    request.commands[3].inOrOut = 0;
+    request.commands[4].command = kPS2C_ReadDataPort;
+    request.commands[4].inOrOut = 0;
+	request.commandsCount = 5;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
 	
     // result is "E6 report"
-	E6->byte0 = request.commands[6].inOrOut;
-	E6->byte1 = request.commands[7].inOrOut;
-	E6->byte2 = request.commands[8].inOrOut;
+	E6->byte0 = request.commands[2].inOrOut;
+	E6->byte1 = request.commands[3].inOrOut;
+	E6->byte2 = request.commands[4].inOrOut;
 	
     // Now fetch "E7 report"
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetMouseResolution;
-	request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
-	request.commands[1].inOrOut = 0;
-	
-    // 3X set mouse scaling 2 to 1
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = kDP_SetMouseScaling2To1;
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseScaling2To1;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = kDP_SetMouseScaling2To1;
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_GetMouseInformation;
-    request.commands[6].command  = kPS2C_ReadDataPort;
-    request.commands[6].inOrOut  = 0;
-    request.commands[7].command = kPS2C_ReadDataPort;
-    request.commands[7].inOrOut = 0;
-    request.commands[8].command = kPS2C_ReadDataPort;
-    request.commands[8].inOrOut = 0;
-	request.commandsCount = 9;
+    request.addMouseBytes(0, alpsE7Knock, sizeof(alpsE7Knock));
+    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut  = kDP_GetMouseInformation;
+    request.commands[2].command  = kPS2C_ReadDataPort;
+    request.commands[2].inOrOut  = 0;
+    request.commands[3].command = kPS2C_ReadDataPort;
+    request.commands[3].inOrOut = 0;
+    request.commands[4].command = kPS2C_ReadDataPort;
+    request.commands[4].inOrOut = 0;
+	request.commandsCount = 5;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
 
     // result is "E7 report"
-	E7->byte0 = request.commands[6].inOrOut;
-	E7->byte1 = request.commands[7].inOrOut;
-	E7->byte2 = request.commands[8].inOrOut;
+	E7->byte0 = request.commands[2].inOrOut;
+	E7->byte1 = request.commands[3].inOrOut;
+	E7->byte2 = request.commands[4].inOrOut;
 }
 
 void ApplePS2ALPSGlidePoint::setAbsoluteMode()
@@ -817,3 +1002,429 @@ void ApplePS2ALPSGlidePoint::setAbsoluteMode()
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
 }
+
+void ApplePS2ALPSGlidePoint::getCommandModeReport(ALPSStatus_t *EC)
+{
+    // "EC report": response to entering command mode
+    TPS2Request<10> request;
+    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[0].inOrOut  = kDP_SetMouseResolution;
+    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut  = 0;
+
+    // 3X reset wrap mode
+    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[2].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[3].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[4].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[5].inOrOut  = kDP_GetMouseInformation;
+    request.commands[6].command  = kPS2C_ReadDataPort;
+    request.commands[6].inOrOut  = 0;
+    request.commands[7].command  = kPS2C_ReadDataPort;
+    request.commands[7].inOrOut  = 0;
+    request.commands[8].command  = kPS2C_ReadDataPort;
+    request.commands[8].inOrOut  = 0;
+
+    // leave command mode
+    request.commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[9].inOrOut  = kDP_SetMouseStreamMode;
+    request.commandsCount = 10;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+
+    EC->byte0 = request.commands[6].inOrOut;
+    EC->byte1 = request.commands[7].inOrOut;
+    EC->byte2 = request.commands[8].inOrOut;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Command mode (v3 and later)
+//
+// o  In command mode, addresses and values are sent one nibble at a time,
+//    each nibble encoded as a PS/2 command (_protocol.nibbles).  An address
+//    is introduced by _protocol.addrCommand, and a register is read back
+//    with GetMouseInformation (address high, address low, value).
+//
+
+int ApplePS2ALPSGlidePoint::addNibble(PS2Request* request, int i, int nibble)
+{
+    const ALPSNibbleCommand& cmd = _protocol.nibbles[nibble];
+    request->commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[i++].inOrOut = cmd.command;
+    if (kALPSNoParam != cmd.param)
+    {
+        request->commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        request->commands[i++].inOrOut = cmd.param;
+    }
+    else if (kALPSNibble10 == cmd.command)
+    {
+        // (id byte)
+        request->commands[i].command = kPS2C_ReadDataPort;
+        request->commands[i++].inOrOut = 0;
+    }
+    return i;
+}
+
+int ApplePS2ALPSGlidePoint::addAddress(PS2Request* request, int i, int addr)
+{
+    request->commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[i++].inOrOut = _protocol.addrCommand;
+    for (int shift = 12; shift >= 0; shift -= 4)
+        i = addNibble(request, i, (addr >> shift) & 0xf);
+    return i;
+}
+
+bool ApplePS2ALPSGlidePoint::sendCommands(const UInt8* bytes, int count)
+{
+    // each byte (command or parameter) is acknowledged
+    TPS2Request<8> request;
+    assert(count <= countof(request.commands));
+    for (int i = 0; i < count; i++)
+    {
+        request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        request.commands[i].inOrOut = bytes[i];
+    }
+    request.commandsCount = count;
+    _device->submitRequestAndBlock(&request);
+    return count == request.commandsCount;
+}
+
+bool ApplePS2ALPSGlidePoint::enterCommandMode()
+{
+    TPS2Request<7> request;
+    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[0].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[2].inOrOut  = kDP_ResetMouseWrapMode;
+    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[3].inOrOut  = kDP_GetMouseInformation;
+    request.commands[4].command  = kPS2C_ReadDataPort;
+    request.commands[4].inOrOut  = 0;
+    request.commands[5].command  = kPS2C_ReadDataPort;
+    request.commands[5].inOrOut  = 0;
+    request.commands[6].command  = kPS2C_ReadDataPort;
+    request.commands[6].inOrOut  = 0;
+    request.commandsCount = 7;
+    _device->submitRequestAndBlock(&request);
+    if (7 != request.commandsCount)
+        return false;
+
+    // 0x88 (with the firmware version) or 0x73 (Dolphin)
+    UInt8 byte0 = request.commands[4].inOrOut;
+    if (byte0 != 0x88 && byte0 != 0x73)
+    {
+        DEBUG_LOG("%s: unknown command mode response %02x\n", getName(), byte0);
+        return false;
+    }
+    return true;
+}
+
+void ApplePS2ALPSGlidePoint::exitCommandMode()
+{
+    UInt8 cmd = kDP_SetMouseStreamMode;
+    sendCommands(&cmd, 1);
+}
+
+int ApplePS2ALPSGlidePoint::readRegister(int addr)
+{
+    TPS2Request<24> request;
+    int i = addAddress(&request, 0, addr);
+    int first = i;
+    request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[i++].inOrOut = kDP_GetMouseInformation;
+    for (int j = 0; j < 3; j++)
+    {
+        request.commands[i].command = kPS2C_ReadDataPort;
+        request.commands[i++].inOrOut = 0;
+    }
+    request.commandsCount = i;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    if (i != request.commandsCount)
+        return -1;
+
+    // response echoes the address
+    if (request.commands[first+1].inOrOut != (addr >> 8) || request.commands[first+2].inOrOut != (addr & 0xff))
+        return -1;
+    return request.commands[first+3].inOrOut;
+}
+
+bool ApplePS2ALPSGlidePoint::writeRegister(UInt8 value)
+{
+    // write at the address set by the last read/write
+    TPS2Request<8> request;
+    int i = addNibble(&request, 0, value >> 4);
+    i = addNibble(&request, i, value & 0xf);
+    request.commandsCount = i;
+    _device->submitRequestAndBlock(&request);
+    return i == request.commandsCount;
+}
+
+bool ApplePS2ALPSGlidePoint::writeRegister(int addr, UInt8 value)
+{
+    TPS2Request<28> request;
+    int i = addAddress(&request, 0, addr);
+    i = addNibble(&request, i, value >> 4);
+    i = addNibble(&request, i, value & 0xf);
+    request.commandsCount = i;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    return i == request.commandsCount;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2ALPSGlidePoint::passthroughModeV3(int regBase, bool enable)
+{
+    if (!enterCommandMode())
+        return false;
+
+    bool success = false;
+    int reg = readRegister(regBase + 0x0008);
+    if (reg >= 0)
+        success = writeRegister(enable ? reg | 0x01 : reg & ~0x01);
+    exitCommandMode();
+    return success;
+}
+
+void ApplePS2ALPSGlidePoint::setupTrackstickV3(int regBase)
+{
+    if (!passthroughModeV3(regBase, true))
+    {
+        IOLog("%s: failed to enter passthrough mode\n", getName());
+        return;
+    }
+
+    // E7 report for the trackstick (if this fails, the rest is skipped)
+    TPS2Request<7> report;
+    for (int i = 0; i < 3; i++)
+    {
+        report.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        report.commands[i].inOrOut = kDP_SetMouseScaling2To1;
+    }
+    report.commands[3].command = kPS2C_SendMouseCommandAndCompareAck;
+    report.commands[3].inOrOut = kDP_GetMouseInformation;
+    for (int i = 4; i < 7; i++)
+    {
+        report.commands[i].command = kPS2C_ReadDataPort;
+        report.commands[i].inOrOut = 0;
+    }
+    report.commandsCount = 7;
+    _device->submitRequestAndBlock(&report);
+    if (7 == report.commandsCount)
+    {
+        //
+        // Undocumented, but without it the touchpad does not work at all and
+        // the trackstick sends normal PS/2 packets.
+        //
+        TPS2Request<20> request;
+        int i = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+            request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;
+        }
+        i = addNibble(&request, i, 0x9);
+        i = addNibble(&request, i, 0x4);
+        request.commandsCount = i;
+        _device->submitRequestAndBlock(&request);
+        bool success = i == request.commandsCount;
+
+        // trackstick packets in the format ALPSDecoder understands
+        if (success)
+        {
+            success = enterCommandMode() && writeRegister(regBase + 0x0008, 0x82);
+            exitCommandMode();
+        }
+        if (!success)
+            IOLog("%s: failed to set up trackstick\n", getName());
+    }
+
+    passthroughModeV3(regBase, false);
+}
+
+bool ApplePS2ALPSGlidePoint::hwInitV3()
+{
+    if (_protocol.flags & kALPS_DualPoint)
+        setupTrackstickV3(kALPSRegBasePinnacle);
+
+    bool success = false;
+    do
+    {
+        if (!enterCommandMode())
+            break;
+
+        // absolute mode
+        int reg = readRegister(0x0004);
+        if (reg < 0 || !writeRegister(reg | 0x06))
+            break;
+
+        reg = readRegister(0x0006);
+        if (reg < 0 || !writeRegister(reg | 0x01))
+            break;
+        reg = readRegister(0x0007);
+        if (reg < 0 || !writeRegister(reg | 0x01))
+            break;
+
+        if (readRegister(0x0144) < 0 || !writeRegister(0x04))
+            break;
+        if (readRegister(0x0159) < 0 || !writeRegister(0x03))
+            break;
+        if (readRegister(0x0163) < 0 || !writeRegister(0x0163, 0x03))
+            break;
+        if (readRegister(0x0162) < 0 || !writeRegister(0x0162, 0x04))
+            break;
+        success = true;
+    } while (0);
+    exitCommandMode();
+    if (!success)
+        return false;
+
+    // set rate and enable data reporting
+    static const UInt8 enable[] = { kDP_SetMouseSampleRate, 0x64, kDP_Enable };
+    return sendCommands(enable, countof(enable));
+}
+
+bool ApplePS2ALPSGlidePoint::hwInitV4()
+{
+    bool success = false;
+    do
+    {
+        if (!enterCommandMode())
+            break;
+
+        // absolute mode
+        int reg = readRegister(0x0004);
+        if (reg < 0 || !writeRegister(reg | 0x02))
+            break;
+
+        static const struct { UInt16 addr; UInt8 value; } regs[] =
+        {
+            { 0x0007, 0x8c }, { 0x0149, 0x03 }, { 0x0160, 0x03 }, { 0x017f, 0x15 },
+            { 0x0151, 0x01 }, { 0x0168, 0x03 }, { 0x014a, 0x03 }, { 0x0161, 0x03 },
+        };
+        unsigned i;
+        for (i = 0; i < countof(regs); i++)
+            if (!writeRegister(regs[i].addr, regs[i].value))
+                break;
+        success = countof(regs) == i;
+    } while (0);
+    exitCommandMode();
+    if (!success)
+        return false;
+
+    //
+    // This changes the output from a 9-byte to an 8-byte format (same data,
+    // more compact), then enables data reporting.
+    //
+    TPS2Request<9> request;
+    static const UInt8 rates[] = { 0xc8, 0x64, 0x50 };
+    int i = 0;
+    for (int j = 0; j < 3; j++)
+    {
+        request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        request.commands[i++].inOrOut = kDP_SetMouseSampleRate;
+        request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        request.commands[i++].inOrOut = rates[j];
+    }
+    request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[i++].inOrOut = kDP_GetId;
+    request.commands[i].command = kPS2C_ReadDataPort;
+    request.commands[i++].inOrOut = 0;
+    request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[i++].inOrOut = kDP_Enable;
+    request.commandsCount = i;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    return i == request.commandsCount;
+}
+
+bool ApplePS2ALPSGlidePoint::getDolphinArea()
+{
+    //
+    // Dolphin (v5) sensor line count is not fixed.  It is read from the
+    // device, and the coordinate range follows from it (64 per line).
+    //
+    if (!enterCommandMode())
+        return false;
+
+    TPS2Request<12> request;
+    static const UInt8 cmds[] = { kDP_ResetMouseWrapMode, kDP_SetMouseRemoteMode, kDP_SetMouseRemoteMode,
+        kDP_SetMouseSampleRate, 0x0a, kDP_SetMouseSampleRate, 0x0a, kDP_GetMouseInformation };
+    int i;
+    for (i = 0; i < (int)countof(cmds); i++)
+    {
+        request.commands[i].command = kPS2C_SendMouseCommandAndCompareAck;
+        request.commands[i].inOrOut = cmds[i];
+    }
+    for (int j = 0; j < 3; j++)
+    {
+        request.commands[i].command = kPS2C_ReadDataPort;
+        request.commands[i++].inOrOut = 0;
+    }
+    request.commandsCount = i;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    bool success = i == request.commandsCount;
+    if (success)
+    {
+        if (!setDolphinArea(&_protocol, request.commands[i-1].inOrOut))
+            IOLog("%s: Dolphin size report 0x%02x ignored, using default sensor size\n", getName(), request.commands[i-1].inOrOut);
+        DEBUG_LOG("%s: Dolphin sensor %dx%d lines, max %dx%d\n", getName(),
+                  _protocol.xBits, _protocol.yBits, _protocol.xMax, _protocol.yMax);
+    }
+    exitCommandMode();
+    return success;
+}
+
+bool ApplePS2ALPSGlidePoint::hwInitV5()
+{
+    // Dolphin "v1": stream mode, two sample rates, then enable
+    static const UInt8 cmds[] = { kDP_SetMouseStreamMode, kDP_SetMouseSampleRate, 0x64, kDP_SetMouseSampleRate, 0x28, kDP_Enable };
+    return sendCommands(cmds, countof(cmds));
+}
+
+bool ApplePS2ALPSGlidePoint::hwInitV7()
+{
+    bool success = false;
+    do
+    {
+        if (!enterCommandMode() || readRegister(0xc2d9) < 0)
+            break;
+        if (!writeRegister(0xc2c9, 0x64))
+            break;
+        int reg = readRegister(0xc2c4);
+        if (reg < 0 || !writeRegister(reg | 0x02))
+            break;
+        success = true;
+    } while (0);
+    exitCommandMode();
+    if (!success)
+        return false;
+
+    UInt8 enable = kDP_Enable;
+    return sendCommands(&enable, 1);
+}
+
+bool ApplePS2ALPSGlidePoint::initTouchPad()
+{
+    bool success = false;
+    switch (_protocol.proto)
+    {
+        case kALPS_V3: success = hwInitV3(); break;
+        case kALPS_V4: success = hwInitV4(); break;
+        case kALPS_V5: success = hwInitV5(); break;
+        case kALPS_V7: success = hwInitV7(); break;
+    }
+    if (!success)
+        IOLog("%s: failed to initialize ALPS protocol v%d\n", getName(), _protocol.proto);
+    // (sensor size is known now, Dolphin reads it before this in start)
+    _gesture.config().scaleDivisor = _protocol.xMax;
+    _gesture.reset();
+    return success;
+}
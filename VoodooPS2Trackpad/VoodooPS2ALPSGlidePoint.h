@@ -25,6 +25,11 @@
 
 #include "ApplePS2MouseDevice.h"
 #include <IOKit/hidsystem/IOHIPointing.h>
+#include <IOKit/IOCommandGate.h>
+#include "PS2ALPSDecoder.h"
+#include "PS2TouchGesture.h"
+#include "PS2Acceleration.h"
+#include "PS2Statistics.h"
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2ALPSGlidePoint Class Declaration
@@ -43,7 +48,19 @@ typedef struct ALPSStatus
 
 #define kPacketLengthSmall  3
 #define kPacketLengthLarge  6
-#define kPacketLengthMax    6
+#define kPacketLengthMax    kALPSPacketMax
+
+// absolute coordinates: x is 11 bits, y is 10 bits
+#define kALPSCoordMax       2048
+
+// scroll region bits in _xregion/_yregion
+#define kRegionEdge         0x01    // beyond the scroll edge
+#define kRegionLow          0x02    // low corner (scroll up/left)
+#define kRegionHigh         0x04    // high corner (scroll down/right)
+
+// edge scroll acceleration is 16.16 fixed point
+#define kEdgeAccelShift     16
+#define kEdgeAccelOne       (1 << kEdgeAccelShift)
 
 class EXPORT ApplePS2ALPSGlidePoint : public IOHIPointing
 {
@@ -52,10 +69,16 @@ class EXPORT ApplePS2ALPSGlidePoint : public IOHIPointing
 
 private:
     ApplePS2MouseDevice * _device;
+    IOCommandGate*        _cmdGate;
     bool                  _interruptHandlerInstalled;
     bool                  _powerControlHandlerInstalled;
     RingBuffer<UInt8, kPacketLengthMax*32> _ringBuffer;
+    RingBuffer<uint64_t, 32> _packetTimes;  // interrupt time of each packet in _ringBuffer
+    uint64_t              _packetTime;        // time of packet being dispatched (0 for now)
+    PS2Acceleration       _accel;
+    int                   _accelcurve[kAccelCurveMax+1];  // [0] is count (AccelerationCurve)
     UInt32                _packetByteCount;
+    PS2StreamStats*       _stats;           // aux stream counters (controller's PS2Statistics)
     IOFixed               _resolution;
     UInt16                _touchPadVersion;
     UInt8                 _touchPadModeByte;
@@ -64,7 +87,7 @@ private:
 	bool				  _edgehscroll;
 	bool				  _edgevscroll;
     UInt32                _edgeaccell;
-    double                _edgeaccellvalue;
+    SInt32                _edgeaccelvalue;      // 16.16 fixed point
 	bool				  _draglock;
 
 private:
@@ -73,6 +96,21 @@ private:
     SInt32				  _zpos, _zscrollpos;
     int                   _xdiffold, _ydiffold;
     short                 _scrolling;
+
+    // scroll regions (built from the edges below by buildScrollRegions)
+    int                   _scrolledgex, _scrolledgey;
+    int                   _cornerlow, _cornerhigh;
+    UInt8                 _xregion[kALPSCoordMax];
+    UInt8                 _yregion[kALPSCoordMax];
+
+    // edge scroll acceleration (built by buildScrollAccel)
+    SInt16                _scrollaccel[kALPSCoordMax];   // |delta| -> scroll delta
+    int                   _cornerscroll;
+
+    // v3 and later (ALPSDecoder)
+    ALPSProtocolInfo      _protocol;
+    ALPSDecoder           _decoder;
+    PS2TouchGesture       _gesture;
     
 protected:
 	virtual void   dispatchRelativePointerEventWithPacket( UInt8 * packet,
@@ -82,6 +120,34 @@ protected:
 	virtual void   setAbsoluteMode();
 	virtual void   getStatus(ALPSStatus_t *status);
 	virtual int    insideScrollArea(int x,int y);
+    void           buildScrollRegions();
+    void           buildScrollAccel();
+    inline int     scrollDelta(int delta)
+    {
+        if (delta < 0)
+            return -_scrollaccel[-delta < kALPSCoordMax ? -delta : kALPSCoordMax-1];
+        return _scrollaccel[delta < kALPSCoordMax ? delta : kALPSCoordMax-1];
+    }
+
+    void           getCommandModeReport(ALPSStatus_t *ec);
+    int            addNibble(PS2Request* request, int i, int nibble);
+    int            addAddress(PS2Request* request, int i, int addr);
+    bool           sendCommands(const UInt8* bytes, int count);
+    bool           enterCommandMode();
+    void           exitCommandMode();
+    int            readRegister(int addr);
+    bool           writeRegister(UInt8 value);
+    bool           writeRegister(int addr, UInt8 value);
+    bool           passthroughModeV3(int regBase, bool enable);
+    void           setupTrackstickV3(int regBase);
+    bool           getDolphinArea();
+    bool           hwInitV3();
+    bool           hwInitV4();
+    bool           hwInitV5();
+    bool           hwInitV7();
+    bool           initTouchPad();
+    void           dispatchDecodedPacket(UInt8* packet);
+    void           dispatchTouch(const ALPSReport& report, uint64_t now_abs);
 
 	virtual void   setTapEnable( bool enable );
     virtual void   setTouchPadEnable( bool enable );
@@ -92,12 +158,26 @@ protected:
 #endif
 	virtual PS2InterruptResult interruptOccurred(UInt8 data);
     virtual void packetReady();
+    inline void queuePacketTime()
+        { uint64_t now; clock_get_uptime(&now); _packetTimes.push(now); }
+    inline uint64_t packetTime()
+        { uint64_t now = _packetTime; if (!now) clock_get_uptime(&now); return now; }
+    void setAccelerationParams(OSDictionary* dict);
     virtual void   setDevicePowerState(UInt32 whatToDo);
     
     inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
-        { dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
+    {
+        if (_accel.isEnabled())
+        {
+            uint64_t now_ns;
+            absolutetime_to_nanoseconds(now, &now_ns);
+            _accel.accelerate(dx, dy, now_ns);
+        }
+        ++_stats->hidEvents;
+        dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now);
+    }
     inline void dispatchScrollWheelEventX(short deltaAxis1, short deltaAxis2, short deltaAxis3, uint64_t now)
-        { dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
+        { ++_stats->hidEvents; dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
 
 protected:
 	virtual IOItemCount buttonCount();
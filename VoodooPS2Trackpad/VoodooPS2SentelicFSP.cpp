@@ -61,8 +61,18 @@ bool ApplePS2SentelicFSP::init(OSDictionary* dict)
     _device                    = 0;
     _interruptHandlerInstalled = false;
     _packetByteCount           = 0;
+    _packetTime                = 0;
+    _stats                     = statisticsSink();
     _resolution                = (100) << 16; // (100 dpi, 4 counts/mm)
     _touchPadModeByte          = kModeByteValueGesturesDisabled;
+    _absoluteMode              = true;
+    _absEnabled                = false;
+    _roundTrips                = 0;
+    _regReads                  = 0;
+    _regWrites                 = 0;
+    bzero(_regDefault, sizeof(_regDefault));
+    bzero(_regCache, sizeof(_regCache));
+    bzero(_regWanted, sizeof(_regWanted));
     
     return true;
 }
@@ -80,161 +90,190 @@ bool ApplePS2SentelicFSP::init(OSDictionary* dict)
 #define FSP_BIT_EN_REG_CLK      0x20
 #define FSP_BIT_EN_OPC_TAG      0x80
 
-#define FSP_PKT_TYPE_NORMAL_OPC (0x03)
-#define FSP_PKT_TYPE_SHIFT      (6)
 #define FSPDRV_FLAG_EN_OPC      (0x800)
 
 #define FSP_BIT_ONPAD_ENABLE    0x01
 #define FSP_BIT_FIX_VSCR        0x08
 
-int fsp_ps2_command(ApplePS2MouseDevice * device, PS2Request * request, int cmd)
-{
-    request->commands[0].command  = kPS2C_WriteCommandPort;
-    request->commands[0].inOrOut  = kCP_TransmitToMouse;
-    request->commands[1].command  = kPS2C_WriteDataPort;
-    request->commands[1].inOrOut  = cmd;
-    request->commands[2].command  = kPS2C_ReadDataPort;
-    request->commands[2].inOrOut  = 0;
-
-    request->commandsCount = 3;
-    device->submitRequestAndBlock(request);
+#define FSP_REG_SWC1            0x90
+#define FSP_BIT_SWC1_EN_ABS_1F  0x01
+#define FSP_BIT_SWC1_EN_ABS_2F  0x04
+#define FSP_BIT_SWC1_EN_FUP_OUT 0x08
+#define FSP_BIT_SWC1_EN_ABS_CON 0x10
 
-    //IOLog("ApplePS2Trackpad: Sentelic FSP: fsp_ps2_command(cmd = %0x) => %0x\n", cmd, request->commands[2].inOrOut);
+// first hardware revision (version register) with absolute output
+#define FSP_VER_STL3888_C0      0xE0
 
-    return (request->commandsCount == 3) ? request->commands[2].inOrOut : -1;
-}
+#define kAbsoluteMode           "AbsoluteMode"
+#define kScrollDivisor          "ScrollDivisor"
+#define kSwipeDistance          "SwipeDistance"
+#define kSwipeTime              "SwipeTime"
 
-int fsp_reg_read(ApplePS2MouseDevice * device, PS2Request * request, int reg)
-{
-    int register_select = 0x66;
-    int register_value = reg;
-
-    // mangle reg to avoid collision with reserved values
-    if (reg == 10 || reg == 20 || reg == 40 || reg == 60 || reg == 80 || reg == 100 || reg == 200) {
-        register_value = (reg >> 4) | (reg << 4);
-        register_select = 0xCC;
-    } else if (reg == 0xe9 || reg == 0xee || reg == 0xf2 || reg == 0xff) {
-        register_value = ~reg;
-        register_select = 0x68;
-    }
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Sentelic register access
+//
+// o  Register reads and writes are encoded as a sequence of mouse commands
+//    (each checked for ACK, except 0x66 and 0x88 of the read handshake,
+//    which the device need not acknowledge), so any number of them can be
+//    appended to one request and sent to the controller in a single round
+//    trip.
+//
+// o  fsp_add_* append to the request at index and return the new index.
+//    The value of a register read is in commands[index-1] after submit.
+//
 
-    fsp_ps2_command(device, request, 0xf3);
-    fsp_ps2_command(device, request, 0x66);
-    fsp_ps2_command(device, request, 0x88);
-    fsp_ps2_command(device, request, 0xf3);
-    fsp_ps2_command(device, request, register_select);
-    fsp_ps2_command(device, request, register_value);
-
-    request->commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[0].inOrOut  = kDP_GetMouseInformation;
-    request->commands[1].command  = kPS2C_ReadDataPort;
-    request->commands[1].inOrOut  = 0;
-    request->commands[2].command  = kPS2C_ReadDataPort;
-    request->commands[2].inOrOut  = 0;
-    request->commands[3].command  = kPS2C_ReadDataPort;
-    request->commands[3].inOrOut  = 0;
-
-    request->commandsCount = 4;
-    device->submitRequestAndBlock(request);
+static int fsp_add_command(PS2Request * request, int index, UInt8 cmd)
+{
+    request->commands[index].command = kPS2C_SendMouseCommandAndCompareAck;
+    request->commands[index].inOrOut = cmd;
+    return index+1;
+}
 
-    //IOLog("ApplePS2Trackpad: Sentelic FSP: fsp_reg_read(reg = %0x) => %0x\n", reg, request->commands[3].inOrOut);
+static int fsp_add_commands(PS2Request * request, int index, const UInt8 * bytes, UInt8 count)
+{
+    request->addMouseBytes(index, bytes, count);
+    return index+1;
+}
 
-    return (request->commandsCount == 4) ? request->commands[3].inOrOut : -1;
+static int fsp_add_uncompared(PS2Request * request, int index, UInt8 cmd)
+{
+    // send to the mouse and read the response, whatever it is
+    request->commands[index].command = kPS2C_WriteCommandPort;
+    request->commands[index].inOrOut = kCP_TransmitToMouse;
+    request->commands[index+1].command = kPS2C_WriteDataPort;
+    request->commands[index+1].inOrOut = cmd;
+    request->commands[index+2].command = kPS2C_ReadDataPort;
+    request->commands[index+2].inOrOut = 0;
+    return index+3;
 }
 
-void fsp_reg_write(ApplePS2MouseDevice * device, PS2Request * request, int reg, int val)
+static int fsp_add_byte(PS2Request * request, int index, int value, int select, int selectSwap, int selectInvert)
 {
-    int register_select = 0x55;
-    int register_value = reg;
-
-    // mangle reg to avoid collision with reserved values
-    if (reg == 10 || reg == 20 || reg == 40 || reg == 60 || reg == 80 || reg == 100 || reg == 200) {
-        register_value = (reg >> 4) | (reg << 4);
-        register_select = 0x77;
-    } else if (reg == 0xe9 || reg == 0xee || reg == 0xf2 || reg == 0xff) {
-        register_value = ~reg;
-        register_select = 0x74;
+    // mangle value to avoid collision with reserved values
+    if (value == 10 || value == 20 || value == 40 || value == 60 || value == 80 || value == 100 || value == 200) {
+        value = (value >> 4) | (value << 4);
+        select = selectSwap;
+    } else if (value == 0xe9 || value == 0xee || value == 0xf2 || value == 0xff) {
+        value = ~value;
+        select = selectInvert;
     }
 
-    fsp_ps2_command(device, request, 0xf3);
-    fsp_ps2_command(device, request, register_select);
-    fsp_ps2_command(device, request, register_value);
+    index = fsp_add_command(request, index, 0xf3);
+    index = fsp_add_command(request, index, select);
+    return fsp_add_command(request, index, value);
+}
 
-    register_select = 0x33;
-    register_value = val;
+static int fsp_add_reg_read(PS2Request * request, int index, int reg)
+{
+    index = fsp_add_command(request, index, 0xf3);
+    index = fsp_add_uncompared(request, index, 0x66);
+    index = fsp_add_uncompared(request, index, 0x88);
+    index = fsp_add_byte(request, index, reg, 0x66, 0xCC, 0x68);
 
-    // mangle val to avoid collision with reserved values
-    if (val == 10 || val == 20 || val == 40 || val == 60 || val == 80 || val == 100 || val == 200) {
-        register_value = (val >> 4) | (val << 4);
-        register_select = 0x44;
-    } else if (val == 0xe9 || val == 0xee || val == 0xf2 || val == 0xff) {
-        register_value = ~val;
-        register_select = 0x47;
+    index = fsp_add_command(request, index, kDP_GetMouseInformation);
+    for (int i = 0; i < 3; i++)
+    {
+        request->commands[index].command = kPS2C_ReadDataPort;
+        request->commands[index].inOrOut = 0;
+        ++index;
     }
+    return index;
+}
 
-    fsp_ps2_command(device, request, 0xf3);
-    fsp_ps2_command(device, request, register_select);
-    fsp_ps2_command(device, request, register_value);
-
-    //IOLog("ApplePS2Trackpad: Sentelic FSP: fsp_reg_write(reg = %0x, val = %0x)\n", reg, val);
+static int fsp_add_reg_write(PS2Request * request, int index, int reg, int val)
+{
+    index = fsp_add_byte(request, index, reg, 0x55, 0x77, 0x74);
+    return fsp_add_byte(request, index, val, 0x33, 0x44, 0x47);
 }
 
-void fsp_write_enable(ApplePS2MouseDevice * device, PS2Request * request, int enable)
+static const UInt8 fspIntellimouseKnock[] =
+    { kDP_SetMouseSampleRate, 200, kDP_SetMouseSampleRate, 200, kDP_SetMouseSampleRate, 80 };
+
+static int fsp_add_intellimouse_mode(PS2Request * request, int index)
 {
-    int wen = fsp_reg_read(device, request, FSP_REG_SYSCTL1);
+    // 200, 200, 80 sample rate sequence, then read ID (4 for 4 byte packets)
+    index = fsp_add_commands(request, index, fspIntellimouseKnock, sizeof(fspIntellimouseKnock));
 
-    if (enable)
-        wen |= FSP_BIT_EN_REG_CLK; 
-    else
-        wen &= ~FSP_BIT_EN_REG_CLK;
+    index = fsp_add_command(request, index, kDP_GetId);
+    request->commands[index].command = kPS2C_ReadDataPort;
+    request->commands[index].inOrOut = 0;
+    return index+1;
+}
 
-    fsp_reg_write(device, request, FSP_REG_SYSCTL1, wen);
+static int fsp_add_selector(PS2Request * request, int index, UInt8 selector)
+{
+    // Disable stream mode before the command sequence.
+    index = fsp_add_command(request, index, kDP_SetDefaultsAndDisable);
+
+    // 4 set resolution commands, each encode 2 data bits.
+    for (int shift = 6; shift >= 0; shift -= 2)
+    {
+        index = fsp_add_command(request, index, kDP_SetMouseResolution);
+        index = fsp_add_command(request, index, (selector >> shift) & 0x3);
+    }
+    return index;
 }
 
-void fsp_opctag_enable(ApplePS2MouseDevice * device, PS2Request * request, int enable)
+// registers the driver writes, and so shadows (order of kFSPShadow*)
+static const UInt8 fspShadowRegs[kFSPShadowCount] =
 {
-    fsp_write_enable(device, request, true);
+    FSP_REG_SYSCTL1,
+    FSP_REG_OPC_QDOWN,
+    FSP_REG_ONPAD_CTL,
+    FSP_REG_SWC1,
+};
 
-    int opc = fsp_reg_read(device, request, FSP_REG_OPC_QDOWN);
+bool ApplePS2SentelicFSP::submitBatch(ApplePS2MouseDevice * device, PS2Request * request, int count)
+{
+    request->commandsCount = count;
+    device->submitRequestAndBlock(request);
+    ++_roundTrips;
+    return request->commandsCount == count;
+}
 
-    if (enable)
-        opc |= FSP_BIT_EN_OPC_TAG; 
-    else
-        opc &= ~FSP_BIT_EN_OPC_TAG;
+int ApplePS2SentelicFSP::addDirtyRegisters(PS2Request * request, int index)
+{
+    //
+    // Appends writes for each shadowed register whose wanted value differs
+    // from what the hardware holds.  The register clock is enabled around
+    // the writes from the shadow, so no read-modify-write is needed.
+    //
 
-    fsp_reg_write(device, request, FSP_REG_OPC_QDOWN, opc);
+    int dirty = 0;
+    for (int i = 0; i < kFSPShadowCount; i++)
+        if (_regWanted[i] != _regCache[i])
+            ++dirty;
+    if (!dirty)
+        return index;
 
-    fsp_write_enable(device, request, false);
+    UInt8 sysctl1 = _regWanted[kFSPShadowSysCtl1] & ~FSP_BIT_EN_REG_CLK;
+    index = fsp_add_reg_write(request, index, FSP_REG_SYSCTL1, sysctl1 | FSP_BIT_EN_REG_CLK);
+    for (int i = kFSPShadowSysCtl1+1; i < kFSPShadowCount; i++)
+    {
+        if (_regWanted[i] != _regCache[i])
+            index = fsp_add_reg_write(request, index, fspShadowRegs[i], _regWanted[i]);
+    }
+    index = fsp_add_reg_write(request, index, FSP_REG_SYSCTL1, sysctl1);
+    return index;
 }
 
-int fsp_intellimouse_mode(ApplePS2MouseDevice * device, PS2Request * request)
+void ApplePS2SentelicFSP::commitDirtyRegisters()
 {
-    request->commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[0].inOrOut = kDP_SetMouseSampleRate;
-    request->commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[1].inOrOut = 200;
-
-    request->commands[2].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[2].inOrOut = kDP_SetMouseSampleRate;
-    request->commands[3].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[3].inOrOut = 200;
-
-    request->commands[4].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[4].inOrOut = kDP_SetMouseSampleRate;
-    request->commands[5].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[5].inOrOut = 80;
-
-    request->commands[6].command = kPS2C_SendMouseCommandAndCompareAck;
-    request->commands[6].inOrOut = kDP_GetId;
-    request->commands[7].command = kPS2C_ReadDataPort;
-    request->commands[7].inOrOut = 0;
-
-    request->commandsCount = 8;
-    device->submitRequestAndBlock(request);
-
-    //IOLog("ApplePS2Trackpad: Sentelic FSP: fsp_intellimouse_mode() => %0x\n", request->commands[7].inOrOut);
+    for (int i = 0; i < kFSPShadowCount; i++)
+    {
+        if (_regWanted[i] != _regCache[i])
+        {
+            _regCache[i] = _regWanted[i];
+            ++_regWrites;
+        }
+    }
+}
 
-    return request->commands[7].inOrOut;
+void ApplePS2SentelicFSP::publishRegisterStats()
+{
+    setProperty(kFSPRoundTrips, _roundTrips, 32);
+    setProperty(kFSPRegisterReads, _regReads, 32);
+    setProperty(kFSPRegisterWrites, _regWrites, 32);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -268,6 +307,15 @@ ApplePS2SentelicFSP* ApplePS2SentelicFSP::probe( IOService * provider, SInt32 *
             config->release();
             return 0;
         }
+        if (OSBoolean* absolute = OSDynamicCast(OSBoolean, config->getObject(kAbsoluteMode)))
+            _absoluteMode = absolute->isTrue();
+        PS2TouchGestureConfig& gesture = _gesture.config();
+        if (OSNumber* num = OSDynamicCast(OSNumber, config->getObject(kScrollDivisor)))
+            gesture.scrollDivisor = num->unsigned32BitValue();
+        if (OSNumber* num = OSDynamicCast(OSNumber, config->getObject(kSwipeDistance)))
+            gesture.swipeDistance = num->unsigned32BitValue();
+        if (OSNumber* num = OSDynamicCast(OSNumber, config->getObject(kSwipeTime)))
+            gesture.swipeTime = num->unsigned64BitValue();
 #ifdef DEBUG
         // save configuration for later/diagnostics...
         setProperty(kMergedConfiguration, config);
@@ -276,14 +324,51 @@ ApplePS2SentelicFSP* ApplePS2SentelicFSP::probe( IOService * provider, SInt32 *
     OSSafeReleaseNULL(config);
 
     bool success = false;
-    TPS2Request<> request;
-    if (fsp_reg_read(device, &request, FSP_REG_DEVICE_ID) == FSP_DEVICE_MAGIC)
+    TPS2Request<kFSPBatchMax> request;
+    int index;
+    bool found;
+    PS2AuxIdentity identity;
+    if (device->getIdentity(&identity))
     {
-        _touchPadVersion =
-		(fsp_reg_read(device, &request, FSP_REG_VERSION) << 8) |
-		(fsp_reg_read(device, &request, FSP_REG_REVISION));
-		
-        success = true;
+        // controller already read the device ID register
+        found = kPS2Aux_Sentelic == identity.vendor;
+    }
+    else
+    {
+        index = fsp_add_reg_read(&request, 0, FSP_REG_DEVICE_ID);
+        found = submitBatch(device, &request, index) && request.commands[index-1].inOrOut == FSP_DEVICE_MAGIC;
+        if (found)
+            ++_regReads;
+    }
+    if (found)
+    {
+        //
+        // Version and revision cannot change, so they are read once here.  The
+        // shadowed registers are read in the same request, giving the power on
+        // values that are restored from on wake.
+        //
+
+        index = fsp_add_reg_read(&request, 0, FSP_REG_VERSION);
+        int version = index-1;
+        index = fsp_add_reg_read(&request, index, FSP_REG_REVISION);
+        int revision = index-1;
+        int shadow[kFSPShadowCount];
+        for (int i = 0; i < kFSPShadowCount; i++)
+        {
+            index = fsp_add_reg_read(&request, index, fspShadowRegs[i]);
+            shadow[i] = index-1;
+        }
+        assert(index <= countof(request.commands));
+        if (submitBatch(device, &request, index))
+        {
+            _regReads += 2 + kFSPShadowCount;
+            _touchPadVersion = (request.commands[version].inOrOut << 8) | request.commands[revision].inOrOut;
+            for (int i = 0; i < kFSPShadowCount; i++)
+                _regDefault[i] = _regCache[i] = _regWanted[i] = request.commands[shadow[i]].inOrOut;
+
+            success = true;
+        }
+        publishRegisterStats();
     }
 	
     DEBUG_LOG("ApplePS2SentelicFSP::probe leaving.\n");
@@ -310,6 +395,7 @@ bool ApplePS2SentelicFSP::start( IOService * provider )
 	
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _stats = _device->getController()->getStreamStatistics(kDT_Mouse);
     
     //
     // Enable the mouse clock and disable the mouse IRQ line.
@@ -336,6 +422,18 @@ bool ApplePS2SentelicFSP::start( IOService * provider )
 	
     gesturesEnabled = (_touchPadModeByte == kModeByteValueGesturesEnabled) ? 1 : 0;
     setProperty("Clicking", gesturesEnabled, sizeof(gesturesEnabled)*8);
+    _gesture.config().tapping = gesturesEnabled;
+	
+    //
+    // Cx and later hardware can report absolute coordinates (one or two
+    // fingers), which the driver turns into pointer, scroll and swipe.
+    //
+	
+    if (_absoluteMode && (_touchPadVersion >> 8) >= FSP_VER_STL3888_C0)
+    {
+        _regWanted[kFSPShadowSWC1] |= FSP_BIT_SWC1_EN_ABS_1F | FSP_BIT_SWC1_EN_ABS_2F |
+            FSP_BIT_SWC1_EN_FUP_OUT | FSP_BIT_SWC1_EN_ABS_CON;
+    }
 	
     //
     // Must add this property to let our superclass know that it should handle
@@ -357,6 +455,9 @@ bool ApplePS2SentelicFSP::start( IOService * provider )
     //
 	
     setTouchPadEnable(true);
+    if (_absEnabled)
+        IOLog("ApplePS2Trackpad: Sentelic FSP absolute mode\n");
+    setProperty(kAbsoluteMode, _absEnabled ? kOSBooleanTrue : kOSBooleanFalse);
 	
     //
     // Install our driver's interrupt handler, for asynchronous data delivery.
@@ -436,6 +537,7 @@ PS2InterruptResult ApplePS2SentelicFSP::interruptOccurred( UInt8 data )
     if (_packetByteCount == 0 && ((data == kSC_Acknowledge) || !(data & 0x08)))
     {
         DEBUG_LOG("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        ++_stats->dropped;
         return kPS2IR_packetBuffering;
     }
 	
@@ -449,6 +551,7 @@ PS2InterruptResult ApplePS2SentelicFSP::interruptOccurred( UInt8 data )
     if (_packetByteCount == _packetSize)
     {
         _ringBuffer.advanceHead(kPacketLengthMax);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -458,11 +561,53 @@ PS2InterruptResult ApplePS2SentelicFSP::interruptOccurred( UInt8 data )
 void ApplePS2SentelicFSP::packetReady()
 {
     // empty the ring buffer, dispatching each packet...
+    noteRingCount(_stats, _ringBuffer.count());
     while (_ringBuffer.count() >= kPacketLengthMax)
     {
-        dispatchRelativePointerEventWithPacket(_ringBuffer.tail(), _packetSize);
+        UInt8* packet = _ringBuffer.tail();
+        ++_stats->packets;
+        // time packet was completed at interrupt time
+        _packetTime = _packetTimes.count() ? _packetTimes.fetch() : 0;
+        int type = _absEnabled ? FSPDecoder::packetType(packet) : FSP_PKT_TYPE_NORMAL;
+        if (FSP_PKT_TYPE_ABS == type)
+            dispatchAbsolutePacket(packet);
+        else if (FSP_PKT_TYPE_NOTIFY != type) // (notify is extra buttons, not used)
+            dispatchRelativePointerEventWithPacket(packet, _packetSize);
         _ringBuffer.advanceTail(kPacketLengthMax);
     }
+    _packetTime = 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2SentelicFSP::dispatchAbsolutePacket(UInt8* packet)
+{
+    FSPReport report;
+    if (!_decoder.decode(packet, report))
+        return;
+
+    // (interrupt time of the packet, not when the work loop got to it)
+    uint64_t now_abs = packetTime(), now_ns;
+    absolutetime_to_nanoseconds(now_abs, &now_ns);
+
+    PS2TouchGestureOutput out;
+    _gesture.process(report, now_ns, out);
+
+    if (out.tap)
+        dispatchRelativePointerEventX(0, 0, out.tap, now_abs);
+    dispatchRelativePointerEventX(out.dx, out.dy, out.buttons, now_abs);
+    if (out.scrollx || out.scrolly)
+        dispatchScrollWheelEventX(-out.scrolly, -out.scrollx, 0, now_abs);
+
+    // direction of finger movement, as the Synaptics driver (x grows to the right)
+    switch (out.swipe)
+    {
+        case kPS2TouchSwipe_Left:  _device->dispatchMessage(kPS2M_swipeLeft, &now_abs); break;
+        case kPS2TouchSwipe_Right: _device->dispatchMessage(kPS2M_swipeRight, &now_abs); break;
+        case kPS2TouchSwipe_Up:    _device->dispatchMessage(kPS2M_swipeUp, &now_abs); break;
+        case kPS2TouchSwipe_Down:  _device->dispatchMessage(kPS2M_swipeDown, &now_abs); break;
+        case kPS2TouchSwipe_None:  break;
+    }
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -496,7 +641,7 @@ void ApplePS2SentelicFSP::dispatchRelativePointerEventWithPacket(UInt8* packet,
     dx = ((packet[0] & 0x10) ? 0xffffff00 : 0 ) | packet[1];
     dy = -(((packet[0] & 0x20) ? 0xffffff00 : 0 ) | packet[2]);
     
-    clock_get_uptime(&now_abs);
+    now_abs = packetTime();
     dispatchRelativePointerEventX(dx, dy, buttons, now_abs);
 
     if (packetSize == 4)
@@ -515,20 +660,45 @@ void ApplePS2SentelicFSP::setTouchPadEnable( bool enable )
     // It is safe to issue this request from the interrupt/completion context.
     //
 	
-    // (mouse enable/disable command)
-    TPS2Request<> request;
-    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut =  enable ? kDP_Enable : kDP_SetDefaultsAndDisable;
-    request.commandsCount = 1;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
-	
+    // (mouse disable command, first so the stream stops)
+    TPS2Request<kFSPBatchMax> request;
+    int index = 0;
+    if (!enable)
+        index = fsp_add_command(&request, index, kDP_SetDefaultsAndDisable);
+
     // enable one-pad-click tagging, so we can filter them out!
-    fsp_opctag_enable(_device, &request, true);
+    _regWanted[kFSPShadowOpcQDown] |= FSP_BIT_EN_OPC_TAG;
+    index = addDirtyRegisters(&request, index);
 
-    // turn on intellimouse mode (4 bytes per packet)
-    if (fsp_intellimouse_mode(_device, &request) == 4)
-        _packetSize = 4;
+    // turn on intellimouse mode (4 bytes per packet), then enable
+    int mode = -1;
+    if (enable)
+    {
+        index = fsp_add_intellimouse_mode(&request, index);
+        mode = index-1;
+        index = fsp_add_command(&request, index, kDP_Enable);
+    }
+    assert(index <= countof(request.commands));
+
+    if (submitBatch(_device, &request, index))
+    {
+        commitDirtyRegisters();
+        if (mode >= 0 && request.commands[mode].inOrOut == 4)
+            _packetSize = 4;
+    }
+    else
+    {
+        // hardware state unknown, write all shadowed registers next time
+        DEBUG_LOG("%s: register batch failed at %d of %d\n", getName(), request.commandsCount, index);
+        for (int i = 0; i < kFSPShadowCount; i++)
+            _regCache[i] = ~_regWanted[i];
+    }
+
+    // absolute packets need 4 byte packets and the absolute output enabled
+    _absEnabled = enable && 4 == _packetSize && (_regCache[kFSPShadowSWC1] & FSP_BIT_SWC1_EN_ABS_1F);
+    _decoder.reset();
+    _gesture.reset();
+    publishRegisterStats();
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -536,47 +706,20 @@ void ApplePS2SentelicFSP::setTouchPadEnable( bool enable )
 UInt32 ApplePS2SentelicFSP::getTouchPadData( UInt8 dataSelector )
 {
     TPS2Request<13> request;
-    
-    // Disable stream mode before the command sequence.
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetDefaultsAndDisable;
-	
-    // 4 set resolution commands, each encode 2 data bits.
-    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = (dataSelector >> 6) & 0x3;
-	
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = (dataSelector >> 4) & 0x3;
-	
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[6].inOrOut  = (dataSelector >> 2) & 0x3;
-	
-    request.commands[7].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[8].inOrOut  = (dataSelector >> 0) & 0x3;
+    int index = fsp_add_selector(&request, 0, dataSelector);
 	
     // Read response bytes.
-    request.commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[9].inOrOut  = kDP_GetMouseInformation;
-    request.commands[10].command = kPS2C_ReadDataPort;
-    request.commands[10].inOrOut = 0;
-    request.commands[11].command = kPS2C_ReadDataPort;
-    request.commands[11].inOrOut = 0;
-    request.commands[12].command = kPS2C_ReadDataPort;
-    request.commands[12].inOrOut = 0;
-    request.commandsCount = 13;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
+    index = fsp_add_command(&request, index, kDP_GetMouseInformation);
+    for (int i = 0; i < 3; i++)
+    {
+        request.commands[index].command = kPS2C_ReadDataPort;
+        request.commands[index].inOrOut = 0;
+        ++index;
+    }
+    assert(index <= countof(request.commands));
 	
     UInt32 returnValue = (UInt32)(-1);
-    if (request.commandsCount == 13) // success?
+    if (submitBatch(_device, &request, index)) // success?
     {
         returnValue = ((UInt32)request.commands[10].inOrOut << 16) |
 		((UInt32)request.commands[11].inOrOut <<  8) |
@@ -600,6 +743,7 @@ IOReturn ApplePS2SentelicFSP::setParamProperties( OSDictionary * dict )
         if (_touchPadModeByte != newModeByteValue)
         {
             _touchPadModeByte = newModeByteValue;
+            _gesture.config().tapping = (newModeByteValue == kModeByteValueGesturesEnabled);
 			
             //
             // Advertise the current state of the tapping feature.
@@ -643,6 +787,14 @@ void ApplePS2SentelicFSP::setDevicePowerState( UInt32 whatToDo )
 			
             _packetByteCount = 0;
             _ringBuffer.reset();
+            _packetTimes.reset();
+			
+            //
+            // The registers are back at their power on values, so only the
+            // ones the driver changed get written by setTouchPadEnable.
+            //
+			
+            memcpy(_regCache, _regDefault, sizeof(_regCache));
 			
             //
             // Finally, we enable the trackpad itself, so that it may
@@ -659,44 +811,15 @@ void ApplePS2SentelicFSP::setDevicePowerState( UInt32 whatToDo )
 bool ApplePS2SentelicFSP::setTouchPadModeByte(UInt8 modeByteValue, bool enableStreamMode)
 {
     TPS2Request<12> request;
-    
-    // Disable stream mode before the command sequence.
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetDefaultsAndDisable;
-	
-    // 4 set resolution commands, each encode 2 data bits.
-    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = (modeByteValue >> 6) & 0x3;
-	
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = (modeByteValue >> 4) & 0x3;
-	
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[6].inOrOut  = (modeByteValue >> 2) & 0x3;
-	
-    request.commands[7].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[8].inOrOut  = (modeByteValue >> 0) & 0x3;
+    int index = fsp_add_selector(&request, 0, modeByteValue);
 	
     // Set sample rate 20 to set mode byte 2. Older pads have 4 mode
     // bytes (0,1,2,3), but only mode byte 2 remain in modern pads.
-    request.commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[9].inOrOut  = kDP_SetMouseSampleRate;
-    request.commands[10].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[10].inOrOut = 20;
-	
-    request.commands[11].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[11].inOrOut  = enableStreamMode ? kDP_Enable : kDP_SetMouseScaling1To1;
-    request.commandsCount = 12;
-    assert(request.commandsCount <= countof(request.commands));
+    index = fsp_add_command(&request, index, kDP_SetMouseSampleRate);
+    index = fsp_add_command(&request, index, 20);
+	
+    index = fsp_add_command(&request, index, enableStreamMode ? kDP_Enable : kDP_SetMouseScaling1To1);
+    assert(index <= countof(request.commands));
     
-    _device->submitRequestAndBlock(&request);
-    return 12 == request.commandsCount;
+    return submitBatch(_device, &request, index);
 }
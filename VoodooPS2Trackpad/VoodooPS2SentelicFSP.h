@@ -25,11 +25,32 @@
 
 #include "ApplePS2MouseDevice.h"
 #include <IOKit/hidsystem/IOHIPointing.h>
+#include "PS2FSPDecoder.h"
+#include "PS2TouchGesture.h"
+#include "PS2Statistics.h"
 
 #define kPacketLengthMax          4
 #define kPacketLengthStandard     3
 #define kPacketLengthLarge        4
 
+// registers shadowed by the driver (see fspShadowRegs)
+enum
+{
+    kFSPShadowSysCtl1,
+    kFSPShadowOpcQDown,
+    kFSPShadowOnPadCtl,
+    kFSPShadowSWC1,
+    kFSPShadowCount
+};
+
+// largest request built by the register access layer
+#define kFSPBatchMax              96
+
+// register access statistics
+#define kFSPRoundTrips            "FSPRoundTrips"
+#define kFSPRegisterReads         "FSPRegisterReads"
+#define kFSPRegisterWrites        "FSPRegisterWrites"
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2SentelicFSP Class Declaration
 //
@@ -44,13 +65,36 @@ private:
     bool                  _interruptHandlerInstalled;
     bool                  _powerControlHandlerInstalled;
     RingBuffer<UInt8, kPacketLengthMax*32> _ringBuffer;
+    RingBuffer<uint64_t, 32> _packetTimes;  // interrupt time of each packet in _ringBuffer
+    uint64_t              _packetTime;        // time of packet being dispatched (0 for now)
     UInt32                _packetByteCount;
+    PS2StreamStats*       _stats;           // aux stream counters (controller's PS2Statistics)
     UInt8                 _packetSize;
     IOFixed               _resolution;
     UInt16                _touchPadVersion;
     UInt8                 _touchPadModeByte;
     
+    // register shadow: power on value, value in hardware, value wanted
+    UInt8                 _regDefault[kFSPShadowCount];
+    UInt8                 _regCache[kFSPShadowCount];
+    UInt8                 _regWanted[kFSPShadowCount];
+    UInt32                _roundTrips;
+    UInt32                _regReads;
+    UInt32                _regWrites;
+    
+    // absolute mode (Cx and later hardware)
+    bool                  _absoluteMode;
+    bool                  _absEnabled;
+    FSPDecoder            _decoder;
+    PS2TouchGesture       _gesture;
+    
+    bool submitBatch(ApplePS2MouseDevice * device, PS2Request * request, int count);
+    int  addDirtyRegisters(PS2Request * request, int index);
+    void commitDirtyRegisters();
+    void publishRegisterStats();
+    
     virtual void   dispatchRelativePointerEventWithPacket( UInt8 * packet, UInt32  packetSize ); 
+    void           dispatchAbsolutePacket( UInt8 * packet );
     
     virtual void   setTouchPadEnable( bool enable );
     virtual UInt32 getTouchPadData( UInt8 dataSelector );
@@ -60,15 +104,19 @@ private:
     virtual PS2InterruptResult interruptOccurred(UInt8 data);
     virtual void packetReady();
     virtual void   setDevicePowerState(UInt32 whatToDo);
+    inline void queuePacketTime()
+        { uint64_t now; clock_get_uptime(&now); _packetTimes.push(now); }
+    inline uint64_t packetTime()
+        { uint64_t now = _packetTime; if (!now) clock_get_uptime(&now); return now; }
     
 protected:
     virtual IOItemCount buttonCount();
     virtual IOFixed     resolution();
     
     inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
-        { dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
+        { ++_stats->hidEvents; dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
     inline void dispatchScrollWheelEventX(short deltaAxis1, short deltaAxis2, short deltaAxis3, uint64_t now)
-        { dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
+        { ++_stats->hidEvents; dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
     
     
 public:
@@ -45,6 +45,7 @@
 #include <IOKit/bluetooth/BluetoothAssignedNumbers.h>
 #include "VoodooPS2Controller.h"
 #include "VoodooPS2SynapticsTouchPad.h"
+#include "PS2ParamSchema.h"
 
 //REVIEW: avoids problem with Xcode 5.1.0 where -dead_strip eliminates these required symbols
 #include <libkern/OSKextLib.h>
@@ -89,6 +90,7 @@ bool ApplePS2SynapticsTouchPad::init(OSDictionary * dict)
     _interruptHandlerInstalled = false;
     _powerControlHandlerInstalled = false;
     _packetByteCount = 0;
+    _stats = statisticsSink();
     _lastdata = 0;
     _touchPadModeByte = 0x80; //default: absolute, low-rate, no w-mode
     _cmdGate = 0;
@@ -201,10 +203,11 @@ bool ApplePS2SynapticsTouchPad::init(OSDictionary * dict)
     
     // state for middle button
     _buttonTimer = 0;
-    _mbuttonstate = STATE_NOBUTTONS;
-    _pendingbuttons = 0;
-    _buttontime = 0;
+    _middleButton.init(this);
     _maxmiddleclicktime = 100000000;
+    _packetTime = 0;
+    _accelcurve[0] = 0;
+    _mouseaccelcurve[0] = 0;
     _fakemiddlebutton = true;
     
     ignoredeltas=0;
@@ -344,9 +347,23 @@ ApplePS2SynapticsTouchPad* ApplePS2SynapticsTouchPad::probe(IOService * provider
     injectVersionDependentProperties(config);
     OSSafeReleaseNULL(config);
 
-    // for diagnostics...
+    // identify bytes from the controller, if it did identification
     UInt8 buf3[3];
-    bool success = getTouchPadData(0x0, buf3);
+    bool success;
+    PS2AuxIdentity identity;
+    if (_device->getIdentity(&identity))
+    {
+        if (kPS2Aux_Synaptics != identity.vendor && !forceSynaptics)
+        {
+            DEBUG_LOG("VoodooPS2Trackpad: aux device is %s, not Synaptics\n", auxVendorName(identity.vendor));
+            _device = 0;
+            return 0;
+        }
+        memcpy(buf3, identity.synaptics, sizeof(buf3));
+        success = kPS2Aux_None != identity.vendor;
+    }
+    else
+        success = getTouchPadData(0x0, buf3);
     if (!success)
     {
         IOLog("VoodooPS2Trackpad: Identify TouchPad command failed\n");
@@ -581,6 +598,7 @@ bool ApplePS2SynapticsTouchPad::start( IOService * provider )
 
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _stats = _device->getController()->getStreamStatistics(kDT_Mouse);
     
     //
     // Announce hardware properties.
@@ -633,6 +651,7 @@ bool ApplePS2SynapticsTouchPad::start( IOService * provider )
             return false;
         }
         pWorkLoop->addEventSource(_buttonTimer);
+        _middleButton.setTimer(_buttonTimer);
     }
     
     pWorkLoop->addEventSource(_cmdGate);
@@ -768,6 +787,7 @@ void ApplePS2SynapticsTouchPad::stop( IOService * provider )
             pWorkLoop->removeEventSource(_buttonTimer);
             _buttonTimer->release();
             _buttonTimer = 0;
+            _middleButton.setTimer(0);
         }
         if (_cmdGate)
         {
@@ -820,6 +840,7 @@ void ApplePS2SynapticsTouchPad::onScrollTimer(void)
     // momentum scroll.
     //
     
+    ++_stats->timerFires;
     if (!momentumscrollcurrent)
         return;
     
@@ -870,6 +891,7 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
         packet[0] = 0x00;
         packet[1] = kSC_Reset;
         _ringBuffer.advanceHead(kPacketLength);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -880,19 +902,23 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
     if (0 == _packetByteCount && (data & 0xc8) != 0x80)
     {
         IOLog("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        ++_stats->dropped;
         
         packet[0] = 0x00;
         packet[1] = 0;  // reason=byte0
         _ringBuffer.advanceHead(kPacketLength);
+        queuePacketTime();
         return kPS2IR_packetReady;
     }
     if (3 == _packetByteCount && (data & 0xc8) != 0xc0)
     {
         IOLog("%s: Unexpected byte3 data (%02x) from PS/2 controller\n", getName(), data);
+        _stats->dropped += _packetByteCount + 1;
         
         packet[0] = 0x00;
         packet[1] = 3;  // reason=byte3
         _ringBuffer.advanceHead(kPacketLength);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -914,6 +940,7 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
     if (kPacketLength == _packetByteCount)
     {
         _ringBuffer.advanceHead(kPacketLength);
+        queuePacketTime();
         _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
@@ -923,12 +950,26 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
 void ApplePS2SynapticsTouchPad::packetReady()
 {
     // empty the ring buffer, dispatching each packet...
+    _middleButton.beginDrain();
+    noteRingCount(_stats, _ringBuffer.count());
     while (_ringBuffer.count() >= kPacketLength)
     {
         UInt8* packet = _ringBuffer.tail();
-        if (0x00 != packet[0])
+        // time packet was completed at interrupt time
+        _packetTime = _packetTimes.count() ? _packetTimes.fetch() : 0;
+        if (passthru && 0x04 == (packet[0] & 0x34) && (packet[3] & 0x04))
+        {
+            // pass through packet (w == 3), straight to its own decoder
+            ++_stats->packets;
+            uint64_t now_abs = _packetTime;
+            if (!now_abs)
+                clock_get_uptime(&now_abs);
+            dispatchPassthruPacket(packet, now_abs);
+        }
+        else if (0x00 != packet[0])
         {
             // normal packet
+            ++_stats->packets;
             dispatchEventsWithPacket(_ringBuffer.tail(), kPacketLength);
         }
         else
@@ -938,16 +979,19 @@ void ApplePS2SynapticsTouchPad::packetReady()
         }
         _ringBuffer.advanceTail(kPacketLength);
     }
+    _packetTime = 0;
+    // (while a finger is down the pad keeps reporting)
+    _middleButton.endDrain(_maxmiddleclicktime, lastf > 0);
+    _middleButton.publishStatistics(this);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2SynapticsTouchPad::onButtonTimer(void)
 {
-	uint64_t now_abs;
-	clock_get_uptime(&now_abs);
-    
-    middleButton(lastbuttons, now_abs, fromTimer);
+    ++_stats->timerFires;
+    _middleButton.onTimer(lastbuttons, _maxmiddleclicktime);
+    _middleButton.publishStatistics(this);
 }
 
 UInt32 ApplePS2SynapticsTouchPad::middleButton(UInt32 buttons, uint64_t now_abs, MBComingFrom from)
@@ -955,125 +999,15 @@ UInt32 ApplePS2SynapticsTouchPad::middleButton(UInt32 buttons, uint64_t now_abs,
     if (!_fakemiddlebutton || _buttonCount <= 2 || (ignoreall && fromTrackpad == from))
         return buttons;
     
-    // cancel timer if we see input before timeout has fired, but after expired
-    bool timeout = false;
-    uint64_t now_ns;
-    absolutetime_to_nanoseconds(now_abs, &now_ns);
-    if (fromTimer == from || fromCancel == from || now_ns - _buttontime > _maxmiddleclicktime)
-        timeout = true;
-
-    //
-    // A state machine to simulate middle buttons with two buttons pressed
-    // together.
-    //
-    switch (_mbuttonstate)
-    {
-        // no buttons down, waiting for something to happen
-        case STATE_NOBUTTONS:
-            if (fromCancel != from)
-            {
-                if (buttons & 0x4)
-                    _mbuttonstate = STATE_NOOP;
-                else if (0x3 == buttons)
-                    _mbuttonstate = STATE_MIDDLE;
-                else if (0x0 != buttons)
-                {
-                    // only single button, so delay this for a bit
-                    _pendingbuttons = buttons;
-                    _buttontime = now_ns;
-                    setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                    _mbuttonstate = STATE_WAIT4TWO;
-                }
-            }
-            break;
-            
-        // waiting for second button to come down or timeout
-        case STATE_WAIT4TWO:
-            if (!timeout && 0x3 == buttons)
-            {
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_MIDDLE;
-            }
-            else if (timeout || buttons != _pendingbuttons)
-            {
-                if (fromTimer == from || !(buttons & _pendingbuttons))
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
-                else
-                    _mbuttonstate = STATE_NOOP;
-            }
-            break;
-            
-        // both buttons down and delivering middle button
-        case STATE_MIDDLE:
-            if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
-            else if (0x3 != (buttons & 0x3))
-            {
-                // only single button, so delay to see if we get to none
-                _pendingbuttons = buttons;
-                _buttontime = now_ns;
-                setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                _mbuttonstate = STATE_WAIT4NONE;
-            }
-            break;
-            
-        // was middle button, but one button now up, waiting for second to go up
-        case STATE_WAIT4NONE:
-            if (!timeout && 0x0 == buttons)
-            {
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_NOBUTTONS;
-            }
-            else if (timeout || buttons != _pendingbuttons)
-            {
-                if (fromTimer == from)
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
-                cancelTimer(_buttonTimer);
-                if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
-                else
-                    _mbuttonstate = STATE_NOOP;
-            }
-            break;
-            
-        case STATE_NOOP:
-            if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
-            break;
-    }
-    
-    // modify buttons after new state set
-    switch (_mbuttonstate)
-    {
-        case STATE_MIDDLE:
-            buttons = 0x4;
-            break;
-            
-        case STATE_WAIT4NONE:
-        case STATE_WAIT4TWO:
-            buttons &= ~0x3;
-            break;
-            
-        case STATE_NOBUTTONS:
-        case STATE_NOOP:
-            break;
-    }
-    
-    // return modified buttons
-    return buttons;
+    static const PS2MiddleButtonFrom map[] = { kPS2MB_Passthru, kPS2MB_Device, kPS2MB_Cancel };
+    return _middleButton.middleButton(buttons, now_abs, map[from], _maxmiddleclicktime);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2SynapticsTouchPad::onDragTimer(void)
 {
+    ++_stats->timerFires;
     touchmode=MODE_NOTOUCH;
     uint64_t now_abs;
     clock_get_uptime(&now_abs);
@@ -1085,6 +1019,86 @@ void ApplePS2SynapticsTouchPad::onDragTimer(void)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2SynapticsTouchPad::dispatchPassthruPacket(UInt8* packet, uint64_t now_abs)
+{
+    // Pass through (w == 3) encapsulation packet, see dispatchEventsWithPacket
+    // for the format.  On ThinkPads these come from the trackpoint, much
+    // more often than trackpad packets, so the trackpad decode is skipped.
+    //
+    // The button state is deliberately shared with the trackpad path, not
+    // kept per source: both report the same physical buttons, so one
+    // _middleButton emulator sees them all, and on Lenovo clickpads the
+    // middle button is seen in trackpad packets (thinkpadButtonState) while
+    // the trackpoint movement it scrolls comes here
+    // (thinkpadMiddleButtonPressed/Scrolled).
+
+    // if there are buttons set in the last pass through packet, then be sure
+    // they are set in any trackpad dispatches (see dispatchEventsWithPacket).
+    passbuttons = packet[1] & 0x7; // mask for just M R L
+    UInt32 buttons = (packet[0] & 0x03) | passbuttons;
+    lastbuttons = buttons;
+
+    // allow middle button to be simulated with two buttons down
+    buttons = middleButton(buttons, now_abs, fromPassthru);
+
+    // New Lenovo clickpads do not have buttons, so LR in packet byte 1 is zero and thus
+    // passbuttons is 0.  Instead we need to check the trackpad buttons in byte 0 and byte 3
+    // However for clickpads that would miss right clicks, so use the last clickbuttons that
+    // were saved.
+    UInt32 combinedButtons = buttons | ((packet[0] & 0x3) | (packet[3] & 0x3)) | _clickbuttons | thinkpadButtonState;
+
+    SInt32 dx = ((packet[1] & 0x10) ? 0xffffff00 : 0 ) | packet[4];
+    SInt32 dy = ((packet[1] & 0x20) ? 0xffffff00 : 0 ) | packet[5];
+    if (mousemiddlescroll && ((packet[1] & 0x4) || thinkpadButtonState == 4)) // only for physical middle button
+    {
+        if (dx != 0 || dy != 0)
+            thinkpadMiddleScrolled = true;
+        // middle button treats deltas for scrolling
+        SInt32 scrollx = 0, scrolly = 0;
+        if (abs(dx) > abs(dy))
+            scrollx = dx * mousescrollmultiplierx;
+        else
+            scrolly = dy * mousescrollmultipliery;
+        
+        if (isthinkpad && thinkpadMiddleButtonPressed)
+        {
+            scrolly = scrolly * thinkpadNubScrollYMultiplier;
+            scrollx = scrollx * thinkpadNubScrollXMultiplier;
+        }
+        
+        dispatchScrollWheelEventX(scrolly, -scrollx, 0, now_abs);
+        dx = dy = 0;
+    }
+    dx *= mousemultiplierx;
+    dy *= mousemultipliery;
+    //If this is a thinkpad, we do extra logic here to see if we're doing a middle click
+    if (isthinkpad)
+    {
+        if (mousemiddlescroll && combinedButtons == 4)
+        {
+            thinkpadMiddleButtonPressed = true;
+        }
+        else
+        {
+            if (thinkpadMiddleButtonPressed && !thinkpadMiddleScrolled)
+                dispatchPassthruPointerEventX(dx, -dy, 4, now_abs);
+            dispatchPassthruPointerEventX(dx, -dy, combinedButtons, now_abs);
+            thinkpadMiddleButtonPressed = false;
+            thinkpadMiddleScrolled = false;
+        }
+    }
+    else
+    {
+        dispatchPassthruPointerEventX(dx, -dy, combinedButtons, now_abs);
+    }
+#ifdef DEBUG_VERBOSE
+    static int count = 0;
+    IOLog("ps2: passthru packet dx=%d, dy=%d, buttons=%d (%d)\n", dx, dy, combinedButtons, count++);
+#endif
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2SynapticsTouchPad::dispatchEventsWithPacket(UInt8* packet, UInt32 packetSize)
 {
     // Note: This is the three byte relative format packet. Which pretty
@@ -1129,8 +1143,9 @@ void ApplePS2SynapticsTouchPad::dispatchEventsWithPacket(UInt8* packet, UInt32 p
     // [4] X7 X6 X5 X4 X3 X3 X1 X0  (packet byte 1, X delta)
     // [5] Y7 Y6 Y5 Y4 Y3 Y2 Y1 Y0  (packet byte 2, Y delta)
 
-	uint64_t now_abs;
-	clock_get_uptime(&now_abs);
+	uint64_t now_abs = _packetTime;
+    if (!now_abs)
+        clock_get_uptime(&now_abs);
     uint64_t now_ns;
     absolutetime_to_nanoseconds(now_abs, &now_ns);
 
@@ -1146,6 +1161,13 @@ void ApplePS2SynapticsTouchPad::dispatchEventsWithPacket(UInt8* packet, UInt32 p
         dispatchEventsWithPacketEW(packet, packetSize);
         return;
     }
+
+    if (passthru && 3 == w)
+    {
+        // pass through packets are normally taken by packetReady
+        dispatchPassthruPacket(packet, now_abs);
+        return;
+    }
     
 #ifdef SIMULATE_CLICKPAD
     packet[3] &= ~0x3;
@@ -1162,10 +1184,6 @@ void ApplePS2SynapticsTouchPad::dispatchEventsWithPacket(UInt8* packet, UInt32 p
         trackbuttons = buttons;
 #endif
     
-    // deal with pass through packet buttons
-    if (passthru && 3 == w)
-        passbuttons = packet[1] & 0x7; // mask for just M R L
-    
     // if there are buttons set in the last pass through packet, then be sure
     // they are set in any trackpad dispatches.
     // otherwise, you might see double clicks that aren't there
@@ -1176,66 +1194,6 @@ void ApplePS2SynapticsTouchPad::dispatchEventsWithPacket(UInt8* packet, UInt32 p
     if (!clickpadtype || 3 == w)
         buttons = middleButton(buttons, now_abs, 3 == w ? fromPassthru : fromTrackpad);
 
-    // now deal with pass through packet moving/scrolling
-    if (passthru && 3 == w)
-    {
-        // New Lenovo clickpads do not have buttons, so LR in packet byte 1 is zero and thus
-        // passbuttons is 0.  Instead we need to check the trackpad buttons in byte 0 and byte 3
-        // However for clickpads that would miss right clicks, so use the last clickbuttons that
-        // were saved.
-        UInt32 combinedButtons = buttons | ((packet[0] & 0x3) | (packet[3] & 0x3)) | _clickbuttons | thinkpadButtonState;
-
-        SInt32 dx = ((packet[1] & 0x10) ? 0xffffff00 : 0 ) | packet[4];
-        SInt32 dy = ((packet[1] & 0x20) ? 0xffffff00 : 0 ) | packet[5];
-        if (mousemiddlescroll && ((packet[1] & 0x4) || thinkpadButtonState == 4)) // only for physical middle button
-        {
-            if (dx != 0 || dy != 0)
-                thinkpadMiddleScrolled = true;
-            // middle button treats deltas for scrolling
-            SInt32 scrollx = 0, scrolly = 0;
-            if (abs(dx) > abs(dy))
-                scrollx = dx * mousescrollmultiplierx;
-            else
-                scrolly = dy * mousescrollmultipliery;
-            
-            if (isthinkpad && thinkpadMiddleButtonPressed)
-            {
-                scrolly = scrolly * thinkpadNubScrollYMultiplier;
-                scrollx = scrollx * thinkpadNubScrollXMultiplier;
-            }
-            
-            dispatchScrollWheelEventX(scrolly, -scrollx, 0, now_abs);
-            dx = dy = 0;
-        }
-        dx *= mousemultiplierx;
-        dy *= mousemultipliery;
-        //If this is a thinkpad, we do extra logic here to see if we're doing a middle click
-        if (isthinkpad)
-        {
-            if (mousemiddlescroll && combinedButtons == 4)
-            {
-                thinkpadMiddleButtonPressed = true;
-            }
-            else
-            {
-                if (thinkpadMiddleButtonPressed && !thinkpadMiddleScrolled)
-                    dispatchRelativePointerEventX(dx, -dy, 4, now_abs);
-                dispatchRelativePointerEventX(dx, -dy, combinedButtons, now_abs);
-                thinkpadMiddleButtonPressed = false;
-                thinkpadMiddleScrolled = false;
-            }
-        }
-        else
-        {
-            dispatchRelativePointerEventX(dx, -dy, combinedButtons, now_abs);
-        }
-#ifdef DEBUG_VERBOSE
-        static int count = 0;
-        IOLog("ps2: passthru packet dx=%d, dy=%d, buttons=%d (%d)\n", dx, dy, combinedButtons, count++);
-#endif
-        return;
-    }
-    
     // otherwise, deal with normal wmode touchpad packet
     int xraw = packet[4]|((packet[1]&0x0f)<<8)|((packet[3]&0x10)<<8);
     int yraw = packet[5]|((packet[1]&0xf0)<<4)|((packet[3]&0x20)<<7);
@@ -2030,8 +1988,9 @@ void ApplePS2SynapticsTouchPad::dispatchEventsWithPacketEW(UInt8* packet, UInt32
     int y = yraw;
     ////int w = z + 8;
     
-    uint64_t now_abs;
-	clock_get_uptime(&now_abs);
+    uint64_t now_abs = _packetTime;
+    if (!now_abs)
+        clock_get_uptime(&now_abs);
     uint64_t now_ns;
     absolutetime_to_nanoseconds(now_abs, &now_ns);
     
@@ -2259,54 +2218,41 @@ bool ApplePS2SynapticsTouchPad::getTouchPadStatus(  UInt8 buf3[] )
 
 bool ApplePS2SynapticsTouchPad::getTouchPadData(UInt8 dataSelector, UInt8 buf3[])
 {
-    TPS2Request<14> request;
-
-    // Disable stream mode before the command sequence.
-    request.commands[0].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetDefaultsAndDisable;
+    TPS2Request<6> request;
 
+    // Disable stream mode before the command sequence, then
     // 4 set resolution commands, each encode 2 data bits.
-    request.commands[1].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut  = (dataSelector >> 6) & 0x3;
-
-    request.commands[3].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut  = (dataSelector >> 4) & 0x3;
-
-    request.commands[5].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[6].inOrOut  = (dataSelector >> 2) & 0x3;
-
-    request.commands[7].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[8].inOrOut  = (dataSelector >> 0) & 0x3;
+    const UInt8 bytes[] =
+    {
+        kDP_SetDefaultsAndDisable,
+        kDP_SetMouseResolution, (UInt8)((dataSelector >> 6) & 0x3),
+        kDP_SetMouseResolution, (UInt8)((dataSelector >> 4) & 0x3),
+        kDP_SetMouseResolution, (UInt8)((dataSelector >> 2) & 0x3),
+        kDP_SetMouseResolution, (UInt8)((dataSelector >> 0) & 0x3),
+    };
+    request.addMouseBytes(0, bytes, sizeof(bytes));
 
     // Read response bytes.
-    request.commands[9].command  = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[9].inOrOut  = kDP_GetMouseInformation;
-    request.commands[10].command = kPS2C_ReadDataPort;
-    request.commands[10].inOrOut = 0;
-    request.commands[11].command = kPS2C_ReadDataPort;
-    request.commands[11].inOrOut = 0;
-    request.commands[12].command = kPS2C_ReadDataPort;
-    request.commands[12].inOrOut = 0;
-    request.commands[13].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[13].inOrOut = kDP_SetDefaultsAndDisable;
-    request.commandsCount = 14;
+    request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[1].inOrOut = kDP_GetMouseInformation;
+    request.commands[2].command = kPS2C_ReadDataPort;
+    request.commands[2].inOrOut = 0;
+    request.commands[3].command = kPS2C_ReadDataPort;
+    request.commands[3].inOrOut = 0;
+    request.commands[4].command = kPS2C_ReadDataPort;
+    request.commands[4].inOrOut = 0;
+    request.commands[5].command = kPS2C_SendMouseCommandAndCompareAck;
+    request.commands[5].inOrOut = kDP_SetDefaultsAndDisable;
+    request.commandsCount = 6;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
-    if (14 != request.commandsCount)
+    if (6 != request.commandsCount)
         return false;
     
     // store results
-    buf3[0] = request.commands[10].inOrOut;
-    buf3[1] = request.commands[11].inOrOut;
-    buf3[2] = request.commands[12].inOrOut;
+    buf3[0] = request.commands[2].inOrOut;
+    buf3[1] = request.commands[3].inOrOut;
+    buf3[2] = request.commands[4].inOrOut;
     return true;
 }
 
@@ -2321,6 +2267,9 @@ void ApplePS2SynapticsTouchPad::initTouchPad()
     
     _packetByteCount = 0;
     _ringBuffer.reset();
+    _packetTimes.reset();
+    _accel.reset();
+    _mouseaccel.reset();
     
     // clear passbuttons, just in case buttons were down when system
     // went to sleep (now just assume they are up)
@@ -2392,9 +2341,10 @@ bool ApplePS2SynapticsTouchPad::setTouchPadModeByte(UInt8 modeByteValue)
     // Currently we are doing some of this, but not all...
     // (not the F5, but probably should be at startup only)
     
-    // IMPORTANT: Currently this init sequence is 30 commands.  Current limit
-    //  for a PS2Request is 30.  So don't add any. Break it into multiple
-    //  requests!
+    // IMPORTANT: The final init sequence is sent as one string of mouse
+    //  bytes (kPS2C_SendMouseCommandsAndCompareAck), which is limited to
+    //  kMaxSequenceBytes (32).  Don't add more than that.  Break it into
+    //  multiple requests!
     
     int i;
     TPS2Request<> request;
@@ -2436,58 +2386,57 @@ bool ApplePS2SynapticsTouchPad::setTouchPadModeByte(UInt8 modeByteValue)
 #endif
     
     // Disable stream mode before the command sequence.
+    UInt8 bytes[kMaxSequenceBytes];
     i = 0;
-    request.commands[i++].inOrOut = kDP_SetDefaultsAndDisable;     // F5
-    request.commands[i++].inOrOut = kDP_SetDefaultsAndDisable;     // F5
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetDefaultsAndDisable;     // F5
+    bytes[i++] = kDP_SetDefaultsAndDisable;     // F5
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
     
     // 4 set resolution commands, each encode 2 data bits.
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 6) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 4) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 2) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 0) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 6) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 4) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 2) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 0) & 0x3;    // 0x (depends on mode byte)
     
     // Set sample rate 20 to set mode byte 2. Older pads have 4 mode
     // bytes (0,1,2,3), but only mode byte 2 remain in modern pads.
-    request.commands[i++].inOrOut = kDP_SetMouseSampleRate;        // F3
-    request.commands[i++].inOrOut = 20;                            // 14
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetMouseSampleRate;        // F3
+    bytes[i++] = 20;                            // 14
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
 
 #ifdef UNDOCUMENTED_INIT_SEQUENCE_POST
     // maybe this is commit?
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = 0x0;                           // 00
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = 0x0;                           // 00
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = 0x0;                           // 00
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = 0x3;                           // 03
-    request.commands[i++].inOrOut = kDP_SetMouseSampleRate;        // F3
-    request.commands[i++].inOrOut = 200;                           // C8
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = 0x0;                           // 00
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = 0x0;                           // 00
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = 0x0;                           // 00
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = 0x3;                           // 03
+    bytes[i++] = kDP_SetMouseSampleRate;        // F3
+    bytes[i++] = 200;                           // C8
 #endif
 
     // enable trackpad
-    request.commands[i++].inOrOut = kDP_Enable;                    // F4
+    bytes[i++] = kDP_Enable;                    // F4
     
     DEBUG_LOG("VoodooPS2Trackpad: sending final init sequence...\n");
     
-    // all these commands are "send mouse" and "compare ack"
-    for (int x = 0; x < i; x++)
-        request.commands[x].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commandsCount = i;
-    assert(request.commandsCount <= countof(request.commands));
+    // all these are "send mouse" and "compare ack", as one command
+    request.addMouseBytes(0, bytes, i);
+    request.commandsCount = 1;
     _device->submitRequestAndBlock(&request);
-    if (i != request.commandsCount)
-        DEBUG_LOG("VoodooPS2Trackpad: sending final init sequence failed: %d\n", request.commandsCount);
+    if (!request.succeeded())
+        DEBUG_LOG("VoodooPS2Trackpad: sending final init sequence failed: %d of %d\n", request.commands[0].bytesDone, i);
 
-    return i == request.commandsCount;
+    return request.succeeded();
 }
 
 
@@ -2518,162 +2467,175 @@ bool ApplePS2SynapticsTouchPad::setModeByte(UInt8 modeByteValue)
     if (!_device)
         return false;
 
+    // (called when the buttons change, so do not wait for the touchpad)
     int i;
-    TPS2Request<> request;
+    UInt8 bytes[kMaxSequenceBytes];
+    PS2Request* request = _device->allocateRequest(1);
+    if (!request)
+        return false;
 
     // Disable stream mode before the command sequence.
     i = 0;
-    request.commands[i++].inOrOut = kDP_SetDefaultsAndDisable;     // F5
-    request.commands[i++].inOrOut = kDP_SetDefaultsAndDisable;     // F5
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetDefaultsAndDisable;     // F5
+    bytes[i++] = kDP_SetDefaultsAndDisable;     // F5
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
 
     // 4 set resolution commands, each encode 2 data bits.
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 6) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 4) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 2) & 0x3;    // 0x (depends on mode byte)
-    request.commands[i++].inOrOut = kDP_SetMouseResolution;        // E8
-    request.commands[i++].inOrOut = (modeByteValue >> 0) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 6) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 4) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 2) & 0x3;    // 0x (depends on mode byte)
+    bytes[i++] = kDP_SetMouseResolution;        // E8
+    bytes[i++] = (modeByteValue >> 0) & 0x3;    // 0x (depends on mode byte)
 
     // Set sample rate 20 to set mode byte 2. Older pads have 4 mode
     // bytes (0,1,2,3), but only mode byte 2 remain in modern pads.
-    request.commands[i++].inOrOut = kDP_SetMouseSampleRate;        // F3
-    request.commands[i++].inOrOut = 20;                            // 14
-    request.commands[i++].inOrOut = kDP_SetMouseScaling1To1;       // E6
+    bytes[i++] = kDP_SetMouseSampleRate;        // F3
+    bytes[i++] = 20;                            // 14
+    bytes[i++] = kDP_SetMouseScaling1To1;       // E6
 
     // enable trackpad
-    request.commands[i++].inOrOut = kDP_Enable;                    // F4
+    bytes[i++] = kDP_Enable;                    // F4
 
-    // all these commands are "send mouse" and "compare ack"
-    for (int x = 0; x < i; x++)
-        request.commands[x].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commandsCount = i;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
-    if (i != request.commandsCount)
-        DEBUG_LOG("VoodooPS2Trackpad: sestModeByte failed: %d\n", request.commandsCount);
+    // all these are "send mouse" and "compare ack", as one command
+    request->addMouseBytes(0, bytes, i);
+    request->commandsCount = 1;
+    return _device->submitRequestAsync(request, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2SynapticsTouchPad::onRequestDone), (void*)"setModeByte");
+}
 
-    return i == request.commandsCount;
+void ApplePS2SynapticsTouchPad::onRequestDone(PS2Request* request, void* param)
+{
+    // completion of async requests (on our work loop)
+    if (!request->succeeded())
+        DEBUG_LOG("VoodooPS2Trackpad: %s failed: %d of %d\n", (const char*)param, request->commandsCount, request->commandsSubmitted);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+// bits for PS2ParamEntry::affects
+enum
+{
+    kAffectsDivisor = 0x01,
+    kAffectsUSBMouse = 0x04,
+    kAffectsAccel = 0x08,
+    kAffectsMouseAccel = 0x10,
+};
+
 void ApplePS2SynapticsTouchPad::setParamPropertiesGated(OSDictionary * config)
 {
 	if (NULL == config)
 		return;
     
-	const struct {const char *name; int *var;} int32vars[]={
-		{"FingerZ",							&z_finger},
-		{"DivisorX",						&divisorx},
-		{"DivisorY",						&divisory},
-		{"EdgeRight",						&redge},
-		{"EdgeLeft",						&ledge},
-		{"EdgeTop",							&tedge},
-		{"EdgeBottom",						&bedge},
-		{"VerticalScrollDivisor",			&vscrolldivisor},
-		{"HorizontalScrollDivisor",			&hscrolldivisor},
-		{"CircularScrollDivisor",			&cscrolldivisor},
-		{"CenterX",							&centerx},
-		{"CenterY",							&centery},
-		{"CircularScrollTrigger",			&ctrigger},
-		{"MultiFingerWLimit",				&wlimit},
-		{"MultiFingerVerticalDivisor",		&wvdivisor},
-		{"MultiFingerHorizontalDivisor",	&whdivisor},
-        {"ZLimit",                          &zlimit},
-        {"MouseMultiplierX",                &mousemultiplierx},
-        {"MouseMultiplierY",                &mousemultipliery},
-        {"MouseScrollMultiplierX",          &mousescrollmultiplierx},
-        {"MouseScrollMultiplierY",          &mousescrollmultipliery},
-        {"WakeDelay",                       &wakedelay},
-        {"TapThresholdX",                   &tapthreshx},
-        {"TapThresholdY",                   &tapthreshy},
-        {"DoubleTapThresholdX",             &dblthreshx},
-        {"DoubleTapThresholdY",             &dblthreshy},
-        {"ZoneLeft",                        &zonel},
-        {"ZoneRight",                       &zoner},
-        {"ZoneTop",                         &zonet},
-        {"ZoneBottom",                      &zoneb},
-        {"DisableZoneLeft",                 &diszl},
-        {"DisableZoneRight",                &diszr},
-        {"DisableZoneTop",                  &diszt},
-        {"DisableZoneBottom",               &diszb},
-        {"DisableZoneControl",              &diszctrl},
-        {"Resolution",                      &_resolution},
-        {"ScrollResolution",                &_scrollresolution},
-        {"SwipeDeltaX",                     &swipedx},
-        {"SwipeDeltaY",                     &swipedy},
-        {"RightClickZoneLeft",              &rczl},
-        {"RightClickZoneRight",             &rczr},
-        {"RightClickZoneTop",               &rczt},
-        {"RightClickZoneBottom",            &rczb},
-        {"HIDScrollZoomModifierMask",       &scrollzoommask},
-        {"ButtonCount",                     &_buttonCount},
-        {"DragLockTempMask",                &draglocktempmask},
-        {"MomentumScrollThreshY",           &momentumscrollthreshy},
-        {"MomentumScrollMultiplier",        &momentumscrollmultiplier},
-        {"MomentumScrollDivisor",           &momentumscrolldivisor},
-        {"MomentumScrollSamplesMin",        &momentumscrollsamplesmin},
-        {"FingerChangeIgnoreDeltas",        &ignoredeltasstart},
-        {"BogusDeltaThreshX",               &bogusdxthresh},
-        {"BogusDeltaThreshY",               &bogusdythresh},
-        {"UnitsPerMMX",                     &xupmm},
-        {"UnitsPerMMY",                     &yupmm},
-        {"ScrollDeltaThreshX",              &scrolldxthresh},
-        {"ScrollDeltaThreshY",              &scrolldythresh},
-        // usr-sse2 added
-        {"TrackpadCornerSecondaryClick",    &rightclick_corner},
-        {"TrackpointScrollXMultiplier",     &thinkpadNubScrollXMultiplier},
-        {"TrackpointScrollYMultiplier",     &thinkpadNubScrollYMultiplier},
-	};
-	const struct {const char *name; int *var;} boolvars[]={
-		{"StickyHorizontalScrolling",		&hsticky},
-		{"StickyVerticalScrolling",			&vsticky},
-		{"StickyMultiFingerScrolling",		&wsticky},
-		{"StabilizeTapping",				&tapstable},
-        {"DisableLEDUpdate",                &noled},
-        {"SmoothInput",                     &smoothinput},
-        {"UnsmoothInput",                   &unsmoothinput},
-        {"SkipPassThrough",                 &skippassthru},
-        {"ForcePassThrough",                &forcepassthru},
-        {"Thinkpad",                        &isthinkpad},
-        {"HWResetOnStart",                  &hwresetonstart},
-        {"SwapDoubleTriple",                &swapdoubletriple},
-        {"ClickPadTrackBoth",               &clickpadtrackboth},
-        {"ImmediateClick",                  &immediateclick},
-        {"MouseMiddleScroll",               &mousemiddlescroll},
-        {"FakeMiddleButton",                &_fakemiddlebutton},
-        {"DynamicEWMode",                   &_dynamicEW},
-        {"ProcessUSBMouseStopsTrackpad",    &_processusbmouse},
-        {"ProcessBluetoothMouseStopsTrackpad", &_processbluetoothmouse},
-	};
-    const struct {const char* name; bool* var;} lowbitvars[]={
-        {"TrackpadRightClick",              &rtap},
-        {"Clicking",                        &clicking},
-        {"Dragging",                        &dragging},
-        {"DragLock",                        &draglock},
-        {"TrackpadHorizScroll",             &hscroll},
-        {"TrackpadScroll",                  &scroll},
-        {"OutsidezoneNoAction When Typing", &outzone_wt},
-        {"PalmNoAction Permanent",          &palm},
-        {"PalmNoAction When Typing",        &palm_wt},
-        {"USBMouseStopsTrackpad",           &usb_mouse_stops_trackpad},
-        {"TrackpadMomentumScroll",          &momentumscroll},
-    };
-    const struct {const char* name; uint64_t* var; } int64vars[]={
-        {"MaxDragTime",                     &maxdragtime},
-        {"MaxTapTime",                      &maxtaptime},
-        {"HIDClickTime",                    &maxdbltaptime},
-        {"QuietTimeAfterTyping",            &maxaftertyping},
-        {"MomentumScrollTimer",             &momentumscrolltimer},
-        {"ClickPadClickTime",               &clickpadclicktime},
-        {"MiddleClickTime",                 &_maxmiddleclicktime},
-        {"DragExitDelayTime",               &dragexitdelay},
+    // Note: must be kept sorted by name (see PS2ParamSchema.h)
+    const PS2ParamEntry schema[]={
+        {"AccelerationCurve",                kPS2P_IntArray, _accelcurve, 0, kAccelCurveMax, kAffectsAccel},
+        {"BogusDeltaThreshX",                kPS2P_Limit,    &bogusdxthresh},
+        {"BogusDeltaThreshY",                kPS2P_Limit,    &bogusdythresh},
+        {"ButtonCount",                      kPS2P_Int32,    &_buttonCount},
+        {"CenterX",                          kPS2P_Int32,    &centerx},
+        {"CenterY",                          kPS2P_Int32,    &centery},
+        {"CircularScrollDivisor",            kPS2P_Int32,    &cscrolldivisor},
+        {"CircularScrollTrigger",            kPS2P_Int32,    &ctrigger},
+        {"ClickPadClickTime",                kPS2P_Int64,    &clickpadclicktime},
+        {"ClickPadTrackBoth",                kPS2P_Bool,     &clickpadtrackboth},
+        {"Clicking",                         kPS2P_LowBit,   &clicking},
+        {"DisableLEDUpdate",                 kPS2P_Bool,     &noled},
+        {"DisableZoneBottom",                kPS2P_Int32,    &diszb},
+        {"DisableZoneControl",               kPS2P_Int32,    &diszctrl},
+        {"DisableZoneLeft",                  kPS2P_Int32,    &diszl},
+        {"DisableZoneRight",                 kPS2P_Int32,    &diszr},
+        {"DisableZoneTop",                   kPS2P_Int32,    &diszt},
+        {"DivisorX",                         kPS2P_Int32,    &divisorx, 0, 0, kAffectsDivisor},
+        {"DivisorY",                         kPS2P_Int32,    &divisory, 0, 0, kAffectsDivisor},
+        {"DoubleTapThresholdX",              kPS2P_Int32,    &dblthreshx},
+        {"DoubleTapThresholdY",              kPS2P_Int32,    &dblthreshy},
+        {"DragExitDelayTime",                kPS2P_Int64,    &dragexitdelay},
+        {"DragLock",                         kPS2P_LowBit,   &draglock},
+        {"DragLockTempMask",                 kPS2P_Int32,    &draglocktempmask},
+        {"Dragging",                         kPS2P_LowBit,   &dragging},
+        {"DynamicEWMode",                    kPS2P_Bool,     &_dynamicEW},
+        {"EdgeBottom",                       kPS2P_Int32,    &bedge},
+        {"EdgeLeft",                         kPS2P_Int32,    &ledge},
+        {"EdgeRight",                        kPS2P_Int32,    &redge},
+        {"EdgeTop",                          kPS2P_Int32,    &tedge},
+        {"FakeMiddleButton",                 kPS2P_Bool,     &_fakemiddlebutton},
+        {"FingerChangeIgnoreDeltas",         kPS2P_Int32,    &ignoredeltasstart},
+        {"FingerZ",                          kPS2P_Int32,    &z_finger},
+        {"ForcePassThrough",                 kPS2P_Bool,     &forcepassthru},
+        {"HIDClickTime",                     kPS2P_Int64,    &maxdbltaptime},
+        {"HIDScrollZoomModifierMask",        kPS2P_Int32,    &scrollzoommask},
+        {"HWResetOnStart",                   kPS2P_Bool,     &hwresetonstart},
+        {"HorizontalScrollDivisor",          kPS2P_Int32,    &hscrolldivisor},
+        {"ImmediateClick",                   kPS2P_Bool,     &immediateclick},
+        {"MaxDragTime",                      kPS2P_Int64,    &maxdragtime},
+        {"MaxTapTime",                       kPS2P_Int64,    &maxtaptime},
+        {"MiddleClickTime",                  kPS2P_Int64,    &_maxmiddleclicktime},
+        {"MomentumScrollDivisor",            kPS2P_Int32,    &momentumscrolldivisor},
+        {"MomentumScrollMultiplier",         kPS2P_Int32,    &momentumscrollmultiplier},
+        {"MomentumScrollSamplesMin",         kPS2P_Int32,    &momentumscrollsamplesmin},
+        {"MomentumScrollThreshY",            kPS2P_Int32,    &momentumscrollthreshy},
+        {"MomentumScrollTimer",              kPS2P_Int64,    &momentumscrolltimer},
+        {"MouseAccelerationCurve",           kPS2P_IntArray, _mouseaccelcurve, 0, kAccelCurveMax, kAffectsMouseAccel},
+        {"MouseMiddleScroll",                kPS2P_Bool,     &mousemiddlescroll},
+        {"MouseMultiplierX",                 kPS2P_Int32,    &mousemultiplierx},
+        {"MouseMultiplierY",                 kPS2P_Int32,    &mousemultipliery},
+        {"MouseScrollMultiplierX",           kPS2P_Int32,    &mousescrollmultiplierx},
+        {"MouseScrollMultiplierY",           kPS2P_Int32,    &mousescrollmultipliery},
+        {"MultiFingerHorizontalDivisor",     kPS2P_Int32,    &whdivisor},
+        {"MultiFingerVerticalDivisor",       kPS2P_Int32,    &wvdivisor},
+        {"MultiFingerWLimit",                kPS2P_Int32,    &wlimit},
+        {"OutsidezoneNoAction When Typing",  kPS2P_LowBit,   &outzone_wt},
+        {"PalmNoAction Permanent",           kPS2P_LowBit,   &palm},
+        {"PalmNoAction When Typing",         kPS2P_LowBit,   &palm_wt},
+        {"ProcessBluetoothMouseStopsTrackpad", kPS2P_Bool,  &_processbluetoothmouse},
+        {"ProcessUSBMouseStopsTrackpad",     kPS2P_Bool,     &_processusbmouse},
+        {"QuietTimeAfterTyping",             kPS2P_Int64,    &maxaftertyping},
+        {"Resolution",                       kPS2P_Int32,    &_resolution},
+        {"RightClickZoneBottom",             kPS2P_Int32,    &rczb},
+        {"RightClickZoneLeft",               kPS2P_Int32,    &rczl},
+        {"RightClickZoneRight",              kPS2P_Int32,    &rczr},
+        {"RightClickZoneTop",                kPS2P_Int32,    &rczt},
+        {"ScrollDeltaThreshX",               kPS2P_Int32,    &scrolldxthresh},
+        {"ScrollDeltaThreshY",               kPS2P_Int32,    &scrolldythresh},
+        {"ScrollResolution",                 kPS2P_Int32,    &_scrollresolution},
+        {"SkipPassThrough",                  kPS2P_Bool,     &skippassthru},
+        {"SmoothInput",                      kPS2P_Bool,     &smoothinput},
+        {"StabilizeTapping",                 kPS2P_Bool,     &tapstable},
+        {"StickyHorizontalScrolling",        kPS2P_Bool,     &hsticky},
+        {"StickyMultiFingerScrolling",       kPS2P_Bool,     &wsticky},
+        {"StickyVerticalScrolling",          kPS2P_Bool,     &vsticky},
+        {"SwapDoubleTriple",                 kPS2P_Bool,     &swapdoubletriple},
+        {"SwipeDeltaX",                      kPS2P_Int32,    &swipedx},
+        {"SwipeDeltaY",                      kPS2P_Int32,    &swipedy},
+        {"TapThresholdX",                    kPS2P_Int32,    &tapthreshx},
+        {"TapThresholdY",                    kPS2P_Int32,    &tapthreshy},
+        {"Thinkpad",                         kPS2P_Bool,     &isthinkpad},
+        {"TrackpadCornerSecondaryClick",     kPS2P_Int32,    &rightclick_corner},
+        {"TrackpadHorizScroll",              kPS2P_LowBit,   &hscroll},
+        {"TrackpadMomentumScroll",           kPS2P_LowBit,   &momentumscroll},
+        {"TrackpadRightClick",               kPS2P_LowBit,   &rtap},
+        {"TrackpadScroll",                   kPS2P_LowBit,   &scroll},
+        {"TrackpointScrollXMultiplier",      kPS2P_Int32,    &thinkpadNubScrollXMultiplier},
+        {"TrackpointScrollYMultiplier",      kPS2P_Int32,    &thinkpadNubScrollYMultiplier},
+        {"USBMouseStopsTrackpad",            kPS2P_LowBit,   &usb_mouse_stops_trackpad, 0, 0, kAffectsUSBMouse},
+        {"UnitsPerMMX",                      kPS2P_Int32,    &xupmm},
+        {"UnitsPerMMY",                      kPS2P_Int32,    &yupmm},
+        {"UnsmoothInput",                    kPS2P_Bool,     &unsmoothinput},
+        {"VerticalScrollDivisor",            kPS2P_Int32,    &vscrolldivisor},
+        {"WakeDelay",                        kPS2P_Int32,    &wakedelay},
+        {"ZLimit",                           kPS2P_Int32,    &zlimit},
+        {"ZoneBottom",                       kPS2P_Int32,    &zoneb},
+        {"ZoneLeft",                         kPS2P_Int32,    &zonel},
+        {"ZoneRight",                        kPS2P_Int32,    &zoner},
+        {"ZoneTop",                          kPS2P_Int32,    &zonet},
     };
-    
+#ifdef DEBUG
+    checkParamSchema("VoodooPS2Trackpad", schema, countof(schema));
+#endif
+
 	uint8_t oldmode = _touchPadModeByte;
     
     // highrate?
@@ -2687,43 +2649,7 @@ void ApplePS2SynapticsTouchPad::setParamPropertiesGated(OSDictionary * config)
         setProperty("UseHighRate", bl->isTrue());
     }
     
-    OSNumber *num;
-    // 64-bit config items
-    for (int i = 0; i < countof(int64vars); i++)
-        if ((num=OSDynamicCast(OSNumber, config->getObject(int64vars[i].name))))
-        {
-            *int64vars[i].var = num->unsigned64BitValue();
-            setProperty(int64vars[i].name, *int64vars[i].var, 64);
-        }
-    // boolean config items
-	for (int i = 0; i < countof(boolvars); i++)
-		if ((bl=OSDynamicCast (OSBoolean,config->getObject (boolvars[i].name))))
-        {
-			*boolvars[i].var = bl->isTrue();
-            setProperty(boolvars[i].name, *boolvars[i].var ? kOSBooleanTrue : kOSBooleanFalse);
-        }
-    // 32-bit config items
-	for (int i = 0; i < countof(int32vars);i++)
-		if ((num=OSDynamicCast (OSNumber,config->getObject (int32vars[i].name))))
-        {
-			*int32vars[i].var = num->unsigned32BitValue();
-            setProperty(int32vars[i].name, *int32vars[i].var, 32);
-        }
-    // lowbit config items
-	for (int i = 0; i < countof(lowbitvars); i++)
-    {
-		if ((num=OSDynamicCast (OSNumber,config->getObject(lowbitvars[i].name))))
-        {
-			*lowbitvars[i].var = (num->unsigned32BitValue()&0x1)?true:false;
-            setProperty(lowbitvars[i].name, *lowbitvars[i].var ? 1 : 0, 32);
-        }
-        //REVIEW: are these items ever carried in a boolean?
-        else if ((bl=OSDynamicCast(OSBoolean, config->getObject(lowbitvars[i].name))))
-        {
-            *lowbitvars[i].var = bl->isTrue();
-            setProperty(lowbitvars[i].name, *lowbitvars[i].var ? kOSBooleanTrue : kOSBooleanFalse);
-        }
-    }
+    PS2ParamResult result = applyParamSchema(this, schema, countof(schema), config);
 
     // special case for MaxDragTime (which is really max time for a double-click)
     // we can let it go no more than 230ms because otherwise taps on
@@ -2757,16 +2683,18 @@ void ApplePS2SynapticsTouchPad::setParamPropertiesGated(OSDictionary * config)
     //    maxdragtime = 230000000;
     
     // DivisorX and DivisorY cannot be zero, but don't crash if they are...
-    if (!divisorx)
-        divisorx = 1;
-    if (!divisory)
-        divisory = 1;
+    if (result.affects & kAffectsDivisor)
+    {
+        if (!divisorx)
+            divisorx = 1;
+        if (!divisory)
+            divisory = 1;
+    }
 
-    // bogusdeltathreshx/y = 0 is MAX_INT
-    if (!bogusdxthresh)
-        bogusdxthresh = 0x7FFFFFFF;
-    if (!bogusdythresh)
-        bogusdythresh = 0x7FFFFFFF;
+    if ((result.affects & kAffectsAccel) && !_accel.setCurve(&_accelcurve[1], _accelcurve[0]))
+        IOLog("%s: AccelerationCurve speeds must be increasing\n", getName());
+    if ((result.affects & kAffectsMouseAccel) && !_mouseaccel.setCurve(&_mouseaccelcurve[1], _mouseaccelcurve[0]))
+        IOLog("%s: MouseAccelerationCurve speeds must be increasing\n", getName());
 
     // this driver assumes wmode is available (6-byte packets)
     _touchPadModeByte |= 1<<0;
@@ -2776,19 +2704,26 @@ void ApplePS2SynapticsTouchPad::setParamPropertiesGated(OSDictionary * config)
 	// if changed, setup touchpad mode
 	if (_touchPadModeByte != oldmode)
     {
+        ++result.changed;
 		setTouchpadModeByte();
         _packetByteCount=0;
         _ringBuffer.reset();
+        _packetTimes.reset();
+        _accel.reset();
+        _mouseaccel.reset();
     }
 
-//REVIEW: this should be done maybe only when necessary...
-    touchmode=MODE_NOTOUCH;
+    // only reset touch state when something actually changed
+    if (result.changed)
+        touchmode=MODE_NOTOUCH;
 
     // disable trackpad when USB mouse is plugged in and this functionality is requested
-    if (attachedHIDPointerDevices && attachedHIDPointerDevices->getCount() > 0) {
+    if ((result.affects & kAffectsUSBMouse) && attachedHIDPointerDevices && attachedHIDPointerDevices->getCount() > 0) {
         ignoreall = usb_mouse_stops_trackpad;
         updateTouchpadLED();
     }
+
+    publishParamResult(this, result);
 }
 
 IOReturn ApplePS2SynapticsTouchPad::setParamProperties(OSDictionary* dict)
@@ -3021,36 +2956,37 @@ void ApplePS2SynapticsTouchPad::updateTouchpadLED()
 
 bool ApplePS2SynapticsTouchPad::setTouchpadLED(UInt8 touchLED)
 {
-    TPS2Request<12> request;
+    // (called from packet handling, so do not wait for the touchpad)
+    PS2Request* request = _device->allocateRequest(1);
+    if (!request)
+        return false;
+    
+    UInt8 bytes[12];
     
     // send NOP before special command sequence
-    request.commands[0].inOrOut  = kDP_SetMouseScaling1To1;
+    bytes[0]  = kDP_SetMouseScaling1To1;
     
     // 4 set resolution commands, each encode 2 data bits of LED level
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].inOrOut  = (touchLED >> 6) & 0x3;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].inOrOut  = (touchLED >> 4) & 0x3;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].inOrOut  = (touchLED >> 2) & 0x3;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].inOrOut  = (touchLED >> 0) & 0x3;
+    bytes[1]  = kDP_SetMouseResolution;
+    bytes[2]  = (touchLED >> 6) & 0x3;
+    bytes[3]  = kDP_SetMouseResolution;
+    bytes[4]  = (touchLED >> 4) & 0x3;
+    bytes[5]  = kDP_SetMouseResolution;
+    bytes[6]  = (touchLED >> 2) & 0x3;
+    bytes[7]  = kDP_SetMouseResolution;
+    bytes[8]  = (touchLED >> 0) & 0x3;
     
     // Set sample rate 10 (10 is command for setting LED)
-    request.commands[9].inOrOut  = kDP_SetMouseSampleRate;
-    request.commands[10].inOrOut = 10; // 0x0A command for setting LED
+    bytes[9]  = kDP_SetMouseSampleRate;
+    bytes[10] = 10; // 0x0A command for setting LED
     
     // finally send NOP command to end the special sequence
-    request.commands[11].inOrOut  = kDP_SetMouseScaling1To1;
-    request.commandsCount = 12;
-    assert(request.commandsCount <= countof(request.commands));
-    
-    // all these commands are "send mouse" and "compare ack"
-    for (int x = 0; x < request.commandsCount; x++)
-        request.commands[x].command = kPS2C_SendMouseCommandAndCompareAck;
-    _device->submitRequestAndBlock(&request);
+    bytes[11] = kDP_SetMouseScaling1To1;
     
-    return 12 == request.commandsCount;
+    // all these are "send mouse" and "compare ack", as one command
+    request->addMouseBytes(0, bytes, sizeof(bytes));
+    request->commandsCount = 1;
+    return _device->submitRequestAsync(request, this, OSMemberFunctionCast(PS2RequestAction, this, &ApplePS2SynapticsTouchPad::onRequestDone), (void*)"setTouchpadLED");
 }
 
 void ApplePS2SynapticsTouchPad::registerHIDPointerNotifications()
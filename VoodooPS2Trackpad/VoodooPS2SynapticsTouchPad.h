@@ -24,6 +24,9 @@
 #define _APPLEPS2SYNAPTICSTOUCHPAD_H
 
 #include "ApplePS2MouseDevice.h"
+#include "PS2MiddleButton.h"
+#include "PS2Acceleration.h"
+#include "PS2Statistics.h"
 #include <IOKit/hidsystem/IOHIPointing.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
@@ -170,7 +173,14 @@ private:
     bool                _interruptHandlerInstalled;
     bool                _powerControlHandlerInstalled;
     RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
+    RingBuffer<uint64_t, 32> _packetTimes;  // interrupt time of each packet in _ringBuffer
+    uint64_t            _packetTime;        // time of packet being dispatched (0 for now)
+    PS2Acceleration     _accel;
+    int                 _accelcurve[kAccelCurveMax+1];  // [0] is count (AccelerationCurve)
+    PS2Acceleration     _mouseaccel;        // pass through device
+    int                 _mouseaccelcurve[kAccelCurveMax+1]; // (MouseAccelerationCurve)
     UInt32              _packetByteCount;
+    PS2StreamStats*     _stats;             // aux stream counters (controller's PS2Statistics)
     UInt8               _lastdata;
     UInt16              _touchPadVersion;
     UInt8               _touchPadType; // from identify: either 0x46 or 0x47
@@ -296,17 +306,8 @@ private:
     int xupmm, yupmm;
     
     // for middle button simulation
-    enum mbuttonstate
-    {
-        STATE_NOBUTTONS,
-        STATE_MIDDLE,
-        STATE_WAIT4TWO,
-        STATE_WAIT4NONE,
-        STATE_NOOP,
-    } _mbuttonstate;
-    
-    UInt32 _pendingbuttons;
-    uint64_t _buttontime;
+    friend class PS2MiddleButton<ApplePS2SynapticsTouchPad>;
+    PS2MiddleButton<ApplePS2SynapticsTouchPad> _middleButton;
     IOTimerEventSource* _buttonTimer;
     uint64_t _maxmiddleclicktime;
     int _fakemiddlebutton;
@@ -386,6 +387,7 @@ private:
         
     virtual void   dispatchEventsWithPacket(UInt8* packet, UInt32 packetSize);
     virtual void   dispatchEventsWithPacketEW(UInt8* packet, UInt32 packetSize);
+    void dispatchPassthruPacket(UInt8* packet, uint64_t now_abs);
     // virtual void   dispatchSwipeEvent ( IOHIDSwipeMask swipeType, AbsoluteTime now);
     
     virtual void   setTouchPadEnable( bool enable );
@@ -402,6 +404,7 @@ private:
     void initTouchPad();
     bool setModeByte(UInt8 modeByteValue);
     bool setModeByte(); // set based on state
+    void onRequestDone(PS2Request* request, void* param);
 
     inline bool isFingerTouch(int z) { return z>z_finger && z<zlimit; }
     
@@ -413,8 +416,12 @@ private:
     
     void onDragTimer(void);
     
-    enum MBComingFrom { fromPassthru, fromTimer, fromTrackpad, fromCancel };
+    enum MBComingFrom { fromPassthru, fromTrackpad, fromCancel };
     UInt32 middleButton(UInt32 butttons, uint64_t now, MBComingFrom from);
+    inline void dispatchMiddleButtonEvent(UInt32 buttons, uint64_t now)
+        { dispatchRelativePointerEventX(0, 0, buttons, now); }
+    inline void queuePacketTime()
+        { uint64_t now; clock_get_uptime(&now); _packetTimes.push(now); }
     
     void setParamPropertiesGated(OSDictionary* dict);
     void injectVersionDependentProperties(OSDictionary* dict);
@@ -428,9 +435,29 @@ protected:
 	virtual IOItemCount buttonCount();
 	virtual IOFixed     resolution();
     inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
-        { dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
+    {
+        if (_accel.isEnabled())
+        {
+            uint64_t now_ns;
+            absolutetime_to_nanoseconds(now, &now_ns);
+            _accel.accelerate(dx, dy, now_ns);
+        }
+        ++_stats->hidEvents;
+        dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now);
+    }
+    inline void dispatchPassthruPointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
+    {
+        if (_mouseaccel.isEnabled())
+        {
+            uint64_t now_ns;
+            absolutetime_to_nanoseconds(now, &now_ns);
+            _mouseaccel.accelerate(dx, dy, now_ns);
+        }
+        ++_stats->hidEvents;
+        dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now);
+    }
     inline void dispatchScrollWheelEventX(short deltaAxis1, short deltaAxis2, short deltaAxis3, uint64_t now)
-        { dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
+        { ++_stats->hidEvents; dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
     inline void setTimerTimeout(IOTimerEventSource* timer, uint64_t time)
         { timer->setTimeout(*(AbsoluteTime*)&time); }
     inline void cancelTimer(IOTimerEventSource* timer)
@@ -0,0 +1,33 @@
+#!/bin/bash
+#set -x
+
+# verify each PS2ParamEntry schema table is sorted by name (strcmp order)
+# (see PS2ParamSchema.h; applyParamSchema depends on it)
+
+cd "$(dirname "$0")"
+STATUS=0
+
+for FILE in $(grep -l "PS2ParamEntry schema\[\]" */*.cpp); do
+    # first field of each entry: either "literal" or a kName macro
+    # (quotes are stripped after, so they do not affect the order)
+    NAMES=$(awk '/PS2ParamEntry schema\[\]/ {on=1; next} on && /^ *};/ {on=0} on' "$FILE" \
+        | sed -n 's/^ *{ *\([^,]*\),.*/\1/p')
+    RESOLVED=$(echo "$NAMES" | while read -r NAME; do
+        if [[ "$NAME" == \"* ]]; then
+            echo "$NAME"
+        else
+            VALUE=$(grep -h "#define[[:space:]]*$NAME[[:space:]]" "$FILE" */*.h | head -1 | sed -n 's/.*\(".*"\).*/\1/p')
+            echo "${VALUE:-?$NAME}"
+        fi
+    done | tr -d '"')
+    if echo "$RESOLVED" | grep -q "^?"; then
+        echo "$FILE: parameter schema name not resolved: $(echo "$RESOLVED" | grep "^?" | tr -d '?')"
+        STATUS=1
+    elif ! echo "$RESOLVED" | LC_ALL=C sort -c -u 2>/dev/null; then
+        echo "$FILE: parameter schema not sorted:"
+        echo "$RESOLVED" | LC_ALL=C sort -c -u 2>&1 | sed 's/^/    /'
+        STATUS=1
+    fi
+done
+
+exit $STATUS
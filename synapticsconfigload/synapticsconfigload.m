@@ -3,6 +3,36 @@
 #include <stdio.h>
 #include <IOKit/IOCFPlugIn.h>
 #include <IOKit/IOKitLib.h>
+#include <mach/mach_time.h>
+
+//
+// All preferences are pushed to the driver as one dictionary (one setProperties, so one
+// gated reconfiguration in the driver) instead of one IORegistryEntrySetCFProperty per key.
+//
+// The driver publishes the current value of each parameter as a property, so those are the
+// snapshot of what was last applied: only keys that differ are sent (nothing at all if the
+// driver already has the preferences, for example when run again in the same boot).
+//
+
+static uint64_t elapsedMicroseconds(uint64_t start)
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return (mach_absolute_time() - start) * timebase.numer / timebase.denom / 1000;
+}
+
+static long long numericProperty(io_service_t io_service, CFStringRef key)
+{
+	long long value = -1;
+	CFTypeRef prop = IORegistryEntryCreateCFProperty(io_service, key, kCFAllocatorDefault, 0);
+	if (prop)
+	{
+		if (CFNumberGetTypeID() == CFGetTypeID(prop))
+			CFNumberGetValue((CFNumberRef)prop, kCFNumberLongLongType, &value);
+		CFRelease(prop);
+	}
+	return value;
+}
 
 int main (int argc, char * const argv[]) {
 	io_service_t io_service;
@@ -68,9 +98,45 @@ int main (int argc, char * const argv[]) {
 		return 1;
 	}
 	
+	uint64_t start = mach_absolute_time();
+
+	// current driver values (last applied)
+	CFMutableDictionaryRef current = NULL;
+	if (KERN_SUCCESS != IORegistryEntryCreateCFProperties(io_service, &current, kCFAllocatorDefault, 0))
+		current = NULL;
+
+	CFMutableDictionaryRef changed = CFDictionaryCreateMutable(kCFAllocatorDefault, nkeys, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	if (!changed)
+	{
+		printf ("Couldn't allocate space\n");
+		return 1;
+	}
 	CFDictionaryGetKeysAndValues (plist, (const void **)keys, vals);
 	for (i=0;i<nkeys;i++)
-		IORegistryEntrySetCFProperty(io_service, keys[i], vals[i]);
+	{
+		CFTypeRef old = current ? CFDictionaryGetValue(current, keys[i]) : NULL;
+		if (!old || !CFEqual(old, vals[i]))
+			CFDictionarySetValue(changed, keys[i], vals[i]);
+	}
+	if (current)
+		CFRelease(current);
+
+	long nchanged = CFDictionaryGetCount(changed);
+	uint64_t diffTime = elapsedMicroseconds(start);
+	kern_return_t kr = KERN_SUCCESS;
+	if (nchanged)
+		kr = IORegistryEntrySetCFProperties(io_service, changed);
+	uint64_t totalTime = elapsedMicroseconds(start);
+	CFRelease(changed);
+
+	if (KERN_SUCCESS != kr)
+		printf ("IORegistryEntrySetCFProperties returned 0x%08x\n", kr);
+	// driver's own time for the apply (published by setParamPropertiesGated)
+	long long applyTime = nchanged ? numericProperty(io_service, CFSTR("ParamApplyTime")) : 0;
+	long long changedKeys = nchanged ? numericProperty(io_service, CFSTR("ParamChangedKeys")) : 0;
+	printf ("%ld of %ld keys sent in %llu us (diff %llu us), driver apply %lld ns (%lld keys changed)\n",
+		nchanged, nkeys, totalTime, diffTime, applyTime, changedKeys);
+
 	CFRelease (plist);
 	CFRelease (dat);
 	free (buf);